@@ -0,0 +1,204 @@
+#include "include/astfile.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <vector>
+#include "include/mapping.h"
+
+static_assert(sizeof(NodeType) == 1, "NodeType is stored as one byte");
+static_assert(sizeof(Token) == 12 && offsetof(Token, value) == 4 && offsetof(Token, loc) == 8,
+	"Token is stored as kind, 3 padding bytes, value, loc");
+static_assert(sizeof(ChildRange) == 8, "ChildRange is stored as first, count");
+static_assert(sizeof(SourceBuffer) == 32 && offsetof(SourceBuffer, offset) == 24,
+	"SourceBuffer is stored as start, size, firstLine, name, nameSize, lineNo, offset");
+
+namespace {
+
+uint64_t align8(uint64_t offset) {
+	return (offset + 7) & ~uint64_t(7);
+}
+
+// Section offsets follow from the counts alone
+struct Layout
+{
+	uint64_t types, toks, ranges, childIds, offsets, hashes, buckets, chars, buffers, lineStarts, names, end;
+
+	explicit Layout(const AstFileHeader& h)
+	{
+		types = align8(sizeof(AstFileHeader));
+		toks = align8(types + uint64_t(h.nodeCount) * sizeof(NodeType));
+		ranges = align8(toks + uint64_t(h.nodeCount) * sizeof(Token));
+		childIds = align8(ranges + uint64_t(h.nodeCount) * sizeof(ChildRange));
+		offsets = align8(childIds + uint64_t(h.childIdCount) * sizeof(NodeId));
+		hashes = align8(offsets + (uint64_t(h.symbolCount) + 1) * sizeof(uint32_t));
+		buckets = align8(hashes + uint64_t(h.symbolCount) * sizeof(uint64_t));
+		chars = align8(buckets + uint64_t(h.bucketCount) * sizeof(uint32_t));
+		buffers = align8(chars + h.charBytes);
+		lineStarts = align8(buffers + uint64_t(h.bufferCount) * sizeof(SourceBuffer));
+		names = align8(lineStarts + uint64_t(h.lineCount) * sizeof(uint32_t));
+		end = names + h.nameBytes;
+	}
+};
+
+class Writer
+{
+public:
+	explicit Writer(std::ofstream& out) : out(out) {}
+
+	void at(uint64_t offset)
+	{
+		static const char zeros[8] = {};
+		while (written < offset)
+		{
+			size_t n = static_cast<size_t>(std::min<uint64_t>(offset - written, sizeof(zeros)));
+			bytes(zeros, n);
+		}
+	}
+
+	void bytes(const void* data, size_t size)
+	{
+		out.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+		written += size;
+	}
+
+private:
+	std::ofstream& out;
+	uint64_t written = 0;
+};
+
+}
+
+void AstFile::write(const Ast& ast, uint64_t sourceHash, const std::string& path) {
+	const SymbolTable& symbols = ast.symbolTable;
+	const SourceTable& sources = ast.sourceTable;
+
+	AstFileHeader header{};
+	header.magic = AstFileMagic;
+	header.version = AstFileVersion;
+	header.byteOrder = AstFileByteOrder;
+	header.sourceHash = sourceHash;
+	header.nodeCount = static_cast<uint32_t>(ast.size());
+	header.childIdCount = static_cast<uint32_t>(ast.childIds.size());
+	header.symbolCount = static_cast<uint32_t>(symbols.size());
+	header.bucketCount = static_cast<uint32_t>(symbols.buckets.size());
+	header.charBytes = static_cast<uint32_t>(symbols.chars.size());
+	header.root = ast.root();
+	header.bufferCount = static_cast<uint32_t>(sources.buffers.size());
+	header.lineCount = static_cast<uint32_t>(sources.lineStarts.size());
+	header.nameBytes = static_cast<uint32_t>(sources.names.size());
+	Layout layout(header);
+	header.fileSize = layout.end;
+
+	// Unique per writer, so concurrent runs on one source never interleave
+	std::string temp = path + ".tmp" + std::to_string(std::random_device()());
+	{
+		std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+		if (!out) throw std::runtime_error("Cannot write " + temp);
+		Writer w(out);
+
+		w.bytes(&header, sizeof(header));
+		w.at(layout.types);
+		w.bytes(ast.types.data(), ast.types.size() * sizeof(NodeType));
+
+		// Tokens go through a zeroed buffer so the padding bytes, and with
+		// them the whole file, are deterministic
+		w.at(layout.toks);
+		constexpr size_t Chunk = 4096;
+		std::vector<unsigned char> buffer(Chunk * sizeof(Token));
+		for (size_t first = 0; first < ast.toks.size(); first += Chunk)
+		{
+			size_t n = std::min(Chunk, ast.toks.size() - first);
+			std::memset(buffer.data(), 0, n * sizeof(Token));
+			for (size_t i = 0; i < n; i++)
+			{
+				const Token& tok = ast.toks[first + i];
+				unsigned char* rec = buffer.data() + i * sizeof(Token);
+				std::memcpy(rec + offsetof(Token, kind), &tok.kind, sizeof(tok.kind));
+				std::memcpy(rec + offsetof(Token, value), &tok.value, sizeof(tok.value));
+				std::memcpy(rec + offsetof(Token, loc), &tok.loc, sizeof(tok.loc));
+			}
+			w.bytes(buffer.data(), n * sizeof(Token));
+		}
+
+		w.at(layout.ranges);
+		w.bytes(ast.ranges.data(), ast.ranges.size() * sizeof(ChildRange));
+		w.at(layout.childIds);
+		w.bytes(ast.childIds.data(), ast.childIds.size() * sizeof(NodeId));
+		w.at(layout.offsets);
+		w.bytes(symbols.offsets.data(), symbols.offsets.size() * sizeof(uint32_t));
+		w.at(layout.hashes);
+		w.bytes(symbols.hashes.data(), symbols.hashes.size() * sizeof(uint64_t));
+		w.at(layout.buckets);
+		w.bytes(symbols.buckets.data(), symbols.buckets.size() * sizeof(uint32_t));
+		w.at(layout.chars);
+		w.bytes(symbols.chars.data(), symbols.chars.size());
+		w.at(layout.buffers);
+		w.bytes(sources.buffers.data(), sources.buffers.size() * sizeof(SourceBuffer));
+		w.at(layout.lineStarts);
+		w.bytes(sources.lineStarts.data(), sources.lineStarts.size() * sizeof(uint32_t));
+		w.at(layout.names);
+		w.bytes(sources.names.data(), sources.names.size());
+
+		if (!out) throw std::runtime_error("Cannot write " + temp);
+	}
+
+#ifdef _WIN32
+	// rename() does not replace an existing file on Windows
+	std::remove(path.c_str());
+#endif
+	if (std::rename(temp.c_str(), path.c_str()) != 0)
+	{
+		std::remove(temp.c_str());
+		throw std::runtime_error("Cannot write " + path);
+	}
+}
+
+bool AstFile::map(const std::string& path, uint64_t sourceHash, Ast& ast) {
+	std::shared_ptr<MappedFile> mapping = MappedFile::open(path);
+	if (!mapping || mapping->size() < sizeof(AstFileHeader)) return false;
+
+	AstFileHeader header;
+	std::memcpy(&header, mapping->data(), sizeof(header));
+	if (header.magic != AstFileMagic || header.version != AstFileVersion || header.byteOrder != AstFileByteOrder
+		|| header.sourceHash != sourceHash)
+		return false;
+
+	// Constant-time sanity checks only; the file is our own cache output and
+	// is never rewritten in place
+	Layout layout(header);
+	const char* base = mapping->data();
+	bool bucketsPowerOfTwo = header.bucketCount != 0 && (header.bucketCount & (header.bucketCount - 1)) == 0;
+	if (header.fileSize != mapping->size() || layout.end != mapping->size() || header.symbolCount == 0
+		|| !bucketsPowerOfTwo || header.bucketCount <= header.symbolCount
+		|| (header.bufferCount != 0) != (header.lineCount != 0)
+		|| (header.nodeCount != 0 && header.root >= header.nodeCount)
+		|| reinterpret_cast<const uint32_t*>(base + layout.offsets)[header.symbolCount] != header.charBytes)
+		return false;
+
+	ast.clear();
+	ast.types.borrow(reinterpret_cast<const NodeType*>(base + layout.types), header.nodeCount);
+	ast.toks.borrow(reinterpret_cast<const Token*>(base + layout.toks), header.nodeCount);
+	ast.ranges.borrow(reinterpret_cast<const ChildRange*>(base + layout.ranges), header.nodeCount);
+	ast.childIds.borrow(reinterpret_cast<const NodeId*>(base + layout.childIds), header.childIdCount);
+
+	SymbolTable& symbols = ast.symbolTable;
+	symbols.offsets.borrow(reinterpret_cast<const uint32_t*>(base + layout.offsets), header.symbolCount + size_t(1));
+	symbols.hashes.borrow(reinterpret_cast<const uint64_t*>(base + layout.hashes), header.symbolCount);
+	symbols.buckets.borrow(reinterpret_cast<const uint32_t*>(base + layout.buckets), header.bucketCount);
+	symbols.chars.borrow(base + layout.chars, header.charBytes);
+
+	SourceTable& sources = ast.sourceTable;
+	sources.buffers.borrow(reinterpret_cast<const SourceBuffer*>(base + layout.buffers), header.bufferCount);
+	sources.lineStarts.borrow(reinterpret_cast<const uint32_t*>(base + layout.lineStarts), header.lineCount);
+	sources.names.borrow(base + layout.names, header.nameBytes);
+
+	ast.rootId = header.nodeCount == 0 ? InvalidNode : header.root;
+	ast.backing = std::move(mapping);
+	return true;
+}
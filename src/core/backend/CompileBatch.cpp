@@ -0,0 +1,64 @@
+#include "include/batch.h"
+
+#include <stdexcept>
+#include "include/lexer.h"
+#include "include/packedtree.h"
+#include "include/parser.h"
+#include "include/threadpool.h"
+
+namespace {
+
+void compileUnit(const BatchUnit& unit, CodegenMode mode, CodegenOptions options, BatchResult& out) {
+	out.timings = std::make_unique<TimeReport>();
+	options.timings = out.timings.get();
+	try
+	{
+		Ast ast;
+		if (unit.packed)
+		{
+			PhaseTimer timer(options.timings, "bridge");
+			readPackedTree(unit.data.data(), unit.data.size(), ast);
+			timer.setItems(ast.size());
+		}
+		else
+		{
+			TokenBuffer tokens;
+			{
+				PhaseTimer timer(options.timings, "lex");
+				QuarkLexer(unit.data).tokenize(tokens);
+				timer.setItems(tokens.size());
+			}
+			out.diagnostics = std::move(tokens.diagnostics);
+			PhaseTimer timer(options.timings, "parse");
+			QuarkParser(tokens, ast).parse();
+			timer.setItems(ast.size());
+		}
+		out.result = QuarkCodegen(options).run(ast, mode);
+	}
+	catch (...)
+	{
+		out.error = std::current_exception();
+	}
+}
+
+}
+
+std::vector<BatchResult> compileBatch(const std::vector<BatchUnit>& units, CodegenMode mode, const CodegenOptions& options) {
+	// Dump mode would interleave the trees on one descriptor, and AOT mode
+	// would link every unit into the same output
+	if (mode != CodegenMode::IR && mode != CodegenMode::JIT)
+		throw std::invalid_argument("A batch runs ir or jit mode");
+
+	std::vector<BatchResult> results(units.size());
+	if (units.size() == 1)
+	{
+		compileUnit(units[0], mode, options, results[0]);
+		return results;
+	}
+
+	TaskGroup group(ThreadPool::shared());
+	for (size_t i = 0; i < units.size(); i++)
+		group.run([&, i] { compileUnit(units[i], mode, options, results[i]); });
+	group.wait();
+	return results;
+}
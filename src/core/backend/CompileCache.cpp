@@ -0,0 +1,203 @@
+#include "include/compilecache.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr char CacheMagic[4] = { 'Q', 'O', 'B', 'J' };
+constexpr uint32_t CacheVersion = 1;
+constexpr const char* CacheSuffix = ".qobj";
+
+#pragma pack(push, 1)
+struct CacheFileHeader
+{
+	char magic[4];
+	uint32_t version;
+	uint64_t size;
+};
+#pragma pack(pop)
+
+static_assert(sizeof(CacheFileHeader) == 16, "cache header layout must match the on-disk format");
+
+bool isCacheFile(const fs::directory_entry& entry) {
+	std::error_code ec;
+	return entry.is_regular_file(ec) && entry.path().extension() == CacheSuffix;
+}
+
+}
+
+std::string cacheKeyString(const CacheKey& key) {
+	static const char digits[] = "0123456789abcdef";
+	std::string hex;
+	hex.reserve(key.size() * 2);
+	for (uint8_t byte : key)
+	{
+		hex.push_back(digits[byte >> 4]);
+		hex.push_back(digits[byte & 0xf]);
+	}
+	return hex;
+}
+
+std::shared_ptr<CompileCache> CompileCache::open(const std::string& directory, uint64_t maxBytes) {
+	static std::mutex mutex;
+	static std::unordered_map<std::string, std::shared_ptr<CompileCache>> caches;
+
+	std::lock_guard<std::mutex> lock(mutex);
+	std::shared_ptr<CompileCache>& cache = caches[directory];
+	if (!cache) cache = std::make_shared<CompileCache>(directory, maxBytes);
+	else cache->setMaxBytes(maxBytes);
+	return cache;
+}
+
+CompileCache::CompileCache(std::string directory, uint64_t maxBytes) : dir(std::move(directory)), maxBytes(maxBytes) {
+	std::error_code ec;
+	fs::create_directories(dir, ec);
+
+	uint64_t total = 0;
+	for (const fs::directory_entry& entry : fs::directory_iterator(dir, ec))
+		if (isCacheFile(entry)) total += entry.file_size(ec);
+	bytes = total;
+}
+
+std::string CompileCache::path(const CacheKey& key) const {
+	return (fs::path(dir) / (cacheKeyString(key) + CacheSuffix)).string();
+}
+
+bool CompileCache::load(const CacheKey& key, std::string& object) {
+	std::string file = path(key);
+	std::ifstream in(file, std::ios::binary);
+	CacheFileHeader header;
+	if (!in || !in.read(reinterpret_cast<char*>(&header), sizeof(header)))
+	{
+		misses++;
+		return false;
+	}
+
+	bool valid = std::memcmp(header.magic, CacheMagic, sizeof(CacheMagic)) == 0 && header.version == CacheVersion;
+	if (valid)
+	{
+		// A corrupt size would otherwise be allocated before the read fails
+		std::error_code ec;
+		uintmax_t bytes = fs::file_size(file, ec);
+		valid = !ec && bytes >= sizeof(header) && header.size == bytes - sizeof(header);
+	}
+	if (valid)
+	{
+		object.resize(header.size);
+		valid = static_cast<bool>(in.read(object.data(), static_cast<std::streamsize>(header.size)));
+	}
+
+	if (!valid)
+	{
+		// Truncated, corrupt or from an older backend; recompile and overwrite it
+		in.close();
+		std::error_code ec;
+		fs::remove(file, ec);
+		object.clear();
+		misses++;
+		return false;
+	}
+
+	// mtime is the recency eviction goes by
+	std::error_code ec;
+	fs::last_write_time(file, fs::file_time_type::clock::now(), ec);
+	hits++;
+	return true;
+}
+
+void CompileCache::store(const CacheKey& key, const std::string& object) {
+	std::string file = path(key);
+
+	// Write under a unique name and rename, so a concurrent reader never sees
+	// a partial file
+	static std::atomic<uint64_t> counter{ 0 };
+	std::string temp = file + ".tmp" + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()))
+		+ "." + std::to_string(counter++);
+	{
+		std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+		CacheFileHeader header;
+		std::memcpy(header.magic, CacheMagic, sizeof(CacheMagic));
+		header.version = CacheVersion;
+		header.size = object.size();
+		out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		out.write(object.data(), static_cast<std::streamsize>(object.size()));
+		if (!out)
+		{
+			out.close();
+			std::error_code ec;
+			fs::remove(temp, ec);
+			return;
+		}
+	}
+
+	std::error_code ec;
+	fs::rename(temp, file, ec);
+	if (ec)
+	{
+		fs::remove(temp, ec);
+		return;
+	}
+
+	stores++;
+	bytes += sizeof(CacheFileHeader) + object.size();
+	if (maxBytes && bytes > maxBytes) evict();
+}
+
+void CompileCache::evict() {
+	std::lock_guard<std::mutex> lock(evictMutex);
+
+	// Other processes may share the directory, so go by what is on disk
+	struct Entry
+	{
+		fs::path path;
+		fs::file_time_type mtime;
+		uint64_t size;
+	};
+	std::vector<Entry> entries;
+	uint64_t total = 0;
+	std::error_code ec;
+	for (const fs::directory_entry& entry : fs::directory_iterator(dir, ec))
+	{
+		if (!isCacheFile(entry)) continue;
+		Entry e{ entry.path(), entry.last_write_time(ec), entry.file_size(ec) };
+		total += e.size;
+		entries.push_back(std::move(e));
+	}
+
+	// Trim to 90% of the limit so the next few stores do not rescan again
+	uint64_t limit = maxBytes;
+	uint64_t target = limit - limit / 10;
+	if (total > limit)
+	{
+		std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.mtime < b.mtime; });
+		for (const Entry& entry : entries)
+		{
+			if (total <= target) break;
+			if (fs::remove(entry.path, ec))
+			{
+				total -= entry.size;
+				evictions++;
+			}
+		}
+	}
+	bytes = total;
+}
+
+CacheStats CompileCache::stats() const {
+	CacheStats stats;
+	stats.hits = hits;
+	stats.misses = misses;
+	stats.stores = stores;
+	stats.evictions = evictions;
+	stats.bytes = bytes;
+	return stats;
+}
@@ -0,0 +1,450 @@
+#include "include/server.h"
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include "include/codegen.h"
+#include "include/lexer.h"
+#include "include/parser.h"
+#include "include/threadpool.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+bool flag(const std::string& value) {
+	if (value == "1" || value == "true") return true;
+	if (value == "0" || value == "false") return false;
+	throw std::invalid_argument("Expected 0 or 1, got '" + value + "'");
+}
+
+// The header of a request, what initCodegen() takes as keywords
+void setOption(CodegenOptions& options, CodegenMode& mode, bool& report, const std::string& key, const std::string& value) {
+	if (key == "mode") mode = codegenModeFromString(value);
+	else if (key == "report") report = flag(value);
+	else if (key == "opt") options.optimizer.level = optLevelFromString(value);
+	else if (key == "passes") options.optimizer.passPipeline = value;
+	else if (key == "threads") options.threads = static_cast<unsigned>(std::stoul(value));
+	else if (key == "fold") options.foldConstants = flag(value);
+	else if (key == "share") options.shareSubtrees = flag(value);
+	else if (key == "debug") options.debugInfo = flag(value);
+	else if (key == "site_counters") options.siteCounters = flag(value);
+	else if (key == "profile_generate") options.optimizer.profileGenerate = value;
+	else if (key == "profile_use") options.optimizer.profileUse = value;
+	else if (key == "cache_dir") options.cacheDir = value;
+	else if (key == "cache_size") options.cacheMaxBytes = std::stoull(value);
+	else if (key == "dump_format") options.dumpFormat = dumpFormatFromString(value);
+	else if (key == "target") options.target.triple = value;
+	else if (key == "cpu") options.target.cpu = value;
+	else if (key == "features") options.target.features = value;
+	else if (key == "output") options.aot.output = value;
+	else if (key == "shared") options.aot.kind = flag(value) ? AotOutput::SharedLibrary : AotOutput::Executable;
+	else if (key == "static") options.aot.staticExecutable = flag(value);
+	// Would run any program, or link any code into what the server runs
+	else if (key == "linker" || key == "runtime_library")
+		throw std::invalid_argument("'" + key + "' is set when the server starts, not per request");
+	else throw std::invalid_argument("Unknown request option '" + key + "'");
+}
+
+// Always with a fraction or an exponent, so that a reader tells 5.0 from 5;
+// NaN and Infinity as Python's json module writes and reads them
+void appendJsonNumber(std::string& out, double value) {
+	if (std::isnan(value))
+	{
+		out += "NaN";
+		return;
+	}
+	if (std::isinf(value))
+	{
+		out += value < 0 ? "-Infinity" : "Infinity";
+		return;
+	}
+	char text[32];
+	char* end = std::to_chars(text, text + sizeof(text), value).ptr;
+	out.append(text, end);
+	if (std::find_if(text, end, [](char c) { return c == '.' || c == 'e'; }) == end) out += ".0";
+}
+
+void appendJsonNumber(std::string& out, int64_t value) {
+	out += std::to_string(value);
+}
+
+template <typename T>
+void appendJsonArray(std::string& out, const std::vector<T>& values) {
+	out.push_back('[');
+	for (size_t i = 0; i < values.size(); i++)
+	{
+		if (i) out += ", ";
+		appendJsonNumber(out, values[i]);
+	}
+	out.push_back(']');
+}
+
+void appendKey(std::string& out, const char* key) {
+	out += ", ";
+	appendJsonString(out, key);
+	out += ": ";
+}
+
+void appendResult(std::string& out, const CodegenResult& result) {
+	static const char* const kinds[] = { "none", "int", "float", "int_list", "float_list" };
+	appendKey(out, "kind");
+	appendJsonString(out, kinds[static_cast<int>(result.kind)]);
+	appendKey(out, "value");
+	switch (result.kind)
+	{
+	case ValueKind::Int: appendJsonNumber(out, result.intValue); break;
+	case ValueKind::Float: appendJsonNumber(out, result.floatValue); break;
+	case ValueKind::IntList: appendJsonArray(out, result.intValues); break;
+	case ValueKind::FloatList: appendJsonArray(out, result.floatValues); break;
+	default: out += "null"; break;
+	}
+}
+
+// {"ok": false, ...}, with the Python exception initCodegen() would raise
+std::string failureReply(const std::string& diagnostics, const char* error, const char* message) {
+	std::string reply = "{\"ok\": false, \"diagnostics\": " + diagnostics + ", \"error\": \"" + error + "\", \"message\": ";
+	appendJsonString(reply, message);
+	reply += "}\n";
+	return reply;
+}
+
+#ifndef _WIN32
+// What dump mode wrote to the temporary file behind fd
+std::string readBack(int fd) {
+	std::string text;
+	char buffer[1 << 16];
+	lseek(fd, 0, SEEK_SET);
+	ssize_t n;
+	while ((n = read(fd, buffer, sizeof(buffer))) > 0) text.append(buffer, static_cast<size_t>(n));
+	return text;
+}
+
+void closeFd(int& fd) {
+	if (fd >= 0) close(fd);
+	fd = -1;
+}
+
+[[noreturn]] void fail(const std::string& what) {
+	throw QuarkCodegenError(what + ": " + std::strerror(errno));
+}
+
+sockaddr_un socketAddress(const std::string& path) {
+	sockaddr_un address{};
+	address.sun_family = AF_UNIX;
+	if (path.empty() || path.size() >= sizeof(address.sun_path))
+		throw QuarkCodegenError("Socket path '" + path + "' is empty or too long");
+	std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+	return address;
+}
+
+// The client ends its request by shutting down its side for writing, at
+// most maxBytes in and within timeoutMs of the call
+std::string receive(int fd, size_t maxBytes, unsigned timeoutMs) {
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+	std::string request;
+	char buffer[1 << 16];
+	for (;;)
+	{
+		auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+		pollfd readable = { fd, POLLIN, 0 };
+		int ready = left > 0 ? poll(&readable, 1, static_cast<int>(left)) : 0;
+		if (ready < 0 && errno == EINTR) continue;
+		if (ready < 0) fail("Cannot read the request");
+		if (ready == 0) throw std::invalid_argument("The request did not end within " + std::to_string(timeoutMs) + " ms");
+
+		ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+		if (n == 0) return request;
+		if (n < 0 && (errno == EINTR || errno == EAGAIN)) continue;
+		if (n < 0) fail("Cannot read the request");
+		if (request.size() + static_cast<size_t>(n) > maxBytes)
+			throw std::invalid_argument("The request is bigger than " + std::to_string(maxBytes) + " bytes");
+		request.append(buffer, static_cast<size_t>(n));
+	}
+}
+
+void sendAll(int fd, const std::string& reply) {
+#ifdef MSG_NOSIGNAL
+	constexpr int flags = MSG_NOSIGNAL;
+#else
+	constexpr int flags = 0;
+#endif
+	size_t sent = 0;
+	while (sent < reply.size())
+	{
+		ssize_t n = send(fd, reply.data() + sent, reply.size() - sent, flags);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return;		// the client has gone
+		sent += static_cast<size_t>(n);
+	}
+}
+#endif
+
+}
+
+std::string CompileServer::handle(const std::string& request) const {
+	std::string reply = "{\"ok\": ";
+	std::string diagnostics = "[]";
+	try
+	{
+		size_t headerEnd = request.compare(0, 1, "\n") == 0 ? 0 : request.find("\n\n");
+		if (headerEnd == std::string::npos) throw std::invalid_argument("The request has no blank line after its header");
+
+		CodegenOptions codegenOptions;
+		CodegenMode mode = CodegenMode::JIT;
+		bool report = false;
+		std::string name = "<input>";
+		size_t line = 0;
+		while (line < headerEnd)
+		{
+			size_t end = request.find('\n', line);
+			size_t space = request.find(' ', line);
+			if (space == std::string::npos || space > end) space = end;
+			std::string key = request.substr(line, space - line);
+			std::string value = space < end ? request.substr(space + 1, end - space - 1) : std::string();
+			if (key == "name") name = value;
+			else setOption(codegenOptions, mode, report, key, value);
+			line = end + 1;
+		}
+		std::string_view source = std::string_view(request).substr(headerEnd + (headerEnd ? 2 : 1));
+		if (!options.linker.empty()) codegenOptions.aot.linker = options.linker;
+		if (!options.runtimeLibrary.empty()) codegenOptions.aot.runtimeLibrary = options.runtimeLibrary;
+
+		TimeReport timings;
+		if (report) codegenOptions.timings = &timings;
+		TokenBuffer tokens;
+		Ast ast;
+		tokens.start = ast.sources().add(name, source);
+		{
+			PhaseTimer timer(codegenOptions.timings, "lex");
+			QuarkLexer(source).tokenizeParallel(tokens, ThreadPool::shared());
+			timer.setItems(tokens.size());
+		}
+		diagnostics = "[";
+		for (size_t i = 0; i < tokens.diagnostics.size(); i++)
+		{
+			if (i) diagnostics += ", ";
+			appendJsonString(diagnostics, tokens.diagnostics[i]);
+		}
+		diagnostics += "]";
+		{
+			PhaseTimer timer(codegenOptions.timings, "parse", tokens.size());
+			QuarkParser(tokens, ast).parse();
+		}
+
+		std::string result;
+#ifndef _WIN32
+		// Dump mode writes to a descriptor, and the client's is not ours
+		FILE* dumpFile = nullptr;
+		if (mode == CodegenMode::Dump)
+		{
+			dumpFile = std::tmpfile();
+			if (!dumpFile) fail("Cannot create a file for the dump");
+			codegenOptions.dumpFd = fileno(dumpFile);
+		}
+		struct DumpFile
+		{
+			FILE*& file;
+			~DumpFile()
+			{
+				if (file) std::fclose(file);
+			}
+		} dumpGuard{ dumpFile };
+#else
+		if (mode == CodegenMode::Dump) throw std::invalid_argument("The server cannot dump trees on this platform");
+#endif
+
+		QuarkCodegen cg(codegenOptions);
+		CodegenResult value = cg.run(ast, mode);
+		switch (mode)
+		{
+#ifndef _WIN32
+		case CodegenMode::Dump:
+			appendKey(result, "dump");
+			appendJsonString(result, readBack(codegenOptions.dumpFd));
+			break;
+#endif
+		case CodegenMode::IR:
+			appendKey(result, "ir");
+			appendJsonString(result, value.ir);
+			break;
+		case CodegenMode::AOT:
+			appendKey(result, "output");
+			appendJsonString(result, value.output);
+			break;
+		default:
+			appendResult(result, value);
+			break;
+		}
+		if (!codegenOptions.cacheDir.empty())
+		{
+			CacheStats stats = cg.cacheStats();
+			appendKey(result, "cache");
+			result += "{\"hits\": " + std::to_string(stats.hits) + ", \"misses\": " + std::to_string(stats.misses)
+				+ ", \"stores\": " + std::to_string(stats.stores) + ", \"evictions\": " + std::to_string(stats.evictions)
+				+ ", \"bytes\": " + std::to_string(stats.bytes) + "}";
+		}
+		if (report)
+		{
+			appendKey(result, "report");
+			result += timings.json();
+			appendKey(result, "report_text");
+			appendJsonString(result, timings.text());
+		}
+		reply += "true, \"diagnostics\": " + diagnostics + result + "}";
+	}
+	catch (const std::exception& e)
+	{
+		// The exceptions initCodegen() and parse() translate them to
+		const char* error = "RuntimeError";
+		if (dynamic_cast<const QuarkIndentationError*>(&e)) error = "IndentationError";
+		else if (dynamic_cast<const QuarkSyntaxError*>(&e)) error = "SyntaxError";
+		else if (dynamic_cast<const std::invalid_argument*>(&e)) error = "ValueError";
+		return failureReply(diagnostics, error, e.what());
+	}
+	reply.push_back('\n');
+	return reply;
+}
+
+#ifndef _WIN32
+
+CompileServer::CompileServer(ServerOptions serverOptions) : options(std::move(serverOptions)) {
+	sockaddr_un address = socketAddress(options.socketPath);
+
+	// A socket nobody accepts on is left over from a server that died
+	int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (probe < 0) fail("Cannot create a socket");
+	bool answered = connect(probe, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0;
+	close(probe);
+	if (answered) throw QuarkCodegenError("A server is already listening on " + options.socketPath);
+	unlink(options.socketPath.c_str());
+
+	listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listenFd < 0) fail("Cannot create a socket");
+	fcntl(listenFd, F_SETFD, FD_CLOEXEC);
+	// Connecting takes write permission on the socket, which only the owner
+	// gets. No other thread runs yet to see the umask.
+	mode_t mask = umask(0177);
+	bool bound = bind(listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0;
+	umask(mask);
+	if (!bound || ::listen(listenFd, SOMAXCONN) != 0)
+	{
+		closeFd(listenFd);
+		fail("Cannot listen on " + options.socketPath);
+	}
+	if (pipe(wakeFds) != 0)
+	{
+		closeFd(listenFd);
+		fail("Cannot create the wake-up pipe");
+	}
+}
+
+CompileServer::~CompileServer() {
+	closeFd(listenFd);
+	closeFd(wakeFds[0]);
+	closeFd(wakeFds[1]);
+}
+
+void CompileServer::stop() {
+	char byte = 0;
+	ssize_t written = write(wakeFds[1], &byte, 1);
+	(void)written;
+}
+
+void CompileServer::work() {
+	// Each worker lives as long as the server, and so do the target machines
+	// and pipelines that codegen keeps per thread
+	if (options.warmUp) handle("mode jit\nthreads 1\n\n0\n");
+	for (;;)
+	{
+		int fd;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			ready.wait(lock, [this] { return stopping || !connections.empty(); });
+			if (connections.empty()) return;
+			fd = connections.front();
+			connections.pop_front();
+		}
+		// A client that does not read its reply cannot hold the worker either
+		timeval timeout = { static_cast<time_t>(options.requestTimeoutMs / 1000),
+			static_cast<suseconds_t>(options.requestTimeoutMs % 1000 * 1000) };
+		setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+		try
+		{
+			std::string request = receive(fd, options.maxRequestBytes, options.requestTimeoutMs);
+			sendAll(fd, handle(request));
+		}
+		catch (const std::invalid_argument& e)
+		{
+			sendAll(fd, failureReply("[]", "ValueError", e.what()));
+		}
+		catch (const std::exception&)
+		{
+			// Nothing can be told to a client whose connection broke
+		}
+		close(fd);
+		requests++;
+	}
+}
+
+void CompileServer::serve() {
+	unsigned count = options.workers ? options.workers : std::max(1u, std::thread::hardware_concurrency());
+	for (unsigned i = 0; i < count; i++) workers.emplace_back([this] { work(); });
+
+	pollfd fds[] = { { listenFd, POLLIN, 0 }, { wakeFds[0], POLLIN, 0 } };
+	for (;;)
+	{
+		if (poll(fds, 2, -1) < 0)
+		{
+			if (errno == EINTR) continue;
+			break;
+		}
+		if (fds[1].revents) break;
+		if (!(fds[0].revents & POLLIN)) continue;
+
+		int fd = accept(listenFd, nullptr, nullptr);
+		if (fd < 0) continue;
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+		std::lock_guard<std::mutex> lock(mutex);
+		connections.push_back(fd);
+		ready.notify_one();
+	}
+
+	// Clients already accepted still get their answers
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	ready.notify_all();
+	for (std::thread& worker : workers) worker.join();
+	workers.clear();
+	closeFd(listenFd);
+	unlink(options.socketPath.c_str());
+}
+
+#else
+
+CompileServer::CompileServer(ServerOptions serverOptions) : options(std::move(serverOptions)) {
+	throw QuarkCodegenError("The compile server needs Unix domain sockets");
+}
+
+CompileServer::~CompileServer() = default;
+
+void CompileServer::stop() {}
+
+void CompileServer::work() {}
+
+void CompileServer::serve() {}
+
+#endif
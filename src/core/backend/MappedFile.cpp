@@ -0,0 +1,77 @@
+#include "include/mapping.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+std::shared_ptr<MappedFile> MappedFile::open(const std::string& path) {
+	auto mapping = std::make_shared<MappedFile>();
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) return nullptr;
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+	{
+		CloseHandle(file);
+		return nullptr;
+	}
+	HANDLE view = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	CloseHandle(file);
+	if (!view) return nullptr;
+	mapping->addr = MapViewOfFile(view, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(view);
+	if (!mapping->addr) return nullptr;
+	mapping->length = static_cast<size_t>(size.QuadPart);
+#else
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0) return nullptr;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0 || !S_ISREG(st.st_mode))
+	{
+		::close(fd);
+		return nullptr;
+	}
+	// Private and read-only: a later rewrite of the file goes to a new
+	// inode through rename, so this view never changes under its users
+	void* addr = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (addr == MAP_FAILED) return nullptr;
+	mapping->addr = addr;
+	mapping->length = static_cast<size_t>(st.st_size);
+#endif
+	return mapping;
+}
+
+MappedFile::~MappedFile() {
+	if (!addr) return;
+#ifdef _WIN32
+	UnmapViewOfFile(addr);
+#else
+	munmap(addr, length);
+#endif
+}
+
+void MappedFile::sequential() {
+#ifndef _WIN32
+	madvise(addr, length, MADV_SEQUENTIAL);
+#endif
+}
+
+void MappedFile::release(size_t offset) {
+#ifndef _WIN32
+	size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+	size_t end = offset < length ? offset / page * page : length;
+	if (end <= released) return;
+	madvise(static_cast<char*>(addr) + released, end - released, MADV_DONTNEED);
+	released = end;
+#else
+	(void)offset;
+#endif
+}
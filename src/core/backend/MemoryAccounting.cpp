@@ -0,0 +1,190 @@
+#include "include/accounting.h"
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include "include/ast.h"
+
+namespace {
+
+struct Counter
+{
+	std::atomic<uint64_t> bytes{ 0 };
+	std::atomic<uint64_t> peak{ 0 };
+	std::atomic<uint64_t> phasePeak{ 0 };
+};
+
+// One per kind, then the total
+Counter counters[MemoryKindCount + 1];
+
+struct SiteCounter
+{
+	std::string site;
+	std::atomic<uint64_t> calls{ 0 };
+	std::atomic<uint64_t> bytes{ 0 };
+};
+
+// Entries are never erased, so the pointers threads hold to them stay valid
+// across turning tracking off and on; turning it on zeroes them instead
+std::mutex siteMutex;
+std::map<std::pair<const char*, uint32_t>, SiteCounter> sites;
+
+thread_local SiteCounter* currentSite = nullptr;
+
+// The last site this thread entered, which building a tree mostly enters
+// again next
+thread_local const char* lastFile = nullptr;
+thread_local uint32_t lastLine = 0;
+thread_local SiteCounter* lastSite = nullptr;
+
+std::mutex modeMutex;
+MemoryTracking mode = MemoryTracking::Off;
+
+void raise(std::atomic<uint64_t>& peak, uint64_t value) {
+	uint64_t seen = peak.load(std::memory_order_relaxed);
+	while (value > seen && !peak.compare_exchange_weak(seen, value, std::memory_order_relaxed)) {}
+}
+
+void change(Counter& counter, int64_t bytes) {
+	uint64_t now = counter.bytes.fetch_add(static_cast<uint64_t>(bytes), std::memory_order_relaxed) + static_cast<uint64_t>(bytes);
+	if (bytes <= 0) return;
+	raise(counter.peak, now);
+	raise(counter.phasePeak, now);
+}
+
+std::string siteString(const char* file, uint32_t line, const char* function) {
+	std::string path = file;
+	size_t slash = path.find_last_of("/\\");
+	return path.substr(slash == std::string::npos ? 0 : slash + 1) + ":" + std::to_string(line) + " " + function;
+}
+
+}
+
+const char* memoryKindString(MemoryKind kind) {
+	switch (kind)
+	{
+	case MemoryKind::AstNodes: return "ast_nodes";
+	case MemoryKind::Tokens: return "tokens";
+	case MemoryKind::Symbols: return "symbols";
+	case MemoryKind::Sources: return "sources";
+	case MemoryKind::LlvmModules: return "llvm_modules";
+	case MemoryKind::Objects: return "objects";
+	default: return "unknown";
+	}
+}
+
+MemoryTracking memoryTrackingFromString(const std::string& mode) {
+	if (mode == "off") return MemoryTracking::Off;
+	if (mode == "counters") return MemoryTracking::Counters;
+	if (mode == "sites") return MemoryTracking::Sites;
+	throw std::invalid_argument("Unknown memory tracking mode " + mode + ", expected off, counters or sites");
+}
+
+void setMemoryTracking(MemoryTracking tracking) {
+	std::lock_guard<std::mutex> lock(modeMutex);
+	if (mode == MemoryTracking::Off && tracking != MemoryTracking::Off)
+	{
+		for (Counter& counter : counters)
+		{
+			uint64_t bytes = counter.bytes.load(std::memory_order_relaxed);
+			counter.peak.store(bytes, std::memory_order_relaxed);
+			counter.phasePeak.store(bytes, std::memory_order_relaxed);
+		}
+		std::lock_guard<std::mutex> sitesLock(siteMutex);
+		for (auto& entry : sites)
+		{
+			entry.second.calls.store(0, std::memory_order_relaxed);
+			entry.second.bytes.store(0, std::memory_order_relaxed);
+		}
+	}
+	mode = tracking;
+	detail::memoryTrackingOn.store(tracking != MemoryTracking::Off, std::memory_order_relaxed);
+	detail::memorySitesOn.store(tracking == MemoryTracking::Sites, std::memory_order_relaxed);
+}
+
+MemoryTracking memoryTracking() {
+	std::lock_guard<std::mutex> lock(modeMutex);
+	return mode;
+}
+
+MemoryStats memoryStats() {
+	MemoryStats stats;
+	for (size_t i = 0; i < MemoryKindCount; i++)
+		stats.kinds[i] = MemoryUsage{ counters[i].bytes.load(std::memory_order_relaxed), counters[i].peak.load(std::memory_order_relaxed) };
+	const Counter& total = counters[MemoryKindCount];
+	stats.total = MemoryUsage{ total.bytes.load(std::memory_order_relaxed), total.peak.load(std::memory_order_relaxed) };
+	return stats;
+}
+
+MemoryStats sampleMemoryPhase() {
+	MemoryStats stats;
+	auto sample = [](Counter& counter) {
+		uint64_t bytes = counter.bytes.load(std::memory_order_relaxed);
+		// What the next phase starts from
+		uint64_t peak = counter.phasePeak.exchange(bytes, std::memory_order_relaxed);
+		return MemoryUsage{ bytes, std::max(peak, bytes) };
+	};
+	for (size_t i = 0; i < MemoryKindCount; i++) stats.kinds[i] = sample(counters[i]);
+	stats.total = sample(counters[MemoryKindCount]);
+	return stats;
+}
+
+void memoryChange(MemoryKind kind, int64_t bytes) {
+	change(counters[static_cast<size_t>(kind)], bytes);
+	change(counters[MemoryKindCount], bytes);
+	if (bytes > 0 && currentSite) currentSite->bytes.fetch_add(static_cast<uint64_t>(bytes), std::memory_order_relaxed);
+}
+
+void MemorySiteScope::enter(const MemorySite& site) {
+	if (site.file != lastFile || site.line != lastLine)
+	{
+		std::lock_guard<std::mutex> lock(siteMutex);
+		SiteCounter& counter = sites[{ site.file, site.line }];
+		if (counter.site.empty()) counter.site = siteString(site.file, site.line, site.function);
+		lastFile = site.file;
+		lastLine = site.line;
+		lastSite = &counter;
+	}
+	lastSite->calls.fetch_add(1, std::memory_order_relaxed);
+	outer = currentSite;
+	currentSite = lastSite;
+	entered = true;
+}
+
+void MemorySiteScope::leave() {
+	currentSite = static_cast<SiteCounter*>(outer);
+}
+
+std::vector<SiteUsage> memorySites() {
+	// Each unit that includes a header has its own copy of the header's name
+	std::map<std::string, SiteUsage> merged;
+	{
+		std::lock_guard<std::mutex> lock(siteMutex);
+		for (const auto& entry : sites)
+		{
+			const SiteCounter& counter = entry.second;
+			uint64_t calls = counter.calls.load(std::memory_order_relaxed);
+			if (!calls) continue;
+			SiteUsage& usage = merged[counter.site];
+			usage.site = counter.site;
+			usage.calls += calls;
+			usage.bytes += counter.bytes.load(std::memory_order_relaxed);
+		}
+	}
+
+	std::vector<SiteUsage> sorted;
+	for (auto& entry : merged) sorted.push_back(std::move(entry.second));
+	std::stable_sort(sorted.begin(), sorted.end(), [](const SiteUsage& a, const SiteUsage& b) { return a.bytes > b.bytes; });
+	return sorted;
+}
+
+NodeId AstBuilder::closeAt(const MemorySite& site) {
+	MemorySiteScope scope(site);
+	return closeNode();
+}
+
+NodeId AstBuilder::leafAt(NodeType type, Token tok, const MemorySite& site) {
+	MemorySiteScope scope(site);
+	return leafNode(type, std::move(tok));
+}
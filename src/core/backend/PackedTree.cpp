@@ -0,0 +1,128 @@
+#include "include/packedtree.h"
+
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+
+template <typename T>
+const T* readArray(const uint8_t*& cur, const uint8_t* end, size_t count, const char* what)
+{
+	if (static_cast<size_t>(end - cur) / sizeof(T) < count)
+		throw std::runtime_error(std::string("Packed tree truncated while reading ") + what);
+	const T* arr = reinterpret_cast<const T*>(cur);
+	cur += count * sizeof(T);
+	return arr;
+}
+
+}
+
+void readPackedTree(const void* data, size_t size, Ast& ast) {
+	const uint8_t* cur = static_cast<const uint8_t*>(data);
+	const uint8_t* end = cur + size;
+
+	PackedTreeHeader header;
+	std::memcpy(&header, readArray<uint8_t>(cur, end, sizeof(header), "header"), sizeof(header));
+	if (header.magic != PackedTreeMagic) throw std::runtime_error("Not a packed Quark tree");
+	if (header.version != PackedTreeVersion)
+		throw std::runtime_error("Unsupported packed tree version " + std::to_string(header.version));
+
+	const uint32_t* offsets = readArray<uint32_t>(cur, end, header.symbolCount + size_t(1), "symbol offsets");
+	const char* chars = readArray<char>(cur, end, (header.charBytes + 3u) & ~3u, "symbol table");
+	const PackedNode* nodes = readArray<PackedNode>(cur, end, header.nodeCount, "nodes");
+
+	// Python ids are dense and deduplicated already, but interning them again
+	// builds the native lookup index. This is per symbol, not per node.
+	std::vector<SymbolId> symbolMap(header.symbolCount);
+	for (uint32_t i = 0; i < header.symbolCount; i++)
+	{
+		if (offsets[i] > offsets[i + 1] || offsets[i + 1] > header.charBytes)
+			throw std::runtime_error("Corrupt packed tree symbol table");
+		symbolMap[i] = ast.symbols().intern(std::string_view(chars + offsets[i], offsets[i + 1] - offsets[i]));
+	}
+
+	ast.reserve(ast.size() + header.nodeCount);
+	AstBuilder builder(ast);
+	SourceSketch source(ast.sources());
+	std::vector<uint32_t> remaining;
+	for (uint32_t i = 0; i < header.nodeCount; i++)
+	{
+		const PackedNode& node = nodes[i];
+		if (node.type >= NodeTypeCount || node.kind >= static_cast<uint8_t>(TokenKind::Count)
+			|| node.value >= header.symbolCount)
+			throw std::runtime_error("Corrupt packed tree node " + std::to_string(i));
+		if (i > 0 && remaining.empty())
+			throw std::runtime_error("Packed tree has more than one root");
+
+		Token tok{ static_cast<TokenKind>(node.kind), symbolMap[node.value], source.loc(node.lineNo, node.pos) };
+		if (node.childCount > 0)
+		{
+			builder.open(static_cast<NodeType>(node.type), tok);
+			remaining.push_back(node.childCount);
+			continue;
+		}
+
+		builder.leaf(static_cast<NodeType>(node.type), tok);
+		while (!remaining.empty() && --remaining.back() == 0)
+		{
+			remaining.pop_back();
+			builder.close();
+		}
+	}
+
+	if (header.nodeCount == 0 || !remaining.empty())
+		throw std::runtime_error("Packed tree ended in the middle of a node");
+	source.finish("<input>");
+}
+
+std::vector<uint8_t> writePackedTree(NodeRef root) {
+	const Ast& ast = root.tree();
+	SymbolTable symbols;
+	std::vector<PackedNode> nodes;
+	std::vector<NodeId> stack{ root.id() };
+	while (!stack.empty())
+	{
+		NodeId id = stack.back();
+		stack.pop_back();
+
+		const Token& tok = ast.tok(id);
+		PackedNode node{};
+		node.type = static_cast<uint8_t>(ast.type(id));
+		node.childCount = ast.childCount(id);
+		if (tok.kind != TokenKind::None)
+		{
+			node.kind = static_cast<uint8_t>(tok.kind);
+			node.value = symbols.intern(ast.spelling(id));
+			PresumedLoc where = ast.sources().resolve(tok.loc);
+			node.lineNo = static_cast<int32_t>(where.line);
+			node.pos = static_cast<int32_t>(where.offset);
+		}
+		nodes.push_back(node);
+
+		for (const NodeId* child = ast.childEnd(id); child != ast.childBegin(id);) stack.push_back(*--child);
+	}
+
+	std::vector<uint32_t> offsets{ 0 };
+	std::string chars;
+	for (SymbolId i = 0; i < symbols.size(); i++)
+	{
+		chars.append(symbols.spelling(i));
+		offsets.push_back(static_cast<uint32_t>(chars.size()));
+	}
+
+	PackedTreeHeader header{ PackedTreeMagic, PackedTreeVersion, 0, static_cast<uint32_t>(nodes.size()),
+		static_cast<uint32_t>(symbols.size()), static_cast<uint32_t>(chars.size()) };
+	chars.resize((chars.size() + 3u) & ~size_t(3));
+
+	std::vector<uint8_t> out(sizeof(header) + offsets.size() * sizeof(uint32_t) + chars.size() + nodes.size() * sizeof(PackedNode));
+	uint8_t* cur = out.data();
+	auto put = [&cur](const void* data, size_t size) {
+		std::memcpy(cur, data, size);
+		cur += size;
+	};
+	put(&header, sizeof(header));
+	put(offsets.data(), offsets.size() * sizeof(uint32_t));
+	put(chars.data(), chars.size());
+	put(nodes.data(), nodes.size() * sizeof(PackedNode));
+	return out;
+}
@@ -1,5 +1,870 @@
 #include "include/codegen.h"
 
-void QuarkCodegen::begin(const TreeNode &tree) {
-	printTree(tree);
-}
\ No newline at end of file
+#include <algorithm>
+#include <cstdio>
+#include <deque>
+#include <exception>
+#include <iostream>
+#include "include/accounting.h"
+#include "include/fold.h"
+#include "include/lowering.h"
+#include "include/profile.h"
+#include "include/runtime.h"
+#include "include/sharing.h"
+#include "include/stream.h"
+#include "include/threadpool.h"
+
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Config/llvm-config.h>
+#include <llvm/ExecutionEngine/Orc/Core.h>
+#include <llvm/ExecutionEngine/JITEventListener.h>
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/ExecutionEngine/Orc/RTDyldObjectLinkingLayer.h>
+#include <llvm/ExecutionEngine/SectionMemoryManager.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/FileUtilities.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Program.h>
+#include <llvm/Support/SHA1.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Target/TargetMachine.h>
+
+// The build defines this as the path of the quark_runtime library it makes
+#ifndef QUARK_RUNTIME_LIBRARY
+#define QUARK_RUNTIME_LIBRARY "libquark_runtime.a"
+#endif
+
+namespace {
+
+template <typename T>
+T unwrap(llvm::Expected<T> value, const char* what)
+{
+	if (!value) throw QuarkCodegenError(std::string(what) + ": " + llvm::toString(value.takeError()));
+	return std::move(*value);
+}
+
+void check(llvm::Error err, const char* what)
+{
+	if (err) throw QuarkCodegenError(std::string(what) + ": " + llvm::toString(std::move(err)));
+}
+
+void initNativeTarget() {
+	static bool initialized = [] {
+		llvm::InitializeNativeTarget();
+		llvm::InitializeNativeTargetAsmPrinter();
+		return true;
+	}();
+	(void)initialized;
+}
+
+// Only a foreign triple needs the other targets, which take a while to
+// register
+void initAllTargets() {
+	static bool initialized = [] {
+		llvm::InitializeAllTargetInfos();
+		llvm::InitializeAllTargets();
+		llvm::InitializeAllTargetMCs();
+		llvm::InitializeAllAsmPrinters();
+		return true;
+	}();
+	(void)initialized;
+}
+
+template <typename T>
+T* symbolAddress(llvm::orc::LLJIT& jit, const char* name)
+{
+	auto sym = unwrap(jit.lookup(name), "JIT symbol lookup failed");
+#if LLVM_VERSION_MAJOR >= 15
+	return sym.template toPtr<T*>();
+#else
+	return reinterpret_cast<T*>(static_cast<uintptr_t>(sym.getAddress()));
+#endif
+}
+
+// The generated code calls the runtime linked into this library. Its
+// symbols are defined by address, since an extension module's are not
+// visible to a lookup in the process.
+void defineRuntime(llvm::orc::LLJIT& jit) {
+	llvm::orc::SymbolMap symbols;
+	llvm::JITSymbolFlags flags = llvm::JITSymbolFlags::Exported | llvm::JITSymbolFlags::Callable;
+	for (const RuntimeSymbol& symbol : runtimeSymbols())
+	{
+#if LLVM_VERSION_MAJOR >= 17
+		symbols[jit.mangleAndIntern(symbol.name)] = llvm::orc::ExecutorSymbolDef(llvm::orc::ExecutorAddr::fromPtr(symbol.address), flags);
+#else
+		symbols[jit.mangleAndIntern(symbol.name)] = llvm::JITEvaluatedSymbol(llvm::pointerToJITTargetAddress(symbol.address), flags);
+#endif
+	}
+	check(jit.getMainJITDylib().define(llvm::orc::absoluteSymbols(std::move(symbols))), "Failed to define the runtime");
+}
+
+llvm::CodeGenOpt::Level codeGenOptLevel(OptLevel level) {
+	switch (level)
+	{
+	case OptLevel::O0: return llvm::CodeGenOpt::None;
+	case OptLevel::O1: return llvm::CodeGenOpt::Less;
+	case OptLevel::O3: return llvm::CodeGenOpt::Aggressive;
+	default: return llvm::CodeGenOpt::Default;
+	}
+}
+
+llvm::orc::JITTargetMachineBuilder hostMachine(OptLevel level) {
+	initNativeTarget();
+	auto jtmb = unwrap(llvm::orc::JITTargetMachineBuilder::detectHost(), "Failed to detect host target");
+	jtmb.setCodeGenOptLevel(codeGenOptLevel(level));
+	return jtmb;
+}
+
+// The machine the options target. Code is position independent for every
+// mode, so objects the JIT ran can be linked into executables and shared
+// libraries, and the other way round, through the cache.
+llvm::orc::JITTargetMachineBuilder targetMachine(const TargetOptions& target, OptLevel level) {
+	llvm::orc::JITTargetMachineBuilder jtmb = hostMachine(level);
+	llvm::Triple triple(llvm::Triple::normalize(target.triple));
+	if (!target.triple.empty() && triple != jtmb.getTargetTriple())
+	{
+		initAllTargets();
+		jtmb = llvm::orc::JITTargetMachineBuilder(triple);
+		jtmb.setCPU(target.cpu.empty() ? "generic" : target.cpu);
+		jtmb.setCodeGenOptLevel(codeGenOptLevel(level));
+	}
+	else if (!target.cpu.empty())
+	{
+		// The host's features are the host CPU's, not those of the one named
+		jtmb.setCPU(target.cpu);
+		jtmb.getFeatures() = llvm::SubtargetFeatures();
+	}
+
+	llvm::SmallVector<llvm::StringRef, 8> features;
+	llvm::StringRef(target.features).split(features, ',', -1, false);
+	for (llvm::StringRef feature : features) jtmb.getFeatures().AddFeature(feature.trim());
+	jtmb.setRelocationModel(llvm::Reloc::PIC_);
+	return jtmb;
+}
+
+// TargetMachines are not thread-safe, so every worker keeps its own, one per
+// target and codegen level
+llvm::TargetMachine& threadTargetMachine(const TargetOptions& target, OptLevel level) {
+	thread_local std::map<std::string, std::unique_ptr<llvm::TargetMachine>> machines;
+	std::string key = target.triple + '\0' + target.cpu + '\0' + target.features + '\0' + std::to_string(codeGenOptLevel(level));
+	std::unique_ptr<llvm::TargetMachine>& machine = machines[key];
+	if (!machine) machine = unwrap(targetMachine(target, level).createTargetMachine(), "Failed to create target machine");
+	return *machine;
+}
+
+// Bump whenever lowering, or the runtime entry points it calls, change in a
+// way the unit fingerprint cannot see
+constexpr const char* CacheFormat = "quark-object-5";
+
+// Statements of a stream are compiled once they make up this many nodes, so
+// that a segment's modules stay small but the pool still gets a few
+// thousand lines at a time
+constexpr size_t StreamSegmentNodes = 1 << 16;
+
+std::string emitObject(llvm::Module& module, llvm::TargetMachine& targetMachine) {
+	// Object emission needs a seekable stream
+	llvm::SmallVector<char, 0> object;
+	llvm::raw_svector_ostream os(object);
+	llvm::legacy::PassManager pm;
+#if LLVM_VERSION_MAJOR >= 18
+	bool failed = targetMachine.addPassesToEmitFile(pm, os, nullptr, llvm::CodeGenFileType::ObjectFile);
+#else
+	bool failed = targetMachine.addPassesToEmitFile(pm, os, nullptr, llvm::CGFT_ObjectFile);
+#endif
+	if (failed) throw QuarkCodegenError("Target cannot emit object files");
+	pm.run(module);
+	return std::string(object.data(), object.size());
+}
+
+}
+
+CodegenMode codegenModeFromString(const std::string& mode) {
+	if (mode == "dump") return CodegenMode::Dump;
+	if (mode == "ir") return CodegenMode::IR;
+	if (mode == "jit") return CodegenMode::JIT;
+	if (mode == "aot") return CodegenMode::AOT;
+	throw std::invalid_argument("Unknown codegen mode '" + mode + "', expected dump, ir, jit or aot");
+}
+
+AotOutput aotOutputFromString(const std::string& output) {
+	if (output == "exe") return AotOutput::Executable;
+	if (output == "shared") return AotOutput::SharedLibrary;
+	throw std::invalid_argument("Unknown AOT output '" + output + "', expected exe or shared");
+}
+
+// LLVM does not say what a module allocates, so this is what its values
+// take at least: each object and the operands it uses. Types, constants and
+// metadata belong to the context and are left out.
+uint64_t irBytes(const llvm::Module& module) {
+	uint64_t bytes = sizeof(llvm::Module);
+	for (const llvm::GlobalVariable& global : module.globals())
+		bytes += sizeof(llvm::GlobalVariable) + global.getNumOperands() * sizeof(llvm::Use);
+	for (const llvm::Function& fn : module)
+	{
+		bytes += sizeof(llvm::Function) + fn.arg_size() * sizeof(llvm::Argument);
+		for (const llvm::BasicBlock& block : fn)
+		{
+			bytes += sizeof(llvm::BasicBlock);
+			for (const llvm::Instruction& inst : block) bytes += sizeof(llvm::Instruction) + inst.getNumOperands() * sizeof(llvm::Use);
+		}
+	}
+	return bytes;
+}
+
+// Walks the module only when its memory is tracked
+void chargeModule(MemoryCharge& charge, const llvm::Module* module) {
+	if (charge.bytes() || memoryTrackingOn()) charge.set(module ? irBytes(*module) : 0);
+}
+
+// One function (or the top-level statements) with its own context, so units
+// never share LLVM state across threads
+struct CodegenUnit
+{
+	std::unique_ptr<llvm::LLVMContext> context;
+	std::unique_ptr<llvm::Module> module;
+	std::string object;
+	MemoryCharge moduleCharge{ MemoryKind::LlvmModules };
+	MemoryCharge objectCharge{ MemoryKind::Objects };
+
+	// After the module or the object changed
+	void account()
+	{
+		chargeModule(moduleCharge, module.get());
+		objectCharge.update(object.size());
+	}
+};
+
+struct QuarkCodegen::Impl
+{
+	CodegenOptions options;
+	std::unique_ptr<ThreadPool> ownPool;
+	ModulePlan plan;
+	std::vector<CodegenUnit> units;
+	std::shared_ptr<CompileCache> cache;
+
+	// The functions of the units instrumented since the plan was made, whose
+	// records runJit() writes and link() registers
+	std::vector<std::string> profiled;
+
+	// Same for the units that count their dispatch sites
+	std::vector<std::string> counted;
+
+	// profileDigest() of the profile used, read once per compile
+	std::string profileKey;
+
+	// Object code depends on the unit, the pipeline it went through, the
+	// profile it was instrumented for or with and the exact target it was
+	// emitted for
+	CacheKey unitKey(size_t unit, const llvm::TargetMachine& targetMachine) const
+	{
+		std::string bytes = CacheFormat;
+		for (const std::string& part : { std::string(optLevelString(options.optimizer.level)), options.optimizer.passPipeline,
+			std::string(options.optimizer.profileGenerate.empty() ? "" : "instrument"), profileKey,
+			targetMachine.getTargetTriple().str(), targetMachine.getTargetCPU().str(), targetMachine.getTargetFeatureString().str() })
+		{
+			bytes.push_back('\0');
+			bytes += part;
+		}
+		bytes.push_back('\0');
+		bytes += unitFingerprint(plan, unit);
+		return llvm::SHA1::hash(llvm::ArrayRef<uint8_t>(reinterpret_cast<const uint8_t*>(bytes.data()), bytes.size()));
+	}
+
+	// This thread's machine for the target of the options
+	llvm::TargetMachine& machine() const
+	{
+		return threadTargetMachine(options.target, options.optimizer.level);
+	}
+
+	ThreadPool& pool()
+	{
+		if (options.threads == 0) return ThreadPool::shared();
+		if (!ownPool) ownPool = std::make_unique<ThreadPool>(options.threads);
+		return *ownPool;
+	}
+
+	// Runs step on every unit in parallel. Errors are rethrown in unit order
+	// so the reported one does not depend on scheduling.
+	template <typename Step>
+	void forEachUnit(Step step)
+	{
+		std::vector<std::exception_ptr> errors(units.size());
+		auto runUnit = [&](size_t i) {
+			try
+			{
+				step(units[i], i);
+			}
+			catch (...)
+			{
+				errors[i] = std::current_exception();
+			}
+		};
+
+		if (options.threads == 1 || units.size() == 1)
+		{
+			for (size_t i = 0; i < units.size(); i++) runUnit(i);
+		}
+		else
+		{
+			TaskGroup group(pool());
+			for (size_t i = 0; i < units.size(); i++) group.run([&runUnit, i] { runUnit(i); });
+			group.wait();
+		}
+
+		for (std::exception_ptr& err : errors)
+			if (err) std::rethrow_exception(err);
+	}
+
+	// Before a new plan; a profile that is not indexed fails here, before
+	// any unit is compiled
+	void beginProfile()
+	{
+		profiled.clear();
+		counted.clear();
+		profileKey = options.optimizer.profileUse.empty() ? std::string() : profileDigest(options.optimizer.profileUse);
+	}
+
+	void addInstrumented()
+	{
+		for (size_t i = 0; i < units.size(); i++)
+		{
+			const std::string& name = i == 0 ? plan.entryName : plan.instance(i).linkName;
+			if (!options.optimizer.profileGenerate.empty()) profiled.push_back(name);
+			if (plan.siteCounters) counted.push_back(name);
+		}
+	}
+
+	// What begin(), optimize() and compile() do once the plan is made; a
+	// stream runs them per segment, without timings
+	void lowerUnits(TimeReport* timings)
+	{
+		units.clear();
+		units.resize(plan.unitCount());
+		addInstrumented();
+		PhaseTimer timer(timings, "lower", units.size());
+		forEachUnit([&](CodegenUnit& unit, size_t i) {
+			unit.context = std::make_unique<llvm::LLVMContext>();
+			unit.module = lowerUnit(plan, i, *unit.context, machine());
+			unit.account();
+		});
+	}
+
+	void optimizeUnits(TimeReport* timings)
+	{
+		PhaseTimer timer(timings, "optimize", units.size());
+		forEachUnit([&](CodegenUnit& unit, size_t) {
+			std::map<std::string, PassTiming> passTimes;
+			optimizeModule(*unit.module, &machine(), options.optimizer, timings ? &passTimes : nullptr);
+			unit.account();
+			if (timings) timings->passes(passTimes);
+		});
+	}
+
+	void compileUnits(TimeReport* timings)
+	{
+		units.clear();
+		units.resize(plan.unitCount());
+		addInstrumented();
+		if (!options.cacheDir.empty() && !cache) cache = CompileCache::open(options.cacheDir, options.cacheMaxBytes);
+
+		// Each unit times its own steps, so workers never contend on the report
+		struct UnitTimes
+		{
+			double cache = 0, lower = 0, optimize = 0, emit = 0;
+			bool hit = false;
+			std::map<std::string, PassTiming> passes;
+		};
+		std::vector<UnitTimes> times(timings ? units.size() : 0);
+
+		PhaseTimer timer(timings, "compile", units.size());
+		forEachUnit([&](CodegenUnit& unit, size_t i) {
+			UnitTimes* t = timings ? &times[i] : nullptr;
+			llvm::TargetMachine& targetMachine = machine();
+			CacheKey key;
+			if (cache)
+			{
+				StepTimer step(t ? &t->cache : nullptr);
+				key = unitKey(i, targetMachine);
+				if (cache->load(key, unit.object))
+				{
+					unit.account();
+					if (t) t->hit = true;
+					return;
+				}
+			}
+
+			llvm::LLVMContext context;
+			std::unique_ptr<llvm::Module> module;
+			MemoryCharge moduleCharge(MemoryKind::LlvmModules);
+			{
+				StepTimer step(t ? &t->lower : nullptr);
+				module = lowerUnit(plan, i, context, targetMachine);
+			}
+			chargeModule(moduleCharge, module.get());
+			{
+				StepTimer step(t ? &t->optimize : nullptr);
+				optimizeModule(*module, &targetMachine, options.optimizer, t ? &t->passes : nullptr);
+			}
+			chargeModule(moduleCharge, module.get());
+			{
+				StepTimer step(t ? &t->emit : nullptr);
+				unit.object = emitObject(*module, targetMachine);
+			}
+			unit.account();
+
+			if (cache)
+			{
+				StepTimer step(t ? &t->cache : nullptr);
+				cache->store(key, unit.object);
+			}
+		});
+
+		if (!timings) return;
+		UnitTimes total;
+		uint64_t hits = 0;
+		for (const UnitTimes& t : times)
+		{
+			total.cache += t.cache;
+			total.lower += t.lower;
+			total.optimize += t.optimize;
+			total.emit += t.emit;
+			hits += t.hit;
+			timings->passes(t.passes);
+		}
+		uint64_t built = times.size() - hits;
+		if (cache) timings->step("compile.cache", total.cache, hits);
+		timings->step("compile.lower", total.lower, built);
+		timings->step("compile.optimize", total.optimize, built);
+		timings->step("compile.emit", total.emit, built);
+	}
+};
+
+QuarkCodegen::QuarkCodegen(CodegenOptions options) : impl(std::make_unique<Impl>()) {
+	impl->options = std::move(options);
+}
+
+QuarkCodegen::~QuarkCodegen() = default;
+
+void QuarkCodegen::begin(NodeRef root) {
+	TimeReport* timings = impl->options.timings;
+	impl->beginProfile();
+	{
+		PhaseTimer timer(timings, "plan");
+		impl->plan = planModule(root);
+		impl->plan.debugInfo = impl->options.debugInfo;
+		impl->plan.siteCounters = impl->options.siteCounters;
+		timer.setItems(impl->plan.unitCount());
+	}
+	impl->lowerUnits(timings);
+}
+
+void QuarkCodegen::optimize() {
+	if (impl->units.empty()) throw QuarkCodegenError("Nothing to optimize, call begin() first");
+	impl->optimizeUnits(impl->options.timings);
+}
+
+std::string QuarkCodegen::printIR() const {
+	std::string ir;
+	llvm::raw_string_ostream os(ir);
+	for (const CodegenUnit& unit : impl->units)
+		if (unit.module) unit.module->print(os, nullptr);
+	return os.str();
+}
+
+void QuarkCodegen::compile(NodeRef root) {
+	TimeReport* timings = impl->options.timings;
+	impl->beginProfile();
+	{
+		PhaseTimer timer(timings, "plan");
+		impl->plan = planModule(root);
+		impl->plan.debugInfo = impl->options.debugInfo;
+		impl->plan.siteCounters = impl->options.siteCounters;
+		timer.setItems(impl->plan.unitCount());
+	}
+	impl->compileUnits(timings);
+}
+
+CodegenResult QuarkCodegen::runJit() {
+	if (impl->units.empty()) throw QuarkCodegenError("Nothing to run, call begin() or compile() first");
+	const std::string& triple = impl->options.target.triple;
+	if (!triple.empty() && llvm::Triple(llvm::Triple::normalize(triple)) != llvm::Triple(llvm::sys::getProcessTriple()))
+		throw QuarkCodegenError("JIT mode runs code on the host, not on " + triple);
+
+	// Machine code generation is the expensive part, so it runs per unit on
+	// the pool; the JIT only has to link the finished objects
+	TimeReport* timings = impl->options.timings;
+	OptLevel level = impl->options.optimizer.level;
+	if (impl->units.front().module)
+	{
+		PhaseTimer timer(timings, "emit", impl->units.size());
+		impl->forEachUnit([&](CodegenUnit& unit, size_t) {
+			if (!unit.module) return;
+			unit.object = emitObject(*unit.module, impl->machine());
+			unit.module.reset();
+			unit.context.reset();
+			unit.account();
+		});
+	}
+
+	std::unique_ptr<llvm::orc::LLJIT> jit;
+	void (*entry)() = nullptr;
+	{
+		PhaseTimer timer(timings, "link", impl->units.size());
+		llvm::orc::LLJITBuilder builder;
+		builder.setJITTargetMachineBuilder(hostMachine(level));
+		if (impl->plan.debugInfo)
+		{
+			// gdb learns of JIT code, and reads its line tables, through the
+			// registration interface, which RuntimeDyld reports to
+			builder.setObjectLinkingLayerCreator([](llvm::orc::ExecutionSession& session, const llvm::Triple&) {
+				auto layer = std::make_unique<llvm::orc::RTDyldObjectLinkingLayer>(session,
+					[] { return std::make_unique<llvm::SectionMemoryManager>(); });
+				layer->registerJITEventListener(*llvm::JITEventListener::createGDBRegistrationListener());
+				return std::unique_ptr<llvm::orc::ObjectLayer>(std::move(layer));
+			});
+		}
+		jit = unwrap(builder.create(), "Failed to create LLJIT");
+		defineRuntime(*jit);
+		for (size_t i = 0; i < impl->units.size(); i++)
+		{
+			check(jit->addObjectFile(llvm::MemoryBuffer::getMemBufferCopy(impl->units[i].object, "quark.unit" + std::to_string(i))),
+				"Failed to add object");
+		}
+		impl->units.clear();
+
+		// Lookup is what actually links the objects
+		entry = symbolAddress<void()>(*jit, EntryName);
+	}
+
+	// The program's lists go when the result has been copied out of them
+	ListArena lists;
+	std::vector<DispatchSite> sites;
+	{
+		PhaseTimer timer(timings, "run");
+		std::string error;
+		bool ran = runProgram(entry, error);
+
+		// Counts up to a runtime error are a profile as well, as those of a
+		// program that exits early are
+		if (!impl->profiled.empty())
+		{
+			std::vector<const QuarkProfileRecord*> records;
+			for (const std::string& function : impl->profiled)
+				records.push_back(symbolAddress<QuarkProfileRecord>(*jit, profileSymbol(function).c_str()));
+			const std::string& path = impl->options.optimizer.profileGenerate;
+			if (quark_profile_write(path.c_str(), records.data(), static_cast<int64_t>(records.size())) != 0)
+				throw QuarkCodegenError("Cannot write the profile " + path);
+		}
+		for (const std::string& function : impl->counted)
+		{
+			const QuarkSiteTable* table = symbolAddress<QuarkSiteTable>(*jit, siteSymbol(function).c_str());
+			for (int64_t i = 0; i < table->count; i++)
+			{
+				const QuarkSiteRecord& record = *table->records[i];
+				sites.push_back(DispatchSite{ record.site, record.fastPath != 0, record.calls, record.hits, record.elements });
+			}
+		}
+		std::stable_sort(sites.begin(), sites.end(), [](const DispatchSite& a, const DispatchSite& b) { return a.calls > b.calls; });
+		if (timings && !sites.empty()) timings->sites(sites);
+		if (!ran) throw QuarkRuntimeError(error);
+	}
+
+	CodegenResult result;
+	result.sites = std::move(sites);
+	result.kind = impl->plan.resultKind;
+	switch (result.kind)
+	{
+	case ValueKind::Int: result.intValue = *symbolAddress<int64_t>(*jit, ResultName); break;
+	case ValueKind::Float: result.floatValue = *symbolAddress<double>(*jit, ResultName); break;
+	case ValueKind::IntList:
+	{
+		const QuarkList* list = *symbolAddress<QuarkList*>(*jit, ResultName);
+		result.intValues.assign(listInts(list), listInts(list) + list->length);
+		break;
+	}
+	case ValueKind::FloatList:
+	{
+		const QuarkList* list = *symbolAddress<QuarkList*>(*jit, ResultName);
+		result.floatValues.assign(listFloats(list), listFloats(list) + list->length);
+		break;
+	}
+	default: break;
+	}
+	return result;
+}
+
+std::string QuarkCodegen::link() {
+	if (impl->units.empty() || impl->units.front().object.empty()) throw QuarkCodegenError("Nothing to link, call compile() first");
+
+	const AotOptions& aot = impl->options.aot;
+	TimeReport* timings = impl->options.timings;
+	llvm::TargetMachine& targetMachine = impl->machine();
+	const llvm::Triple& triple = targetMachine.getTargetTriple();
+	std::vector<std::string> objects;
+	for (CodegenUnit& unit : impl->units) objects.push_back(std::move(unit.object));
+	impl->units.clear();
+	if (aot.kind == AotOutput::Executable)
+	{
+		PhaseTimer timer(timings, "entry", 1);
+		llvm::LLVMContext context;
+		objects.push_back(emitObject(*lowerProgramEntry(impl->plan, context, targetMachine), targetMachine));
+	}
+	if (!impl->profiled.empty())
+	{
+		// A relative path is taken from where the program runs
+		llvm::LLVMContext context;
+		objects.push_back(emitObject(*lowerProfileRegistration(impl->profiled, impl->options.optimizer.profileGenerate, context,
+			targetMachine), targetMachine));
+	}
+	if (!impl->counted.empty())
+	{
+		llvm::LLVMContext context;
+		objects.push_back(emitObject(*lowerSiteRegistration(impl->counted, context, targetMachine), targetMachine));
+	}
+
+	PhaseTimer timer(timings, "link", objects.size());
+	auto linker = llvm::sys::findProgramByName(aot.linker);
+	if (!linker) throw QuarkCodegenError("Cannot find the linker '" + aot.linker + "': " + linker.getError().message());
+
+	// Temporary files go however linking ends
+	std::deque<llvm::FileRemover> removers;
+	auto temporary = [&](const std::string& prefix, const char* suffix) {
+		llvm::SmallString<128> path;
+		if (std::error_code ec = llvm::sys::fs::createTemporaryFile(prefix, suffix, path))
+			throw QuarkCodegenError("Cannot create a temporary file: " + ec.message());
+		removers.emplace_back(path);
+		return std::string(path.str());
+	};
+
+	std::vector<std::string> args = { aot.linker };
+	if (aot.kind == AotOutput::SharedLibrary) args.push_back("-shared");
+	else if (aot.staticExecutable && triple.isOSLinux()) args.push_back("-static");
+	// Only the runtime entry points the program calls are kept
+	if (triple.isOSDarwin()) args.push_back("-Wl,-dead_strip");
+	else if (triple.isOSBinFormatELF()) args.push_back("-Wl,--gc-sections");
+	args.push_back("-o");
+	args.push_back(aot.output);
+	for (size_t i = 0; i < objects.size(); i++)
+	{
+		std::string path = temporary("quark.unit" + std::to_string(i), "o");
+		std::error_code ec;
+		llvm::raw_fd_ostream os(path, ec);
+		if (!ec) os << objects[i];
+		os.close();
+		if (ec || os.has_error()) throw QuarkCodegenError("Cannot write " + path + ": " + (ec ? ec : os.error()).message());
+		args.push_back(path);
+	}
+	args.push_back(aot.runtimeLibrary.empty() ? QUARK_RUNTIME_LIBRARY : aot.runtimeLibrary);
+	args.insert(args.end(), aot.linkerArgs.begin(), aot.linkerArgs.end());
+
+	std::string log = temporary("quark.link", "log");
+	std::vector<llvm::StringRef> argRefs(args.begin(), args.end());
+#if LLVM_VERSION_MAJOR >= 16
+	std::optional<llvm::StringRef> redirects[] = { std::nullopt, llvm::StringRef(log), llvm::StringRef(log) };
+#else
+	llvm::Optional<llvm::StringRef> redirects[] = { llvm::None, llvm::StringRef(log), llvm::StringRef(log) };
+#endif
+	std::string error;
+	int status = llvm::sys::ExecuteAndWait(*linker, argRefs, {}, redirects, 0, 0, &error);
+	if (status != 0)
+	{
+		std::string message = "Linking " + aot.output + " failed";
+		if (!error.empty()) message += ": " + error;
+		if (auto output = llvm::MemoryBuffer::getFile(log)) message += "\n" + (*output)->getBuffer().rtrim().str();
+		throw QuarkCodegenError(message);
+	}
+	return aot.output;
+}
+
+CacheStats QuarkCodegen::cacheStats() const {
+	if (impl->cache) return impl->cache->stats();
+	if (impl->options.cacheDir.empty()) return CacheStats();
+	return CompileCache::open(impl->options.cacheDir, impl->options.cacheMaxBytes)->stats();
+}
+
+CodegenResult QuarkCodegen::run(NodeRef root, CodegenMode mode) {
+	CodegenResult result;
+	switch (mode)
+	{
+	case CodegenMode::Dump:
+	{
+		// Whatever iostreams and stdio still hold comes out before the tree
+		std::cout.flush();
+		std::fflush(stdout);
+		PhaseTimer timer(impl->options.timings, "dump");
+		timer.setItems(dumpTree(root, impl->options.dumpFormat, impl->options.dumpFd));
+		break;
+	}
+	case CodegenMode::IR:
+		begin(root);
+		optimize();
+		result.ir = printIR();
+		break;
+	case CodegenMode::JIT:
+		compile(root);
+		result = runJit();
+		break;
+	case CodegenMode::AOT:
+		compile(root);
+		result.output = link();
+		break;
+	}
+	return result;
+}
+
+CodegenResult QuarkCodegen::run(Ast& ast, CodegenMode mode) {
+	if (impl->options.foldConstants && mode != CodegenMode::Dump)
+	{
+		PhaseTimer timer(impl->options.timings, "fold", ast.size());
+		foldConstants(ast);
+	}
+	if (impl->options.shareSubtrees && !impl->options.debugInfo && !impl->options.siteCounters && mode != CodegenMode::Dump)
+	{
+		PhaseTimer timer(impl->options.timings, "share", ast.size());
+		shareSubtrees(ast);
+	}
+	return run(ast.rootRef(), mode);
+}
+
+CodegenResult QuarkCodegen::runStream(ItemReader& items, CodegenMode mode) {
+	if (mode == CodegenMode::Dump) throw std::invalid_argument("A stream runs ir, jit or aot mode");
+
+	impl->beginProfile();
+
+	// Definitions sit at the bottom of the arena and stay; the statements of
+	// the segment being gathered lie above keep and go once it is compiled
+	Ast ast;
+	// Each item's parser shares what it builds, within the item
+	ast.setHashConsing(impl->options.shareSubtrees && !impl->options.debugInfo && !impl->options.siteCounters);
+	ModulePlan& plan = impl->plan;
+	plan = ModulePlan();
+	plan.root = NodeRef(&ast, InvalidNode);
+	plan.debugInfo = impl->options.debugInfo;
+	plan.siteCounters = impl->options.siteCounters;
+	StreamPlanner planner(plan);
+	std::vector<NodeRef> statements;
+	NodeId keep = 0;
+	// Same for the items' windows in ast.sources(), and the locations in them
+	size_t keepSources = 0;
+
+	CodegenResult result;
+	std::vector<CodegenUnit> objects;
+	size_t segments = 0, resultSegment = 0, itemCount = 0;
+	ValueKind resultKind = ValueKind::None;
+	bool lastIsFunction = false;
+
+	TimeReport* timings = impl->options.timings;
+	double lexTime = 0, parseTime = 0, foldTime = 0, planTime = 0, compileTime = 0;
+	auto step = [&](double& total) { return timings ? &total : nullptr; };
+
+	auto compileSegment = [&](bool last) {
+		{
+			StepTimer timer(step(planTime));
+			planner.segment(segments, std::move(statements));
+			if (last) planner.finish();
+		}
+		if (!plan.statements.empty())
+		{
+			resultSegment = segments;
+			resultKind = plan.resultKind;
+		}
+
+		StepTimer timer(step(compileTime));
+		if (mode == CodegenMode::IR)
+		{
+			impl->lowerUnits(nullptr);
+			impl->optimizeUnits(nullptr);
+			result.ir += printIR();
+		}
+		else
+		{
+			impl->compileUnits(nullptr);
+			for (CodegenUnit& unit : impl->units) objects.push_back(std::move(unit));
+		}
+		impl->units.clear();
+		segments++;
+		statements.clear();
+		ast.truncate(keep);
+		ast.sources().truncate(keepSources);
+	};
+
+	{
+		PhaseTimer timer(timings, "stream");
+		for (;;)
+		{
+			{
+				StepTimer lexing(step(lexTime));
+				if (!items.next()) break;
+			}
+			itemCount++;
+
+			// A definition stays, so what is below it has to go first
+			bool defines = items.definesFunction();
+			if (defines && !statements.empty()) compileSegment(false);
+
+			NodeRef item;
+			NodeId first = static_cast<NodeId>(ast.size());
+			{
+				StepTimer parsing(step(parseTime));
+				item = NodeRef(&ast, items.parse(ast));
+			}
+			if (impl->options.foldConstants)
+			{
+				// Only the item's nodes, not the definitions kept below them
+				StepTimer folding(step(foldTime));
+				foldConstants(ast, first);
+			}
+
+			// Both are wrapped in the item's CompilationUnit and Block
+			for (NodeRef statement : item.child(0).children())
+			{
+				lastIsFunction = statement.type() == Function;
+				if (lastIsFunction) planner.define(statement);
+				else statements.push_back(statement);
+			}
+
+			if (defines)
+			{
+				keep = static_cast<NodeId>(ast.size());
+				keepSources = ast.sources().size();
+			}
+			else if (ast.size() - keep >= StreamSegmentNodes) compileSegment(false);
+		}
+		compileSegment(true);
+		timer.setItems(itemCount);
+	}
+	if (timings)
+	{
+		timings->step("stream.lex", lexTime, itemCount);
+		timings->step("stream.parse", parseTime, itemCount);
+		if (impl->options.foldConstants) timings->step("stream.fold", foldTime, itemCount);
+		timings->step("stream.plan", planTime, segments);
+		timings->step("stream.compile", compileTime, segments);
+	}
+
+	plan.resultKind = lastIsFunction ? ValueKind::None : resultKind;
+	plan.resultName = segmentSymbol(ResultName, resultSegment);
+	llvm::TargetMachine& targetMachine = impl->machine();
+	llvm::LLVMContext context;
+	std::unique_ptr<llvm::Module> entry = lowerStreamEntry(plan, segments, context, targetMachine);
+	if (mode == CodegenMode::IR)
+	{
+		llvm::raw_string_ostream os(result.ir);
+		entry->print(os, nullptr);
+		os.flush();
+		return result;
+	}
+
+	objects.emplace_back();
+	objects.back().object = emitObject(*entry, targetMachine);
+	objects.back().account();
+	impl->units = std::move(objects);
+	if (mode == CodegenMode::JIT) return runJit();
+	result.output = link();
+	return result;
+}
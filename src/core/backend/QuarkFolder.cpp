@@ -0,0 +1,263 @@
+#include "include/fold.h"
+
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "include/visitor.h"
+
+namespace {
+
+// What the folder knows about a subtree's type; identifiers and calls are
+// Unknown until codegen plans the module
+enum class Kind : uint8_t
+{
+	Unknown,
+	Int,
+	Float,
+};
+
+struct Constant
+{
+	Kind kind = Kind::Unknown;
+	int64_t i = 0;
+	double f = 0;
+
+	double asFloat() const { return kind == Kind::Float ? f : static_cast<double>(i); }
+};
+
+// i64 arithmetic wraps in the backend; doing it on uint64_t keeps it defined here
+int64_t wrap(uint64_t value) {
+	return static_cast<int64_t>(value);
+}
+
+class ConstantFolder : public AstVisitor<ConstantFolder>
+{
+public:
+	ConstantFolder(Ast& ast, NodeId first) : AstVisitor(ast), tree(ast), first(first), kinds(ast.size() - first, Kind::Unknown) {}
+
+	FoldStats run()
+	{
+		// Post-order, so each node is simplified after its children
+		if (tree.root() != InvalidNode) walk(tree.root());
+		return stats;
+	}
+
+private:
+	friend class AstVisitor<ConstantFolder>;
+
+	Ast& tree;	// ast, writable
+	NodeId first;
+	std::vector<Kind> kinds;	// from node first on
+	FoldStats stats;
+
+	Kind& kind(NodeId id) { return kinds[id - first]; }
+	Kind kind(NodeId id) const { return kinds[id - first]; }
+
+	void leaveLiteral(NodeRef node)
+	{
+		Constant c;
+		if (constant(node.id(), c)) kind(node.id()) = c.kind;
+	}
+
+	void leaveOperator(NodeRef node)
+	{
+		NodeId replacement = simplify(node.id());
+		if (replacement == node.id()) return;
+
+		NodeRef up = parent();
+		if (up.valid()) tree.setChild(up.id(), childIndex(), replacement);
+		else tree.setRoot(replacement);
+	}
+
+	bool constant(NodeId id, Constant& out) const
+	{
+		if (ast.type(id) != Literal) return false;
+
+		// Spellings are not NUL-terminated inside the symbol table
+		std::string text(ast.spelling(id));
+		char* end = nullptr;
+		errno = 0;
+		if (ast.tok(id).kind == TokenKind::INT)
+		{
+			long long value = std::strtoll(text.c_str(), &end, 10);
+			if (errno == ERANGE || *end) return false;
+			out.kind = Kind::Int;
+			out.i = value;
+			return true;
+		}
+		if (ast.tok(id).kind == TokenKind::FLOAT)
+		{
+			double value = std::strtod(text.c_str(), &end);
+			if (*end) return false;
+			out.kind = Kind::Float;
+			out.f = value;
+			return true;
+		}
+		return false;
+	}
+
+	bool isConstant(NodeId id, Kind kind, int64_t value) const
+	{
+		Constant c;
+		if (!constant(id, c) || c.kind != kind) return false;
+		return kind == Kind::Int ? c.i == value : c.f == static_cast<double>(value);
+	}
+
+	// The location an expression starts at is that of its leftmost leaf
+	Token location(NodeId id) const
+	{
+		while (ast.type(id) == Operator && ast.childCount(id) == 2) id = ast.child(id, 0);
+		return ast.tok(id);
+	}
+
+	NodeId simplify(NodeId id)
+	{
+		if (ast.childCount(id) == 1) return unary(id);
+		if (ast.childCount(id) != 2) return id;
+
+		TokenKind op = ast.tok(id).kind;
+		NodeId lhs = ast.child(id, 0);
+		NodeId rhs = ast.child(id, 1);
+		if (op == TokenKind::EQUALS)
+		{
+			kind(id) = kind(rhs);
+			return id;
+		}
+		if (op != TokenKind::PLUS && op != TokenKind::MINUS && op != TokenKind::MULTIPLY && op != TokenKind::DIVIDE) return id;
+
+		Constant a, b;
+		if (constant(lhs, a) && constant(rhs, b))
+		{
+			Constant result;
+			if (arith(op, a, b, result)) return replace(id, result, location(lhs));
+		}
+
+		if (kind(lhs) != Kind::Unknown && kind(rhs) != Kind::Unknown)
+			kind(id) = (kind(lhs) == Kind::Float || kind(rhs) == Kind::Float) ? Kind::Float : Kind::Int;
+
+		NodeId operand = identity(op, lhs, rhs);
+		if (operand == InvalidNode) return id;
+		stats.simplified++;
+		return operand;
+	}
+
+	NodeId unary(NodeId id)
+	{
+		if (ast.tok(id).kind != TokenKind::MINUS) return id;
+		NodeId operand = ast.child(id, 0);
+		kind(id) = kind(operand);
+
+		Constant c;
+		if (constant(operand, c))
+		{
+			if (c.kind == Kind::Int) c.i = wrap(0 - static_cast<uint64_t>(c.i));
+			else c.f = -c.f;
+			return replace(id, c, ast.tok(id));
+		}
+
+		// --x is x for i64 (wrapping) and double alike
+		if (ast.type(operand) == Operator && ast.childCount(operand) == 1 && ast.tok(operand).kind == TokenKind::MINUS)
+		{
+			stats.simplified++;
+			return ast.child(operand, 0);
+		}
+		return id;
+	}
+
+	// The operand op leaves unchanged, or InvalidNode. An Int identity
+	// element works for either operand type, since Int promotes to Float
+	// without changing the result. A Float one would turn an Int operand into
+	// a Float result, so it needs the operand to be known Float.
+	NodeId identity(TokenKind op, NodeId lhs, NodeId rhs) const
+	{
+		auto unit = [&](NodeId c, NodeId x, int64_t value) {
+			return isConstant(c, Kind::Int, value) || (isConstant(c, Kind::Float, value) && kind(x) == Kind::Float);
+		};
+
+		switch (op)
+		{
+		case TokenKind::MULTIPLY:
+			if (unit(rhs, lhs, 1)) return lhs;
+			if (unit(lhs, rhs, 1)) return rhs;
+			break;
+		case TokenKind::DIVIDE:
+			if (unit(rhs, lhs, 1)) return lhs;
+			break;
+		case TokenKind::MINUS:
+			if (unit(rhs, lhs, 0)) return lhs;
+			break;
+		case TokenKind::PLUS:
+			// -0.0 + 0 is +0.0, so only an Int operand is left as is
+			if (kind(lhs) == Kind::Int && isConstant(rhs, Kind::Int, 0)) return lhs;
+			if (kind(rhs) == Kind::Int && isConstant(lhs, Kind::Int, 0)) return rhs;
+			break;
+		default:
+			break;
+		}
+		return InvalidNode;
+	}
+
+	bool arith(TokenKind op, const Constant& a, const Constant& b, Constant& result) const
+	{
+		if (a.kind == Kind::Int && b.kind == Kind::Int)
+		{
+			uint64_t x = static_cast<uint64_t>(a.i), y = static_cast<uint64_t>(b.i);
+			result.kind = Kind::Int;
+			switch (op)
+			{
+			case TokenKind::PLUS: result.i = wrap(x + y); return true;
+			case TokenKind::MINUS: result.i = wrap(x - y); return true;
+			case TokenKind::MULTIPLY: result.i = wrap(x * y); return true;
+			default:
+				// A zero divisor is a runtime error, left for the program to raise;
+				// -1 negates, wrapping, as the lowering's divide() does
+				if (b.i == 0) return false;
+				result.i = b.i == -1 ? wrap(0 - x) : a.i / b.i;
+				return true;
+			}
+		}
+
+		double x = a.asFloat(), y = b.asFloat();
+		result.kind = Kind::Float;
+		switch (op)
+		{
+		case TokenKind::PLUS: result.f = x + y; break;
+		case TokenKind::MINUS: result.f = x - y; break;
+		case TokenKind::MULTIPLY: result.f = x * y; break;
+		default: result.f = x / y; break;
+		}
+		return std::isfinite(result.f);
+	}
+
+	NodeId replace(NodeId id, const Constant& value, Token loc)
+	{
+		char text[32];
+		if (value.kind == Kind::Int)
+		{
+			std::snprintf(text, sizeof(text), "%lld", static_cast<long long>(value.i));
+		}
+		else
+		{
+			// 17 significant digits round-trip any double
+			std::snprintf(text, sizeof(text), "%.17g", value.f);
+			if (!std::strpbrk(text, ".e")) std::strcat(text, ".0");
+		}
+
+		loc.kind = value.kind == Kind::Int ? TokenKind::INT : TokenKind::FLOAT;
+		loc.value = tree.symbols().intern(text);
+		tree.makeLeaf(id, Literal, loc);
+		kind(id) = value.kind;
+		stats.folded++;
+		return id;
+	}
+};
+
+}
+
+FoldStats foldConstants(Ast& ast, NodeId first) {
+	return ConstantFolder(ast, first).run();
+}
@@ -0,0 +1,500 @@
+#include "include/lexer.h"
+
+#include <algorithm>
+#include <cstring>
+#include "include/threadpool.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+enum CharClass : uint8_t
+{
+	Other,
+	Alpha,   // [a-zA-Z_]
+	Digit,   // [0-9]
+	Space,   // ' ' only, tabs are illegal just like in lex_grammar.py
+	Newline,
+};
+
+struct CharTable
+{
+	uint8_t cls[256] = {};
+
+	constexpr CharTable()
+	{
+		for (int c = 'a'; c <= 'z'; c++) cls[c] = Alpha;
+		for (int c = 'A'; c <= 'Z'; c++) cls[c] = Alpha;
+		for (int c = '0'; c <= '9'; c++) cls[c] = Digit;
+		cls[static_cast<int>('_')] = Alpha;
+		cls[static_cast<int>(' ')] = Space;
+		cls[static_cast<int>('\n')] = Newline;
+	}
+};
+
+constexpr CharTable chars;
+
+inline CharClass classOf(char c) { return static_cast<CharClass>(chars.cls[static_cast<unsigned char>(c)]); }
+inline bool isIdentChar(char c) { CharClass cls = classOf(c); return cls == Alpha || cls == Digit; }
+
+const char* scanIdentifier(const char* p, const char* end) {
+#if defined(__SSE2__)
+	const __m128i caseBit = _mm_set1_epi8(0x20);
+	const __m128i beforeA = _mm_set1_epi8('a' - 1), afterZ = _mm_set1_epi8('z' + 1);
+	const __m128i before0 = _mm_set1_epi8('0' - 1), after9 = _mm_set1_epi8('9' + 1);
+	const __m128i underscore = _mm_set1_epi8('_');
+	while (end - p >= 16)
+	{
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+		__m128i lower = _mm_or_si128(v, caseBit);
+		__m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(lower, beforeA), _mm_cmplt_epi8(lower, afterZ));
+		__m128i digit = _mm_and_si128(_mm_cmpgt_epi8(v, before0), _mm_cmplt_epi8(v, after9));
+		__m128i ident = _mm_or_si128(_mm_or_si128(alpha, digit), _mm_cmpeq_epi8(v, underscore));
+		unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(ident));
+		if (mask != 0xFFFF) return p + __builtin_ctz(~mask);
+		p += 16;
+	}
+#endif
+	while (p < end && isIdentChar(*p)) ++p;
+	return p;
+}
+
+const char* scanRun(const char* p, const char* end, char c) {
+#if defined(__SSE2__)
+	const __m128i needle = _mm_set1_epi8(c);
+	while (end - p >= 16)
+	{
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+		unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, needle)));
+		if (mask != 0xFFFF) return p + __builtin_ctz(~mask);
+		p += 16;
+	}
+#endif
+	while (p < end && *p == c) ++p;
+	return p;
+}
+
+const char* scanDigits(const char* p, const char* end) {
+	while (p < end && classOf(*p) == Digit) ++p;
+	return p;
+}
+
+// Sources smaller than this are lexed on the caller, and no piece of a
+// parallel lex is smaller than the second
+constexpr size_t ParallelLexBytes = 1 << 20;
+constexpr size_t LexPieceBytes = 256 << 10;
+
+// Start of the first line after at that begins with a name or a number, or
+// npos. Strings and comments end at the line, so every newline is a real one.
+// Whether a token is spelled from p on; comments, spaces and illegal
+// characters leave the lexer where it was
+bool startsToken(const char* p, const char* end) {
+	CharClass cls = classOf(*p);
+	if (cls == Alpha || cls == Digit) return true;
+	char next = p + 1 < end ? p[1] : '\0';
+	if (*p == '/') return next != '/';
+	if (*p == '!') return next == '=';
+	return *p != '\0' && std::strchr(".()\"<>=+-*%&~[],'|:@", *p);
+}
+
+size_t nextCut(std::string_view source, size_t at) {
+	while (const void* nl = std::memchr(source.data() + at, '\n', source.size() - at))
+	{
+		at = static_cast<size_t>(static_cast<const char*>(nl) - source.data()) + 1;
+		if (at < source.size() && (classOf(source[at]) == Alpha || classOf(source[at]) == Digit)) return at;
+	}
+	return std::string_view::npos;
+}
+
+TokenKind reservedKind(std::string_view word) {
+	switch (word.size())
+	{
+	case 2:
+		if (word == "in") return TokenKind::IN;
+		if (word == "or") return TokenKind::OR;
+		if (word == "if") return TokenKind::IF;
+		if (word == "fn") return TokenKind::FN;
+		break;
+	case 3:
+		if (word == "use") return TokenKind::USE;
+		if (word == "and") return TokenKind::AND;
+		if (word == "for") return TokenKind::FOR;
+		break;
+	case 4:
+		if (word == "elif") return TokenKind::ELIF;
+		if (word == "else") return TokenKind::ELSE;
+		break;
+	case 5:
+		if (word == "while") return TokenKind::WHILE;
+		if (word == "class") return TokenKind::CLASS;
+		break;
+	case 6:
+		if (word == "module") return TokenKind::MODULE;
+		break;
+	}
+	return TokenKind::ID;
+}
+
+}
+
+void QuarkLexer::emit(TokenBuffer& out, TokenKind kind, uint32_t offset, uint32_t length, int32_t line) {
+	out.tokens.push_back(LexToken{ kind, offset, length, line });
+}
+
+// One raw token through _track_tokens_filter and _indentation_filter
+void QuarkLexer::emitRaw(TokenBuffer& out, TokenKind kind, uint32_t offset, uint32_t length) {
+	bool tokAtLineStart = atLineStart;
+	bool mustIndent = false;
+
+	switch (kind)
+	{
+	case TokenKind::COLON:
+		atLineStart = false;
+		indent = MayIndent;
+		break;
+	case TokenKind::NEWLINE:
+		atLineStart = true;
+		if (indent == MayIndent) indent = MustIndent;
+		break;
+	case TokenKind::WS:
+		atLineStart = true;
+		break;
+	default:
+		// A real token; only indent after COLON NEWLINE
+		mustIndent = indent == MustIndent;
+		atLineStart = false;
+		indent = NoIndent;
+		break;
+	}
+
+	lastRawOffset = offset;
+	lastRawLine = lineNo;
+
+	if (kind == TokenKind::WS)
+	{
+		// WS tokens are never passed to the parser
+		depth = length;
+		prevWasWs = true;
+		return;
+	}
+
+	if (kind == TokenKind::NEWLINE)
+	{
+		depth = 0;
+		// ignore blank lines
+		if (!(prevWasWs || tokAtLineStart)) emit(out, kind, offset, length, lineNo);
+		return;
+	}
+
+	prevWasWs = false;
+	if (mustIndent)
+	{
+		// The current depth must be larger than the previous level
+		if (!(depth > levels.back())) throw QuarkIndentationError("expected an indented block");
+		levels.push_back(depth);
+		emit(out, TokenKind::INDENT, offset, 0, lineNo);
+	}
+	else if (tokAtLineStart)
+	{
+		// Must be on the same level or one of the previous levels
+		if (depth > levels.back())
+		{
+			throw QuarkIndentationError("indentation increase but not in new block");
+		}
+		else if (depth < levels.back())
+		{
+			// Back up; but only if it matches a previous level
+			auto it = std::find(levels.begin(), levels.end(), depth);
+			if (it == levels.end()) throw QuarkIndentationError("inconsistent indentation");
+			size_t keep = static_cast<size_t>(it - levels.begin()) + 1;
+			for (size_t i = keep; i < levels.size(); i++) emit(out, TokenKind::DEDENT, offset, 0, lineNo);
+			levels.resize(keep);
+		}
+	}
+
+	emit(out, kind, offset, length, lineNo);
+}
+
+void QuarkLexer::reset() {
+	position = 0;
+	base = 0;
+	lineNo = 1;
+	parenCount = 0;
+	atLineStart = true;
+	indent = NoIndent;
+	levels.assign(1, 0);
+	depth = 0;
+	prevWasWs = false;
+	lastRawOffset = 0;
+	lastRawLine = 1;
+}
+
+void QuarkLexer::tokenize(TokenBuffer& out, bool addEndMarker) {
+	out.source = source;
+	out.tokens.reserve(out.tokens.size() + source.size() / 3 + 8);
+
+	reset();
+	scan(out, false);
+
+	// Must dedent any remaining levels
+	for (size_t i = 1; i < levels.size(); i++) emit(out, TokenKind::DEDENT, lastRawOffset, 0, lastRawLine);
+	levels.resize(1);
+
+	if (addEndMarker)
+	{
+		if (out.tokens.empty()) emit(out, TokenKind::EndMarker, 0, 0, 1);
+		else emit(out, TokenKind::EndMarker, out.tokens.back().offset, 0, out.tokens.back().lineNo);
+	}
+	out.account();
+}
+
+void QuarkLexer::tokenizeParallel(TokenBuffer& out, ThreadPool& pool, bool addEndMarker) {
+	// Cuts near every size / count bytes, with the end of the source last
+	std::vector<size_t> cuts{ 0 };
+	size_t count = std::min<size_t>(pool.size() * 4, source.size() / LexPieceBytes);
+	if (pool.size() > 1 && source.size() >= ParallelLexBytes)
+	{
+		for (size_t i = 1; i < count; i++)
+		{
+			size_t cut = nextCut(source, std::max(source.size() / count * i, cuts.back()));
+			if (cut == std::string_view::npos) break;
+			cuts.push_back(cut);
+		}
+	}
+	cuts.push_back(source.size());
+	if (cuts.size() < 3)
+	{
+		tokenize(out, addEndMarker);
+		return;
+	}
+
+	struct Piece
+	{
+		explicit Piece(std::string_view text) : lexer(text) {}
+
+		QuarkLexer lexer;
+		TokenBuffer out;
+		// Lexed without error and, but for the last piece, ended in the state
+		// a fresh lexer starts the next one in
+		bool joins = false;
+	};
+	std::vector<Piece> pieces;
+	pieces.reserve(cuts.size() - 1);
+	for (size_t i = 0; i + 1 < cuts.size(); i++) pieces.emplace_back(source.substr(cuts[i], cuts[i + 1] - cuts[i]));
+
+	TaskGroup group(pool);
+	for (size_t i = 0; i < pieces.size(); i++)
+	{
+		bool last = i + 1 == pieces.size();
+		group.run([&piece = pieces[i], last] {
+			QuarkLexer& lexer = piece.lexer;
+			piece.out.source = lexer.source;
+			piece.out.tokens.reserve(lexer.source.size() / 3 + 8);
+			try
+			{
+				lexer.reset();
+				lexer.scan(piece.out, false);
+				piece.out.account();
+			}
+			catch (const QuarkIndentationError&)
+			{
+				return;
+			}
+
+			if (last)
+			{
+				for (size_t j = 1; j < lexer.levels.size(); j++)
+					lexer.emit(piece.out, TokenKind::DEDENT, lexer.lastRawOffset, 0, lexer.lastRawLine);
+				piece.joins = true;
+				return;
+			}
+
+			// The first token of the next piece closes the blocks still open,
+			// as it would in one pass
+			uint32_t end = static_cast<uint32_t>(lexer.source.size());
+			for (size_t j = 1; j < lexer.levels.size(); j++) lexer.emit(piece.out, TokenKind::DEDENT, end, 0, lexer.lineNo);
+			piece.joins = lexer.parenCount == 0 && lexer.indent != MustIndent;
+		});
+	}
+	group.wait();
+	if (!std::all_of(pieces.begin(), pieces.end(), [](const Piece& piece) { return piece.joins; }))
+	{
+		tokenize(out, addEndMarker);
+		return;
+	}
+
+	std::vector<size_t> firstToken(pieces.size());
+	std::vector<int32_t> firstLine(pieces.size());
+	size_t total = out.tokens.size();
+	int32_t lines = 0;
+	for (size_t i = 0; i < pieces.size(); i++)
+	{
+		firstToken[i] = total;
+		firstLine[i] = lines;
+		total += pieces[i].out.size();
+		lines += pieces[i].lexer.lineNo - 1;
+	}
+
+	out.source = source;
+	out.tokens.resize(total);
+	for (size_t i = 0; i < pieces.size(); i++)
+	{
+		group.run([&, i] {
+			uint32_t offset = static_cast<uint32_t>(cuts[i]);
+			LexToken* to = out.tokens.data() + firstToken[i];
+			for (const LexToken& tok : pieces[i].out.tokens)
+				*to++ = LexToken{ tok.kind, tok.offset + offset, tok.length, tok.lineNo + firstLine[i] };
+		});
+	}
+	group.wait();
+
+	for (Piece& piece : pieces)
+		for (std::string& message : piece.out.diagnostics) out.diagnostics.push_back(std::move(message));
+
+	if (addEndMarker) emit(out, TokenKind::EndMarker, out.tokens.back().offset, 0, out.tokens.back().lineNo);
+	out.account();
+}
+
+bool QuarkLexer::tokenizeItem(TokenBuffer& out) {
+	// Levels only go empty before the first item
+	if (levels.empty()) reset();
+	base = position;
+	out.source = source.substr(base);
+	out.origin = base;
+	out.tokens.clear();
+
+	scan(out, true);
+	if (position == source.size())
+	{
+		for (size_t i = 1; i < levels.size(); i++) emit(out, TokenKind::DEDENT, lastRawOffset, 0, lastRawLine);
+		levels.resize(1);
+	}
+	if (out.tokens.empty()) return false;
+	emit(out, TokenKind::EndMarker, out.tokens.back().offset, 0, out.tokens.back().lineNo);
+	out.account();
+	return true;
+}
+
+void QuarkLexer::scan(TokenBuffer& out, bool oneItem) {
+	const char* begin = source.data() + base;
+	const char* end = source.data() + source.size();
+	const char* p = source.data() + position;
+
+	// Hand-written DFA over the lex_grammar rules. PLY tries function rules
+	// first (ID, FLOAT, INT, LPAR, RPAR, WS, newline), then string rules from
+	// the longest regex down, which is why "<=" beats "<", "//" beats "/" and
+	// a complete string literal beats a lone '"'.
+	while (p < end)
+	{
+		const char* start = p;
+		uint32_t offset = static_cast<uint32_t>(start - begin);
+
+		// A token at the very start of a line, outside any block, begins the
+		// next item. A function body that ends here is closed in this one.
+		if (oneItem && atLineStart && depth == 0 && parenCount == 0 && indent != MustIndent && !out.tokens.empty()
+			&& startsToken(p, end))
+		{
+			for (size_t i = 1; i < levels.size(); i++) emit(out, TokenKind::DEDENT, offset, 0, lineNo);
+			levels.resize(1);
+			break;
+		}
+		auto raw = [&](TokenKind kind, const char* stop) {
+			p = stop;
+			emitRaw(out, kind, offset, static_cast<uint32_t>(stop - start));
+		};
+
+		switch (classOf(*p))
+		{
+		case Alpha:
+		{
+			const char* stop = scanIdentifier(p + 1, end);
+			raw(reservedKind(std::string_view(start, static_cast<size_t>(stop - start))), stop);
+			continue;
+		}
+		case Digit:
+		{
+			const char* stop = scanDigits(p, end);
+			if (stop < end && *stop == '.') raw(TokenKind::FLOAT, scanDigits(stop + 1, end));
+			else raw(TokenKind::INT, stop);
+			continue;
+		}
+		case Space:
+			p = scanRun(p, end, ' ');
+			if (atLineStart && parenCount == 0) emitRaw(out, TokenKind::WS, offset, static_cast<uint32_t>(p - start));
+			continue;
+		case Newline:
+			p = scanRun(p, end, '\n');
+			if (parenCount == 0) emitRaw(out, TokenKind::NEWLINE, offset, static_cast<uint32_t>(p - start));
+			lineNo += static_cast<int32_t>(p - start);
+			continue;
+		default:
+			break;
+		}
+
+		char next = p + 1 < end ? p[1] : '\0';
+		switch (*p)
+		{
+		case '.':
+			if (classOf(next) == Digit) raw(TokenKind::FLOAT, scanDigits(p + 1, end));
+			else raw(TokenKind::DOT, p + 1);
+			break;
+		case '(':
+			parenCount++;
+			raw(TokenKind::LPAR, p + 1);
+			break;
+		case ')':
+			// check for underflow?  should be the job of the parser
+			parenCount--;
+			raw(TokenKind::RPAR, p + 1);
+			break;
+		case '"':
+		{
+			const char* close = p + 1;
+			while (close < end && *close != '"' && *close != '\n') ++close;
+			if (close < end && *close == '"') raw(TokenKind::STR, close + 1);
+			else raw(TokenKind::DQUOTES, p + 1);
+			break;
+		}
+		case '/':
+			if (next == '/')
+			{
+				// t_ignore_COMMENT
+				const char* eol = static_cast<const char*>(std::memchr(p, '\n', static_cast<size_t>(end - p)));
+				p = eol ? eol : end;
+			}
+			else raw(TokenKind::DIVIDE, p + 1);
+			break;
+		case '<': raw(next == '=' ? TokenKind::LTE : TokenKind::LT, p + (next == '=' ? 2 : 1)); break;
+		case '>': raw(next == '=' ? TokenKind::GTE : TokenKind::GT, p + (next == '=' ? 2 : 1)); break;
+		case '=': raw(next == '=' ? TokenKind::DEQ : TokenKind::EQUALS, p + (next == '=' ? 2 : 1)); break;
+		case '+': raw(TokenKind::PLUS, p + 1); break;
+		case '-': raw(TokenKind::MINUS, p + 1); break;
+		case '*': raw(TokenKind::MULTIPLY, p + 1); break;
+		case '%': raw(TokenKind::MODULO, p + 1); break;
+		case '&': raw(TokenKind::AMPER, p + 1); break;
+		case '~': raw(TokenKind::NOT, p + 1); break;
+		case '[': raw(TokenKind::LBRACE, p + 1); break;
+		case ']': raw(TokenKind::RBRACE, p + 1); break;
+		case ',': raw(TokenKind::COMMA, p + 1); break;
+		case '\'': raw(TokenKind::QUOTES, p + 1); break;
+		case '|': raw(TokenKind::PIPE, p + 1); break;
+		case ':': raw(TokenKind::COLON, p + 1); break;
+		case '@': raw(TokenKind::AT, p + 1); break;
+		case '!':
+			if (next == '=')
+			{
+				raw(TokenKind::NE, p + 2);
+				break;
+			}
+			[[fallthrough]];
+		default:
+			out.diagnostics.push_back(std::string("Illegal Character: '") + *p + "'");
+			p++;
+			break;
+		}
+	}
+
+	position = static_cast<size_t>(p - source.data());
+}
@@ -0,0 +1,2037 @@
+#include "include/lowering.h"
+
+#include <exception>
+#include <utility>
+#include "include/profile.h"
+#include "include/runtime.h"
+#include "include/visitor.h"
+
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/DIBuilder.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/MDBuilder.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Target/TargetMachine.h>
+
+namespace {
+
+std::string str(std::string_view text) {
+	return std::string(text);
+}
+
+bool isList(ValueKind kind) {
+	return kind == ValueKind::IntList || kind == ValueKind::FloatList;
+}
+
+// Kind of a list's elements; a scalar is its own element
+ValueKind elementKind(ValueKind kind) {
+	if (kind == ValueKind::IntList) return ValueKind::Int;
+	if (kind == ValueKind::FloatList) return ValueKind::Float;
+	return kind;
+}
+
+// As site names spell operand kinds
+const char* kindString(ValueKind kind) {
+	static const char* const names[] = { "None", "Int", "Float", "IntList", "FloatList" };
+	return names[static_cast<size_t>(kind)];
+}
+
+ValueKind listKind(ValueKind element) {
+	return element == ValueKind::Float ? ValueKind::FloatList : ValueKind::IntList;
+}
+
+// Elements promote as scalars do, and a list with anything is a list
+ValueKind promotedKind(ValueKind lhs, ValueKind rhs) {
+	ValueKind element = (elementKind(lhs) == ValueKind::Float || elementKind(rhs) == ValueKind::Float) ? ValueKind::Float : ValueKind::Int;
+	return isList(lhs) || isList(rhs) ? listKind(element) : element;
+}
+
+bool isArithmetic(TokenKind kind) {
+	return kind == TokenKind::PLUS || kind == TokenKind::MINUS || kind == TokenKind::MULTIPLY || kind == TokenKind::DIVIDE;
+}
+
+bool isAssignment(NodeRef node) {
+	return node.type() == Operator && node.kind() == TokenKind::EQUALS && node.childCount() == 2;
+}
+
+bool isSubscript(NodeRef node) {
+	return node.type() == Operator && node.kind() == TokenKind::LBRACE && node.childCount() == 2;
+}
+
+// The list runtime's functions, called with @ like the program's own. A
+// function the program defines takes precedence over the builtin of that
+// name. The comparisons are in ListCompare order.
+enum class Builtin
+{
+	Len,
+	Sum,
+	Min,
+	Max,
+	Range,
+	Filter,
+	Lt,
+	Le,
+	Gt,
+	Ge,
+	Eq,
+	Ne,
+};
+
+struct BuiltinFunction
+{
+	std::string_view name;
+	Builtin builtin;
+	uint32_t arity;
+};
+
+constexpr BuiltinFunction Builtins[] = {
+	{ "len", Builtin::Len, 1 },
+	{ "sum", Builtin::Sum, 1 },
+	{ "min", Builtin::Min, 1 },
+	{ "max", Builtin::Max, 1 },
+	{ "range", Builtin::Range, 1 },
+	{ "filter", Builtin::Filter, 2 },
+	{ "lt", Builtin::Lt, 2 },
+	{ "le", Builtin::Le, 2 },
+	{ "gt", Builtin::Gt, 2 },
+	{ "ge", Builtin::Ge, 2 },
+	{ "eq", Builtin::Eq, 2 },
+	{ "ne", Builtin::Ne, 2 },
+};
+
+const BuiltinFunction* builtin(std::string_view name) {
+	for (const BuiltinFunction& function : Builtins)
+		if (function.name == name) return &function;
+	return nullptr;
+}
+
+// What a builtin returns for arguments of the given kinds, none of which is
+// None. Comparisons give 0 or 1, element-wise when either side is a list.
+ValueKind builtinKind(const BuiltinFunction& function, const std::vector<ValueKind>& args) {
+	auto takes = [&](const char* what) {
+		return QuarkCodegenError("'" + str(function.name) + "' takes " + what);
+	};
+
+	switch (function.builtin)
+	{
+	case Builtin::Len:
+		if (!isList(args[0])) throw takes("a list");
+		return ValueKind::Int;
+	case Builtin::Sum:
+	case Builtin::Min:
+	case Builtin::Max:
+		if (!isList(args[0])) throw takes("a list");
+		return elementKind(args[0]);
+	case Builtin::Range:
+		if (args[0] != ValueKind::Int) throw takes("an Int");
+		return ValueKind::IntList;
+	case Builtin::Filter:
+		if (!isList(args[0]) || args[1] != ValueKind::IntList) throw takes("a list and an Int list");
+		return args[0];
+	default:
+		return isList(args[0]) || isList(args[1]) ? ValueKind::IntList : ValueKind::Int;
+	}
+}
+
+ListCompare listCompare(Builtin builtin) {
+	return static_cast<ListCompare>(static_cast<int>(builtin) - static_cast<int>(Builtin::Lt));
+}
+
+// The comparison that holds with the operands the other way round
+ListCompare swapped(ListCompare compare) {
+	switch (compare)
+	{
+	case ListCompare::Lt: return ListCompare::Gt;
+	case ListCompare::Le: return ListCompare::Ge;
+	case ListCompare::Gt: return ListCompare::Lt;
+	case ListCompare::Ge: return ListCompare::Le;
+	default: return compare;
+	}
+}
+
+bool isRange(std::string_view name) {
+	return builtin(name) && builtin(name)->builtin == Builtin::Range;
+}
+
+// What a pipe stage does. Maps and filters, up to and including the
+// reduction that may end them, run in one loop over the piped list with no
+// list in between; any other stage is a call that gets the piped value as
+// its first argument.
+enum class Stage
+{
+	Call,
+	Map,
+	Filter,
+	Reduce,
+	Sum,
+	Min,
+	Max,
+	Len,
+};
+
+bool isReduction(Stage stage) {
+	return stage >= Stage::Reduce;
+}
+
+bool isFunction(const ModulePlan& plan, NodeRef node) {
+	return node.type() == Identifier && plan.definition(node.tok().value);
+}
+
+// A definition of the stage's name is called, as @name would be. Filter
+// with a function is the stage, with a mask the builtin.
+Stage stageOf(const ModulePlan& plan, NodeRef stage) {
+	NodeRef name = stage.child(0);
+	NodeRef args = stage.child(1);
+	if (plan.definition(name.tok().value)) return Stage::Call;
+	if (name.value() == "map") return Stage::Map;
+	if (name.value() == "reduce") return Stage::Reduce;
+	if (name.value() == "filter") return args.childCount() && isFunction(plan, args.child(0)) ? Stage::Filter : Stage::Call;
+	if (args.childCount() || !builtin(name.value())) return Stage::Call;
+
+	switch (builtin(name.value())->builtin)
+	{
+	case Builtin::Sum: return Stage::Sum;
+	case Builtin::Min: return Stage::Min;
+	case Builtin::Max: return Stage::Max;
+	case Builtin::Len: return Stage::Len;
+	default: return Stage::Call;
+	}
+}
+
+// The target of an assignment and the name in a call are not evaluated
+bool isValue(NodeRef node, uint32_t child) {
+	return child != 0 || !(isAssignment(node) || node.type() == FunctionCall);
+}
+
+// Infers the types the units agree on. Mirrors the typing rules of
+// UnitLowering without emitting anything: each node leaves its kind on a
+// stack, where its parent picks it up.
+class Planner : public AstVisitor<Planner>
+{
+public:
+	explicit Planner(ModulePlan& plan) : AstVisitor(plan.root.tree()), plan(plan) {}
+
+	void run()
+	{
+		collect();
+		typeStatements();
+		if (lastIsFunction) plan.resultKind = ValueKind::None;
+		instantiateUncalled();
+	}
+
+	void define(NodeRef function)
+	{
+		FunctionDefinition definition;
+		definition.node = function;
+		definition.name = function.child(0).tok().value;
+		for (NodeRef param : function.child(1).children())
+		{
+			if (param.type() != Identifier)
+				throw located(function, "Parameters of '" + str(function.child(0).value()) + "' must be identifiers");
+			definition.params.push_back(param.tok().value);
+		}
+
+		if (!plan.definitionIndex.emplace(definition.name, plan.definitions.size()).second)
+			throw located(function, "Function '" + str(function.child(0).value()) + "' is defined twice");
+		plan.definitions.push_back(std::move(definition));
+		called.push_back(false);
+	}
+
+	// Globals are typed in program order; a function is instantiated at its
+	// first call, so it already sees the globals assigned before that call
+	void typeStatements()
+	{
+		locatedError = false;
+		ValueKind last = ValueKind::None;
+		for (NodeRef statement : plan.statements) last = kindOf(statement, nullptr, 0);
+		plan.resultKind = last;
+	}
+
+	// Uncalled functions are still compiled, and checked, as they were
+	// before call sites decided the parameter types
+	void instantiateUncalled()
+	{
+		locatedError = false;
+		for (size_t i = 0; i < plan.definitions.size(); i++)
+		{
+			const FunctionDefinition& definition = plan.definitions[i];
+			if (called[i]) continue;
+			try
+			{
+				instantiate(i, std::vector<ValueKind>(definition.params.size(), ValueKind::Int));
+			}
+			catch (const QuarkCodegenError& error)
+			{
+				rethrowAt(definition.node, error);
+			}
+		}
+	}
+
+private:
+	friend class AstVisitor<Planner>;
+
+	using Scope = std::unordered_map<SymbolId, ValueKind>;
+
+	enum class State
+	{
+		Resolving,
+		Resolved,
+	};
+
+	ModulePlan& plan;
+	std::vector<bool> called;				// per definition
+	std::vector<State> states;				// per instance
+	std::vector<bool> calledWhileResolving;	// per instance
+	bool lastIsFunction = false;
+
+	// What the walk in progress sees: the locals of the instance being typed,
+	// null at the top level, and its unit
+	Scope* locals = nullptr;
+	size_t unit = 0;
+	std::vector<ValueKind> values;
+
+	// The line each open Block is typing, innermost last, and whether the
+	// error in flight already says where it happened
+	std::vector<NodeRef> lines;
+	bool locatedError = false;
+
+	void collect()
+	{
+		// Both front ends wrap the top-level lines in one Block
+		std::vector<NodeRef> top;
+		for (NodeRef child : plan.root.children())
+		{
+			if (child.type() != Block) top.push_back(child);
+			else for (NodeRef statement : child.children()) top.push_back(statement);
+		}
+
+		for (NodeRef statement : top)
+		{
+			lastIsFunction = statement.type() == Function;
+			if (lastIsFunction) define(statement);
+			else plan.statements.push_back(statement);
+		}
+	}
+
+	// The planner numbers units from the first instance on, whichever
+	// segment of a stream the instance is in
+	CallTargets& calls(size_t unit)
+	{
+		return unit == 0 ? plan.mainCalls : plan.functions[unit - 1].calls;
+	}
+
+	// Index of the instance of definition for paramKinds, typed on first use
+	size_t instantiate(size_t definitionIndex, const std::vector<ValueKind>& paramKinds)
+	{
+		const FunctionDefinition& definition = plan.definitions[definitionIndex];
+		called[definitionIndex] = true;
+
+		auto key = std::make_pair(definition.name, paramKinds);
+		auto it = plan.instanceIndex.find(key);
+		if (it != plan.instanceIndex.end())
+		{
+			// A recursive call sees the return type assumed so far
+			if (states[it->second] == State::Resolving) calledWhileResolving[it->second] = true;
+			return it->second;
+		}
+
+		size_t index = plan.functions.size();
+		plan.instanceIndex.emplace(key, index);
+		FunctionPlan instance;
+		instance.name = definition.name;
+		instance.node = definition.node;
+		instance.params = definition.params;
+		instance.paramKinds = paramKinds;
+		instance.linkName = symbolName(plan.spelling(definition.name), paramKinds);
+		plan.functions.push_back(std::move(instance));
+		states.push_back(State::Resolving);
+		calledWhileResolving.push_back(false);
+
+		// Recursion is solved by assuming a return type and checking the body
+		// agrees. Int is tried first; instances typed under a rejected
+		// assumption are dropped and typed again.
+		std::exception_ptr firstError;
+		for (ValueKind assumed : { ValueKind::Int, ValueKind::Float })
+		{
+			discardAfter(index);
+			plan.functions[index].returnKind = assumed;
+			plan.functions[index].calls.clear();
+			calledWhileResolving[index] = false;
+
+			Scope scope;
+			for (size_t i = 0; i < paramKinds.size(); i++) scope[definition.params[i]] = paramKinds[i];
+
+			ValueKind kind;
+			try
+			{
+				kind = kindOf(definition.node.child(2), &scope, index + 1);
+			}
+			catch (const QuarkCodegenError&)
+			{
+				if (!calledWhileResolving[index]) throw;
+				if (!firstError) firstError = std::current_exception();
+				locatedError = false;
+				continue;
+			}
+
+			if (!calledWhileResolving[index] || kind == assumed)
+			{
+				plan.functions[index].returnKind = kind;
+				states[index] = State::Resolved;
+				return index;
+			}
+		}
+
+		if (firstError)
+		{
+			locatedError = true;
+			std::rethrow_exception(firstError);
+		}
+		throw QuarkCodegenError("Recursive function '" + str(plan.spelling(definition.name)) + "' has no consistent return type");
+	}
+
+	void discardAfter(size_t index)
+	{
+		if (plan.functions.size() == index + 1) return;
+		for (auto it = plan.instanceIndex.begin(); it != plan.instanceIndex.end();)
+		{
+			if (it->second > index) it = plan.instanceIndex.erase(it);
+			else ++it;
+		}
+		plan.functions.resize(index + 1);
+		states.resize(index + 1);
+		calledWhileResolving.resize(index + 1);
+	}
+
+	// Kind of the value of the subtree at node, typed with the given locals as
+	// part of unit. Calls instantiate their callees on the way, which types
+	// the callee bodies in nested walks.
+	ValueKind kindOf(NodeRef node, Scope* scope, size_t in)
+	{
+		Scope* outerLocals = std::exchange(locals, scope);
+		size_t outerUnit = std::exchange(unit, in);
+		size_t mark = values.size();
+		size_t lineMark = lines.size();
+		auto restore = [&] {
+			values.resize(mark);
+			lines.resize(lineMark);
+			locals = outerLocals;
+			unit = outerUnit;
+		};
+
+		try
+		{
+			walk(node.id());
+		}
+		catch (const QuarkCodegenError& error)
+		{
+			NodeRef at = lines.size() > lineMark && lines.back().valid() ? lines.back() : node;
+			restore();
+			rethrowAt(at, error);
+		}
+		catch (...)
+		{
+			restore();
+			throw;
+		}
+		ValueKind kind = values.back();
+		restore();
+		return kind;
+	}
+
+	ValueKind pop()
+	{
+		ValueKind kind = values.back();
+		values.pop_back();
+		return kind;
+	}
+
+	// "file:line:column: what" with where the subtree at node starts
+	QuarkCodegenError located(NodeRef node, const std::string& what) const
+	{
+		std::string where = node.tree().sources().describe(node.tree().startLoc(node.id()));
+		return QuarkCodegenError(where.empty() ? what : where + ": " + what);
+	}
+
+	// Rethrows the error being handled located at node, unless a walk nested
+	// deeper, which knows the line better, has located it already
+	[[noreturn]] void rethrowAt(NodeRef node, const QuarkCodegenError& error)
+	{
+		if (locatedError) throw;
+		locatedError = true;
+		throw located(node, error.what());
+	}
+
+	// Only the piped value; leavePipe types the stages
+	bool descend(NodeRef node, uint32_t child)
+	{
+		if (node.type() == Block) lines.back() = node.child(child);
+		return node.type() == Pipe ? child == 0 : isValue(node, child);
+	}
+
+	bool enterFunction(NodeRef) { throw QuarkCodegenError("Functions can only be defined at the top level"); }
+
+	bool enterCondition(NodeRef node) { return unsupported(node); }
+
+	bool enterArguments(NodeRef node)
+	{
+		if (parent().type() != FunctionCall) return unsupported(node);
+		return true;
+	}
+
+	bool unsupported(NodeRef node)
+	{
+		throw QuarkCodegenError(std::string(nodeTypeString(node.type())) + " nodes are not supported by the native backend yet");
+	}
+
+	// A sequence has the value of its last child
+	void leaveCompilationUnit(NodeRef node) { sequence(node); }
+	void leaveBlock(NodeRef node)
+	{
+		lines.pop_back();
+		sequence(node);
+	}
+	void leaveStatement(NodeRef node) { sequence(node); }
+	void leaveExpression(NodeRef node) { sequence(node); }
+
+	bool enterBlock(NodeRef)
+	{
+		lines.emplace_back();
+		return true;
+	}
+
+	void sequence(NodeRef node)
+	{
+		ValueKind last = node.childCount() ? values.back() : ValueKind::None;
+		values.resize(values.size() - node.childCount());
+		values.push_back(last);
+	}
+
+	void leaveLiteral(NodeRef node)
+	{
+		if (node.kind() == TokenKind::INT) values.push_back(ValueKind::Int);
+		else if (node.kind() == TokenKind::FLOAT) values.push_back(ValueKind::Float);
+		else throw QuarkCodegenError(std::string(tokenKindString(node.kind())) + " literals are not supported by the native backend yet");
+	}
+
+	// A Float element makes a Float list, ints in it included; [] is an Int list
+	void leaveList(NodeRef node)
+	{
+		ValueKind element = ValueKind::Int;
+		for (auto it = values.end() - node.childCount(); it != values.end(); ++it)
+		{
+			if (*it == ValueKind::None) throw QuarkCodegenError("List element has no value");
+			if (isList(*it)) throw QuarkCodegenError("List elements must be numbers");
+			if (*it == ValueKind::Float) element = ValueKind::Float;
+		}
+		values.resize(values.size() - node.childCount());
+		values.push_back(listKind(element));
+	}
+
+	void leaveIdentifier(NodeRef node)
+	{
+		SymbolId name = node.tok().value;
+		if (locals)
+		{
+			auto it = locals->find(name);
+			if (it != locals->end())
+			{
+				values.push_back(it->second);
+				return;
+			}
+		}
+		if (const GlobalPlan* global = plan.global(name))
+		{
+			values.push_back(global->kind);
+			return;
+		}
+		if (plan.definition(name)) throw QuarkCodegenError("Function '" + str(node.value()) + "' can only be called with @");
+		throw QuarkCodegenError("Undefined identifier '" + str(node.value()) + "'");
+	}
+
+	// Operators and targets are checked before their operands are typed
+	bool enterOperator(NodeRef node)
+	{
+		if (node.childCount() == 1)
+		{
+			if (node.kind() != TokenKind::MINUS)
+				throw QuarkCodegenError(std::string("Unsupported unary operator ") + tokenKindString(node.kind()));
+			return true;
+		}
+
+		if (isAssignment(node))
+		{
+			NodeRef target = node.child(0);
+			if (target.type() != Identifier) throw QuarkCodegenError("Can only assign to an identifier");
+			if (plan.definition(target.tok().value)) throw QuarkCodegenError("Cannot assign to function '" + str(target.value()) + "'");
+			return true;
+		}
+
+		if (isSubscript(node)) return true;
+		if (!isArithmetic(node.kind()))
+			throw QuarkCodegenError(std::string("Unsupported binary operator ") + tokenKindString(node.kind()));
+		return true;
+	}
+
+	void leaveOperator(NodeRef node)
+	{
+		if (isAssignment(node))
+		{
+			assign(node);
+			return;
+		}
+
+		if (node.childCount() == 1)
+		{
+			if (values.back() == ValueKind::None) throw QuarkCodegenError("Operand of an arithmetic operator has no value");
+			return;
+		}
+
+		ValueKind rhs = pop();
+		ValueKind lhs = pop();
+		if (isSubscript(node))
+		{
+			if (!isList(lhs)) throw QuarkCodegenError("Only lists can be indexed");
+			if (rhs != ValueKind::Int) throw QuarkCodegenError("List index must be an Int");
+			values.push_back(elementKind(lhs));
+			return;
+		}
+
+		if (lhs == ValueKind::None || rhs == ValueKind::None)
+			throw QuarkCodegenError("Operand of an arithmetic operator has no value");
+		values.push_back(promotedKind(lhs, rhs));
+	}
+
+	void assign(NodeRef node)
+	{
+		NodeRef target = node.child(0);
+		SymbolId name = target.tok().value;
+		ValueKind kind = values.back();
+		if (kind == ValueKind::None) throw QuarkCodegenError("Cannot assign a statement without a value");
+
+		// Inside a function an assignment always creates or updates a local
+		ValueKind previous = ValueKind::None;
+		if (locals)
+		{
+			previous = locals->emplace(name, kind).first->second;
+		}
+		else if (const GlobalPlan* global = plan.global(name))
+		{
+			previous = global->kind;
+		}
+		else
+		{
+			plan.globalIndex.emplace(name, plan.globals.size());
+			plan.globals.push_back(GlobalPlan{ name, kind });
+			previous = kind;
+		}
+
+		if (previous != kind) throw QuarkCodegenError("Cannot change the type of '" + str(target.value()) + "' by assignment");
+	}
+
+	bool enterFunctionCall(NodeRef node)
+	{
+		checkArity(node.child(0), node.child(1).childCount());
+		return true;
+	}
+
+	void leaveFunctionCall(NodeRef node)
+	{
+		uint32_t count = node.child(1).childCount();
+		std::vector<ValueKind> argKinds(values.end() - count, values.end());
+		values.resize(values.size() - count);
+		values.push_back(call(node, argKinds));
+	}
+
+	void checkArity(NodeRef callee, size_t given)
+	{
+		size_t paramCount;
+		if (const FunctionDefinition* definition = plan.definition(callee.tok().value)) paramCount = definition->params.size();
+		else if (const BuiltinFunction* function = builtin(callee.value())) paramCount = function->arity;
+		else throw QuarkCodegenError("Call to undefined function '" + str(callee.value()) + "'");
+
+		if (given != paramCount)
+		{
+			throw QuarkCodegenError("'" + str(callee.value()) + "' takes " + std::to_string(paramCount)
+				+ " arguments but " + std::to_string(given) + " were given");
+		}
+	}
+
+	void checkValues(NodeRef callee, const std::vector<ValueKind>& argKinds)
+	{
+		for (size_t i = 0; i < argKinds.size(); i++)
+		{
+			if (argKinds[i] == ValueKind::None)
+				throw QuarkCodegenError("Argument " + std::to_string(i + 1) + " of '" + str(callee.value()) + "' has no value");
+		}
+	}
+
+	// Kind of what the call at node returns, its callee being node's first child
+	ValueKind call(NodeRef node, const std::vector<ValueKind>& argKinds)
+	{
+		NodeRef callee = node.child(0);
+		if (plan.definition(callee.tok().value)) return callFunction(node, callee, argKinds);
+
+		checkValues(callee, argKinds);
+		return builtinKind(*builtin(callee.value()), argKinds);
+	}
+
+	// Instantiates the function named by callee for the argument kinds, as the
+	// one node calls, and types it now if this signature is new
+	ValueKind callFunction(NodeRef node, NodeRef callee, const std::vector<ValueKind>& argKinds)
+	{
+		checkValues(callee, argKinds);
+		size_t index = instantiate(plan.definitionIndex.at(callee.tok().value), argKinds);
+		calls(unit)[node.id()] = static_cast<uint32_t>(index);
+		return plan.functions[index].returnKind;
+	}
+
+	// The piped value goes from stage to stage, as the element kind for as
+	// long as the stages loop over a list
+	void leavePipe(NodeRef node)
+	{
+		ValueKind value = pop();
+		if (value == ValueKind::None) throw QuarkCodegenError("Piped expression has no value");
+
+		bool looping = false;
+		for (uint32_t i = 1; i < node.childCount(); i++)
+		{
+			NodeRef stage = node.child(i);
+			NodeRef name = stage.child(0);
+			NodeRef args = stage.child(1);
+			Stage kind = stageOf(plan, stage);
+			if (kind == Stage::Call)
+			{
+				checkArity(name, args.childCount() + 1);
+				std::vector<ValueKind> argKinds{ looping ? listKind(value) : value };
+				for (NodeRef arg : args.children()) argKinds.push_back(kindOf(arg, locals, unit));
+				value = call(stage, argKinds);
+				looping = false;
+				continue;
+			}
+
+			if (!looping)
+			{
+				if (!isList(value)) throw QuarkCodegenError("Only lists can be piped into '" + str(name.value()) + "'");
+				value = elementKind(value);
+				looping = true;
+			}
+
+			switch (kind)
+			{
+			case Stage::Map:
+				value = apply(stage, { value }, 1);
+				break;
+			case Stage::Filter:
+				apply(stage, { value }, 1);
+				break;
+			case Stage::Reduce:
+			{
+				if (args.childCount() < 2 || !isFunction(plan, args.child(0)))
+					throw QuarkCodegenError("'reduce' takes the name of a function and a starting value");
+				ValueKind start = kindOf(args.child(1), locals, unit);
+				if (start != ValueKind::Int && start != ValueKind::Float)
+					throw QuarkCodegenError("Starting value of 'reduce' must be a number");
+				if (apply(stage, { start, value }, 2) != start && start == ValueKind::Int)
+				{
+					throw QuarkCodegenError("'" + str(args.child(0).value())
+						+ "' makes a Float of the Int that 'reduce' starts from; start from a Float");
+				}
+				value = start;
+				break;
+			}
+			case Stage::Len:
+				value = ValueKind::Int;
+				break;
+			default:
+				break;
+			}
+			looping = !isReduction(kind);
+		}
+		values.push_back(looping ? listKind(value) : value);
+	}
+
+	// Types the call a map, filter or reduce stage makes per element: to the
+	// function its first argument names, with the given leading arguments and
+	// then the stage's own from index first on. The function must give a
+	// number.
+	ValueKind apply(NodeRef stage, std::vector<ValueKind> argKinds, uint32_t first)
+	{
+		NodeRef name = stage.child(0);
+		NodeRef args = stage.child(1);
+		if (!args.childCount() || !isFunction(plan, args.child(0)))
+			throw QuarkCodegenError("'" + str(name.value()) + "' takes the name of a function");
+
+		NodeRef function = args.child(0);
+		checkArity(function, argKinds.size() + args.childCount() - first);
+		for (uint32_t i = first; i < args.childCount(); i++) argKinds.push_back(kindOf(args.child(i), locals, unit));
+
+		ValueKind result = callFunction(stage, function, argKinds);
+		if (result != ValueKind::Int && result != ValueKind::Float)
+			throw QuarkCodegenError("'" + str(function.value()) + "' must return a number to be used by '" + str(name.value()) + "'");
+		return result;
+	}
+};
+
+struct TypedValue
+{
+	llvm::Value* value = nullptr;
+	ValueKind kind = ValueKind::None;
+};
+
+// Lowers one codegen unit. Other units' functions and globals are declared
+// on first use and resolved when the modules are linked or JIT-loaded.
+// Instructions are emitted in post-order, which is evaluation order, with
+// operand values passed up on a stack.
+class UnitLowering : public AstVisitor<UnitLowering>
+{
+public:
+	UnitLowering(const ModulePlan& plan, size_t unit, llvm::LLVMContext& context, const llvm::TargetMachine& targetMachine)
+		: AstVisitor(plan.root.tree()), plan(plan), unit(unit), ctx(context), builder(context), sharing(plan.root.tree().hashConsing())
+	{
+		module = std::make_unique<llvm::Module>("quark", ctx);
+		module->setDataLayout(targetMachine.createDataLayout());
+		module->setTargetTriple(targetMachine.getTargetTriple().str());
+	}
+
+	std::unique_ptr<llvm::Module> main()
+	{
+		auto* entry = llvm::Function::Create(llvm::FunctionType::get(builder.getVoidTy(), false),
+			llvm::Function::ExternalLinkage, plan.entryName, module.get());
+		builder.SetInsertPoint(llvm::BasicBlock::Create(ctx, "entry", entry));
+		if (plan.debugInfo) debugFunction(entry, plan.statements.empty() ? NodeRef() : plan.statements.front());
+
+		// Every global is defined here, whichever unit assigns it first
+		for (size_t i = plan.firstGlobal; i < plan.globals.size(); i++) globalVariable(plan.globals[i]);
+
+		TypedValue last;
+		for (NodeRef statement : plan.statements)
+		{
+			at(statement);
+			last = lower(statement);
+		}
+		if (plan.resultKind != ValueKind::None)
+		{
+			// The JIT reads the value of the last statement back from here
+			auto* result = new llvm::GlobalVariable(*module, typeOf(plan.resultKind), false, llvm::GlobalValue::ExternalLinkage,
+				llvm::Constant::getNullValue(typeOf(plan.resultKind)), plan.resultName);
+			builder.CreateStore(last.value, result);
+		}
+		builder.CreateRetVoid();
+		return finish();
+	}
+
+	std::unique_ptr<llvm::Module> function(const FunctionPlan& signature)
+	{
+		llvm::Function* fn = declare(signature);
+		builder.SetInsertPoint(llvm::BasicBlock::Create(ctx, "entry", fn));
+		if (plan.debugInfo) debugFunction(fn, signature.node);
+		inFunction = true;
+		self = &signature;
+
+		for (size_t i = 0; i < signature.params.size(); i++)
+		{
+			llvm::Argument* arg = fn->getArg(static_cast<unsigned>(i));
+			arg->setName(str(plan.spelling(signature.params[i])));
+			builder.CreateStore(arg, local(signature.params[i], signature.paramKinds[i]));
+		}
+
+		// A self tail call stores the next arguments and branches back here
+		tailCall = findTailCall(signature.node.child(2));
+		if (tailCall != InvalidNode && &plan.callee(unit, NodeRef(&plan.root.tree(), tailCall)) == self)
+		{
+			selfLoop = llvm::BasicBlock::Create(ctx, "loop", fn);
+			builder.CreateBr(selfLoop);
+			builder.SetInsertPoint(selfLoop);
+		}
+
+		TypedValue last = lower(signature.node.child(2));
+		if (builder.GetInsertBlock()->getTerminator()) return finish();
+		if (signature.returnKind == ValueKind::None) builder.CreateRetVoid();
+		else builder.CreateRet(promote(last, signature.returnKind).value);
+		return finish();
+	}
+
+private:
+	friend class AstVisitor<UnitLowering>;
+
+	const ModulePlan& plan;
+	size_t unit;
+	llvm::LLVMContext& ctx;
+	llvm::IRBuilder<> builder;
+	std::unique_ptr<llvm::Module> module;
+	bool inFunction = false;
+
+	// In a function unit: the instance, the call its body ends in, if that
+	// returns what the instance does, and where the instance loops when that
+	// call is to itself
+	const FunctionPlan* self = nullptr;
+	NodeId tailCall = InvalidNode;
+	llvm::BasicBlock* selfLoop = nullptr;
+
+	// Function units keep assignments and parameters in entry-block allocas,
+	// which mem2reg turns back into SSA values
+	std::unordered_map<SymbolId, TypedValue> locals;
+	std::vector<TypedValue> values;
+
+	// On a hash-consed tree, the value each shared identifier and operator
+	// had when last lowered. It is reused where the node comes up again in the
+	// same block with no assignment in between, the only way a variable it
+	// reads can change; calls only assign their own locals.
+	struct Reusable
+	{
+		TypedValue value;
+		llvm::BasicBlock* block;
+		uint64_t stores;
+	};
+	bool sharing;
+	std::unordered_map<NodeId, Reusable> reusable;
+	uint64_t stores = 0;
+	NodeId reused = InvalidNode;
+
+	// With plan.siteCounters: a QuarkSiteRecord per dispatch site of the
+	// unit, and the Operator or FunctionCall node being lowered, at whose site
+	// runtime calls count
+	std::vector<llvm::Constant*> siteRecords;
+	NodeRef site;
+
+	// With plan.debugInfo: the unit's compile unit and the function being
+	// lowered, whose instructions take the location of their statement
+	std::unique_ptr<llvm::DIBuilder> debug;
+	llvm::DISubprogram* debugScope = nullptr;
+
+	// Makes fn a subprogram that starts where node does, creating the compile
+	// unit on the way. A unit is a single function from a single file.
+	void debugFunction(llvm::Function* fn, NodeRef node)
+	{
+		const SourceTable& sources = plan.root.tree().sources();
+		PresumedLoc where = node.valid() ? sources.resolve(node.tree().startLoc(node.id())) : PresumedLoc();
+
+		debug = std::make_unique<llvm::DIBuilder>(*module);
+		llvm::StringRef path(where.file.data(), where.file.size());
+		llvm::DIFile* file = debug->createFile(llvm::sys::path::filename(path), llvm::sys::path::parent_path(path));
+		debug->createCompileUnit(llvm::dwarf::DW_LANG_C, file, "quark", false, "", 0);
+		module->addModuleFlag(llvm::Module::Warning, "Debug Info Version", llvm::DEBUG_METADATA_VERSION);
+		module->addModuleFlag(llvm::Module::Warning, "Dwarf Version", 4);
+
+		llvm::DISubroutineType* type = debug->createSubroutineType(debug->getOrCreateTypeArray({}));
+		debugScope = debug->createFunction(file, fn->getName(), fn->getName(), file, where.line, type, where.line,
+			llvm::DINode::FlagPrototyped, llvm::DISubprogram::SPFlagDefinition);
+		fn->setSubprogram(debugScope);
+		builder.SetCurrentDebugLocation(llvm::DILocation::get(ctx, where.line, where.column, debugScope));
+	}
+
+	// Gives the instructions from here on the location of statement
+	void at(NodeRef statement)
+	{
+		if (!debugScope) return;
+		PresumedLoc where = plan.root.tree().sources().resolve(statement.tree().startLoc(statement.id()));
+		if (where.valid()) builder.SetCurrentDebugLocation(llvm::DILocation::get(ctx, where.line, where.column, debugScope));
+	}
+
+	std::unique_ptr<llvm::Module> finish()
+	{
+		if (debug) debug->finalize();
+		if (plan.siteCounters) siteTable();
+
+		std::string err;
+		llvm::raw_string_ostream os(err);
+		if (llvm::verifyModule(*module, &os)) throw QuarkCodegenError("Invalid module generated: " + os.str());
+		return std::move(module);
+	}
+
+	llvm::Type* typeOf(ValueKind kind)
+	{
+		// Every value is unboxed; the plan has already settled each type
+		switch (kind)
+		{
+		case ValueKind::Int: return llvm::Type::getInt64Ty(ctx);
+		case ValueKind::Float: return llvm::Type::getDoubleTy(ctx);
+		case ValueKind::IntList:
+		case ValueKind::FloatList: return llvm::Type::getInt8PtrTy(ctx);	// QuarkList*, only the runtime looks inside
+		default: return llvm::Type::getVoidTy(ctx);
+		}
+	}
+
+	llvm::GlobalVariable* globalVariable(const GlobalPlan& global)
+	{
+		std::string name = symbolName(plan.spelling(global.name));
+		if (llvm::GlobalVariable* existing = module->getGlobalVariable(name)) return existing;
+
+		// Unit 0 owns the definition, of the segment that added the global in a
+		// stream; everyone else gets an external declaration
+		bool owned = !inFunction && plan.globalIndex.at(global.name) >= plan.firstGlobal;
+		llvm::Constant* init = owned ? llvm::Constant::getNullValue(typeOf(global.kind)) : nullptr;
+		return new llvm::GlobalVariable(*module, typeOf(global.kind), false, llvm::GlobalValue::ExternalLinkage, init, name);
+	}
+
+	llvm::Function* declare(const FunctionPlan& function)
+	{
+		if (llvm::Function* existing = module->getFunction(function.linkName)) return existing;
+
+		// tailcc makes every tail call a jump, whatever the two signatures
+		std::vector<llvm::Type*> params;
+		for (ValueKind kind : function.paramKinds) params.push_back(typeOf(kind));
+		llvm::Function* fn = llvm::Function::Create(llvm::FunctionType::get(typeOf(function.returnKind), params, false),
+			llvm::Function::ExternalLinkage, function.linkName, module.get());
+		fn->setCallingConv(llvm::CallingConv::Tail);
+		return fn;
+	}
+
+	// The call the function's value comes from, through the last statements
+	// of blocks and the last stage of a pipe, when it returns the same kind;
+	// the callee's frame can then replace the caller's
+	NodeId findTailCall(NodeRef node)
+	{
+		for (;;)
+		{
+			if ((node.type() == Block || node.type() == Statement || node.type() == Expression) && node.childCount())
+				node = node.child(node.childCount() - 1);
+			else if (node.type() == Pipe && stageOf(plan, node.child(node.childCount() - 1)) == Stage::Call)
+				node = node.child(node.childCount() - 1);
+			else
+				break;
+		}
+
+		if (node.type() != FunctionCall || !plan.definition(node.child(0).tok().value)) return InvalidNode;
+		return plan.callee(unit, node).returnKind == self->returnKind ? node.id() : InvalidNode;
+	}
+
+	llvm::Value* local(SymbolId name, ValueKind kind)
+	{
+		auto it = locals.find(name);
+		if (it != locals.end()) return it->second.value;
+
+		llvm::Value* slot = entryAlloca(typeOf(kind), str(plan.spelling(name)) + ".addr");
+		locals.emplace(name, TypedValue{ slot, kind });
+		return slot;
+	}
+
+	llvm::Value* entryAlloca(llvm::Type* type, const std::string& name)
+	{
+		llvm::BasicBlock& entry = builder.GetInsertBlock()->getParent()->getEntryBlock();
+		llvm::IRBuilder<> allocas(&entry, entry.begin());
+		return allocas.CreateAlloca(type, nullptr, name);
+	}
+
+	// Calls a runtime entry point, declared with the types of the arguments
+	llvm::Value* callRuntime(const std::string& name, ValueKind result, std::initializer_list<llvm::Value*> args)
+	{
+		std::vector<llvm::Type*> params;
+		for (llvm::Value* arg : args) params.push_back(arg->getType());
+		llvm::FunctionCallee function = module->getOrInsertFunction(name, llvm::FunctionType::get(typeOf(result), params, false));
+		return builder.CreateCall(function, args);
+	}
+
+	static std::string runtimeName(std::string name, ValueKind element)
+	{
+		return name + (element == ValueKind::Float ? "_f64" : "_i64");
+	}
+
+	TypedValue lower(NodeRef node)
+	{
+		walk(node.id());
+		return pop();
+	}
+
+	TypedValue pop()
+	{
+		TypedValue value = values.back();
+		values.pop_back();
+		return value;
+	}
+
+	// leavePipe lowers the pipe's children itself
+	bool descend(NodeRef node, uint32_t child)
+	{
+		if (node.type() == Block) at(node.child(child));
+		return node.type() != Pipe && isValue(node, child);
+	}
+
+	// The plan has rejected every other node already
+	void leaveNode(NodeRef node)
+	{
+		throw QuarkCodegenError(std::string(nodeTypeString(node.type())) + " nodes are not supported by the native backend yet");
+	}
+
+	void leaveBlock(NodeRef node) { sequence(node); }
+	void leaveStatement(NodeRef node) { sequence(node); }
+	void leaveExpression(NodeRef node) { sequence(node); }
+
+	// Argument values stay on the stack for the call
+	void leaveArguments(NodeRef) {}
+
+	void sequence(NodeRef node)
+	{
+		TypedValue last = node.childCount() ? values.back() : TypedValue{};
+		values.resize(values.size() - node.childCount());
+		values.push_back(last);
+	}
+
+	void leaveLiteral(NodeRef node)
+	{
+		llvm::StringRef text(node.value().data(), node.value().size());
+		if (node.kind() == TokenKind::INT)
+		{
+			// Folded literals may be negative
+			int64_t value;
+			if (text.getAsInteger(10, value)) throw QuarkCodegenError("Integer literal " + text.str() + " does not fit in 64 bits");
+			values.push_back(TypedValue{ llvm::ConstantInt::get(typeOf(ValueKind::Int), static_cast<uint64_t>(value), true), ValueKind::Int });
+			return;
+		}
+		values.push_back(TypedValue{ llvm::ConstantFP::get(typeOf(ValueKind::Float), text), ValueKind::Float });
+	}
+
+	// The runtime copies the elements from a private constant when they are
+	// all known, otherwise from a stack array
+	void leaveList(NodeRef node)
+	{
+		uint32_t count = node.childCount();
+		ValueKind element = ValueKind::Int;
+		for (auto it = values.end() - count; it != values.end(); ++it)
+			if (it->kind == ValueKind::Float) element = ValueKind::Float;
+
+		std::vector<llvm::Value*> elements;
+		bool constant = true;
+		for (auto it = values.end() - count; it != values.end(); ++it)
+		{
+			elements.push_back(promote(*it, element).value);
+			constant = constant && llvm::isa<llvm::Constant>(elements.back());
+		}
+		values.resize(values.size() - count);
+
+		llvm::Type* type = typeOf(element);
+		llvm::Value* first = llvm::ConstantPointerNull::get(type->getPointerTo());
+		if (count)
+		{
+			llvm::ArrayType* arrayType = llvm::ArrayType::get(type, count);
+			llvm::Value* array;
+			if (constant)
+			{
+				std::vector<llvm::Constant*> init;
+				for (llvm::Value* value : elements) init.push_back(llvm::cast<llvm::Constant>(value));
+				auto* global = new llvm::GlobalVariable(*module, arrayType, true, llvm::GlobalValue::PrivateLinkage,
+					llvm::ConstantArray::get(arrayType, init), "list");
+				global->setUnnamedAddr(llvm::GlobalValue::UnnamedAddr::Global);
+				array = global;
+			}
+			else
+			{
+				array = entryAlloca(arrayType, "list");
+				for (uint32_t i = 0; i < count; i++) builder.CreateStore(elements[i], builder.CreateConstInBoundsGEP2_32(arrayType, array, 0, i));
+			}
+			first = builder.CreateConstInBoundsGEP2_32(arrayType, array, 0, 0);
+		}
+
+		ValueKind kind = listKind(element);
+		values.push_back(TypedValue{ callRuntime(element == ValueKind::Float ? "quark_list_from_f64" : "quark_list_from_i64", kind,
+			{ first, builder.getInt64(count) }), kind });
+	}
+
+	bool enterIdentifier(NodeRef node) { return !reuse(node); }
+	bool enterOperator(NodeRef node) { return isAssignment(node) || !reuse(node); }
+
+	// Pushes the value node has in this block already, if any, in which case
+	// its children are skipped and leaving it does nothing
+	bool reuse(NodeRef node)
+	{
+		if (!sharing) return false;
+		auto it = reusable.find(node.id());
+		if (it == reusable.end() || it->second.block != builder.GetInsertBlock() || it->second.stores != stores) return false;
+		values.push_back(it->second.value);
+		reused = node.id();
+		return true;
+	}
+
+	bool wasReused(NodeRef node)
+	{
+		if (reused != node.id()) return false;
+		reused = InvalidNode;
+		return true;
+	}
+
+	void remember(NodeRef node)
+	{
+		if (sharing) reusable[node.id()] = Reusable{ values.back(), builder.GetInsertBlock(), stores };
+	}
+
+	void leaveIdentifier(NodeRef node)
+	{
+		if (wasReused(node)) return;
+		SymbolId name = node.tok().value;
+		auto it = locals.find(name);
+		if (it != locals.end())
+		{
+			values.push_back(TypedValue{ builder.CreateLoad(typeOf(it->second.kind), it->second.value, str(node.value())), it->second.kind });
+		}
+		else
+		{
+			const GlobalPlan* global = plan.global(name);
+			values.push_back(TypedValue{ builder.CreateLoad(typeOf(global->kind), globalVariable(*global), str(node.value())), global->kind });
+		}
+		remember(node);
+	}
+
+	void leaveOperator(NodeRef node)
+	{
+		if (isAssignment(node))
+		{
+			assign(node);
+			return;
+		}
+		if (wasReused(node)) return;
+		values.push_back(operation(node));
+		remember(node);
+	}
+
+	TypedValue operation(NodeRef node)
+	{
+		site = node;
+		if (node.childCount() == 1)
+		{
+			// Multiplying by -1 negates Ints (wrapping) and Floats (signed zeros too) exactly
+			TypedValue operand = pop();
+			if (isList(operand.kind))
+			{
+				ValueKind element = elementKind(operand.kind);
+				llvm::Value* minusOne = element == ValueKind::Float ? llvm::ConstantFP::get(typeOf(element), -1.0)
+					: llvm::ConstantInt::get(typeOf(element), static_cast<uint64_t>(-1), true);
+				return arith(TokenKind::MULTIPLY, operand, TypedValue{ minusOne, element });
+			}
+			if (operand.kind == ValueKind::Float) return TypedValue{ builder.CreateFNeg(operand.value), operand.kind };
+			return TypedValue{ builder.CreateNeg(operand.value), operand.kind };
+		}
+
+		TypedValue rhs = pop();
+		TypedValue lhs = pop();
+		if (isSubscript(node)) return subscript(lhs, rhs);
+		return arith(node.kind(), lhs, rhs);
+	}
+
+	// An index from 0 to the length loads the element inline. Anything else
+	// goes to the runtime, which counts a negative one from the end and fails
+	// on one out of range.
+	TypedValue subscript(TypedValue list, TypedValue index)
+	{
+		ValueKind element = elementKind(list.kind);
+		llvm::GlobalVariable* record = countSite({ list.kind, index.kind }, nullptr, true);
+		llvm::Function* fn = builder.GetInsertBlock()->getParent();
+		llvm::BasicBlock* fast = llvm::BasicBlock::Create(ctx, "at.fast", fn);
+		llvm::BasicBlock* slow = llvm::BasicBlock::Create(ctx, "at.slow", fn);
+		llvm::BasicBlock* done = llvm::BasicBlock::Create(ctx, "at.done", fn);
+		// The weights __builtin_expect gives
+		builder.CreateCondBr(builder.CreateICmpULT(index.value, listLength(list.value)), fast, slow,
+			llvm::MDBuilder(ctx).createBranchWeights(2000, 1));
+
+		builder.SetInsertPoint(fast);
+		if (record) bump(record, SiteHits, builder.getInt64(1));
+		llvm::Value* elements = builder.CreateBitCast(builder.CreateConstInBoundsGEP1_64(builder.getInt8Ty(), list.value, sizeof(QuarkList)),
+			typeOf(element)->getPointerTo());
+		llvm::Value* loaded = builder.CreateLoad(typeOf(element), builder.CreateInBoundsGEP(typeOf(element), elements, index.value));
+		builder.CreateBr(done);
+
+		builder.SetInsertPoint(slow);
+		llvm::Value* called = callRuntime(runtimeName("quark_list_at", element), element, { list.value, index.value });
+		builder.CreateBr(done);
+
+		builder.SetInsertPoint(done);
+		llvm::PHINode* value = builder.CreatePHI(typeOf(element), 2);
+		value->addIncoming(loaded, fast);
+		value->addIncoming(called, slow);
+		return TypedValue{ value, element };
+	}
+
+	// The length field of a QuarkList
+	llvm::Value* listLength(llvm::Value* list)
+	{
+		return builder.CreateLoad(builder.getInt64Ty(), builder.CreateBitCast(list, builder.getInt64Ty()->getPointerTo()));
+	}
+
+	// Fields of a QuarkSiteRecord
+	enum SiteField : unsigned
+	{
+		SiteName,
+		SiteFastPath,
+		SiteCalls,
+		SiteHits,
+		SiteElements,
+	};
+
+	// With plan.siteCounters, counts a call at the site being lowered, which
+	// goes through elements list elements unless that is null, and returns
+	// the site's record; null otherwise
+	llvm::GlobalVariable* countSite(std::initializer_list<ValueKind> operands, llvm::Value* elements, bool fastPath)
+	{
+		if (!plan.siteCounters) return nullptr;
+
+		// "file:line:column what operand-kinds"
+		std::string name = site.type() == FunctionCall ? "@" + str(site.child(0).value()) : isSubscript(site) ? "[]" : str(site.value());
+		for (ValueKind kind : operands) name = name + " " + kindString(kind);
+		const Ast& tree = plan.root.tree();
+		std::string where = tree.sources().describe(tree.startLoc(site.id()));
+		if (!where.empty()) name = where + " " + name;
+
+		llvm::Type* i64 = builder.getInt64Ty();
+		llvm::StructType* type = llvm::StructType::get(builder.getInt8PtrTy(), i64, i64, i64, i64);
+		llvm::Constant* zero = builder.getInt64(0);
+		llvm::Constant* fields[] = { builder.CreateGlobalStringPtr(name, "site.name"), builder.getInt64(fastPath), zero, zero, zero };
+		auto* record = new llvm::GlobalVariable(*module, type, false, llvm::GlobalValue::PrivateLinkage, llvm::ConstantStruct::get(type, fields),
+			"site");
+		siteRecords.push_back(record);
+
+		bump(record, SiteCalls, builder.getInt64(1));
+		if (elements) bump(record, SiteElements, elements);
+		return record;
+	}
+
+	// Not atomic, like the profile counters
+	void bump(llvm::GlobalVariable* record, SiteField field, llvm::Value* by)
+	{
+		llvm::Value* counter = builder.CreateStructGEP(record->getValueType(), record, field);
+		builder.CreateStore(builder.CreateAdd(builder.CreateLoad(builder.getInt64Ty(), counter), by), counter);
+	}
+
+	// The unit's QuarkSiteTable, under the name siteSymbol() gives it
+	void siteTable()
+	{
+		llvm::Type* recordPointer = siteRecords.empty() ? builder.getInt8PtrTy() : siteRecords.front()->getType();
+		auto* arrayType = llvm::ArrayType::get(recordPointer, siteRecords.size());
+		auto* array = new llvm::GlobalVariable(*module, arrayType, true, llvm::GlobalValue::PrivateLinkage,
+			llvm::ConstantArray::get(arrayType, siteRecords), "sites");
+		llvm::Constant* first = llvm::ConstantExpr::getInBoundsGetElementPtr(arrayType, array,
+			llvm::ArrayRef<llvm::Constant*>{ builder.getInt64(0), builder.getInt64(0) });
+		llvm::Constant* fields[] = { builder.getInt64(siteRecords.size()), first };
+		llvm::Constant* table = llvm::ConstantStruct::getAnon(fields);
+		new llvm::GlobalVariable(*module, table->getType(), true, llvm::GlobalValue::ExternalLinkage, table,
+			siteSymbol(inFunction ? self->linkName : plan.entryName));
+	}
+
+	void assign(NodeRef node)
+	{
+		// The value stays on the stack as the value of the assignment
+		SymbolId name = node.child(0).tok().value;
+		const TypedValue& value = values.back();
+		stores++;
+		if (inFunction) builder.CreateStore(value.value, local(name, value.kind));
+		else builder.CreateStore(value.value, globalVariable(*plan.global(name)));
+	}
+
+	void leaveFunctionCall(NodeRef node)
+	{
+		uint32_t count = node.child(1).childCount();
+		std::vector<TypedValue> args(values.end() - count, values.end());
+		values.resize(values.size() - count);
+		values.push_back(call(node, args));
+	}
+
+	// Calls what node's first child names; the instance takes the argument
+	// kinds as they are
+	TypedValue call(NodeRef node, const std::vector<TypedValue>& args)
+	{
+		if (!plan.definition(node.child(0).tok().value))
+		{
+			site = node;
+			return callBuiltin(*builtin(node.child(0).value()), args);
+		}
+
+		const FunctionPlan& function = plan.callee(unit, node);
+		if (node.id() == tailCall && &function == self)
+		{
+			// The arguments are all evaluated by now, so they can overwrite the
+			// parameters one by one
+			stores++;
+			for (size_t i = 0; i < args.size(); i++) builder.CreateStore(args[i].value, locals.at(self->params[i]).value);
+			builder.CreateBr(selfLoop);
+			return TypedValue{};
+		}
+
+		std::vector<llvm::Value*> argValues;
+		for (const TypedValue& arg : args) argValues.push_back(arg.value);
+
+		llvm::CallInst* result = builder.CreateCall(declare(function), argValues);
+		result->setCallingConv(llvm::CallingConv::Tail);
+		if (node.id() == tailCall) result->setTailCallKind(llvm::CallInst::TCK_MustTail);
+		if (function.returnKind == ValueKind::None) return TypedValue{};
+		return TypedValue{ result, function.returnKind };
+	}
+
+	TypedValue callBuiltin(const BuiltinFunction& function, const std::vector<TypedValue>& args)
+	{
+		TypedValue arg = args[0];
+		ValueKind element = elementKind(arg.kind);
+		switch (function.builtin)
+		{
+		// Reads the length inline, so it is no dispatch site
+		case Builtin::Len: return TypedValue{ listLength(arg.value), ValueKind::Int };
+		case Builtin::Sum:
+			countSite({ arg.kind }, listLength(arg.value), false);
+			return TypedValue{ callRuntime(runtimeName("quark_list_sum", element), element, { arg.value }), element };
+		case Builtin::Min:
+			countSite({ arg.kind }, listLength(arg.value), false);
+			return TypedValue{ callRuntime(runtimeName("quark_list_min", element), element, { arg.value }), element };
+		case Builtin::Max:
+			countSite({ arg.kind }, listLength(arg.value), false);
+			return TypedValue{ callRuntime(runtimeName("quark_list_max", element), element, { arg.value }), element };
+		case Builtin::Range:
+			countSite({ arg.kind }, arg.value, false);
+			return TypedValue{ callRuntime("quark_list_range", ValueKind::IntList, { arg.value }), ValueKind::IntList };
+		case Builtin::Filter:
+			countSite({ arg.kind, args[1].kind }, listLength(arg.value), false);
+			return TypedValue{ callRuntime("quark_list_filter", arg.kind, { arg.value, args[1].value }), arg.kind };
+		default:
+		{
+			ListCompare compare = listCompare(function.builtin);
+			if (isList(args[0].kind) || isList(args[1].kind))
+			{
+				return elementWise("quark_list_compare", static_cast<int32_t>(compare), static_cast<int32_t>(swapped(compare)), true,
+					args[0], args[1]);
+			}
+			return scalarCompare(compare, args[0], args[1]);
+		}
+		}
+	}
+
+	// Each run of looping stages becomes one loop, see loop(). @range n piped
+	// straight into one counts to n without making the list.
+	void leavePipe(NodeRef node)
+	{
+		NodeRef source = node.child(0);
+		TypedValue value;
+		llvm::Value* range = nullptr;
+		if (source.type() == FunctionCall && !plan.definition(source.child(0).tok().value) && isRange(source.child(0).value())
+			&& stageOf(plan, node.child(1)) != Stage::Call)
+		{
+			range = lower(source.child(1).child(0)).value;
+		}
+		else
+		{
+			value = lower(source);
+		}
+
+		uint32_t first = 1;
+		while (first < node.childCount())
+		{
+			NodeRef stage = node.child(first);
+			if (stageOf(plan, stage) == Stage::Call)
+			{
+				std::vector<TypedValue> args{ value };
+				for (NodeRef arg : stage.child(1).children()) args.push_back(lower(arg));
+				value = call(stage, args);
+				first++;
+				continue;
+			}
+
+			uint32_t end = first;
+			for (Stage kind = Stage::Map; end < node.childCount() && !isReduction(kind);)
+			{
+				kind = stageOf(plan, node.child(end));
+				if (kind == Stage::Call) break;
+				end++;
+			}
+			value = loop(node, first, end, value, range);
+			range = nullptr;
+			first = end;
+		}
+		values.push_back(value);
+	}
+
+	// Runs stages [first, end) of pipe element by element over list, or over
+	// 0 to range. A map replaces the element, a filter that fails skips to the
+	// next one, and a reduction, or else the list being built, takes what
+	// passes. The stages' arguments are evaluated once, up front; the
+	// functions are called once per element.
+	TypedValue loop(NodeRef pipe, uint32_t first, uint32_t end, TypedValue list, llvm::Value* range)
+	{
+		llvm::Type* i64 = builder.getInt64Ty();
+		llvm::Function* fn = builder.GetInsertBlock()->getParent();
+		Stage last = stageOf(plan, pipe.child(end - 1));
+		bool reduces = isReduction(last);
+
+		std::vector<std::vector<TypedValue>> stageArgs;
+		ValueKind kind = range ? ValueKind::Int : elementKind(list.kind);
+		for (uint32_t i = first; i < end; i++)
+		{
+			NodeRef args = pipe.child(i).child(1);
+			stageArgs.emplace_back();
+			for (uint32_t a = 1; a < args.childCount(); a++) stageArgs.back().push_back(lower(args.child(a)));
+			if (stageOf(plan, pipe.child(i)) == Stage::Map) kind = plan.callee(unit, pipe.child(i)).returnKind;
+		}
+
+		// Lists are laid out as in runtime.h: the length, then the elements
+		llvm::Value* length = range;
+		llvm::Value* elements = nullptr;
+		if (!range)
+		{
+			length = builder.CreateLoad(i64, builder.CreateBitCast(list.value, i64->getPointerTo()), "length");
+			elements = builder.CreateBitCast(builder.CreateConstInBoundsGEP1_64(builder.getInt8Ty(), list.value, sizeof(QuarkList)),
+				typeOf(elementKind(list.kind))->getPointerTo(), "elements");
+		}
+
+		llvm::Value* index = entryAlloca(i64, "index");
+		llvm::Value* count = entryAlloca(i64, "count");
+		builder.CreateStore(builder.getInt64(0), index);
+		builder.CreateStore(builder.getInt64(0), count);
+
+		// What the element ends up in
+		llvm::Value* out = nullptr;
+		llvm::Value* acc = nullptr;
+		llvm::Value* lanes = nullptr;
+		bool laned = kind == ValueKind::Float && (last == Stage::Sum || last == Stage::Min || last == Stage::Max);
+		if (!reduces)
+		{
+			out = callRuntime("quark_list_new", listKind(kind), { length });
+		}
+		else if (laned)
+		{
+			lanes = entryAlloca(llvm::ArrayType::get(typeOf(kind), ReductionLanes), "lanes");
+			if (last == Stage::Sum) builder.CreateMemSet(lanes, builder.getInt8(0), ReductionLanes * sizeof(double), llvm::MaybeAlign(8));
+		}
+		else if (last == Stage::Reduce)
+		{
+			TypedValue start = stageArgs.back()[0];
+			acc = entryAlloca(typeOf(start.kind), "acc");
+			builder.CreateStore(start.value, acc);
+		}
+		else if (last == Stage::Sum || last == Stage::Min || last == Stage::Max)
+		{
+			acc = entryAlloca(typeOf(kind), "acc");
+			builder.CreateStore(llvm::ConstantInt::get(typeOf(kind), 0), acc);
+		}
+
+		auto* header = llvm::BasicBlock::Create(ctx, "pipe.header", fn);
+		auto* body = llvm::BasicBlock::Create(ctx, "pipe.body", fn);
+		auto* next = llvm::BasicBlock::Create(ctx, "pipe.next", fn);
+		auto* exit = llvm::BasicBlock::Create(ctx, "pipe.exit", fn);
+		builder.CreateBr(header);
+
+		builder.SetInsertPoint(header);
+		llvm::Value* i = builder.CreateLoad(i64, index, "i");
+		builder.CreateCondBr(builder.CreateICmpSLT(i, length), body, exit);
+
+		builder.SetInsertPoint(body);
+		TypedValue element{ i, ValueKind::Int };
+		if (elements)
+		{
+			ValueKind listElement = elementKind(list.kind);
+			element = TypedValue{ builder.CreateLoad(typeOf(listElement), builder.CreateInBoundsGEP(typeOf(listElement), elements, i)),
+				listElement };
+		}
+		llvm::Value* n = builder.CreateLoad(i64, count, "n");
+
+		for (uint32_t s = first; s < end; s++)
+		{
+			NodeRef stage = pipe.child(s);
+			const std::vector<TypedValue>& args = stageArgs[s - first];
+			switch (stageOf(plan, stage))
+			{
+			case Stage::Map:
+				element = apply(stage, { element }, args);
+				break;
+			case Stage::Filter:
+			{
+				TypedValue keep = apply(stage, { element }, args);
+				llvm::Value* zero = llvm::Constant::getNullValue(typeOf(keep.kind));
+				auto* pass = llvm::BasicBlock::Create(ctx, "pipe.pass", fn);
+				builder.CreateCondBr(keep.kind == ValueKind::Float ? builder.CreateFCmpUNE(keep.value, zero) : builder.CreateICmpNE(keep.value, zero),
+					pass, next);
+				builder.SetInsertPoint(pass);
+				break;
+			}
+			case Stage::Reduce:
+			{
+				TypedValue accumulated{ builder.CreateLoad(typeOf(args[0].kind), acc), args[0].kind };
+				std::vector<TypedValue> rest(args.begin() + 1, args.end());
+				builder.CreateStore(promote(apply(stage, { accumulated, element }, rest), args[0].kind).value, acc);
+				break;
+			}
+			case Stage::Sum:
+				if (laned)
+				{
+					llvm::Value* lane = laneOf(lanes, n);
+					builder.CreateStore(builder.CreateFAdd(builder.CreateLoad(typeOf(kind), lane), element.value), lane);
+				}
+				else
+				{
+					builder.CreateStore(builder.CreateAdd(builder.CreateLoad(typeOf(kind), acc), element.value), acc);
+				}
+				break;
+			case Stage::Min:
+			case Stage::Max:
+			{
+				bool max = stageOf(plan, stage) == Stage::Max;
+				if (laned)
+				{
+					// Every lane starts out as the first element, as in the runtime
+					auto* fill = llvm::BasicBlock::Create(ctx, "pipe.fill", fn);
+					auto* update = llvm::BasicBlock::Create(ctx, "pipe.update", fn);
+					builder.CreateCondBr(builder.CreateICmpEQ(n, builder.getInt64(0)), fill, update);
+					builder.SetInsertPoint(fill);
+					for (int64_t lane = 0; lane < ReductionLanes; lane++) builder.CreateStore(element.value, laneOf(lanes, builder.getInt64(lane)));
+					builder.CreateBr(update);
+					builder.SetInsertPoint(update);
+
+					llvm::Value* lane = laneOf(lanes, n);
+					builder.CreateStore(pick(max, element, builder.CreateLoad(typeOf(kind), lane)), lane);
+				}
+				else
+				{
+					llvm::Value* previous = builder.CreateLoad(typeOf(kind), acc);
+					builder.CreateStore(builder.CreateSelect(builder.CreateICmpEQ(n, builder.getInt64(0)), element.value,
+						pick(max, element, previous)), acc);
+				}
+				break;
+			}
+			default:
+				break;
+			}
+		}
+
+		if (out)
+		{
+			llvm::Value* outElements = builder.CreateBitCast(builder.CreateConstInBoundsGEP1_64(builder.getInt8Ty(), out, sizeof(QuarkList)),
+				typeOf(kind)->getPointerTo());
+			builder.CreateStore(element.value, builder.CreateInBoundsGEP(typeOf(kind), outElements, n));
+		}
+		builder.CreateStore(builder.CreateAdd(n, builder.getInt64(1)), count);
+		builder.CreateBr(next);
+
+		builder.SetInsertPoint(next);
+		builder.CreateStore(builder.CreateAdd(i, builder.getInt64(1)), index);
+		builder.CreateBr(header);
+
+		builder.SetInsertPoint(exit);
+		llvm::Value* total = builder.CreateLoad(i64, count, "total");
+		switch (last)
+		{
+		case Stage::Reduce:
+			return TypedValue{ builder.CreateLoad(typeOf(stageArgs.back()[0].kind), acc), stageArgs.back()[0].kind };
+		case Stage::Len:
+			return TypedValue{ total, ValueKind::Int };
+		case Stage::Sum:
+			if (!laned) return TypedValue{ builder.CreateLoad(typeOf(kind), acc), kind };
+			return TypedValue{ combine(lanes, [&](llvm::Value* lane, llvm::Value* sum) { return builder.CreateFAdd(sum, lane); }), kind };
+		case Stage::Min:
+		case Stage::Max:
+		{
+			auto* empty = llvm::BasicBlock::Create(ctx, "pipe.empty", fn);
+			auto* done = llvm::BasicBlock::Create(ctx, "pipe.done", fn);
+			builder.CreateCondBr(builder.CreateICmpEQ(total, builder.getInt64(0)), empty, done);
+			builder.SetInsertPoint(empty);
+			auto* fail = llvm::cast<llvm::CallInst>(callRuntime("quark_list_fail_empty", ValueKind::None,
+				{ builder.CreateGlobalStringPtr(last == Stage::Max ? "max" : "min") }));
+			fail->setDoesNotReturn();
+			builder.CreateUnreachable();
+			builder.SetInsertPoint(done);
+
+			bool max = last == Stage::Max;
+			if (!laned) return TypedValue{ builder.CreateLoad(typeOf(kind), acc), kind };
+			return TypedValue{ combine(lanes, [&](llvm::Value* lane, llvm::Value* m) { return pick(max, TypedValue{ lane, kind }, m); }), kind };
+		}
+		default:
+			builder.CreateStore(total, builder.CreateBitCast(out, i64->getPointerTo()));
+			return TypedValue{ out, listKind(kind) };
+		}
+	}
+
+	// The call a map, filter or reduce stage makes, to the function its first
+	// argument names
+	TypedValue apply(NodeRef stage, std::vector<TypedValue> args, const std::vector<TypedValue>& rest)
+	{
+		args.insert(args.end(), rest.begin(), rest.end());
+		const FunctionPlan& function = plan.callee(unit, stage);
+		std::vector<llvm::Value*> argValues;
+		for (const TypedValue& arg : args) argValues.push_back(arg.value);
+		llvm::CallInst* result = builder.CreateCall(declare(function), argValues);
+		result->setCallingConv(llvm::CallingConv::Tail);
+		return TypedValue{ result, function.returnKind };
+	}
+
+	llvm::Value* laneOf(llvm::Value* lanes, llvm::Value* n)
+	{
+		llvm::Value* lane = builder.CreateAnd(n, builder.getInt64(ReductionLanes - 1));
+		return builder.CreateInBoundsGEP(llvm::ArrayType::get(typeOf(ValueKind::Float), ReductionLanes), lanes, { builder.getInt64(0), lane });
+	}
+
+	// Folds the lanes in order, starting from the first
+	template <typename Fold>
+	llvm::Value* combine(llvm::Value* lanes, Fold fold)
+	{
+		llvm::Type* type = typeOf(ValueKind::Float);
+		llvm::Value* result = builder.CreateLoad(type, laneOf(lanes, builder.getInt64(0)));
+		for (int64_t lane = 1; lane < ReductionLanes; lane++) result = fold(builder.CreateLoad(type, laneOf(lanes, builder.getInt64(lane))), result);
+		return result;
+	}
+
+	// x < m ? x : m for min and x > m ? x : m for max, as the runtime picks
+	llvm::Value* pick(bool max, TypedValue x, llvm::Value* m)
+	{
+		llvm::Value* better = x.kind == ValueKind::Float ? builder.CreateFCmp(max ? llvm::CmpInst::FCMP_OGT : llvm::CmpInst::FCMP_OLT, x.value, m)
+			: builder.CreateICmp(max ? llvm::CmpInst::ICMP_SGT : llvm::CmpInst::ICMP_SLT, x.value, m);
+		return builder.CreateSelect(better, x.value, m);
+	}
+
+	TypedValue promote(TypedValue value, ValueKind kind)
+	{
+		if (value.kind == kind) return value;
+		if (value.kind == ValueKind::IntList) return TypedValue{ callRuntime("quark_list_to_f64", kind, { value.value }), kind };
+		return TypedValue{ builder.CreateSIToFP(value.value, typeOf(kind)), kind };
+	}
+
+	// Runs the runtime's name_i64/_f64 over two lists, or name_scalar_i64/_f64
+	// over a list and a scalar. The scalar goes second, so when it comes first
+	// the operation is swapped to the one that takes them the other way round.
+	// Comparisons make an Int list, arithmetic a list of the promoted kind.
+	TypedValue elementWise(const char* name, int32_t code, int32_t swappedCode, bool comparison, TypedValue lhs, TypedValue rhs)
+	{
+		ValueKind kind = promotedKind(lhs.kind, rhs.kind);
+		ValueKind element = elementKind(kind);
+		lhs = promote(lhs, isList(lhs.kind) ? kind : element);
+		rhs = promote(rhs, isList(rhs.kind) ? kind : element);
+		if (!isList(lhs.kind))
+		{
+			std::swap(lhs, rhs);
+			code = swappedCode;
+		}
+
+		ValueKind result = comparison ? ValueKind::IntList : kind;
+		countSite({ lhs.kind, rhs.kind }, listLength(lhs.value), false);
+		std::string function = runtimeName(std::string(name) + (isList(rhs.kind) ? "" : "_scalar"), element);
+		return TypedValue{ callRuntime(function, result, { builder.getInt32(static_cast<uint32_t>(code)), lhs.value, rhs.value }), result };
+	}
+
+	TypedValue scalarCompare(ListCompare compare, TypedValue lhs, TypedValue rhs)
+	{
+		// ListCompare order; != is true for NaN, as in the runtime
+		static const llvm::CmpInst::Predicate ints[] = { llvm::CmpInst::ICMP_SLT, llvm::CmpInst::ICMP_SLE, llvm::CmpInst::ICMP_SGT,
+			llvm::CmpInst::ICMP_SGE, llvm::CmpInst::ICMP_EQ, llvm::CmpInst::ICMP_NE };
+		static const llvm::CmpInst::Predicate floats[] = { llvm::CmpInst::FCMP_OLT, llvm::CmpInst::FCMP_OLE, llvm::CmpInst::FCMP_OGT,
+			llvm::CmpInst::FCMP_OGE, llvm::CmpInst::FCMP_OEQ, llvm::CmpInst::FCMP_UNE };
+
+		ValueKind kind = promotedKind(lhs.kind, rhs.kind);
+		lhs = promote(lhs, kind);
+		rhs = promote(rhs, kind);
+		size_t index = static_cast<size_t>(compare);
+		llvm::Value* bit = kind == ValueKind::Float ? builder.CreateFCmp(floats[index], lhs.value, rhs.value)
+			: builder.CreateICmp(ints[index], lhs.value, rhs.value);
+		return TypedValue{ builder.CreateZExt(bit, typeOf(ValueKind::Int)), ValueKind::Int };
+	}
+
+	TypedValue arith(TokenKind op, TypedValue lhs, TypedValue rhs)
+	{
+		if (isList(lhs.kind) || isList(rhs.kind))
+		{
+			ListOp listOp = op == TokenKind::PLUS ? ListOp::Add : op == TokenKind::MINUS ? ListOp::Sub : op == TokenKind::MULTIPLY ? ListOp::Mul : ListOp::Div;
+			ListOp swappedOp = listOp == ListOp::Sub ? ListOp::RevSub : listOp == ListOp::Div ? ListOp::RevDiv : listOp;
+			return elementWise("quark_list_arith", static_cast<int32_t>(listOp), static_cast<int32_t>(swappedOp), false, lhs, rhs);
+		}
+
+		ValueKind kind = promotedKind(lhs.kind, rhs.kind);
+		lhs = promote(lhs, kind);
+		rhs = promote(rhs, kind);
+		bool fp = kind == ValueKind::Float;
+
+		switch (op)
+		{
+		case TokenKind::PLUS: return TypedValue{ fp ? builder.CreateFAdd(lhs.value, rhs.value) : builder.CreateAdd(lhs.value, rhs.value), kind };
+		case TokenKind::MINUS: return TypedValue{ fp ? builder.CreateFSub(lhs.value, rhs.value) : builder.CreateSub(lhs.value, rhs.value), kind };
+		case TokenKind::MULTIPLY: return TypedValue{ fp ? builder.CreateFMul(lhs.value, rhs.value) : builder.CreateMul(lhs.value, rhs.value), kind };
+		default: return TypedValue{ fp ? builder.CreateFDiv(lhs.value, rhs.value) : divide(lhs.value, rhs.value), kind };
+		}
+	}
+
+	// Int division as the runtime's list kernels do it: a zero divisor raises
+	// a runtime error and -1 negates, wrapping, where sdiv would trap
+	llvm::Value* divide(llvm::Value* x, llvm::Value* y)
+	{
+		llvm::Function* fn = builder.GetInsertBlock()->getParent();
+		llvm::BasicBlock* zero = llvm::BasicBlock::Create(ctx, "div.zero", fn);
+		llvm::BasicBlock* nonzero = llvm::BasicBlock::Create(ctx, "div.nonzero", fn);
+		builder.CreateCondBr(builder.CreateICmpEQ(y, builder.getInt64(0)), zero, nonzero, llvm::MDBuilder(ctx).createBranchWeights(1, 2000));
+
+		builder.SetInsertPoint(zero);
+		llvm::cast<llvm::CallInst>(callRuntime("quark_fail_division_by_zero", ValueKind::None, {}))->setDoesNotReturn();
+		builder.CreateUnreachable();
+
+		// Both arms are computed, so the divided one never sees -1
+		builder.SetInsertPoint(nonzero);
+		llvm::Value* negate = builder.CreateICmpEQ(y, builder.getInt64(-1));
+		llvm::Value* quotient = builder.CreateSDiv(x, builder.CreateSelect(negate, builder.getInt64(1), y));
+		return builder.CreateSelect(negate, builder.CreateSub(builder.getInt64(0), x), quotient);
+	}
+};
+
+// Serializes subtrees and the interface they depend on for unitFingerprint
+class Fingerprint : public AstVisitor<Fingerprint>
+{
+public:
+	Fingerprint(const ModulePlan& plan, size_t unit) : AstVisitor(plan.root.tree()), plan(plan), unit(unit) {}
+
+	std::string take() { return std::move(bytes); }
+
+	void tree(NodeRef root)
+	{
+		// The unit's debug info and site names name the file the tree starts in
+		if (plan.debugInfo || plan.siteCounters) text(ast.sources().resolve(ast.startLoc(root.id())).file);
+		walk(root.id());
+	}
+
+	void signature(const FunctionPlan& function)
+	{
+		text(function.linkName);
+		put(static_cast<uint32_t>(function.paramKinds.size()));
+		for (ValueKind kind : function.paramKinds) put(static_cast<uint8_t>(kind));
+		put(static_cast<uint8_t>(function.returnKind));
+	}
+
+	void global(const GlobalPlan& global)
+	{
+		text(plan.spelling(global.name));
+		put(static_cast<uint8_t>(global.kind));
+	}
+
+	template <typename T>
+	void put(T value)
+	{
+		bytes.append(reinterpret_cast<const char*>(&value), sizeof(value));
+	}
+
+	void text(std::string_view value)
+	{
+		put(static_cast<uint32_t>(value.size()));
+		bytes.append(value.data(), value.size());
+	}
+
+private:
+	friend class AstVisitor<Fingerprint>;
+
+	const ModulePlan& plan;
+	size_t unit;
+	std::string bytes;
+
+	// On a hash-consed tree, the nodes written so far by the order they were
+	// written in. A node met again is written as a reference to that, so a
+	// shared subtree costs its size once, while the bytes still tell a DAG
+	// from the tree it expands to.
+	std::unordered_map<NodeId, uint32_t> written;
+
+	// Pre-order
+	bool enterNode(NodeRef node)
+	{
+		if (ast.hashConsing())
+		{
+			auto [it, first] = written.emplace(node.id(), static_cast<uint32_t>(written.size()));
+			if (!first)
+			{
+				put(static_cast<uint8_t>(NodeTypeCount));
+				put(it->second);
+				return false;
+			}
+		}
+		put(static_cast<uint8_t>(node.type()));
+		put(static_cast<uint8_t>(node.kind()));
+		text(node.value());
+		put(node.childCount());
+		if (plan.debugInfo || plan.siteCounters)
+		{
+			PresumedLoc where = ast.sources().resolve(node.tok().loc);
+			put(where.line);
+			put(where.column);
+		}
+		return true;
+	}
+
+	bool enterFunctionCall(NodeRef node)
+	{
+		// A builtin is known by its name, already written. A pipe stage may
+		// call the function its first argument names.
+		if (!enterNode(node)) return false;
+		const CallTargets& calls = plan.calls(unit);
+		auto it = calls.find(node.id());
+		if (it != calls.end()) signature(plan.functions[it->second]);
+		return true;
+	}
+
+	bool enterIdentifier(NodeRef node)
+	{
+		if (!enterNode(node)) return false;
+		if (const GlobalPlan* global = plan.global(node.tok().value)) put(static_cast<uint8_t>(global->kind));
+		return true;
+	}
+};
+
+}
+
+const FunctionDefinition* ModulePlan::definition(SymbolId name) const {
+	auto it = definitionIndex.find(name);
+	return it == definitionIndex.end() ? nullptr : &definitions[it->second];
+}
+
+const GlobalPlan* ModulePlan::global(SymbolId name) const {
+	auto it = globalIndex.find(name);
+	return it == globalIndex.end() ? nullptr : &globals[it->second];
+}
+
+const FunctionPlan& ModulePlan::callee(size_t unit, NodeRef call) const {
+	return functions[calls(unit).at(call.id())];
+}
+
+ModulePlan planModule(NodeRef root) {
+	ModulePlan plan;
+	plan.root = root;
+	Planner(plan).run();
+	return plan;
+}
+
+struct StreamPlanner::Impl
+{
+	explicit Impl(ModulePlan& plan) : plan(plan), planner(plan) {}
+
+	ModulePlan& plan;
+	Planner planner;
+};
+
+StreamPlanner::StreamPlanner(ModulePlan& plan) : impl(std::make_unique<Impl>(plan)) {}
+
+StreamPlanner::~StreamPlanner() = default;
+
+void StreamPlanner::define(NodeRef function) {
+	impl->planner.define(function);
+}
+
+void StreamPlanner::segment(size_t index, std::vector<NodeRef> statements) {
+	ModulePlan& plan = impl->plan;
+	plan.statements = std::move(statements);
+	plan.mainCalls.clear();
+	plan.firstFunction = plan.functions.size();
+	plan.firstGlobal = plan.globals.size();
+	plan.entryName = segmentSymbol(EntryName, index);
+	plan.resultName = segmentSymbol(ResultName, index);
+	impl->planner.typeStatements();
+}
+
+void StreamPlanner::finish() {
+	impl->planner.instantiateUncalled();
+}
+
+std::string symbolName(std::string_view name) {
+	// Keeps user names clear of libc and of the __quark_ entry points
+	return "quark." + std::string(name);
+}
+
+std::string symbolName(std::string_view name, const std::vector<ValueKind>& paramKinds) {
+	// One letter per parameter tells the instances apart, e.g. quark.add.if,
+	// upper case for lists of the type
+	static const char letters[] = { 'v', 'i', 'f', 'I', 'F' };
+	std::string linkName = symbolName(name);
+	if (!paramKinds.empty()) linkName.push_back('.');
+	for (ValueKind kind : paramKinds) linkName.push_back(letters[static_cast<size_t>(kind)]);
+	return linkName;
+}
+
+std::string segmentSymbol(const char* name, size_t segment) {
+	return std::string(name) + "." + std::to_string(segment);
+}
+
+std::string unitFingerprint(const ModulePlan& plan, size_t unit) {
+	Fingerprint fingerprint(plan, unit);
+	fingerprint.put(static_cast<uint32_t>(unit == 0 ? 0 : 1));
+	fingerprint.put(static_cast<uint8_t>(plan.debugInfo));
+	fingerprint.put(static_cast<uint8_t>(plan.siteCounters));
+	fingerprint.put(static_cast<uint8_t>(plan.root.tree().hashConsing()));
+
+	if (unit == 0)
+	{
+		// The main unit defines every global and stores the result
+		fingerprint.text(plan.entryName);
+		fingerprint.text(plan.resultName);
+		fingerprint.put(static_cast<uint32_t>(plan.globals.size() - plan.firstGlobal));
+		for (size_t i = plan.firstGlobal; i < plan.globals.size(); i++) fingerprint.global(plan.globals[i]);
+		fingerprint.put(static_cast<uint8_t>(plan.resultKind));
+		fingerprint.put(static_cast<uint32_t>(plan.statements.size()));
+		for (NodeRef statement : plan.statements) fingerprint.tree(statement);
+	}
+	else
+	{
+		const FunctionPlan& function = plan.instance(unit);
+		fingerprint.signature(function);
+		fingerprint.tree(function.node);
+	}
+	return fingerprint.take();
+}
+
+std::unique_ptr<llvm::Module> lowerUnit(const ModulePlan& plan, size_t unit, llvm::LLVMContext& context,
+	const llvm::TargetMachine& targetMachine) {
+	UnitLowering lowering(plan, unit, context, targetMachine);
+	if (unit == 0) return lowering.main();
+	return lowering.function(plan.instance(unit));
+}
+
+std::unique_ptr<llvm::Module> lowerProgramEntry(const ModulePlan& plan, llvm::LLVMContext& context,
+	const llvm::TargetMachine& targetMachine) {
+	auto module = std::make_unique<llvm::Module>("quark.entry", context);
+	module->setDataLayout(targetMachine.createDataLayout());
+	module->setTargetTriple(targetMachine.getTargetTriple().str());
+
+	llvm::IRBuilder<> builder(context);
+	auto* main = llvm::Function::Create(llvm::FunctionType::get(builder.getInt32Ty(), false), llvm::Function::ExternalLinkage,
+		"main", module.get());
+	builder.SetInsertPoint(llvm::BasicBlock::Create(context, "entry", main));
+	builder.CreateCall(module->getOrInsertFunction(EntryName, builder.getVoidTy()));
+
+	// A runtime error has already printed its message and exited
+	llvm::Type* type = nullptr;
+	const char* print = nullptr;
+	switch (plan.resultKind)
+	{
+	case ValueKind::Int: type = builder.getInt64Ty(); print = "quark_print_i64"; break;
+	case ValueKind::Float: type = builder.getDoubleTy(); print = "quark_print_f64"; break;
+	case ValueKind::IntList: type = builder.getInt8PtrTy(); print = "quark_print_list_i64"; break;
+	case ValueKind::FloatList: type = builder.getInt8PtrTy(); print = "quark_print_list_f64"; break;
+	default: break;
+	}
+	if (print)
+	{
+		llvm::Constant* result = module->getOrInsertGlobal(ResultName, type);
+		builder.CreateCall(module->getOrInsertFunction(print, builder.getVoidTy(), type), builder.CreateLoad(type, result));
+	}
+	builder.CreateRet(builder.getInt32(0));
+
+	std::string err;
+	llvm::raw_string_ostream os(err);
+	if (llvm::verifyModule(*module, &os)) throw QuarkCodegenError("Invalid module generated: " + os.str());
+	return module;
+}
+
+std::unique_ptr<llvm::Module> lowerStreamEntry(const ModulePlan& plan, size_t segments, llvm::LLVMContext& context,
+	const llvm::TargetMachine& targetMachine) {
+	auto module = std::make_unique<llvm::Module>("quark.stream", context);
+	module->setDataLayout(targetMachine.createDataLayout());
+	module->setTargetTriple(targetMachine.getTargetTriple().str());
+
+	llvm::IRBuilder<> builder(context);
+	auto* entry = llvm::Function::Create(llvm::FunctionType::get(builder.getVoidTy(), false), llvm::Function::ExternalLinkage,
+		EntryName, module.get());
+	builder.SetInsertPoint(llvm::BasicBlock::Create(context, "entry", entry));
+	for (size_t i = 0; i < segments; i++)
+		builder.CreateCall(module->getOrInsertFunction(segmentSymbol(EntryName, i), builder.getVoidTy()));
+
+	if (plan.resultKind != ValueKind::None)
+	{
+		llvm::Type* type = plan.resultKind == ValueKind::Int ? builder.getInt64Ty()
+			: plan.resultKind == ValueKind::Float ? builder.getDoubleTy() : builder.getInt8PtrTy();
+		llvm::Constant* last = module->getOrInsertGlobal(plan.resultName, type);
+		auto* result = new llvm::GlobalVariable(*module, type, false, llvm::GlobalValue::ExternalLinkage,
+			llvm::Constant::getNullValue(type), ResultName);
+		builder.CreateStore(builder.CreateLoad(type, last), result);
+	}
+	builder.CreateRetVoid();
+
+	std::string err;
+	llvm::raw_string_ostream os(err);
+	if (llvm::verifyModule(*module, &os)) throw QuarkCodegenError("Invalid module generated: " + os.str());
+	return module;
+}
@@ -0,0 +1,218 @@
+#include "include/optimizer.h"
+#include "include/codegen.h"
+#include "include/profile.h"
+
+#include <chrono>
+#include <memory>
+#include <tuple>
+#include <llvm/ADT/Any.h>
+#include <llvm/IR/DiagnosticInfo.h>
+#include <llvm/IR/DiagnosticPrinter.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/PassInstrumentation.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Target/TargetMachine.h>
+#include <llvm/Transforms/Instrumentation/PGOInstrumentation.h>
+
+namespace {
+
+// Times passes through the instrumentation callbacks into the map it is
+// given for the run, if any. A pass's time excludes the passes nested in it,
+// and pass managers and adaptors, which only run other passes, are left out.
+class PassTimer
+{
+public:
+	void attach(llvm::PassInstrumentationCallbacks& callbacks)
+	{
+		callbacks.registerBeforeNonSkippedPassCallback([this](llvm::StringRef, llvm::Any) { begin(); });
+		callbacks.registerAfterPassCallback([this](llvm::StringRef name, llvm::Any, const llvm::PreservedAnalyses&) { end(name); });
+		callbacks.registerAfterPassInvalidatedCallback([this](llvm::StringRef name, const llvm::PreservedAnalyses&) { end(name); });
+	}
+
+	void setTimes(std::map<std::string, PassTiming>* passTimes)
+	{
+		times = passTimes;
+		stack.clear();
+	}
+
+private:
+	using Clock = std::chrono::steady_clock;
+
+	struct Running
+	{
+		Clock::time_point start;
+		double nested = 0;
+	};
+
+	std::map<std::string, PassTiming>* times = nullptr;
+	std::vector<Running> stack;
+
+	void begin()
+	{
+		if (times) stack.push_back(Running{ Clock::now(), 0 });
+	}
+
+	void end(llvm::StringRef name)
+	{
+		if (!times || stack.empty()) return;
+		double elapsed = std::chrono::duration<double>(Clock::now() - stack.back().start).count();
+		double own = elapsed - stack.back().nested;
+		stack.pop_back();
+		if (!stack.empty()) stack.back().nested += elapsed;
+
+		if (name.contains("PassManager") || name.contains("PassAdaptor")) return;
+		PassTiming& timing = (*times)[name.str()];
+		if (timing.name.empty()) timing.name = name.str();
+		timing.seconds += own;
+		timing.runs++;
+	}
+};
+
+llvm::OptimizationLevel optimizationLevel(OptLevel level) {
+	switch (level)
+	{
+	case OptLevel::O1: return llvm::OptimizationLevel::O1;
+	case OptLevel::O2: return llvm::OptimizationLevel::O2;
+	case OptLevel::O3: return llvm::OptimizationLevel::O3;
+	case OptLevel::Os: return llvm::OptimizationLevel::Os;
+	default: return llvm::OptimizationLevel::O0;
+	}
+}
+
+// Same tuning clang uses: vectorize from O2 up, keep Os loops compact
+llvm::PipelineTuningOptions tuning(OptLevel level) {
+	llvm::PipelineTuningOptions options;
+	bool vectorize = level == OptLevel::O2 || level == OptLevel::O3;
+	options.LoopVectorization = vectorize;
+	options.SLPVectorization = vectorize;
+	options.LoopInterleaving = vectorize;
+	options.LoopUnrolling = level != OptLevel::O0 && level != OptLevel::Os;
+	return options;
+}
+
+// The passes for one target machine, level and custom pipeline. Building
+// them takes longer than running them over a small module.
+struct Pipeline
+{
+	llvm::PassInstrumentationCallbacks callbacks;
+	PassTimer timer;
+	llvm::PassBuilder passBuilder;
+	llvm::ModulePassManager passes;
+
+	Pipeline(llvm::TargetMachine* targetMachine, const OptimizerOptions& options)
+		: passBuilder(targetMachine, tuning(options.level), {}, &callbacks)
+	{
+		timer.attach(callbacks);
+		if (!options.passPipeline.empty())
+		{
+			if (llvm::Error err = passBuilder.parsePassPipeline(passes, options.passPipeline))
+				throw QuarkCodegenError("Invalid pass pipeline '" + options.passPipeline + "': " + llvm::toString(std::move(err)));
+		}
+		else if (options.level == OptLevel::O0)
+		{
+			passes = passBuilder.buildO0DefaultPipeline(llvm::OptimizationLevel::O0);
+		}
+		else
+		{
+			passes = passBuilder.buildPerModuleDefaultPipeline(optimizationLevel(options.level));
+		}
+	}
+};
+
+// Keeps the first error the PGO passes report, which the context's default
+// handler would print and exit on, and drops their warnings, such as that of
+// a function the profile does not have or has with a different hash
+class ProfileDiagnostics : public llvm::DiagnosticHandler
+{
+public:
+	std::string error;
+
+	bool handleDiagnostics(const llvm::DiagnosticInfo& info) override
+	{
+		if (info.getSeverity() == llvm::DS_Error && error.empty())
+		{
+			llvm::raw_string_ostream os(error);
+			llvm::DiagnosticPrinterRawOStream printer(os);
+			info.print(printer);
+		}
+		return true;
+	}
+};
+
+// Both run on the module as lowered, before the pipeline changes its
+// control flow, so the hashes of a function agree between the two
+void applyProfile(llvm::Module& module, llvm::ModuleAnalysisManager& mam, const OptimizerOptions& options) {
+	llvm::ModulePassManager passes;
+	if (!options.profileGenerate.empty()) passes.addPass(llvm::PGOInstrumentationGen());
+	else passes.addPass(llvm::PGOInstrumentationUse(options.profileUse));
+
+	llvm::LLVMContext& context = module.getContext();
+	std::unique_ptr<llvm::DiagnosticHandler> previous = context.getDiagnosticHandler();
+	context.setDiagnosticHandler(std::make_unique<ProfileDiagnostics>());
+	passes.run(module, mam);
+	std::unique_ptr<llvm::DiagnosticHandler> diagnostics = context.getDiagnosticHandler();
+	context.setDiagnosticHandler(std::move(previous));
+
+	const std::string& error = static_cast<ProfileDiagnostics&>(*diagnostics).error;
+	if (options.profileGenerate.empty())
+	{
+		if (!error.empty()) throw QuarkCodegenError("Cannot use the profile " + options.profileUse + ": " + error);
+		return;
+	}
+	if (!error.empty()) throw QuarkCodegenError("Cannot instrument the module: " + error);
+
+	// The lowering edits the module outside the pass manager
+	lowerProfileCounters(module);
+	mam.invalidate(module, llvm::PreservedAnalyses::none());
+}
+
+}
+
+OptLevel optLevelFromString(const std::string& level) {
+	std::string name = level;
+	if (!name.empty() && name[0] == '-') name.erase(0, 1);
+	if (!name.empty() && name[0] == 'O') name.erase(0, 1);
+
+	if (name == "0") return OptLevel::O0;
+	if (name == "1") return OptLevel::O1;
+	if (name == "2") return OptLevel::O2;
+	if (name == "3") return OptLevel::O3;
+	if (name == "s") return OptLevel::Os;
+	throw std::invalid_argument("Unknown optimization level '" + level + "', expected O0, O1, O2, O3 or Os");
+}
+
+const char* optLevelString(OptLevel level) {
+	static const char* const names[] = { "O0", "O1", "O2", "O3", "Os" };
+	return names[static_cast<int>(level)];
+}
+
+void optimizeModule(llvm::Module& module, llvm::TargetMachine* targetMachine, const OptimizerOptions& options,
+	std::map<std::string, PassTiming>* passTimes) {
+	if (!options.profileGenerate.empty() && !options.profileUse.empty())
+		throw std::invalid_argument("A profile cannot be generated and used by the same compile");
+
+	// Built on first use and kept for the thread's every later module, which
+	// a long-running process such as the compile server runs many of
+	thread_local std::map<std::tuple<llvm::TargetMachine*, OptLevel, std::string>, std::unique_ptr<Pipeline>> pipelines;
+	std::unique_ptr<Pipeline>& pipeline = pipelines[{ targetMachine, options.level, options.passPipeline }];
+	if (!pipeline) pipeline = std::make_unique<Pipeline>(targetMachine, options);
+
+	// Analysis results describe one module, so they start out empty
+	llvm::LoopAnalysisManager lam;
+	llvm::FunctionAnalysisManager fam;
+	llvm::CGSCCAnalysisManager cgam;
+	llvm::ModuleAnalysisManager mam;
+	llvm::PassBuilder& passBuilder = pipeline->passBuilder;
+	passBuilder.registerModuleAnalyses(mam);
+	passBuilder.registerCGSCCAnalyses(cgam);
+	passBuilder.registerFunctionAnalyses(fam);
+	passBuilder.registerLoopAnalyses(lam);
+	passBuilder.crossRegisterProxies(lam, fam, cgam, mam);
+
+	if (!options.profileGenerate.empty() || !options.profileUse.empty()) applyProfile(module, mam, options);
+	pipeline->timer.setTimes(passTimes);
+	pipeline->passes.run(module, mam);
+	pipeline->timer.setTimes(nullptr);
+}
@@ -0,0 +1,268 @@
+#include "include/parser.h"
+
+#include <algorithm>
+#include <array>
+
+QuarkParser::QuarkParser(const TokenBuffer& tokens, Ast& ast) : tokens(tokens), ast(ast), builder(ast) {
+	if (tokens.size() == 0 || tokens[tokens.size() - 1].kind != TokenKind::EndMarker)
+		throw QuarkSyntaxError("Token stream must end with EOF.");
+	start = tokens.start.valid() ? tokens.start : ast.sources().add("<input>", tokens.source);
+}
+
+const QuarkParser::Rule& QuarkParser::rule(TokenKind kind) {
+	static const std::array<Rule, static_cast<size_t>(TokenKind::Count)> rules = [] {
+		std::array<Rule, static_cast<size_t>(TokenKind::Count)> table{};
+		auto set = [&](TokenKind kind, Precedence precedence, PrefixFn prefix, InfixFn infix) {
+			table[static_cast<size_t>(kind)] = Rule{ precedence, prefix, infix };
+		};
+		set(TokenKind::PLUS, PrecTerm, nullptr, &QuarkParser::binary);
+		set(TokenKind::MINUS, PrecTerm, &QuarkParser::unary, &QuarkParser::binary);
+		set(TokenKind::MULTIPLY, PrecFactor, nullptr, &QuarkParser::binary);
+		set(TokenKind::DIVIDE, PrecFactor, nullptr, &QuarkParser::binary);
+		set(TokenKind::EQUALS, PrecAssignment, nullptr, &QuarkParser::binary);
+		set(TokenKind::NE, PrecZero, &QuarkParser::unary, nullptr);
+		set(TokenKind::INT, PrecZero, &QuarkParser::number, nullptr);
+		set(TokenKind::FLOAT, PrecZero, &QuarkParser::number, nullptr);
+		set(TokenKind::ID, PrecZero, &QuarkParser::identifier, nullptr);
+		set(TokenKind::LPAR, PrecZero, &QuarkParser::paren, nullptr);
+		set(TokenKind::AT, PrecZero, &QuarkParser::call, nullptr);
+		set(TokenKind::LBRACE, PrecCall, &QuarkParser::list, &QuarkParser::subscript);
+		set(TokenKind::PIPE, PrecPipe, nullptr, &QuarkParser::pipe);
+		return table;
+	}();
+	return rules[static_cast<size_t>(kind)];
+}
+
+// Util functions
+const LexToken& QuarkParser::peek(size_t index) const {
+	return tokens[std::min(cursor + index, tokens.size() - 1)];
+}
+
+const LexToken& QuarkParser::consume() {
+	const LexToken& tok = tokens[cursor];
+	if (cursor + 1 < tokens.size()) cursor++;
+	prevKind = tok.kind;
+	return tok;
+}
+
+const LexToken& QuarkParser::expect(TokenKind kind) {
+	if (cur().kind == kind) return consume();
+	throw error(cur(), std::string("Expected ") + tokenKindString(kind) + " but got " + tokenKindString(cur().kind) + ".");
+}
+
+Token QuarkParser::token(const LexToken& tok) {
+	return Token{ tok.kind, ast.symbols().intern(tokens.text(tok)), loc(tok) };
+}
+
+SourceLoc QuarkParser::loc(const LexToken& tok) const {
+	return start + tok.offset;
+}
+
+QuarkSyntaxError QuarkParser::error(const LexToken& at, const std::string& message) const {
+	return QuarkSyntaxError(ast.sources().describe(loc(at)) + ": " + message);
+}
+
+// Parsing functions
+void QuarkParser::block() {
+	builder.open(Block);
+
+	if (cur().kind == TokenKind::NEWLINE && peek().kind == TokenKind::INDENT)
+	{
+		consume();
+		consume();
+		statements(TokenKind::DEDENT);
+		expect(TokenKind::DEDENT);
+	}
+	else
+	{
+		line();
+	}
+
+	builder.close();
+}
+
+// Statements up to the end of the current line. A statement that ends in
+// its own block (a function body) has already consumed the line break.
+void QuarkParser::line() {
+	while (cur().kind != TokenKind::NEWLINE && cur().kind != TokenKind::EndMarker)
+	{
+		statement();
+		if (prevKind == TokenKind::NEWLINE || prevKind == TokenKind::DEDENT) return;
+	}
+
+	if (cur().kind == TokenKind::NEWLINE) consume();
+}
+
+void QuarkParser::statements(TokenKind end) {
+	while (cur().kind != end && cur().kind != TokenKind::EndMarker) line();
+}
+
+void QuarkParser::statement() {
+	if (cur().kind == TokenKind::IF)
+	{
+		throw error(cur(), "if statements are not supported yet.");
+	}
+	else if (cur().kind == TokenKind::FN || peek(2).kind == TokenKind::FN)
+	{
+		function();
+	}
+	else
+	{
+		// Calls included, which a pipe may follow
+		expression();
+	}
+}
+
+void QuarkParser::expression(Precedence precedence) {
+	parseExpr(precedence);
+}
+
+void QuarkParser::function() {
+	if (cur().kind == TokenKind::FN)
+	{
+		builder.open(Function, token(consume()));
+		builder.leaf(Identifier, token(expect(TokenKind::ID)));
+	}
+	else
+	{
+		Token id = token(expect(TokenKind::ID));
+		expect(TokenKind::EQUALS);
+		builder.open(Function, token(consume()));
+		builder.leaf(Identifier, id);
+	}
+
+	arguments();
+	expect(TokenKind::COLON);
+	block();
+	builder.close();
+}
+
+void QuarkParser::functionCall() {
+	builder.open(FunctionCall);
+	builder.leaf(Identifier, token(expect(TokenKind::ID)));
+	arguments();
+	builder.close();
+}
+
+void QuarkParser::arguments() {
+	builder.open(Arguments);
+
+	// A call inside parentheses or a list ends at the closing RPAR or RBRACE,
+	// and one in a pipe at the next |, so @f x | g pipes what f returns
+	while (cur().kind != TokenKind::COLON && cur().kind != TokenKind::NEWLINE && cur().kind != TokenKind::RPAR
+		&& cur().kind != TokenKind::RBRACE && cur().kind != TokenKind::PIPE)
+	{
+		expression(static_cast<Precedence>(PrecPipe + 1));
+
+		if (cur().kind == TokenKind::COMMA) consume();
+	}
+
+	builder.close();
+}
+
+NodeId QuarkParser::parse() {
+	builder.open(CompilationUnit);
+	builder.open(Block);
+	statements(TokenKind::EndMarker);
+	builder.close();
+	return builder.close();
+}
+
+// Pratt expression parser
+void QuarkParser::paren(const LexToken&) {
+	parseExpr();
+	expect(TokenKind::RPAR);
+}
+
+void QuarkParser::call(const LexToken&) {
+	functionCall();
+}
+
+void QuarkParser::identifier(const LexToken& tok) {
+	builder.leaf(Identifier, token(tok));
+}
+
+void QuarkParser::number(const LexToken& tok) {
+	builder.leaf(Literal, token(tok));
+}
+
+void QuarkParser::unary(const LexToken& tok) {
+	builder.open(Operator, token(tok));
+	parseExpr(PrecUnary);
+	builder.close();
+}
+
+void QuarkParser::binary(const LexToken& tok) {
+	// The left operand was attached last; it becomes the operator's first child
+	builder.openAround(Operator, token(tok));
+	parseExpr(static_cast<Precedence>(rule(tok.kind).precedence + 1));
+	builder.close();
+}
+
+// [a, b, c], with an optional trailing comma
+void QuarkParser::list(const LexToken& tok) {
+	builder.open(List, token(tok));
+	while (cur().kind != TokenKind::RBRACE)
+	{
+		parseExpr();
+		if (cur().kind != TokenKind::COMMA) break;
+		consume();
+	}
+	expect(TokenKind::RBRACE);
+	builder.close();
+}
+
+// list[index] is an Operator on the [ token
+void QuarkParser::subscript(const LexToken& tok) {
+	builder.openAround(Operator, token(tok));
+	parseExpr();
+	expect(TokenKind::RBRACE);
+	builder.close();
+}
+
+// a | f x | g is one Pipe node on the first | over a and a FunctionCall per
+// stage, which gets the piped value ahead of its own arguments
+void QuarkParser::pipe(const LexToken& tok) {
+	builder.openAround(Pipe, token(tok));
+	stage();
+	while (cur().kind == TokenKind::PIPE)
+	{
+		consume();
+		stage();
+	}
+	builder.close();
+}
+
+// Arguments are separated by spaces, as a comma ends the whole pipe, and
+// each one ends at the next |
+void QuarkParser::stage() {
+	builder.open(FunctionCall);
+	builder.leaf(Identifier, token(expect(TokenKind::ID)));
+	builder.open(Arguments);
+	for (TokenKind kind = cur().kind; kind != TokenKind::PIPE && kind != TokenKind::RPAR && kind != TokenKind::RBRACE
+		&& kind != TokenKind::NEWLINE && kind != TokenKind::COMMA && kind != TokenKind::COLON && kind != TokenKind::EndMarker;
+		kind = cur().kind)
+	{
+		parseExpr(static_cast<Precedence>(PrecPipe + 1));
+	}
+	builder.close();
+	builder.close();
+}
+
+void QuarkParser::parseExpr(Precedence precedence) {
+	const LexToken& tok = consume();
+	PrefixFn prefix = rule(tok.kind).prefix;
+
+	if (!prefix) throw error(tok, "Expected expression.");
+
+	(this->*prefix)(tok);
+
+	for (TokenKind kind = cur().kind;
+		kind != TokenKind::RPAR && kind != TokenKind::RBRACE && kind != TokenKind::NEWLINE && kind != TokenKind::COMMA
+		&& kind != TokenKind::COLON && rule(kind).precedence >= precedence;
+		kind = cur().kind)
+	{
+		const LexToken& op = consume();
+		(this->*rule(op.kind).infix)(op);
+	}
+}
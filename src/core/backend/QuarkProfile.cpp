@@ -0,0 +1,207 @@
+#include "include/profile.h"
+#include "include/codegen.h"
+
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <llvm/IR/Module.h>
+#include <llvm/ProfileData/InstrProf.h>
+#include <llvm/ProfileData/InstrProfReader.h>
+#include <llvm/ProfileData/InstrProfWriter.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/SHA1.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Target/TargetMachine.h>
+#include <llvm/Transforms/Utils/ModuleUtils.h>
+
+namespace {
+
+// Laid out as QuarkProfileRecord
+llvm::StructType* recordType(llvm::LLVMContext& context) {
+	llvm::Type* i64 = llvm::Type::getInt64Ty(context);
+	return llvm::StructType::get(llvm::Type::getInt8PtrTy(context), i64, i64, llvm::PointerType::getUnqual(i64));
+}
+
+// What nothing reads once the increments are lowered: the intrinsics, the
+// function names they took, and the raw format version, which only
+// compiler-rt's writer looks at
+void eraseProfileGlobals(llvm::Module& module) {
+	for (llvm::Function& fn : llvm::make_early_inc_range(module))
+		if (fn.isIntrinsic() && fn.getName().startswith("llvm.instrprof.") && fn.use_empty()) fn.eraseFromParent();
+
+	for (llvm::GlobalVariable& global : llvm::make_early_inc_range(module.globals()))
+	{
+		global.removeDeadConstantUsers();
+		bool name = global.getName().startswith(llvm::getInstrProfNameVarPrefix()) && global.use_empty();
+		if (!name && global.getName() != "__llvm_profile_raw_version") continue;
+		if (llvm::Comdat* comdat = global.getComdat())
+		{
+			global.setComdat(nullptr);
+			module.getComdatSymbolTable().erase(comdat->getName());
+		}
+		global.eraseFromParent();
+	}
+}
+
+}
+
+std::string profileSymbol(std::string_view function) {
+	return "__quark_profile." + std::string(function);
+}
+
+std::string siteSymbol(std::string_view function) {
+	return "__quark_sites." + std::string(function);
+}
+
+void lowerProfileCounters(llvm::Module& module) {
+	llvm::LLVMContext& context = module.getContext();
+	llvm::IRBuilder<> builder(context);
+	llvm::Type* i64 = builder.getInt64Ty();
+	llvm::StructType* record = recordType(context);
+
+	for (llvm::Function& fn : module)
+	{
+		if (fn.isDeclaration()) continue;
+
+		// Every increment of a function carries its hash and counter count
+		llvm::GlobalVariable* counters = nullptr;
+		uint64_t hash = 0, counterCount = 0;
+		std::vector<llvm::Instruction*> lowered;
+		for (llvm::Instruction& inst : llvm::instructions(fn))
+		{
+			auto* intrinsic = llvm::dyn_cast<llvm::IntrinsicInst>(&inst);
+			if (!intrinsic) continue;
+			switch (intrinsic->getIntrinsicID())
+			{
+			case llvm::Intrinsic::instrprof_increment:
+			case llvm::Intrinsic::instrprof_increment_step:
+			{
+				auto* increment = static_cast<llvm::InstrProfIncrementInst*>(intrinsic);
+				if (!counters)
+				{
+					hash = increment->getHash()->getZExtValue();
+					counterCount = increment->getNumCounters()->getZExtValue();
+					auto* type = llvm::ArrayType::get(i64, counterCount);
+					counters = new llvm::GlobalVariable(module, type, false, llvm::GlobalValue::PrivateLinkage,
+						llvm::ConstantAggregateZero::get(type), "__quark_counters." + fn.getName());
+				}
+				// Not atomic, like clang's counters by default: a lost update
+				// skews a count, it does not break the profile
+				builder.SetInsertPoint(increment);
+				llvm::Value* counter = builder.CreateConstInBoundsGEP2_64(counters->getValueType(), counters, 0,
+					increment->getIndex()->getZExtValue());
+				builder.CreateStore(builder.CreateAdd(builder.CreateLoad(i64, counter), increment->getStep()), counter);
+				lowered.push_back(increment);
+				break;
+			}
+			case llvm::Intrinsic::instrprof_value_profile:
+				// Value profiles need compiler-rt's runtime; the counters are
+				// what block layout and branch weights come from
+				lowered.push_back(intrinsic);
+				break;
+			default: break;
+			}
+		}
+		for (llvm::Instruction* inst : lowered) inst->eraseFromParent();
+
+		llvm::Constant* fields[] = {
+			builder.CreateGlobalStringPtr(llvm::getPGOFuncName(fn), "__quark_profile_name." + fn.getName(), 0, &module),
+			builder.getInt64(hash),
+			builder.getInt64(counterCount),
+			counters ? llvm::ConstantExpr::getInBoundsGetElementPtr(counters->getValueType(), counters,
+				llvm::ArrayRef<llvm::Constant*>{ builder.getInt64(0), builder.getInt64(0) })
+					 : llvm::ConstantPointerNull::get(llvm::PointerType::getUnqual(i64)),
+		};
+		new llvm::GlobalVariable(module, record, true, llvm::GlobalValue::ExternalLinkage, llvm::ConstantStruct::get(record, fields),
+			profileSymbol(fn.getName().str()));
+	}
+	eraseProfileGlobals(module);
+}
+
+std::string profileDigest(const std::string& path) {
+	auto buffer = llvm::MemoryBuffer::getFile(path, false, false);
+	if (!buffer) throw QuarkCodegenError("Cannot read the profile " + path + ": " + buffer.getError().message());
+	if (!llvm::IndexedInstrProfReader::hasFormat(**buffer))
+		throw QuarkCodegenError(path + " is not an indexed profile, merge it first");
+	return cacheKeyString(llvm::SHA1::hash(llvm::arrayRefFromStringRef((*buffer)->getBuffer())));
+}
+
+void mergeProfiles(const std::vector<std::string>& inputs, const std::string& output) {
+	llvm::InstrProfWriter writer;
+	for (const std::string& input : inputs)
+	{
+		auto reader = llvm::InstrProfReader::create(input);
+		if (!reader) throw QuarkCodegenError("Cannot read the profile " + input + ": " + llvm::toString(reader.takeError()));
+		if (llvm::Error err = writer.mergeProfileKind((*reader)->getProfileKind()))
+			throw QuarkCodegenError("Cannot merge " + input + ": " + llvm::toString(std::move(err)));
+
+		// A record whose counters disagree with one merged before is dropped,
+		// as llvm-profdata drops it after warning
+		for (llvm::NamedInstrProfRecord& record : **reader)
+			writer.addRecord(std::move(record), 1, [](llvm::Error err) { llvm::consumeError(std::move(err)); });
+		if (llvm::Error err = (*reader)->getError())
+			throw QuarkCodegenError("Cannot read the profile " + input + ": " + llvm::toString(std::move(err)));
+	}
+
+	std::error_code ec;
+	llvm::raw_fd_ostream os(output, ec);
+	if (ec) throw QuarkCodegenError("Cannot write " + output + ": " + ec.message());
+	if (llvm::Error err = writer.write(os)) throw QuarkCodegenError("Cannot write " + output + ": " + llvm::toString(std::move(err)));
+	os.close();
+	if (os.has_error()) throw QuarkCodegenError("Cannot write " + output + ": " + os.error().message());
+}
+
+std::unique_ptr<llvm::Module> lowerProfileRegistration(const std::vector<std::string>& functions, const std::string& path,
+	llvm::LLVMContext& context, const llvm::TargetMachine& targetMachine) {
+	auto module = std::make_unique<llvm::Module>("quark.profile", context);
+	module->setDataLayout(targetMachine.createDataLayout());
+	module->setTargetTriple(targetMachine.getTargetTriple().str());
+	llvm::IRBuilder<> builder(context);
+
+	llvm::StructType* record = recordType(context);
+	std::vector<llvm::Constant*> records;
+	for (const std::string& function : functions)
+		records.push_back(llvm::cast<llvm::Constant>(module->getOrInsertGlobal(profileSymbol(function), record)));
+	auto* arrayType = llvm::ArrayType::get(llvm::PointerType::getUnqual(record), records.size());
+	auto* array = new llvm::GlobalVariable(*module, arrayType, true, llvm::GlobalValue::PrivateLinkage,
+		llvm::ConstantArray::get(arrayType, records), "__quark_profile_records");
+
+	auto* init = llvm::Function::Create(llvm::FunctionType::get(builder.getVoidTy(), false), llvm::Function::InternalLinkage,
+		"__quark_profile_init", module.get());
+	builder.SetInsertPoint(llvm::BasicBlock::Create(context, "entry", init));
+	llvm::FunctionCallee registerRecords = module->getOrInsertFunction("quark_profile_init", builder.getVoidTy(),
+		builder.getInt8PtrTy(), llvm::PointerType::getUnqual(llvm::PointerType::getUnqual(record)), builder.getInt64Ty());
+	builder.CreateCall(registerRecords, { builder.CreateGlobalStringPtr(path, "__quark_profile_path"),
+		builder.CreateConstInBoundsGEP2_64(arrayType, array, 0, 0), builder.getInt64(records.size()) });
+	builder.CreateRetVoid();
+	llvm::appendToGlobalCtors(*module, init, 0);
+	return module;
+}
+
+std::unique_ptr<llvm::Module> lowerSiteRegistration(const std::vector<std::string>& functions, llvm::LLVMContext& context,
+	const llvm::TargetMachine& targetMachine) {
+	auto module = std::make_unique<llvm::Module>("quark.sites", context);
+	module->setDataLayout(targetMachine.createDataLayout());
+	module->setTargetTriple(targetMachine.getTargetTriple().str());
+	llvm::IRBuilder<> builder(context);
+
+	// Only the address of each table is taken, so its type is opaque here
+	llvm::Type* table = builder.getInt8Ty();
+	std::vector<llvm::Constant*> tables;
+	for (const std::string& function : functions)
+		tables.push_back(llvm::cast<llvm::Constant>(module->getOrInsertGlobal(siteSymbol(function), table)));
+	auto* arrayType = llvm::ArrayType::get(llvm::PointerType::getUnqual(table), tables.size());
+	auto* array = new llvm::GlobalVariable(*module, arrayType, true, llvm::GlobalValue::PrivateLinkage,
+		llvm::ConstantArray::get(arrayType, tables), "__quark_site_tables");
+
+	auto* init = llvm::Function::Create(llvm::FunctionType::get(builder.getVoidTy(), false), llvm::Function::InternalLinkage,
+		"__quark_sites_init", module.get());
+	builder.SetInsertPoint(llvm::BasicBlock::Create(context, "entry", init));
+	llvm::FunctionCallee registerTables = module->getOrInsertFunction("quark_sites_init", builder.getVoidTy(),
+		llvm::PointerType::getUnqual(llvm::PointerType::getUnqual(table)), builder.getInt64Ty());
+	builder.CreateCall(registerTables, { builder.CreateConstInBoundsGEP2_64(arrayType, array, 0, 0), builder.getInt64(tables.size()) });
+	builder.CreateRetVoid();
+	llvm::appendToGlobalCtors(*module, init, 0);
+	return module;
+}
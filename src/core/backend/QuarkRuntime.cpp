@@ -0,0 +1,1191 @@
+#include "include/runtime.h"
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cinttypes>
+#include <cmath>
+#include <csetjmp>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+
+#if defined(_WIN32)
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+// AVX2 kernels are compiled with target attributes and picked at run time,
+// so the library itself still runs on any x86-64. AArch64 always has NEON.
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define QUARK_RUNTIME_AVX2 1
+#include <immintrin.h>
+#define QUARK_AVX2 __attribute__((target("avx2")))
+#endif
+#if defined(__aarch64__) || defined(_M_ARM64)
+#define QUARK_RUNTIME_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+// The lanes of a Float reduction are four AVX2 registers, eight NEON ones
+// or an array
+constexpr int64_t Lanes = ReductionLanes;
+
+struct Trap
+{
+	std::jmp_buf env;
+	char message[256];
+};
+
+thread_local Trap* currentTrap = nullptr;
+thread_local ListArena* currentArena = nullptr;
+
+// Nothing between runProgram and here may need destroying: the frames in
+// between are generated code and the plain C entry points below
+[[noreturn]] void fail(const char* format, ...) {
+	char message[sizeof(Trap::message)];
+	va_list args;
+	va_start(args, format);
+	std::vsnprintf(message, sizeof(message), format, args);
+	va_end(args);
+
+	if (Trap* trap = currentTrap)
+	{
+		std::memcpy(trap->message, message, sizeof(message));
+		std::longjmp(trap->env, 1);
+	}
+	std::fprintf(stderr, "Runtime error: %s\n", message);
+	std::exit(1);
+}
+
+// Elements are 8 bytes of either kind
+constexpr uint64_t MaxListLength = (SIZE_MAX - sizeof(QuarkList)) / sizeof(int64_t);
+
+QuarkList* allocate(int64_t length) {
+	// A length whose size does not fit would wrap to a small block
+	if (static_cast<uint64_t>(length) > MaxListLength) fail("Out of memory for a list of %lld elements", static_cast<long long>(length));
+	auto* list = static_cast<QuarkList*>(std::malloc(sizeof(QuarkList) + static_cast<size_t>(length) * sizeof(int64_t)));
+	if (!list) fail("Out of memory for a list of %lld elements", static_cast<long long>(length));
+	list->length = length;
+	list->reserved = 0;
+	if (currentArena) currentArena->adopt(list);
+	return list;
+}
+
+void checkLengths(const QuarkList* lhs, const QuarkList* rhs) {
+	if (lhs->length != rhs->length)
+	{
+		fail("Lists of %lld and %lld elements cannot be combined element-wise", static_cast<long long>(lhs->length),
+			static_cast<long long>(rhs->length));
+	}
+}
+
+bool containsZero(const int64_t* values, int64_t n) {
+	int64_t zeros = 0;
+	for (int64_t i = 0; i < n; i++) zeros += values[i] == 0;
+	return zeros != 0;
+}
+
+// Portable kernels, which the compiler is free to vectorize for the baseline
+// target. Ints wrap like the generated code; INT64_MIN / -1 wraps as well.
+
+int64_t divide(int64_t x, int64_t y) {
+	if (y == -1) return static_cast<int64_t>(0 - static_cast<uint64_t>(x));
+	return x / y;
+}
+
+template <ListOp Op>
+int64_t apply(int64_t x, int64_t y) {
+	uint64_t a = static_cast<uint64_t>(x), b = static_cast<uint64_t>(y);
+	if constexpr (Op == ListOp::Add) return static_cast<int64_t>(a + b);
+	else if constexpr (Op == ListOp::Sub) return static_cast<int64_t>(a - b);
+	else if constexpr (Op == ListOp::Mul) return static_cast<int64_t>(a * b);
+	else if constexpr (Op == ListOp::Div) return divide(x, y);
+	else if constexpr (Op == ListOp::RevSub) return static_cast<int64_t>(b - a);
+	else return divide(y, x);
+}
+
+template <ListOp Op>
+double apply(double x, double y) {
+	if constexpr (Op == ListOp::Add) return x + y;
+	else if constexpr (Op == ListOp::Sub) return x - y;
+	else if constexpr (Op == ListOp::Mul) return x * y;
+	else if constexpr (Op == ListOp::Div) return x / y;
+	else if constexpr (Op == ListOp::RevSub) return y - x;
+	else return y / x;
+}
+
+template <ListCompare Compare, typename T>
+int64_t compare(T x, T y) {
+	if constexpr (Compare == ListCompare::Lt) return x < y;
+	else if constexpr (Compare == ListCompare::Le) return x <= y;
+	else if constexpr (Compare == ListCompare::Gt) return x > y;
+	else if constexpr (Compare == ListCompare::Ge) return x >= y;
+	else if constexpr (Compare == ListCompare::Eq) return x == y;
+	else return x != y;
+}
+
+// The right operand is a list or a scalar broadcast over the left one
+template <typename T>
+T operand(const T* values, int64_t i) { return values[i]; }
+template <typename T>
+T operand(T value, int64_t) { return value; }
+
+// From element i on, so SIMD loops can hand over their tail
+template <ListOp Op, typename T, typename Rhs>
+void arithLoop(const T* lhs, Rhs rhs, T* out, int64_t i, int64_t n) {
+	for (; i < n; i++) out[i] = apply<Op>(lhs[i], operand<T>(rhs, i));
+}
+
+template <typename T, typename Rhs>
+void scalarArith(ListOp op, const T* lhs, Rhs rhs, T* out, int64_t n) {
+	switch (op)
+	{
+	case ListOp::Add: return arithLoop<ListOp::Add>(lhs, rhs, out, 0, n);
+	case ListOp::Sub: return arithLoop<ListOp::Sub>(lhs, rhs, out, 0, n);
+	case ListOp::Mul: return arithLoop<ListOp::Mul>(lhs, rhs, out, 0, n);
+	case ListOp::Div: return arithLoop<ListOp::Div>(lhs, rhs, out, 0, n);
+	case ListOp::RevSub: return arithLoop<ListOp::RevSub>(lhs, rhs, out, 0, n);
+	default: return arithLoop<ListOp::RevDiv>(lhs, rhs, out, 0, n);
+	}
+}
+
+template <ListCompare Compare, typename T, typename Rhs>
+void compareLoop(const T* lhs, Rhs rhs, int64_t* out, int64_t i, int64_t n) {
+	for (; i < n; i++) out[i] = compare<Compare>(lhs[i], operand<T>(rhs, i));
+}
+
+template <typename T, typename Rhs>
+void scalarCompare(ListCompare op, const T* lhs, Rhs rhs, int64_t* out, int64_t n) {
+	switch (op)
+	{
+	case ListCompare::Lt: return compareLoop<ListCompare::Lt>(lhs, rhs, out, 0, n);
+	case ListCompare::Le: return compareLoop<ListCompare::Le>(lhs, rhs, out, 0, n);
+	case ListCompare::Gt: return compareLoop<ListCompare::Gt>(lhs, rhs, out, 0, n);
+	case ListCompare::Ge: return compareLoop<ListCompare::Ge>(lhs, rhs, out, 0, n);
+	case ListCompare::Eq: return compareLoop<ListCompare::Eq>(lhs, rhs, out, 0, n);
+	default: return compareLoop<ListCompare::Ne>(lhs, rhs, out, 0, n);
+	}
+}
+
+int64_t scalarSumI64(const int64_t* values, int64_t n) {
+	uint64_t sum = 0;
+	for (int64_t i = 0; i < n; i++) sum += static_cast<uint64_t>(values[i]);
+	return static_cast<int64_t>(sum);
+}
+
+// Lanes already filled up to element i; adds the rest and combines them
+double finishSum(double* lanes, const double* values, int64_t i, int64_t n) {
+	for (int64_t lane = 0; i < n; i++, lane++) lanes[lane] += values[i];
+	double sum = lanes[0];
+	for (int64_t lane = 1; lane < Lanes; lane++) sum += lanes[lane];
+	return sum;
+}
+
+double scalarSumF64(const double* values, int64_t n) {
+	double lanes[Lanes] = {};
+	int64_t i = 0;
+	for (; i + Lanes <= n; i += Lanes)
+		for (int64_t lane = 0; lane < Lanes; lane++) lanes[lane] += values[i + lane];
+	return finishSum(lanes, values, i, n);
+}
+
+// x < m ? x : m, which is what MINPD computes: a NaN element is passed over
+// unless it is the first one, and of two zeros the one seen first is kept
+template <bool Max, typename T>
+T pick(T x, T m) {
+	if constexpr (Max) return x > m ? x : m;
+	else return x < m ? x : m;
+}
+
+template <bool Max, typename T>
+T scalarExtreme(const T* values, int64_t n) {
+	T m = values[0];
+	for (int64_t i = 1; i < n; i++) m = pick<Max>(values[i], m);
+	return m;
+}
+
+template <bool Max>
+double finishExtreme(double* lanes, const double* values, int64_t i, int64_t n) {
+	for (int64_t lane = 0; i < n; i++, lane++) lanes[lane] = pick<Max>(values[i], lanes[lane]);
+	double m = lanes[0];
+	for (int64_t lane = 1; lane < Lanes; lane++) m = pick<Max>(lanes[lane], m);
+	return m;
+}
+
+// Floats go through the lanes so that ties between zeros resolve alike
+template <bool Max>
+double scalarExtremeF64(const double* values, int64_t n) {
+	double lanes[Lanes];
+	for (double& lane : lanes) lane = values[0];
+	int64_t i = 0;
+	for (; i + Lanes <= n; i += Lanes)
+		for (int64_t lane = 0; lane < Lanes; lane++) lanes[lane] = pick<Max>(values[i + lane], lanes[lane]);
+	return finishExtreme<Max>(lanes, values, i, n);
+}
+
+// Writes every element before testing it, so there is no branch to mispredict
+int64_t scalarFilter(const int64_t* values, const int64_t* mask, int64_t* out, int64_t n) {
+	int64_t count = 0;
+	for (int64_t i = 0; i < n; i++)
+	{
+		out[count] = values[i];
+		count += mask[i] != 0;
+	}
+	return count;
+}
+
+struct Kernels
+{
+	void (*arithI64)(ListOp, const int64_t*, const int64_t*, int64_t*, int64_t);
+	void (*arithScalarI64)(ListOp, const int64_t*, int64_t, int64_t*, int64_t);
+	void (*arithF64)(ListOp, const double*, const double*, double*, int64_t);
+	void (*arithScalarF64)(ListOp, const double*, double, double*, int64_t);
+	void (*compareI64)(ListCompare, const int64_t*, const int64_t*, int64_t*, int64_t);
+	void (*compareScalarI64)(ListCompare, const int64_t*, int64_t, int64_t*, int64_t);
+	void (*compareF64)(ListCompare, const double*, const double*, int64_t*, int64_t);
+	void (*compareScalarF64)(ListCompare, const double*, double, int64_t*, int64_t);
+	int64_t (*sumI64)(const int64_t*, int64_t);
+	double (*sumF64)(const double*, int64_t);
+	int64_t (*minI64)(const int64_t*, int64_t);
+	int64_t (*maxI64)(const int64_t*, int64_t);
+	double (*minF64)(const double*, int64_t);
+	double (*maxF64)(const double*, int64_t);
+	int64_t (*filter)(const int64_t*, const int64_t*, int64_t*, int64_t);
+};
+
+const Kernels ScalarKernels = {
+	&scalarArith<int64_t, const int64_t*>,
+	&scalarArith<int64_t, int64_t>,
+	&scalarArith<double, const double*>,
+	&scalarArith<double, double>,
+	&scalarCompare<int64_t, const int64_t*>,
+	&scalarCompare<int64_t, int64_t>,
+	&scalarCompare<double, const double*>,
+	&scalarCompare<double, double>,
+	&scalarSumI64,
+	&scalarSumF64,
+	&scalarExtreme<false, int64_t>,
+	&scalarExtreme<true, int64_t>,
+	&scalarExtremeF64<false>,
+	&scalarExtremeF64<true>,
+	&scalarFilter,
+};
+
+#ifdef QUARK_RUNTIME_AVX2
+
+QUARK_AVX2 inline __m256i avxInts(const int64_t* values, int64_t i) {
+	return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values + i));
+}
+QUARK_AVX2 inline __m256i avxInts(int64_t value, int64_t) { return _mm256_set1_epi64x(value); }
+QUARK_AVX2 inline __m256d avxFloats(const double* values, int64_t i) { return _mm256_loadu_pd(values + i); }
+QUARK_AVX2 inline __m256d avxFloats(double value, int64_t) { return _mm256_set1_pd(value); }
+QUARK_AVX2 inline void avxStore(int64_t* out, int64_t i, __m256i value) {
+	_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), value);
+}
+
+template <ListOp Op>
+QUARK_AVX2 __m256d avxApply(__m256d x, __m256d y) {
+	if constexpr (Op == ListOp::Add) return _mm256_add_pd(x, y);
+	else if constexpr (Op == ListOp::Sub) return _mm256_sub_pd(x, y);
+	else if constexpr (Op == ListOp::Mul) return _mm256_mul_pd(x, y);
+	else if constexpr (Op == ListOp::Div) return _mm256_div_pd(x, y);
+	else if constexpr (Op == ListOp::RevSub) return _mm256_sub_pd(y, x);
+	else return _mm256_div_pd(y, x);
+}
+
+template <ListOp Op, typename Rhs>
+QUARK_AVX2 void avxArithLoop(const double* lhs, Rhs rhs, double* out, int64_t n) {
+	int64_t i = 0;
+	for (; i + 4 <= n; i += 4) _mm256_storeu_pd(out + i, avxApply<Op>(avxFloats(lhs, i), avxFloats(rhs, i)));
+	arithLoop<Op>(lhs, rhs, out, i, n);
+}
+
+// AVX2 has no 64-bit multiply or divide, so those stay scalar
+template <ListOp Op, typename Rhs>
+QUARK_AVX2 void avxArithLoop(const int64_t* lhs, Rhs rhs, int64_t* out, int64_t n) {
+	if constexpr (Op != ListOp::Add && Op != ListOp::Sub && Op != ListOp::RevSub)
+	{
+		arithLoop<Op>(lhs, rhs, out, 0, n);
+	}
+	else
+	{
+		int64_t i = 0;
+		for (; i + 4 <= n; i += 4)
+		{
+			__m256i x = avxInts(lhs, i), y = avxInts(rhs, i);
+			if constexpr (Op == ListOp::Add) avxStore(out, i, _mm256_add_epi64(x, y));
+			else if constexpr (Op == ListOp::Sub) avxStore(out, i, _mm256_sub_epi64(x, y));
+			else avxStore(out, i, _mm256_sub_epi64(y, x));
+		}
+		arithLoop<Op>(lhs, rhs, out, i, n);
+	}
+}
+
+template <typename T, typename Rhs>
+QUARK_AVX2 void avxArith(ListOp op, const T* lhs, Rhs rhs, T* out, int64_t n) {
+	switch (op)
+	{
+	case ListOp::Add: return avxArithLoop<ListOp::Add>(lhs, rhs, out, n);
+	case ListOp::Sub: return avxArithLoop<ListOp::Sub>(lhs, rhs, out, n);
+	case ListOp::Mul: return avxArithLoop<ListOp::Mul>(lhs, rhs, out, n);
+	case ListOp::Div: return avxArithLoop<ListOp::Div>(lhs, rhs, out, n);
+	case ListOp::RevSub: return avxArithLoop<ListOp::RevSub>(lhs, rhs, out, n);
+	default: return avxArithLoop<ListOp::RevDiv>(lhs, rhs, out, n);
+	}
+}
+
+// Both return lanes of 0 or 1. NE is the unordered comparison, true for NaN
+// like != in C.
+template <ListCompare Compare>
+QUARK_AVX2 __m256i avxCompare(__m256d x, __m256d y) {
+	__m256d mask;
+	if constexpr (Compare == ListCompare::Lt) mask = _mm256_cmp_pd(x, y, _CMP_LT_OQ);
+	else if constexpr (Compare == ListCompare::Le) mask = _mm256_cmp_pd(x, y, _CMP_LE_OQ);
+	else if constexpr (Compare == ListCompare::Gt) mask = _mm256_cmp_pd(x, y, _CMP_GT_OQ);
+	else if constexpr (Compare == ListCompare::Ge) mask = _mm256_cmp_pd(x, y, _CMP_GE_OQ);
+	else if constexpr (Compare == ListCompare::Eq) mask = _mm256_cmp_pd(x, y, _CMP_EQ_OQ);
+	else mask = _mm256_cmp_pd(x, y, _CMP_NEQ_UQ);
+	return _mm256_and_si256(_mm256_castpd_si256(mask), _mm256_set1_epi64x(1));
+}
+
+template <ListCompare Compare>
+QUARK_AVX2 __m256i avxCompare(__m256i x, __m256i y) {
+	__m256i one = _mm256_set1_epi64x(1);
+	if constexpr (Compare == ListCompare::Lt) return _mm256_and_si256(_mm256_cmpgt_epi64(y, x), one);
+	else if constexpr (Compare == ListCompare::Le) return _mm256_andnot_si256(_mm256_cmpgt_epi64(x, y), one);
+	else if constexpr (Compare == ListCompare::Gt) return _mm256_and_si256(_mm256_cmpgt_epi64(x, y), one);
+	else if constexpr (Compare == ListCompare::Ge) return _mm256_andnot_si256(_mm256_cmpgt_epi64(y, x), one);
+	else if constexpr (Compare == ListCompare::Eq) return _mm256_and_si256(_mm256_cmpeq_epi64(x, y), one);
+	else return _mm256_andnot_si256(_mm256_cmpeq_epi64(x, y), one);
+}
+
+template <ListCompare Compare, typename Rhs>
+QUARK_AVX2 void avxCompareLoop(const double* lhs, Rhs rhs, int64_t* out, int64_t n) {
+	int64_t i = 0;
+	for (; i + 4 <= n; i += 4) avxStore(out, i, avxCompare<Compare>(avxFloats(lhs, i), avxFloats(rhs, i)));
+	compareLoop<Compare>(lhs, rhs, out, i, n);
+}
+
+template <ListCompare Compare, typename Rhs>
+QUARK_AVX2 void avxCompareLoop(const int64_t* lhs, Rhs rhs, int64_t* out, int64_t n) {
+	int64_t i = 0;
+	for (; i + 4 <= n; i += 4) avxStore(out, i, avxCompare<Compare>(avxInts(lhs, i), avxInts(rhs, i)));
+	compareLoop<Compare>(lhs, rhs, out, i, n);
+}
+
+template <typename T, typename Rhs>
+QUARK_AVX2 void avxCompareAll(ListCompare op, const T* lhs, Rhs rhs, int64_t* out, int64_t n) {
+	switch (op)
+	{
+	case ListCompare::Lt: return avxCompareLoop<ListCompare::Lt>(lhs, rhs, out, n);
+	case ListCompare::Le: return avxCompareLoop<ListCompare::Le>(lhs, rhs, out, n);
+	case ListCompare::Gt: return avxCompareLoop<ListCompare::Gt>(lhs, rhs, out, n);
+	case ListCompare::Ge: return avxCompareLoop<ListCompare::Ge>(lhs, rhs, out, n);
+	case ListCompare::Eq: return avxCompareLoop<ListCompare::Eq>(lhs, rhs, out, n);
+	default: return avxCompareLoop<ListCompare::Ne>(lhs, rhs, out, n);
+	}
+}
+
+QUARK_AVX2 int64_t avxSumI64(const int64_t* values, int64_t n) {
+	__m256i acc0 = _mm256_setzero_si256(), acc1 = acc0, acc2 = acc0, acc3 = acc0;
+	int64_t i = 0;
+	for (; i + Lanes <= n; i += Lanes)
+	{
+		acc0 = _mm256_add_epi64(acc0, avxInts(values, i));
+		acc1 = _mm256_add_epi64(acc1, avxInts(values, i + 4));
+		acc2 = _mm256_add_epi64(acc2, avxInts(values, i + 8));
+		acc3 = _mm256_add_epi64(acc3, avxInts(values, i + 12));
+	}
+	int64_t lanes[4];
+	avxStore(lanes, 0, _mm256_add_epi64(_mm256_add_epi64(acc0, acc1), _mm256_add_epi64(acc2, acc3)));
+	uint64_t sum = static_cast<uint64_t>(scalarSumI64(lanes, 4));
+	return static_cast<int64_t>(sum + static_cast<uint64_t>(scalarSumI64(values + i, n - i)));
+}
+
+QUARK_AVX2 double avxSumF64(const double* values, int64_t n) {
+	__m256d acc0 = _mm256_setzero_pd(), acc1 = acc0, acc2 = acc0, acc3 = acc0;
+	int64_t i = 0;
+	for (; i + Lanes <= n; i += Lanes)
+	{
+		acc0 = _mm256_add_pd(acc0, avxFloats(values, i));
+		acc1 = _mm256_add_pd(acc1, avxFloats(values, i + 4));
+		acc2 = _mm256_add_pd(acc2, avxFloats(values, i + 8));
+		acc3 = _mm256_add_pd(acc3, avxFloats(values, i + 12));
+	}
+	double lanes[Lanes];
+	_mm256_storeu_pd(lanes, acc0);
+	_mm256_storeu_pd(lanes + 4, acc1);
+	_mm256_storeu_pd(lanes + 8, acc2);
+	_mm256_storeu_pd(lanes + 12, acc3);
+	return finishSum(lanes, values, i, n);
+}
+
+template <bool Max>
+QUARK_AVX2 int64_t avxExtremeI64(const int64_t* values, int64_t n) {
+	__m256i m = _mm256_set1_epi64x(values[0]);
+	int64_t i = 0;
+	for (; i + 4 <= n; i += 4)
+	{
+		__m256i x = avxInts(values, i);
+		m = _mm256_blendv_epi8(m, x, Max ? _mm256_cmpgt_epi64(x, m) : _mm256_cmpgt_epi64(m, x));
+	}
+	int64_t lanes[4];
+	avxStore(lanes, 0, m);
+	int64_t result = scalarExtreme<Max>(lanes, 4);
+	for (; i < n; i++) result = pick<Max>(values[i], result);
+	return result;
+}
+
+// MINPD and MAXPD return their second operand unless the first is strictly
+// smaller or larger, exactly as pick() does
+template <bool Max>
+QUARK_AVX2 inline __m256d avxPick(__m256d x, __m256d m) {
+	return Max ? _mm256_max_pd(x, m) : _mm256_min_pd(x, m);
+}
+
+template <bool Max>
+QUARK_AVX2 double avxExtremeF64(const double* values, int64_t n) {
+	__m256d acc0 = _mm256_set1_pd(values[0]), acc1 = acc0, acc2 = acc0, acc3 = acc0;
+	int64_t i = 0;
+	for (; i + Lanes <= n; i += Lanes)
+	{
+		acc0 = avxPick<Max>(avxFloats(values, i), acc0);
+		acc1 = avxPick<Max>(avxFloats(values, i + 4), acc1);
+		acc2 = avxPick<Max>(avxFloats(values, i + 8), acc2);
+		acc3 = avxPick<Max>(avxFloats(values, i + 12), acc3);
+	}
+	double lanes[Lanes];
+	_mm256_storeu_pd(lanes, acc0);
+	_mm256_storeu_pd(lanes + 4, acc1);
+	_mm256_storeu_pd(lanes + 8, acc2);
+	_mm256_storeu_pd(lanes + 12, acc3);
+	return finishExtreme<Max>(lanes, values, i, n);
+}
+
+// For each 4-bit keep mask, the 32-bit halves of the kept lanes moved to
+// the front
+struct CompressTable
+{
+	alignas(32) int32_t index[16][8];
+};
+
+constexpr CompressTable compressTable() {
+	CompressTable table{};
+	for (int bits = 0; bits < 16; bits++)
+	{
+		int out = 0;
+		for (int lane = 0; lane < 4; lane++)
+		{
+			if (!(bits & (1 << lane))) continue;
+			table.index[bits][out++] = 2 * lane;
+			table.index[bits][out++] = 2 * lane + 1;
+		}
+	}
+	return table;
+}
+
+constexpr CompressTable Compress = compressTable();
+
+// Stores all four lanes at the end of the output so far and advances past
+// the kept ones. The output never runs ahead of the input, so the store
+// stays inside it.
+QUARK_AVX2 int64_t avxFilter(const int64_t* values, const int64_t* mask, int64_t* out, int64_t n) {
+	int64_t count = 0, i = 0;
+	for (; i + 4 <= n; i += 4)
+	{
+		__m256i zero = _mm256_cmpeq_epi64(avxInts(mask, i), _mm256_setzero_si256());
+		int bits = ~_mm256_movemask_pd(_mm256_castsi256_pd(zero)) & 15;
+		__m256i index = _mm256_load_si256(reinterpret_cast<const __m256i*>(Compress.index[bits]));
+		avxStore(out, count, _mm256_permutevar8x32_epi32(avxInts(values, i), index));
+		count += __builtin_popcount(static_cast<unsigned>(bits));
+	}
+	return count + scalarFilter(values + i, mask + i, out + count, n - i);
+}
+
+const Kernels Avx2Kernels = {
+	&avxArith<int64_t, const int64_t*>,
+	&avxArith<int64_t, int64_t>,
+	&avxArith<double, const double*>,
+	&avxArith<double, double>,
+	&avxCompareAll<int64_t, const int64_t*>,
+	&avxCompareAll<int64_t, int64_t>,
+	&avxCompareAll<double, const double*>,
+	&avxCompareAll<double, double>,
+	&avxSumI64,
+	&avxSumF64,
+	&avxExtremeI64<false>,
+	&avxExtremeI64<true>,
+	&avxExtremeF64<false>,
+	&avxExtremeF64<true>,
+	&avxFilter,
+};
+
+#endif
+
+#ifdef QUARK_RUNTIME_NEON
+
+inline int64x2_t neonInts(const int64_t* values, int64_t i) { return vld1q_s64(values + i); }
+inline int64x2_t neonInts(int64_t value, int64_t) { return vdupq_n_s64(value); }
+inline float64x2_t neonFloats(const double* values, int64_t i) { return vld1q_f64(values + i); }
+inline float64x2_t neonFloats(double value, int64_t) { return vdupq_n_f64(value); }
+
+template <ListOp Op>
+float64x2_t neonApply(float64x2_t x, float64x2_t y) {
+	if constexpr (Op == ListOp::Add) return vaddq_f64(x, y);
+	else if constexpr (Op == ListOp::Sub) return vsubq_f64(x, y);
+	else if constexpr (Op == ListOp::Mul) return vmulq_f64(x, y);
+	else if constexpr (Op == ListOp::Div) return vdivq_f64(x, y);
+	else if constexpr (Op == ListOp::RevSub) return vsubq_f64(y, x);
+	else return vdivq_f64(y, x);
+}
+
+template <ListOp Op, typename Rhs>
+void neonArithLoop(const double* lhs, Rhs rhs, double* out, int64_t n) {
+	int64_t i = 0;
+	for (; i + 2 <= n; i += 2) vst1q_f64(out + i, neonApply<Op>(neonFloats(lhs, i), neonFloats(rhs, i)));
+	arithLoop<Op>(lhs, rhs, out, i, n);
+}
+
+// NEON has no 64-bit multiply or divide either
+template <ListOp Op, typename Rhs>
+void neonArithLoop(const int64_t* lhs, Rhs rhs, int64_t* out, int64_t n) {
+	if constexpr (Op != ListOp::Add && Op != ListOp::Sub && Op != ListOp::RevSub)
+	{
+		arithLoop<Op>(lhs, rhs, out, 0, n);
+	}
+	else
+	{
+		int64_t i = 0;
+		for (; i + 2 <= n; i += 2)
+		{
+			int64x2_t x = neonInts(lhs, i), y = neonInts(rhs, i);
+			if constexpr (Op == ListOp::Add) vst1q_s64(out + i, vaddq_s64(x, y));
+			else if constexpr (Op == ListOp::Sub) vst1q_s64(out + i, vsubq_s64(x, y));
+			else vst1q_s64(out + i, vsubq_s64(y, x));
+		}
+		arithLoop<Op>(lhs, rhs, out, i, n);
+	}
+}
+
+template <typename T, typename Rhs>
+void neonArith(ListOp op, const T* lhs, Rhs rhs, T* out, int64_t n) {
+	switch (op)
+	{
+	case ListOp::Add: return neonArithLoop<ListOp::Add>(lhs, rhs, out, n);
+	case ListOp::Sub: return neonArithLoop<ListOp::Sub>(lhs, rhs, out, n);
+	case ListOp::Mul: return neonArithLoop<ListOp::Mul>(lhs, rhs, out, n);
+	case ListOp::Div: return neonArithLoop<ListOp::Div>(lhs, rhs, out, n);
+	case ListOp::RevSub: return neonArithLoop<ListOp::RevSub>(lhs, rhs, out, n);
+	default: return neonArithLoop<ListOp::RevDiv>(lhs, rhs, out, n);
+	}
+}
+
+inline uint64x2_t vcltq(float64x2_t x, float64x2_t y) { return vcltq_f64(x, y); }
+inline uint64x2_t vcleq(float64x2_t x, float64x2_t y) { return vcleq_f64(x, y); }
+inline uint64x2_t vcgtq(float64x2_t x, float64x2_t y) { return vcgtq_f64(x, y); }
+inline uint64x2_t vcgeq(float64x2_t x, float64x2_t y) { return vcgeq_f64(x, y); }
+inline uint64x2_t vceqq(float64x2_t x, float64x2_t y) { return vceqq_f64(x, y); }
+inline uint64x2_t vcltq(int64x2_t x, int64x2_t y) { return vcltq_s64(x, y); }
+inline uint64x2_t vcleq(int64x2_t x, int64x2_t y) { return vcleq_s64(x, y); }
+inline uint64x2_t vcgtq(int64x2_t x, int64x2_t y) { return vcgtq_s64(x, y); }
+inline uint64x2_t vcgeq(int64x2_t x, int64x2_t y) { return vcgeq_s64(x, y); }
+inline uint64x2_t vceqq(int64x2_t x, int64x2_t y) { return vceqq_s64(x, y); }
+
+template <ListCompare Compare, typename V>
+uint64x2_t neonMask(V x, V y) {
+	if constexpr (Compare == ListCompare::Lt) return vcltq(x, y);
+	else if constexpr (Compare == ListCompare::Le) return vcleq(x, y);
+	else if constexpr (Compare == ListCompare::Gt) return vcgtq(x, y);
+	else if constexpr (Compare == ListCompare::Ge) return vcgeq(x, y);
+	else return vceqq(x, y);
+}
+
+// Lanes of 0 or 1; NE is the complement of EQ, true for NaN
+template <ListCompare Compare, typename V>
+int64x2_t neonCompare(V x, V y) {
+	uint64x2_t one = vdupq_n_u64(1);
+	if constexpr (Compare == ListCompare::Ne)
+		return vreinterpretq_s64_u64(vbicq_u64(one, neonMask<ListCompare::Eq>(x, y)));
+	else
+		return vreinterpretq_s64_u64(vandq_u64(neonMask<Compare>(x, y), one));
+}
+
+template <ListCompare Compare, typename T, typename Rhs>
+void neonCompareLoop(const T* lhs, Rhs rhs, int64_t* out, int64_t n) {
+	int64_t i = 0;
+	for (; i + 2 <= n; i += 2)
+	{
+		if constexpr (std::is_same_v<T, double>) vst1q_s64(out + i, neonCompare<Compare>(neonFloats(lhs, i), neonFloats(rhs, i)));
+		else vst1q_s64(out + i, neonCompare<Compare>(neonInts(lhs, i), neonInts(rhs, i)));
+	}
+	compareLoop<Compare>(lhs, rhs, out, i, n);
+}
+
+template <typename T, typename Rhs>
+void neonCompareAll(ListCompare op, const T* lhs, Rhs rhs, int64_t* out, int64_t n) {
+	switch (op)
+	{
+	case ListCompare::Lt: return neonCompareLoop<ListCompare::Lt>(lhs, rhs, out, n);
+	case ListCompare::Le: return neonCompareLoop<ListCompare::Le>(lhs, rhs, out, n);
+	case ListCompare::Gt: return neonCompareLoop<ListCompare::Gt>(lhs, rhs, out, n);
+	case ListCompare::Ge: return neonCompareLoop<ListCompare::Ge>(lhs, rhs, out, n);
+	case ListCompare::Eq: return neonCompareLoop<ListCompare::Eq>(lhs, rhs, out, n);
+	default: return neonCompareLoop<ListCompare::Ne>(lhs, rhs, out, n);
+	}
+}
+
+int64_t neonSumI64(const int64_t* values, int64_t n) {
+	int64x2_t acc0 = vdupq_n_s64(0), acc1 = acc0;
+	int64_t i = 0;
+	for (; i + 4 <= n; i += 4)
+	{
+		acc0 = vaddq_s64(acc0, neonInts(values, i));
+		acc1 = vaddq_s64(acc1, neonInts(values, i + 2));
+	}
+	uint64_t sum = static_cast<uint64_t>(vaddvq_s64(vaddq_s64(acc0, acc1)));
+	return static_cast<int64_t>(sum + static_cast<uint64_t>(scalarSumI64(values + i, n - i)));
+}
+
+double neonSumF64(const double* values, int64_t n) {
+	float64x2_t acc[Lanes / 2];
+	for (float64x2_t& a : acc) a = vdupq_n_f64(0);
+	int64_t i = 0;
+	for (; i + Lanes <= n; i += Lanes)
+		for (int64_t k = 0; k < Lanes / 2; k++) acc[k] = vaddq_f64(acc[k], neonFloats(values, i + 2 * k));
+	double lanes[Lanes];
+	for (int64_t k = 0; k < Lanes / 2; k++) vst1q_f64(lanes + 2 * k, acc[k]);
+	return finishSum(lanes, values, i, n);
+}
+
+template <bool Max>
+int64_t neonExtremeI64(const int64_t* values, int64_t n) {
+	int64x2_t m = vdupq_n_s64(values[0]);
+	int64_t i = 0;
+	for (; i + 2 <= n; i += 2)
+	{
+		int64x2_t x = neonInts(values, i);
+		m = vbslq_s64(Max ? vcgtq_s64(x, m) : vcltq_s64(x, m), x, m);
+	}
+	int64_t result = pick<Max>(vgetq_lane_s64(m, 1), vgetq_lane_s64(m, 0));
+	for (; i < n; i++) result = pick<Max>(values[i], result);
+	return result;
+}
+
+// Selects like pick(); FMIN/FMAX would return NaN for a NaN element
+template <bool Max>
+double neonExtremeF64(const double* values, int64_t n) {
+	float64x2_t acc[Lanes / 2];
+	for (float64x2_t& a : acc) a = vdupq_n_f64(values[0]);
+	int64_t i = 0;
+	for (; i + Lanes <= n; i += Lanes)
+	{
+		for (int64_t k = 0; k < Lanes / 2; k++)
+		{
+			float64x2_t x = neonFloats(values, i + 2 * k);
+			acc[k] = vbslq_f64(Max ? vcgtq_f64(x, acc[k]) : vcltq_f64(x, acc[k]), x, acc[k]);
+		}
+	}
+	double lanes[Lanes];
+	for (int64_t k = 0; k < Lanes / 2; k++) vst1q_f64(lanes + 2 * k, acc[k]);
+	return finishExtreme<Max>(lanes, values, i, n);
+}
+
+// Compaction has no good NEON form; the scalar loop is branch-free already
+const Kernels NeonKernels = {
+	&neonArith<int64_t, const int64_t*>,
+	&neonArith<int64_t, int64_t>,
+	&neonArith<double, const double*>,
+	&neonArith<double, double>,
+	&neonCompareAll<int64_t, const int64_t*>,
+	&neonCompareAll<int64_t, int64_t>,
+	&neonCompareAll<double, const double*>,
+	&neonCompareAll<double, double>,
+	&neonSumI64,
+	&neonSumF64,
+	&neonExtremeI64<false>,
+	&neonExtremeI64<true>,
+	&neonExtremeF64<false>,
+	&neonExtremeF64<true>,
+	&scalarFilter,
+};
+
+#endif
+
+const Kernels& kernelsFor(SimdLevel level) {
+	switch (level)
+	{
+#ifdef QUARK_RUNTIME_AVX2
+	case SimdLevel::AVX2: return Avx2Kernels;
+#endif
+#ifdef QUARK_RUNTIME_NEON
+	case SimdLevel::NEON: return NeonKernels;
+#endif
+	default: return ScalarKernels;
+	}
+}
+
+struct ActiveLevel
+{
+	std::atomic<SimdLevel> level{ detectSimdLevel() };
+	std::atomic<const Kernels*> kernels{ &kernelsFor(level.load()) };
+};
+
+ActiveLevel& active() {
+	static ActiveLevel state;
+	return state;
+}
+
+const Kernels& kernels() {
+	return *active().kernels.load(std::memory_order_relaxed);
+}
+
+// Python-style: negative indices count from the end
+int64_t checkedIndex(const QuarkList* list, int64_t i) {
+	int64_t at = i < 0 ? i + list->length : i;
+	if (at < 0 || at >= list->length)
+	{
+		fail("Index %lld is out of range for a list of %lld elements", static_cast<long long>(i),
+			static_cast<long long>(list->length));
+	}
+	return at;
+}
+
+void checkIntDivision(ListOp op, const QuarkList* lhs, const int64_t* divisors, int64_t count) {
+	if (op == ListOp::Div && containsZero(divisors, count)) fail("Integer division by zero");
+	if (op == ListOp::RevDiv && containsZero(listInts(lhs), lhs->length)) fail("Integer division by zero");
+}
+
+void checkNotEmpty(const QuarkList* list, const char* what) {
+	if (list->length == 0) fail("Cannot take the %s of an empty list", what);
+}
+
+// Longest formatted element, "-2.2250738585072014e-308" and INT64_MIN
+// included
+constexpr size_t FormatSize = 32;
+
+char* formatInt(char* out, int64_t value) {
+	return std::to_chars(out, out + FormatSize, value).ptr;
+}
+
+// Python's repr: the shortest digits that read back as value, positional
+// for decimal exponents from -4 to 15 and with at least one fraction digit,
+// scientific otherwise
+char* formatFloat(char* out, double value) {
+	if (std::isnan(value)) return std::strcpy(out, "nan") + 3;
+	char scientific[FormatSize];
+	char* end = std::to_chars(scientific, scientific + sizeof(scientific), value, std::chars_format::scientific).ptr;
+	char* e = std::find(scientific, end, 'e');
+	if (e == end) return std::copy(scientific, end, out);	// inf
+
+	int exponent = 0;
+	std::from_chars(e + (e[1] == '+' ? 2 : 1), end, exponent);
+	if (exponent < -4 || exponent >= 16) return std::copy(scientific, end, out);
+
+	const char* first = scientific;
+	if (*first == '-') *out++ = *first++;
+	char digits[FormatSize];
+	int count = 0;
+	for (const char* c = first; c != e; c++)
+		if (*c != '.') digits[count++] = *c;
+
+	if (exponent < 0)
+	{
+		*out++ = '0';
+		*out++ = '.';
+		for (int i = -1; i > exponent; i--) *out++ = '0';
+		return std::copy(digits, digits + count, out);
+	}
+	for (int i = 0; i <= exponent; i++) *out++ = i < count ? digits[i] : '0';
+	*out++ = '.';
+	if (count <= exponent + 1) *out++ = '0';
+	return std::copy(digits + std::min(count, exponent + 1), digits + count, out);
+}
+
+template <typename T, typename Format>
+void printList(const T* values, int64_t length, Format format) {
+	// Formatted in chunks, so huge lists neither go out one element per call
+	// nor need a buffer their size
+	char buffer[4096];
+	char* out = buffer;
+	*out++ = '[';
+	for (int64_t i = 0; i < length; i++)
+	{
+		if (out + FormatSize + 2 > buffer + sizeof(buffer))
+		{
+			std::fwrite(buffer, 1, static_cast<size_t>(out - buffer), stdout);
+			out = buffer;
+		}
+		if (i)
+		{
+			*out++ = ',';
+			*out++ = ' ';
+		}
+		out = format(out, values[i]);
+	}
+	*out++ = ']';
+	*out++ = '\n';
+	std::fwrite(buffer, 1, static_cast<size_t>(out - buffer), stdout);
+}
+
+// What an instrumented executable writes at exit, see quark_profile_init
+struct ProfileRegistration
+{
+	const char* path = nullptr;
+	const QuarkProfileRecord* const* records = nullptr;
+	int64_t count = 0;
+};
+
+ProfileRegistration registeredProfile;
+
+void writeRegisteredProfile() {
+	const ProfileRegistration& profile = registeredProfile;
+	if (quark_profile_write(profile.path, profile.records, profile.count) != 0)
+		std::fprintf(stderr, "Cannot write the profile %s\n", profile.path);
+}
+
+// What an executable built with site counters writes at exit, see
+// quark_sites_init
+struct SiteRegistration
+{
+	const QuarkSiteTable* const* tables = nullptr;
+	int64_t count = 0;
+};
+
+SiteRegistration registeredSites;
+
+void writeRegisteredSites() {
+	quark_sites_write(stderr, registeredSites.tables, registeredSites.count);
+}
+
+// %p becomes the process id, so that runs at the same time write apart
+std::string profilePath(const char* path) {
+	std::string result;
+	for (const char* c = path; *c; c++)
+	{
+		if (c[0] == '%' && c[1] == 'p')
+		{
+			result += std::to_string(static_cast<long long>(getpid()));
+			c++;
+		}
+		else
+		{
+			result += *c;
+		}
+	}
+	return result;
+}
+
+}
+
+const char* simdLevelString(SimdLevel level) {
+	switch (level)
+	{
+	case SimdLevel::AVX2: return "avx2";
+	case SimdLevel::NEON: return "neon";
+	default: return "scalar";
+	}
+}
+
+SimdLevel detectSimdLevel() {
+#if defined(QUARK_RUNTIME_AVX2)
+	if (__builtin_cpu_supports("avx2")) return SimdLevel::AVX2;
+#elif defined(QUARK_RUNTIME_NEON)
+	return SimdLevel::NEON;
+#endif
+	return SimdLevel::Scalar;
+}
+
+SimdLevel simdLevel() {
+	return active().level.load();
+}
+
+SimdLevel setSimdLevel(SimdLevel level) {
+	if (level != SimdLevel::Scalar && level != detectSimdLevel()) level = SimdLevel::Scalar;
+	active().level.store(level);
+	active().kernels.store(&kernelsFor(level));
+	return level;
+}
+
+ListArena::ListArena() : outer(std::exchange(currentArena, this)) {}
+
+ListArena::~ListArena() {
+	for (QuarkList* list : lists) std::free(list);
+	currentArena = outer;
+}
+
+bool runProgram(void (*entry)(), std::string& error) {
+	Trap trap;
+	Trap* outer = currentTrap;
+	currentTrap = &trap;
+	if (setjmp(trap.env) == 0)
+	{
+		entry();
+		currentTrap = outer;
+		return true;
+	}
+	currentTrap = outer;
+	error = trap.message;
+	return false;
+}
+
+extern "C" {
+
+QuarkList* quark_list_from_i64(const int64_t* values, int64_t length) {
+	QuarkList* list = allocate(length);
+	if (length) std::memcpy(listInts(list), values, static_cast<size_t>(length) * sizeof(int64_t));
+	return list;
+}
+
+QuarkList* quark_list_from_f64(const double* values, int64_t length) {
+	QuarkList* list = allocate(length);
+	if (length) std::memcpy(listFloats(list), values, static_cast<size_t>(length) * sizeof(double));
+	return list;
+}
+
+QuarkList* quark_list_range(int64_t length) {
+	QuarkList* list = allocate(length < 0 ? 0 : length);
+	int64_t* out = listInts(list);
+	for (int64_t i = 0; i < list->length; i++) out[i] = i;
+	return list;
+}
+
+QuarkList* quark_list_to_f64(const QuarkList* list) {
+	QuarkList* result = allocate(list->length);
+	const int64_t* values = listInts(list);
+	double* out = listFloats(result);
+	for (int64_t i = 0; i < list->length; i++) out[i] = static_cast<double>(values[i]);
+	return result;
+}
+
+int64_t quark_list_len(const QuarkList* list) {
+	return list->length;
+}
+
+int64_t quark_list_at_i64(const QuarkList* list, int64_t index) {
+	return listInts(list)[checkedIndex(list, index)];
+}
+
+double quark_list_at_f64(const QuarkList* list, int64_t index) {
+	return listFloats(list)[checkedIndex(list, index)];
+}
+
+QuarkList* quark_list_arith_i64(int32_t op, const QuarkList* lhs, const QuarkList* rhs) {
+	checkLengths(lhs, rhs);
+	checkIntDivision(static_cast<ListOp>(op), lhs, listInts(rhs), rhs->length);
+	QuarkList* result = allocate(lhs->length);
+	kernels().arithI64(static_cast<ListOp>(op), listInts(lhs), listInts(rhs), listInts(result), lhs->length);
+	return result;
+}
+
+QuarkList* quark_list_arith_f64(int32_t op, const QuarkList* lhs, const QuarkList* rhs) {
+	checkLengths(lhs, rhs);
+	QuarkList* result = allocate(lhs->length);
+	kernels().arithF64(static_cast<ListOp>(op), listFloats(lhs), listFloats(rhs), listFloats(result), lhs->length);
+	return result;
+}
+
+QuarkList* quark_list_arith_scalar_i64(int32_t op, const QuarkList* lhs, int64_t rhs) {
+	checkIntDivision(static_cast<ListOp>(op), lhs, &rhs, 1);
+	QuarkList* result = allocate(lhs->length);
+	kernels().arithScalarI64(static_cast<ListOp>(op), listInts(lhs), rhs, listInts(result), lhs->length);
+	return result;
+}
+
+QuarkList* quark_list_arith_scalar_f64(int32_t op, const QuarkList* lhs, double rhs) {
+	QuarkList* result = allocate(lhs->length);
+	kernels().arithScalarF64(static_cast<ListOp>(op), listFloats(lhs), rhs, listFloats(result), lhs->length);
+	return result;
+}
+
+QuarkList* quark_list_compare_i64(int32_t compare, const QuarkList* lhs, const QuarkList* rhs) {
+	checkLengths(lhs, rhs);
+	QuarkList* result = allocate(lhs->length);
+	kernels().compareI64(static_cast<ListCompare>(compare), listInts(lhs), listInts(rhs), listInts(result), lhs->length);
+	return result;
+}
+
+QuarkList* quark_list_compare_f64(int32_t compare, const QuarkList* lhs, const QuarkList* rhs) {
+	checkLengths(lhs, rhs);
+	QuarkList* result = allocate(lhs->length);
+	kernels().compareF64(static_cast<ListCompare>(compare), listFloats(lhs), listFloats(rhs), listInts(result), lhs->length);
+	return result;
+}
+
+QuarkList* quark_list_compare_scalar_i64(int32_t compare, const QuarkList* lhs, int64_t rhs) {
+	QuarkList* result = allocate(lhs->length);
+	kernels().compareScalarI64(static_cast<ListCompare>(compare), listInts(lhs), rhs, listInts(result), lhs->length);
+	return result;
+}
+
+QuarkList* quark_list_compare_scalar_f64(int32_t compare, const QuarkList* lhs, double rhs) {
+	QuarkList* result = allocate(lhs->length);
+	kernels().compareScalarF64(static_cast<ListCompare>(compare), listFloats(lhs), rhs, listInts(result), lhs->length);
+	return result;
+}
+
+int64_t quark_list_sum_i64(const QuarkList* list) {
+	return kernels().sumI64(listInts(list), list->length);
+}
+
+double quark_list_sum_f64(const QuarkList* list) {
+	return kernels().sumF64(listFloats(list), list->length);
+}
+
+int64_t quark_list_min_i64(const QuarkList* list) {
+	checkNotEmpty(list, "min");
+	return kernels().minI64(listInts(list), list->length);
+}
+
+double quark_list_min_f64(const QuarkList* list) {
+	checkNotEmpty(list, "min");
+	return kernels().minF64(listFloats(list), list->length);
+}
+
+int64_t quark_list_max_i64(const QuarkList* list) {
+	checkNotEmpty(list, "max");
+	return kernels().maxI64(listInts(list), list->length);
+}
+
+double quark_list_max_f64(const QuarkList* list) {
+	checkNotEmpty(list, "max");
+	return kernels().maxF64(listFloats(list), list->length);
+}
+
+QuarkList* quark_list_filter(const QuarkList* list, const QuarkList* mask) {
+	checkLengths(list, mask);
+	QuarkList* result = allocate(list->length);
+	result->length = kernels().filter(listInts(list), listInts(mask), listInts(result), list->length);
+	return result;
+}
+
+QuarkList* quark_list_new(int64_t capacity) {
+	return allocate(capacity < 0 ? 0 : capacity);
+}
+
+void quark_list_fail_empty(const char* what) {
+	fail("Cannot take the %s of an empty list", what);
+}
+
+void quark_fail_division_by_zero() {
+	fail("Integer division by zero");
+}
+
+void quark_print_i64(int64_t value) {
+	char buffer[FormatSize + 1];
+	char* end = formatInt(buffer, value);
+	*end++ = '\n';
+	std::fwrite(buffer, 1, static_cast<size_t>(end - buffer), stdout);
+}
+
+void quark_print_f64(double value) {
+	char buffer[FormatSize + 1];
+	char* end = formatFloat(buffer, value);
+	*end++ = '\n';
+	std::fwrite(buffer, 1, static_cast<size_t>(end - buffer), stdout);
+}
+
+void quark_print_list_i64(const QuarkList* list) {
+	printList(listInts(list), list->length, &formatInt);
+}
+
+void quark_print_list_f64(const QuarkList* list) {
+	printList(listFloats(list), list->length, &formatFloat);
+}
+
+int32_t quark_profile_write(const char* path, const QuarkProfileRecord* const* records, int64_t count) {
+	const char* override = std::getenv("LLVM_PROFILE_FILE");
+	if (override && *override) path = override;
+	if (!path || !*path) return -1;
+
+	std::FILE* out = std::fopen(profilePath(path).c_str(), "w");
+	if (!out) return -1;
+	std::fputs("# IR level Instrumentation Flag\n:ir\n", out);
+	for (int64_t i = 0; i < count; i++)
+	{
+		const QuarkProfileRecord& record = *records[i];
+		if (!record.counterCount) continue;
+		std::fprintf(out, "%s\n# Func Hash:\n%" PRIu64 "\n# Num Counters:\n%" PRIu64 "\n# Counter Values:\n", record.name, record.hash,
+			record.counterCount);
+		for (uint64_t c = 0; c < record.counterCount; c++) std::fprintf(out, "%" PRIu64 "\n", record.counters[c]);
+		std::fputc('\n', out);
+	}
+	bool failed = std::ferror(out) != 0;
+	if (std::fclose(out) != 0) failed = true;
+	return failed ? -1 : 0;
+}
+
+void quark_profile_init(const char* path, const QuarkProfileRecord* const* records, int64_t count) {
+	registeredProfile = ProfileRegistration{ path, records, count };
+	std::atexit(&writeRegisteredProfile);
+}
+
+void quark_sites_write(std::FILE* out, const QuarkSiteTable* const* tables, int64_t count) {
+	std::vector<const QuarkSiteRecord*> sites;
+	for (int64_t i = 0; i < count; i++)
+		for (int64_t r = 0; r < tables[i]->count; r++) sites.push_back(tables[i]->records[r]);
+	std::stable_sort(sites.begin(), sites.end(), [](const QuarkSiteRecord* a, const QuarkSiteRecord* b) { return a->calls > b->calls; });
+
+	std::fprintf(out, "%-48s %12s %8s %14s\n", "dispatch site", "calls", "hit %", "elements");
+	for (const QuarkSiteRecord* site : sites)
+	{
+		char rate[16] = "-";
+		if (site->fastPath && site->calls) std::snprintf(rate, sizeof(rate), "%.1f", 100.0 * static_cast<double>(site->hits) / static_cast<double>(site->calls));
+		std::fprintf(out, "%-48s %12" PRIu64 " %8s %14" PRIu64 "\n", site->site, site->calls, rate, site->elements);
+	}
+}
+
+void quark_sites_init(const QuarkSiteTable* const* tables, int64_t count) {
+	registeredSites = SiteRegistration{ tables, count };
+	std::atexit(&writeRegisteredSites);
+}
+
+}
+
+const std::vector<RuntimeSymbol>& runtimeSymbols() {
+#define QUARK_RUNTIME_SYMBOL(name) RuntimeSymbol{ #name, reinterpret_cast<void*>(&name) }
+	static const std::vector<RuntimeSymbol> symbols = {
+		QUARK_RUNTIME_SYMBOL(quark_list_from_i64),
+		QUARK_RUNTIME_SYMBOL(quark_list_from_f64),
+		QUARK_RUNTIME_SYMBOL(quark_list_range),
+		QUARK_RUNTIME_SYMBOL(quark_list_to_f64),
+		QUARK_RUNTIME_SYMBOL(quark_list_len),
+		QUARK_RUNTIME_SYMBOL(quark_list_at_i64),
+		QUARK_RUNTIME_SYMBOL(quark_list_at_f64),
+		QUARK_RUNTIME_SYMBOL(quark_list_arith_i64),
+		QUARK_RUNTIME_SYMBOL(quark_list_arith_f64),
+		QUARK_RUNTIME_SYMBOL(quark_list_arith_scalar_i64),
+		QUARK_RUNTIME_SYMBOL(quark_list_arith_scalar_f64),
+		QUARK_RUNTIME_SYMBOL(quark_list_compare_i64),
+		QUARK_RUNTIME_SYMBOL(quark_list_compare_f64),
+		QUARK_RUNTIME_SYMBOL(quark_list_compare_scalar_i64),
+		QUARK_RUNTIME_SYMBOL(quark_list_compare_scalar_f64),
+		QUARK_RUNTIME_SYMBOL(quark_list_sum_i64),
+		QUARK_RUNTIME_SYMBOL(quark_list_sum_f64),
+		QUARK_RUNTIME_SYMBOL(quark_list_min_i64),
+		QUARK_RUNTIME_SYMBOL(quark_list_min_f64),
+		QUARK_RUNTIME_SYMBOL(quark_list_max_i64),
+		QUARK_RUNTIME_SYMBOL(quark_list_max_f64),
+		QUARK_RUNTIME_SYMBOL(quark_list_filter),
+		QUARK_RUNTIME_SYMBOL(quark_list_new),
+		QUARK_RUNTIME_SYMBOL(quark_list_fail_empty),
+		QUARK_RUNTIME_SYMBOL(quark_fail_division_by_zero),
+		QUARK_RUNTIME_SYMBOL(quark_print_i64),
+		QUARK_RUNTIME_SYMBOL(quark_print_f64),
+		QUARK_RUNTIME_SYMBOL(quark_print_list_i64),
+		QUARK_RUNTIME_SYMBOL(quark_print_list_f64),
+		QUARK_RUNTIME_SYMBOL(quark_profile_write),
+		QUARK_RUNTIME_SYMBOL(quark_profile_init),
+		QUARK_RUNTIME_SYMBOL(quark_sites_write),
+		QUARK_RUNTIME_SYMBOL(quark_sites_init),
+	};
+#undef QUARK_RUNTIME_SYMBOL
+	return symbols;
+}
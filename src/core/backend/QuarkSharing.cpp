@@ -0,0 +1,136 @@
+#include "include/sharing.h"
+
+#include <vector>
+#include "include/visitor.h"
+
+namespace {
+
+class SubtreeSharing : public AstVisitor<SubtreeSharing>
+{
+public:
+	explicit SubtreeSharing(Ast& ast) : AstVisitor(ast), tree(ast), canonical(ast.size(), InvalidNode) {}
+
+	ShareStats run()
+	{
+		if (tree.root() == InvalidNode) return stats;
+		walk(tree.root());
+		tree.setHashConsing(true);
+		return stats;
+	}
+
+private:
+	friend class AstVisitor<SubtreeSharing>;
+
+	Ast& tree;	// ast, writable
+	SubtreeTable table;
+	// What a node left already stands for; the tree may be a DAG already
+	std::vector<NodeId> canonical;
+	ShareStats stats;
+
+	bool enterNode(NodeRef node) { return canonical[node.id()] == InvalidNode; }
+
+	// Post-order, so the children are shared by the time their parent is
+	// looked up
+	void leaveNode(NodeRef node)
+	{
+		NodeId id = node.id();
+		if (canonical[id] != InvalidNode) return;
+
+		for (uint32_t i = 0; i < tree.childCount(id); i++)
+		{
+			NodeId child = tree.child(id, i);
+			NodeId to = canonical[child];
+			if (to == InvalidNode || to == child) continue;
+			tree.setChild(id, i, to);
+			stats.shared++;
+		}
+
+		NodeId found = table.find(tree, tree.type(id), tree.tok(id), tree.childBegin(id), tree.childCount(id));
+		if (found == InvalidNode)
+		{
+			table.add(tree, id);
+			if (table.shared(id)) stats.distinct++;
+			found = id;
+		}
+		canonical[id] = found;
+	}
+};
+
+// Folds value into h, then scrambles it with splitmix64's finalizer
+uint64_t mix(uint64_t h, uint64_t value) {
+	h ^= value + 0x9e3779b97f4a7c15 + (h << 6) + (h >> 2);
+	h ^= h >> 30;
+	h *= 0xbf58476d1ce4e5b9;
+	h ^= h >> 27;
+	h *= 0x94d049bb133111eb;
+	return h ^ (h >> 31);
+}
+
+}
+
+bool SubtreeTable::shareable(NodeType type, const Token& tok, const NodeId*, uint32_t count) const {
+	if (type == Literal || type == Identifier) return count == 0;
+	return type == Operator && !(tok.kind == TokenKind::EQUALS && count == 2);
+}
+
+uint64_t SubtreeTable::key(NodeType type, const Token& tok, const NodeId* children, uint32_t count) {
+	uint64_t h = mix(static_cast<uint64_t>(type) | static_cast<uint64_t>(tok.kind) << 8 | static_cast<uint64_t>(count) << 32, tok.value);
+	for (uint32_t i = 0; i < count; i++) h = mix(h, children[i]);
+	return h;
+}
+
+NodeId SubtreeTable::find(const Ast& ast, NodeType type, const Token& tok, const NodeId* children, uint32_t count) const {
+	if (!shareable(type, tok, children, count)) return InvalidNode;
+	for (uint32_t i = 0; i < count; i++)
+		if (!shared(children[i])) return InvalidNode;
+
+	auto it = nodes.find(key(type, tok, children, count));
+	if (it == nodes.end()) return InvalidNode;
+	NodeId id = it->second;
+	const Token& other = ast.tok(id);
+	if (ast.type(id) != type || other.kind != tok.kind || other.value != tok.value || ast.childCount(id) != count) return InvalidNode;
+	for (uint32_t i = 0; i < count; i++)
+		if (ast.child(id, i) != children[i]) return InvalidNode;
+	return id;
+}
+
+void SubtreeTable::add(const Ast& ast, NodeId id) {
+	const NodeId* children = ast.childBegin(id);
+	uint32_t count = ast.childCount(id);
+	if (!shareable(ast.type(id), ast.tok(id), children, count)) return;
+	for (uint32_t i = 0; i < count; i++)
+		if (!shared(children[i])) return;
+
+	if (!nodes.emplace(key(ast.type(id), ast.tok(id), children, count), id).second) return;
+	if (members.size() <= id) members.resize(static_cast<size_t>(id) + 1);
+	members[id] = true;
+}
+
+NodeId AstBuilder::closeShared() {
+	Frame frame = std::move(frames.back());
+	frames.pop_back();
+	uint32_t count = static_cast<uint32_t>(pending.size() - frame.mark);
+	const NodeId* children = pending.data() + frame.mark;
+	NodeId id = shared.find(ast, frame.type, frame.tok, children, count);
+	if (id == InvalidNode)
+	{
+		id = ast.addNode(frame.type, std::move(frame.tok), children, count);
+		shared.add(ast, id);
+	}
+	pending.resize(frame.mark);
+	return attach(id);
+}
+
+NodeId AstBuilder::leafShared(NodeType type, Token tok) {
+	NodeId id = shared.find(ast, type, tok, nullptr, 0);
+	if (id == InvalidNode)
+	{
+		id = ast.addNode(type, std::move(tok), nullptr, 0);
+		shared.add(ast, id);
+	}
+	return attach(id);
+}
+
+ShareStats shareSubtrees(Ast& ast) {
+	return SubtreeSharing(ast).run();
+}
@@ -0,0 +1,57 @@
+#include "include/stream.h"
+
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include "include/parser.h"
+
+namespace {
+
+// Dropping pages is a system call, so it waits for this much text
+constexpr uint64_t ReleaseBytes = 4 << 20;
+
+}
+
+SourceFile::SourceFile(const std::string& path) : name(path), mapping(MappedFile::open(path)) {
+	if (mapping)
+	{
+		mapping->sequential();
+		view = std::string_view(mapping->data(), mapping->size());
+		return;
+	}
+
+	std::ifstream in(path, std::ios::binary);
+	if (!in) throw std::runtime_error("Cannot read " + path);
+	contents.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+	if (in.bad()) throw std::runtime_error("Cannot read " + path);
+	charge.update(contents.capacity());
+	view = contents;
+}
+
+void SourceFile::release(uint64_t offset) {
+	if (!mapping || offset < released + ReleaseBytes) return;
+	mapping->release(static_cast<size_t>(offset));
+	released = offset;
+}
+
+bool ItemReader::next() {
+	// The item before has been parsed, and its nodes own their spellings
+	if (file) file->release(buffer.origin);
+	size_t from = lexer.consumed();
+	bool more = lexer.tokenizeItem(buffer);
+	item = source.substr(from, lexer.consumed() - from);
+	return more;
+}
+
+bool ItemReader::definesFunction() const {
+	for (const LexToken& tok : buffer.tokens)
+		if (tok.kind == TokenKind::FN) return true;
+	return false;
+}
+
+NodeId ItemReader::parse(Ast& ast) {
+	// The item's own window, so only what the Ast keeps has to fit in 32 bits
+	buffer.start = ast.sources().reserve(name, item.size(), buffer.origin, lineNo);
+	lineNo += static_cast<uint32_t>(ast.sources().addLines(buffer.start, item));
+	return QuarkParser(buffer, ast).parse();
+}
@@ -0,0 +1,109 @@
+#include "include/source.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+SourceLoc SourceTable::end() const {
+	if (buffers.empty()) return SourceLoc{ 1 };
+	const SourceBuffer& last = buffers.back();
+	return SourceLoc{ last.start + last.size + 1 };
+}
+
+SourceLoc SourceTable::reserve(std::string_view name, uint64_t size, uint64_t offset, uint32_t lineNo) {
+	SourceLoc start = end();
+	if (start.offset + size + 1 > UINT32_MAX) throw std::length_error("Sources do not fit into 4 GB of locations");
+
+	// The windows of a stream share their file's name
+	uint32_t nameAt = static_cast<uint32_t>(names.size());
+	if (!buffers.empty() && std::string_view(names.data() + buffers.back().name, buffers.back().nameSize) == name)
+		nameAt = buffers.back().name;
+	else names.append(name.data(), name.size());
+
+	buffers.push_back(SourceBuffer{ start.offset, static_cast<uint32_t>(size), static_cast<uint32_t>(lineStarts.size()),
+		nameAt, static_cast<uint32_t>(name.size()), lineNo, offset });
+	lineStarts.push_back(start.offset);
+	return start;
+}
+
+size_t SourceTable::addLines(SourceLoc at, std::string_view text) {
+	const char* begin = text.data();
+	const char* end = begin + text.size();
+	size_t before = lineStarts.size();
+	for (const char* p = begin; const void* nl = std::memchr(p, '\n', static_cast<size_t>(end - p));)
+	{
+		p = static_cast<const char*>(nl) + 1;
+		lineStarts.push_back(at.offset + static_cast<uint32_t>(p - begin));
+	}
+	return lineStarts.size() - before;
+}
+
+void SourceTable::truncate(size_t count) {
+	if (count >= buffers.size()) return;
+	lineStarts.resize(buffers[count].firstLine);
+	names.resize(count == 0 ? 0 : buffers[count - 1].name + buffers[count - 1].nameSize);
+	buffers.resize(count);
+}
+
+SourceLoc SourceTable::add(std::string_view name, std::string_view text) {
+	SourceLoc start = reserve(name, text.size());
+	addLines(start, text);
+	return start;
+}
+
+SourceLoc SourceTable::add(std::string_view name, uint64_t size, const std::vector<uint32_t>& lineOffsets) {
+	SourceLoc start = reserve(name, size);
+	for (uint32_t offset : lineOffsets) lineStarts.push_back(start.offset + offset);
+	return start;
+}
+
+PresumedLoc SourceTable::resolve(SourceLoc loc) const {
+	if (!loc.valid()) return PresumedLoc();
+	auto next = std::upper_bound(buffers.begin(), buffers.end(), loc.offset,
+		[](uint32_t offset, const SourceBuffer& buffer) { return offset < buffer.start; });
+	if (next == buffers.begin()) return PresumedLoc();
+
+	const SourceBuffer& buffer = next[-1];
+	const uint32_t* first = lineStarts.begin() + buffer.firstLine;
+	const uint32_t* last = next == buffers.end() ? lineStarts.end() : lineStarts.begin() + next->firstLine;
+	const uint32_t* line = std::upper_bound(first, last, loc.offset) - 1;
+
+	PresumedLoc result;
+	result.file = std::string_view(names.data() + buffer.name, buffer.nameSize);
+	result.line = buffer.lineNo + static_cast<uint32_t>(line - first);
+	result.column = loc.offset - *line + 1;
+	result.offset = buffer.offset + (loc.offset - buffer.start);
+	return result;
+}
+
+std::string SourceTable::describe(SourceLoc loc) const {
+	PresumedLoc where = resolve(loc);
+	if (!where.valid()) return std::string();
+	return std::string(where.file) + ":" + std::to_string(where.line) + ":" + std::to_string(where.column);
+}
+
+SourceLoc SourceSketch::loc(int32_t lineNo, int32_t pos) {
+	if (lineNo <= 0 || pos < 0 || uint64_t(start.offset) + uint64_t(pos) + 1 >= UINT32_MAX) return SourceLoc();
+
+	size_t line = static_cast<size_t>(lineNo) - 1;
+	if (lineOffsets.size() <= line) lineOffsets.resize(line + 1, UINT32_MAX);
+	lineOffsets[line] = std::min(lineOffsets[line], static_cast<uint32_t>(pos));
+	size = std::max(size, uint64_t(pos) + 1);
+	return start + static_cast<uint32_t>(pos);
+}
+
+void SourceSketch::finish(std::string_view name) {
+	// Line 1 starts the file, a line with no token starts where the next
+	// one does, and no line starts before the one above it
+	if (!lineOffsets.empty()) lineOffsets[0] = 0;
+	uint32_t next = static_cast<uint32_t>(size);
+	for (size_t i = lineOffsets.size(); i-- > 0;)
+	{
+		if (lineOffsets[i] == UINT32_MAX) lineOffsets[i] = next;
+		next = lineOffsets[i];
+	}
+	for (size_t i = 1; i < lineOffsets.size(); i++) lineOffsets[i] = std::max(lineOffsets[i], lineOffsets[i - 1]);
+
+	std::vector<uint32_t> after(lineOffsets.begin() + (lineOffsets.empty() ? 0 : 1), lineOffsets.end());
+	table.add(name, size, after);
+}
@@ -0,0 +1,155 @@
+#include "include/threadpool.h"
+
+#include <chrono>
+
+namespace {
+
+// Which pool and queue the current thread works for, if any
+thread_local const ThreadPool* currentPool = nullptr;
+thread_local unsigned currentQueue = 0;
+
+}
+
+ThreadPool::ThreadPool(unsigned threads) {
+	if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+
+	for (unsigned i = 0; i < threads; i++) queues.push_back(std::make_unique<Queue>());
+	for (unsigned i = 0; i < threads; i++) workers.emplace_back([this, i] { workerLoop(i); });
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (std::thread& worker : workers) worker.join();
+}
+
+ThreadPool& ThreadPool::shared() {
+	static ThreadPool pool;
+	return pool;
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+	// Workers push onto their own queue so nested work stays local
+	unsigned index = currentPool == this ? currentQueue : nextQueue++ % size();
+	{
+		std::lock_guard<std::mutex> lock(queues[index]->mutex);
+		queues[index]->tasks.push_back(std::move(task));
+	}
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		queued++;
+	}
+	wake.notify_one();
+}
+
+bool ThreadPool::pop(unsigned index, std::function<void()>& task) {
+	Queue& queue = *queues[index];
+	std::lock_guard<std::mutex> lock(queue.mutex);
+	if (queue.tasks.empty()) return false;
+	task = std::move(queue.tasks.back());
+	queue.tasks.pop_back();
+	queued--;
+	return true;
+}
+
+bool ThreadPool::steal(unsigned index, std::function<void()>& task) {
+	for (unsigned i = 1; i <= size(); i++)
+	{
+		Queue& queue = *queues[(index + i) % size()];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (queue.tasks.empty()) continue;
+		task = std::move(queue.tasks.front());
+		queue.tasks.pop_front();
+		queued--;
+		return true;
+	}
+	return false;
+}
+
+bool ThreadPool::runOne() {
+	std::function<void()> task;
+	unsigned index = currentPool == this ? currentQueue : 0;
+	if (!(currentPool == this && pop(index, task)) && !steal(index, task)) return false;
+	task();
+	return true;
+}
+
+void ThreadPool::workerLoop(unsigned index) {
+	currentPool = this;
+	currentQueue = index;
+
+	std::function<void()> task;
+	for (;;)
+	{
+		if (pop(index, task) || steal(index, task))
+		{
+			task();
+			task = nullptr;
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(sleepMutex);
+		wake.wait(lock, [this] { return stopping || queued > 0; });
+		if (stopping && queued == 0) return;
+	}
+}
+
+TaskGroup::~TaskGroup() {
+	// Tasks capture references into the caller's frame; never leave any behind
+	try
+	{
+		wait();
+	}
+	catch (...)
+	{
+	}
+}
+
+void TaskGroup::run(std::function<void()> task) {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		pending++;
+	}
+
+	pool.submit([this, task = std::move(task)] {
+		std::exception_ptr failure;
+		try
+		{
+			task();
+		}
+		catch (...)
+		{
+			failure = std::current_exception();
+		}
+
+		std::lock_guard<std::mutex> lock(mutex);
+		if (failure && !error) error = failure;
+		if (--pending == 0) done.notify_all();
+	});
+}
+
+void TaskGroup::wait() {
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			if (pending == 0) break;
+		}
+
+		if (!pool.runOne())
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			done.wait_for(lock, std::chrono::milliseconds(1), [this] { return pending == 0; });
+		}
+	}
+
+	std::exception_ptr failure;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		std::swap(failure, error);
+	}
+	if (failure) std::rethrow_exception(failure);
+}
@@ -0,0 +1,299 @@
+#include "include/timing.h"
+
+#include <algorithm>
+#include <cstdio>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+namespace {
+
+std::string format(const char* fmt, double value) {
+	char text[32];
+	std::snprintf(text, sizeof(text), fmt, value);
+	return text;
+}
+
+// {"ast_nodes": {"bytes": ..., "peak_bytes": ...}, ..., "total": {...}, left
+// open for more keys
+void appendMemory(std::string& out, const MemoryStats& stats) {
+	auto usage = [&out](const char* name, const MemoryUsage& usage) {
+		out += '"';
+		out += name;
+		out += "\": {\"bytes\": " + std::to_string(usage.bytes) + ", \"peak_bytes\": " + std::to_string(usage.peakBytes) + "}, ";
+	};
+	out.push_back('{');
+	for (size_t i = 0; i < MemoryKindCount; i++) usage(memoryKindString(static_cast<MemoryKind>(i)), stats.kinds[i]);
+	usage("total", stats.total);
+	out.resize(out.size() - 2);
+}
+
+}
+
+uint64_t peakRssBytes() {
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0;
+	return counters.PeakWorkingSetSize;
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#ifdef __APPLE__
+	return static_cast<uint64_t>(usage.ru_maxrss);
+#else
+	// Linux reports kilobytes
+	return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+TimeReport::TimeReport() : lastPeak(peakRssBytes()) {}
+
+void TimeReport::phase(const std::string& name, double seconds, uint64_t items) {
+	uint64_t peak = peakRssBytes();
+	bool tracked = memoryTrackingOn();
+	MemoryStats memory = tracked ? sampleMemoryPhase() : MemoryStats();
+	std::lock_guard<std::mutex> lock(mutex);
+	phaseList.push_back(PhaseTiming{ name, seconds, items, peak, peak > lastPeak ? peak - lastPeak : 0, tracked, memory });
+	lastPeak = std::max(lastPeak, peak);
+}
+
+void TimeReport::step(const std::string& name, double seconds, uint64_t items) {
+	std::lock_guard<std::mutex> lock(mutex);
+	phaseList.push_back(PhaseTiming{ name, seconds, items, 0, 0, false, MemoryStats() });
+}
+
+void TimeReport::passes(const std::map<std::string, PassTiming>& timings) {
+	std::lock_guard<std::mutex> lock(mutex);
+	for (const auto& [name, timing] : timings)
+	{
+		PassTiming& total = passTimes[name];
+		total.name = name;
+		total.seconds += timing.seconds;
+		total.runs += timing.runs;
+	}
+}
+
+void TimeReport::sites(const std::vector<DispatchSite>& ran) {
+	std::lock_guard<std::mutex> lock(mutex);
+	siteList.insert(siteList.end(), ran.begin(), ran.end());
+}
+
+std::vector<PhaseTiming> TimeReport::phases() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	return phaseList;
+}
+
+std::vector<PassTiming> TimeReport::passes() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	return sortedPasses();
+}
+
+std::vector<PassTiming> TimeReport::sortedPasses() const {
+	std::vector<PassTiming> sorted;
+	for (const auto& entry : passTimes) sorted.push_back(entry.second);
+	std::stable_sort(sorted.begin(), sorted.end(), [](const PassTiming& a, const PassTiming& b) { return a.seconds > b.seconds; });
+	return sorted;
+}
+
+std::vector<DispatchSite> TimeReport::sites() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	return sortedSites();
+}
+
+std::vector<DispatchSite> TimeReport::sortedSites() const {
+	std::vector<DispatchSite> sorted = siteList;
+	std::stable_sort(sorted.begin(), sorted.end(), [](const DispatchSite& a, const DispatchSite& b) { return a.calls > b.calls; });
+	return sorted;
+}
+
+double TimeReport::totalSeconds() const {
+	double total = 0;
+	for (const PhaseTiming& phase : phaseList)
+		if (phase.name.find('.') == std::string::npos) total += phase.seconds;
+	return total;
+}
+
+void appendJsonString(std::string& out, const std::string& value) {
+	out.push_back('"');
+	for (char c : value)
+	{
+		if (c == '"' || c == '\\')
+		{
+			out.push_back('\\');
+			out.push_back(c);
+		}
+		else if (static_cast<unsigned char>(c) < 0x20)
+		{
+			char escape[8];
+			std::snprintf(escape, sizeof(escape), "\\u%04x", c);
+			out += escape;
+		}
+		else
+		{
+			out.push_back(c);
+		}
+	}
+	out.push_back('"');
+}
+
+std::string TimeReport::json() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	std::string out = "{\"phases\": [";
+	for (size_t i = 0; i < phaseList.size(); i++)
+	{
+		const PhaseTiming& phase = phaseList[i];
+		out += i ? ", {\"name\": " : "{\"name\": ";
+		appendJsonString(out, phase.name);
+		out += ", \"seconds\": " + format("%.9f", phase.seconds);
+		out += ", \"items\": " + std::to_string(phase.items);
+		out += ", \"peak_rss_bytes\": " + std::to_string(phase.peakRssBytes);
+		out += ", \"rss_growth_bytes\": " + std::to_string(phase.rssGrowthBytes);
+		if (phase.memoryTracked)
+		{
+			out += ", \"memory\": ";
+			appendMemory(out, phase.memory);
+			out.push_back('}');
+		}
+		out.push_back('}');
+	}
+	out += "], \"passes\": [";
+
+	std::vector<PassTiming> sorted = sortedPasses();
+	for (size_t i = 0; i < sorted.size(); i++)
+	{
+		out += i ? ", {\"name\": " : "{\"name\": ";
+		appendJsonString(out, sorted[i].name);
+		out += ", \"seconds\": " + format("%.9f", sorted[i].seconds);
+		out += ", \"runs\": " + std::to_string(sorted[i].runs) + "}";
+	}
+	out += "], \"total_seconds\": " + format("%.9f", totalSeconds());
+
+	if (!siteList.empty())
+	{
+		out += ", \"dispatch_sites\": [";
+		std::vector<DispatchSite> sites = sortedSites();
+		for (size_t i = 0; i < sites.size(); i++)
+		{
+			out += i ? ", {\"site\": " : "{\"site\": ";
+			appendJsonString(out, sites[i].site);
+			out += sites[i].fastPath ? ", \"fast_path\": true" : ", \"fast_path\": false";
+			out += ", \"calls\": " + std::to_string(sites[i].calls);
+			out += ", \"hits\": " + std::to_string(sites[i].hits);
+			out += ", \"elements\": " + std::to_string(sites[i].elements) + "}";
+		}
+		out.push_back(']');
+	}
+
+	MemoryTracking tracking = memoryTracking();
+	if (tracking != MemoryTracking::Off)
+	{
+		out += ", \"memory\": ";
+		appendMemory(out, memoryStats());
+		if (tracking == MemoryTracking::Sites)
+		{
+			out += ", \"sites\": [";
+			std::vector<SiteUsage> sites = memorySites();
+			for (size_t i = 0; i < sites.size(); i++)
+			{
+				out += i ? ", {\"site\": " : "{\"site\": ";
+				appendJsonString(out, sites[i].site);
+				out += ", \"calls\": " + std::to_string(sites[i].calls);
+				out += ", \"bytes\": " + std::to_string(sites[i].bytes) + "}";
+			}
+			out.push_back(']');
+		}
+		out.push_back('}');
+	}
+	out.push_back('}');
+	return out;
+}
+
+std::string TimeReport::text() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	std::string out;
+	char line[160];
+	bool tracked = std::any_of(phaseList.begin(), phaseList.end(), [](const PhaseTiming& phase) { return phase.memoryTracked; });
+	std::snprintf(line, sizeof(line), tracked ? "%-24s %12s %12s %14s %14s\n" : "%-24s %12s %12s %14s\n", "phase", "ms", "items",
+		"peak RSS KiB", "tracked KiB");
+	out += line;
+	for (const PhaseTiming& phase : phaseList)
+	{
+		if (phase.peakRssBytes)
+		{
+			int length = std::snprintf(line, sizeof(line), "%-24s %12.3f %12llu %14llu", phase.name.c_str(), phase.seconds * 1e3,
+				static_cast<unsigned long long>(phase.items), static_cast<unsigned long long>(phase.peakRssBytes >> 10));
+			// The most the tracked structures held while the phase ran
+			if (phase.memoryTracked)
+				length += std::snprintf(line + length, sizeof(line) - length, " %14llu",
+					static_cast<unsigned long long>(phase.memory.total.peakBytes >> 10));
+			std::snprintf(line + length, sizeof(line) - length, "\n");
+		}
+		else
+		{
+			std::snprintf(line, sizeof(line), "  %-22s %12.3f %12llu\n", phase.name.c_str(), phase.seconds * 1e3,
+				static_cast<unsigned long long>(phase.items));
+		}
+		out += line;
+	}
+	std::snprintf(line, sizeof(line), "%-24s %12.3f\n", "total", totalSeconds() * 1e3);
+	out += line;
+
+	std::vector<PassTiming> sorted = sortedPasses();
+	if (!sorted.empty())
+	{
+		std::snprintf(line, sizeof(line), "\n%-48s %12s %8s\n", "pass", "ms", "runs");
+		out += line;
+		for (const PassTiming& pass : sorted)
+		{
+			std::snprintf(line, sizeof(line), "%-48s %12.3f %8llu\n", pass.name.c_str(), pass.seconds * 1e3,
+				static_cast<unsigned long long>(pass.runs));
+			out += line;
+		}
+	}
+
+	if (!siteList.empty())
+	{
+		// As an executable built with site counters writes them at exit
+		std::snprintf(line, sizeof(line), "\n%-48s %12s %8s %14s\n", "dispatch site", "calls", "hit %", "elements");
+		out += line;
+		for (const DispatchSite& site : sortedSites())
+		{
+			char rate[16] = "-";
+			if (site.fastPath && site.calls)
+				std::snprintf(rate, sizeof(rate), "%.1f", 100.0 * static_cast<double>(site.hits) / static_cast<double>(site.calls));
+			std::snprintf(line, sizeof(line), "%-48s %12llu %8s %14llu\n", site.site.c_str(), static_cast<unsigned long long>(site.calls),
+				rate, static_cast<unsigned long long>(site.elements));
+			out += line;
+		}
+	}
+
+	MemoryTracking tracking = memoryTracking();
+	if (tracking == MemoryTracking::Off) return out;
+	MemoryStats stats = memoryStats();
+	std::snprintf(line, sizeof(line), "\n%-24s %12s %12s\n", "memory", "KiB", "peak KiB");
+	out += line;
+	auto usage = [&](const char* name, const MemoryUsage& usage) {
+		std::snprintf(line, sizeof(line), "%-24s %12llu %12llu\n", name, static_cast<unsigned long long>(usage.bytes >> 10),
+			static_cast<unsigned long long>(usage.peakBytes >> 10));
+		out += line;
+	};
+	for (size_t i = 0; i < MemoryKindCount; i++) usage(memoryKindString(static_cast<MemoryKind>(i)), stats.kinds[i]);
+	usage("total", stats.total);
+	if (tracking != MemoryTracking::Sites) return out;
+
+	std::snprintf(line, sizeof(line), "\n%-48s %12s %12s\n", "site", "KiB", "calls");
+	out += line;
+	for (const SiteUsage& site : memorySites())
+	{
+		std::snprintf(line, sizeof(line), "%-48s %12llu %12llu\n", site.site.c_str(), static_cast<unsigned long long>(site.bytes >> 10),
+			static_cast<unsigned long long>(site.calls));
+		out += line;
+	}
+	return out;
+}
@@ -0,0 +1,260 @@
+#include "include/dump.h"
+
+#include <cerrno>
+#include <charconv>
+#include <climits>
+#include <stdexcept>
+#include "include/visitor.h"
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace {
+
+constexpr std::string_view Tabs = "\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t";
+
+class TextDumper : public AstVisitor<TextDumper>
+{
+public:
+	TextDumper(const Ast& ast, FdWriter& out) : AstVisitor(ast), out(out) {}
+
+	uint64_t nodes = 0;
+
+private:
+	friend class AstVisitor<TextDumper>;
+
+	FdWriter& out;
+
+	bool enterNode(NodeRef node)
+	{
+		for (size_t level = depth(); level > 0;)
+		{
+			size_t n = level < Tabs.size() ? level : Tabs.size();
+			out.write(Tabs.data(), n);
+			level -= n;
+		}
+		out.write(nodeTypeString(node.type()));
+		out.put('[');
+		out.write(node.value());
+		out.write("]\n", 2);
+		nodes++;
+		return true;
+	}
+};
+
+class JsonDumper : public AstVisitor<JsonDumper>
+{
+public:
+	JsonDumper(const Ast& ast, FdWriter& out) : AstVisitor(ast), out(out) {}
+
+	uint64_t nodes = 0;
+
+private:
+	friend class AstVisitor<JsonDumper>;
+
+	FdWriter& out;
+
+	bool enterNode(NodeRef node)
+	{
+		if (parent().valid() && childIndex() > 0) out.put(',');
+		out.write("{\"type\":\"");
+		out.write(nodeTypeString(node.type()));
+		out.put('"');
+
+		const Token& tok = node.tok();
+		if (tok.kind != TokenKind::None)
+		{
+			out.write(",\"kind\":\"");
+			out.write(tokenKindString(tok.kind));
+			out.write("\",\"value\":");
+			quoted(node.value());
+			PresumedLoc where = node.tree().sources().resolve(tok.loc);
+			out.write(",\"line\":");
+			out.number(static_cast<int64_t>(where.line));
+			out.write(",\"pos\":");
+			out.number(static_cast<int64_t>(where.offset));
+		}
+		out.write(",\"children\":[");
+		nodes++;
+		return true;
+	}
+
+	void leaveNode(NodeRef)
+	{
+		out.write("]}");
+		if (!parent().valid()) out.put('\n');
+	}
+
+	void quoted(std::string_view text)
+	{
+		static const char hex[] = "0123456789abcdef";
+		out.put('"');
+		size_t start = 0;
+		for (size_t i = 0; i < text.size(); i++)
+		{
+			unsigned char c = static_cast<unsigned char>(text[i]);
+			if (c >= 0x20 && c != '"' && c != '\\') continue;
+
+			out.write(text.data() + start, i - start);
+			start = i + 1;
+			switch (c)
+			{
+			case '"': out.write("\\\"", 2); break;
+			case '\\': out.write("\\\\", 2); break;
+			case '\n': out.write("\\n", 2); break;
+			case '\t': out.write("\\t", 2); break;
+			default:
+			{
+				char escape[] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 15] };
+				out.write(escape, sizeof(escape));
+				break;
+			}
+			}
+		}
+		out.write(text.data() + start, text.size() - start);
+		out.put('"');
+	}
+};
+
+class DotDumper : public AstVisitor<DotDumper>
+{
+public:
+	DotDumper(const Ast& ast, FdWriter& out) : AstVisitor(ast), out(out) {}
+
+	uint64_t nodes = 0;
+
+private:
+	friend class AstVisitor<DotDumper>;
+
+	FdWriter& out;
+
+	bool enterNode(NodeRef node)
+	{
+		if (!parent().valid())
+		{
+			// ordering=out keeps children left to right in source order
+			out.write("digraph ast {\n\tgraph [ordering=out];\n\tnode [shape=rectangle];\n");
+		}
+
+		out.write("\tn");
+		out.number(static_cast<uint64_t>(node.id()));
+		out.write(" [label=\"");
+		out.write(nodeTypeString(node.type()));
+		if (node.tok().kind != TokenKind::None)
+		{
+			// TreeNode.__str__ leaves the brackets off nodes without a token
+			out.put('[');
+			label(node.value());
+			out.put(']');
+		}
+		out.write("\"];\n");
+
+		if (parent().valid())
+		{
+			out.write("\tn");
+			out.number(static_cast<uint64_t>(parent().id()));
+			out.write(" -> n");
+			out.number(static_cast<uint64_t>(node.id()));
+			out.write(";\n");
+		}
+		nodes++;
+		return true;
+	}
+
+	void leaveNode(NodeRef)
+	{
+		if (!parent().valid()) out.write("}\n");
+	}
+
+	void label(std::string_view text)
+	{
+		size_t start = 0;
+		for (size_t i = 0; i < text.size(); i++)
+		{
+			if (text[i] != '"' && text[i] != '\\' && text[i] != '\n') continue;
+			out.write(text.data() + start, i - start);
+			start = i + 1;
+			out.write(text[i] == '\n' ? "\\n" : text[i] == '"' ? "\\\"" : "\\\\", 2);
+		}
+		out.write(text.data() + start, text.size() - start);
+	}
+};
+
+template <typename Dumper>
+uint64_t dumpWith(NodeRef root, int fd) {
+	FdWriter out(fd);
+	Dumper dumper(root.tree(), out);
+	dumper.walk(root.id());
+	out.flush();
+	return dumper.nodes;
+}
+
+}
+
+DumpFormat dumpFormatFromString(const std::string& format) {
+	if (format == "text") return DumpFormat::Text;
+	if (format == "json") return DumpFormat::Json;
+	if (format == "dot") return DumpFormat::Dot;
+	throw std::invalid_argument("Unknown dump format '" + format + "', expected text, json or dot");
+}
+
+FdWriter::FdWriter(int fd, size_t capacity) : fd(fd), capacity(capacity), buffer(new char[capacity]) {}
+
+FdWriter::~FdWriter() {
+	try
+	{
+		flush();
+	}
+	catch (const std::exception&)
+	{
+	}
+}
+
+void FdWriter::number(uint64_t value) {
+	char text[24];
+	char* end = std::to_chars(text, text + sizeof(text), value).ptr;
+	write(text, static_cast<size_t>(end - text));
+}
+
+void FdWriter::number(int64_t value) {
+	char text[24];
+	char* end = std::to_chars(text, text + sizeof(text), value).ptr;
+	write(text, static_cast<size_t>(end - text));
+}
+
+void FdWriter::flush() {
+	size_t pending = used;
+	used = 0;
+	writeAll(buffer.get(), pending);
+}
+
+void FdWriter::writeAll(const char* data, size_t size) {
+	while (size > 0)
+	{
+#ifdef _WIN32
+		int n = _write(fd, data, static_cast<unsigned>(size < INT_MAX ? size : INT_MAX));
+#else
+		ssize_t n = ::write(fd, data, size);
+#endif
+		if (n < 0)
+		{
+			if (errno == EINTR) continue;
+			throw std::runtime_error("Cannot write to file descriptor " + std::to_string(fd) + ": " + std::strerror(errno));
+		}
+		data += n;
+		size -= static_cast<size_t>(n);
+		flushed += static_cast<uint64_t>(n);
+	}
+}
+
+uint64_t dumpTree(NodeRef root, DumpFormat format, int fd) {
+	switch (format)
+	{
+	case DumpFormat::Json: return dumpWith<JsonDumper>(root, fd);
+	case DumpFormat::Dot: return dumpWith<DotDumper>(root, fd);
+	default: return dumpWith<TextDumper>(root, fd);
+	}
+}
@@ -0,0 +1,73 @@
+#include "bench.h"
+
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include "codegen.h"
+
+// What each run of a program costs before it does any work: spawning an AOT
+// executable until it has exited, linked statically and dynamically, next
+// to compiling and running the same program in-process with the JIT
+
+static const char* const Program = "fn sq x: x * x\nxs = [3, 1, 4, 1, 5, 9, 2, 6]\nxs | map sq | sum\n";
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/wait.h>
+
+extern char** environ;
+
+static void BM_AotStartup(benchmark::State& state) {
+	bool linkStatic = state.range(0) != 0;
+	std::string path = (std::filesystem::temp_directory_path() / ("quark_bench_aot" + std::to_string(state.range(0)))).string();
+	Ast ast;
+	parseSource(Program, ast);
+	CodegenOptions options;
+	options.optimizer.level = OptLevel::O2;
+	options.aot.output = path;
+	options.aot.staticExecutable = linkStatic;
+	try
+	{
+		QuarkCodegen(options).run(ast, CodegenMode::AOT);
+	}
+	catch (const QuarkCodegenError& e)
+	{
+		state.SkipWithError(e.what());
+		return;
+	}
+
+	// The program prints its result, which would otherwise land in the report
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_addopen(&actions, 1, "/dev/null", O_WRONLY, 0);
+	char* argv[] = { path.data(), nullptr };
+	for (auto _ : state)
+	{
+		pid_t pid;
+		int status = 0;
+		if (posix_spawn(&pid, path.c_str(), &actions, nullptr, argv, environ) != 0 || waitpid(pid, &status, 0) != pid || status != 0)
+		{
+			state.SkipWithError("The AOT executable did not run");
+			break;
+		}
+	}
+	posix_spawn_file_actions_destroy(&actions);
+	std::remove(path.c_str());
+	state.SetLabel(linkStatic ? "static" : "dynamic");
+}
+BENCHMARK(BM_AotStartup)->Arg(0)->Arg(1)->ArgName("static")->Unit(benchmark::kMicrosecond)->UseRealTime();
+#endif
+
+static void BM_JitStartup(benchmark::State& state) {
+	Ast ast;
+	parseSource(Program, ast);
+	CodegenOptions options;
+	options.optimizer.level = OptLevel::O2;
+	for (auto _ : state)
+	{
+		QuarkCodegen cg(options);
+		benchmark::DoNotOptimize(cg.run(ast.rootRef(), CodegenMode::JIT).intValue);
+	}
+}
+BENCHMARK(BM_JitStartup)->Unit(benchmark::kMicrosecond);
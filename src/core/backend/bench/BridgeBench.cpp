@@ -0,0 +1,46 @@
+#include "bench.h"
+
+#include <pybind11/embed.h>
+#include "../pytreetonative/pytreetonative.h"
+
+namespace {
+
+// Mirror of a native tree with the attributes genNativeTreeRepr reads from
+// core.helper_types.TreeNode: type.value, tok (type, value, lineno, pos) and
+// children. Nodes without a spelling have no token, as in the Python parser.
+pybind11::object pythonTree(NodeRef node, const pybind11::object& makeNode) {
+	pybind11::object tok = pybind11::none();
+	if (!node.value().empty())
+	{
+		PresumedLoc where = node.tree().sources().resolve(node.tok().loc);
+		tok = makeNode(pybind11::arg("type") = tokenKindString(node.kind()), pybind11::arg("value") = std::string(node.value()),
+			pybind11::arg("lineno") = where.line, pybind11::arg("pos") = where.offset);
+	}
+
+	pybind11::list children;
+	for (NodeRef child : node.children()) children.append(pythonTree(child, makeNode));
+	return makeNode(pybind11::arg("type") = makeNode(pybind11::arg("value") = static_cast<int>(node.type())),
+		pybind11::arg("tok") = tok, pybind11::arg("children") = children);
+}
+
+}
+
+static void BM_GenNativeTreeRepr(benchmark::State& state) {
+	static pybind11::scoped_interpreter interpreter;
+
+	Ast source;
+	parseSource(syntheticSource(static_cast<int>(state.range(0)), 4), source);
+	pybind11::object tree = pythonTree(source.rootRef(), pybind11::module_::import("types").attr("SimpleNamespace"));
+
+	AllocationCounter counter(state);
+	for (auto _ : state)
+	{
+		Ast ast;
+		AstBuilder builder(ast);
+		SourceSketch sketch(ast.sources());
+		benchmark::DoNotOptimize(PyTreeToNativeRepr::genNativeTreeRepr(tree, builder, sketch));
+		sketch.finish("<input>");
+	}
+	counter.finish(source.size());
+}
+BENCHMARK(BM_GenNativeTreeRepr)->Arg(16)->Arg(256)->Arg(4096);
@@ -0,0 +1,140 @@
+#include "bench.h"
+
+#include <map>
+#include <string>
+#include <vector>
+#include "codegen.h"
+#include "runtime.h"
+
+// The list kernels at each SIMD level the CPU has, on lists of the given
+// number of elements. Results are freed every iteration, as a program's are.
+
+namespace {
+
+struct Lists
+{
+	std::vector<int64_t> ints;
+	std::vector<double> floats;
+	QuarkList* intList;
+	QuarkList* floatList;
+	QuarkList* mask;
+};
+
+// Built outside any arena, so they outlive the benchmark loops
+const Lists& lists(int64_t elements) {
+	static std::map<int64_t, Lists> built;
+	auto it = built.find(elements);
+	if (it != built.end()) return it->second;
+
+	Lists lists;
+	uint64_t state = 0x9e3779b97f4a7c15ull;
+	for (int64_t i = 0; i < elements; i++)
+	{
+		state = state * 6364136223846793005ull + 1442695040888963407ull;
+		lists.ints.push_back(static_cast<int64_t>(state >> 40) - (1 << 23));
+		lists.floats.push_back(static_cast<double>(lists.ints.back()) / 128.0);
+	}
+	lists.intList = quark_list_from_i64(lists.ints.data(), elements);
+	lists.floatList = quark_list_from_f64(lists.floats.data(), elements);
+	lists.mask = quark_list_compare_scalar_i64(static_cast<int32_t>(ListCompare::Gt), lists.intList, 0);
+	return built.emplace(elements, std::move(lists)).first->second;
+}
+
+bool selectLevel(benchmark::State& state) {
+	SimdLevel level = static_cast<SimdLevel>(state.range(1));
+	if (setSimdLevel(level) == level) return true;
+	setSimdLevel(detectSimdLevel());
+	state.SkipWithError("SIMD level not available on this CPU");
+	return false;
+}
+
+void finish(benchmark::State& state) {
+	state.SetItemsProcessed(state.range(0) * static_cast<int64_t>(state.iterations()));
+	state.SetLabel(simdLevelString(simdLevel()));
+	setSimdLevel(detectSimdLevel());
+}
+
+}
+
+static void BM_ListArith(benchmark::State& state) {
+	const Lists& in = lists(state.range(0));
+	if (!selectLevel(state)) return;
+	for (auto _ : state)
+	{
+		ListArena arena;
+		benchmark::DoNotOptimize(quark_list_arith_f64(static_cast<int32_t>(ListOp::Mul), in.floatList, in.floatList));
+		benchmark::DoNotOptimize(quark_list_arith_scalar_i64(static_cast<int32_t>(ListOp::Add), in.intList, 7));
+	}
+	finish(state);
+}
+BENCHMARK(BM_ListArith)->ArgsProduct({ { 1 << 10, 1 << 16, 1 << 20 }, { 0, 1, 2 } })->ArgNames({ "elements", "simd" });
+
+static void BM_ListSum(benchmark::State& state) {
+	const Lists& in = lists(state.range(0));
+	if (!selectLevel(state)) return;
+	for (auto _ : state)
+	{
+		benchmark::DoNotOptimize(quark_list_sum_f64(in.floatList));
+		benchmark::DoNotOptimize(quark_list_sum_i64(in.intList));
+	}
+	finish(state);
+}
+BENCHMARK(BM_ListSum)->ArgsProduct({ { 1 << 10, 1 << 16, 1 << 20 }, { 0, 1, 2 } })->ArgNames({ "elements", "simd" });
+
+static void BM_ListMinMax(benchmark::State& state) {
+	const Lists& in = lists(state.range(0));
+	if (!selectLevel(state)) return;
+	for (auto _ : state)
+	{
+		benchmark::DoNotOptimize(quark_list_min_f64(in.floatList));
+		benchmark::DoNotOptimize(quark_list_max_i64(in.intList));
+	}
+	finish(state);
+}
+BENCHMARK(BM_ListMinMax)->ArgsProduct({ { 1 << 10, 1 << 16, 1 << 20 }, { 0, 1, 2 } })->ArgNames({ "elements", "simd" });
+
+static void BM_ListCompare(benchmark::State& state) {
+	const Lists& in = lists(state.range(0));
+	if (!selectLevel(state)) return;
+	for (auto _ : state)
+	{
+		ListArena arena;
+		benchmark::DoNotOptimize(quark_list_compare_scalar_f64(static_cast<int32_t>(ListCompare::Lt), in.floatList, 0.5));
+	}
+	finish(state);
+}
+BENCHMARK(BM_ListCompare)->ArgsProduct({ { 1 << 10, 1 << 16, 1 << 20 }, { 0, 1, 2 } })->ArgNames({ "elements", "simd" });
+
+// Half the elements pass, at random, which is the worst case for a branch
+static void BM_ListFilter(benchmark::State& state) {
+	const Lists& in = lists(state.range(0));
+	if (!selectLevel(state)) return;
+	for (auto _ : state)
+	{
+		ListArena arena;
+		benchmark::DoNotOptimize(quark_list_filter(in.floatList, in.mask));
+	}
+	finish(state);
+}
+BENCHMARK(BM_ListFilter)->ArgsProduct({ { 1 << 10, 1 << 16, 1 << 20 }, { 0, 1, 2 } })->ArgNames({ "elements", "simd" });
+
+// A map/filter/sum pipeline as one fused pipe and as one statement, and list,
+// per stage; compile time included, which the larger lists drown out
+static void BM_Pipe(benchmark::State& state) {
+	std::string n = std::to_string(state.range(0));
+	std::string source = "fn sq x: x * x\nfn odd x: x - x / 2 * 2\n";
+	if (state.range(1)) source += "@range " + n + " | map sq | filter odd | sum\n";
+	else source += "a = @range " + n + "\nb = a | map sq\nc = b | filter odd\nc | sum\n";
+
+	Ast ast;
+	parseSource(source, ast);
+	CodegenOptions options;
+	options.optimizer.level = OptLevel::O2;
+	for (auto _ : state)
+	{
+		QuarkCodegen cg(options);
+		benchmark::DoNotOptimize(cg.run(ast.rootRef(), CodegenMode::JIT).intValue);
+	}
+	state.SetItemsProcessed(state.range(0) * static_cast<int64_t>(state.iterations()));
+}
+BENCHMARK(BM_Pipe)->ArgsProduct({ { 1 << 16, 1 << 22 }, { 0, 1 } })->ArgNames({ "elements", "fused" })->Unit(benchmark::kMillisecond);
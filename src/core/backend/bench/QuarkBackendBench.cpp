@@ -0,0 +1,305 @@
+#include "bench.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <unordered_map>
+#include <vector>
+#include "batch.h"
+#include "codegen.h"
+#include "dump.h"
+#include "fold.h"
+#include "lexer.h"
+#include "lowering.h"
+#include "packedtree.h"
+#include "parser.h"
+#include "threadpool.h"
+
+std::atomic<uint64_t> allocatedBytes{ 0 };
+
+// Counting allocator. Every replaceable form is defined, so each new pairs
+// with a delete from here, which GCC checks with -Wmismatched-new-delete.
+namespace {
+
+void* allocate(size_t size) {
+	allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+	if (void* p = std::malloc(size ? size : 1)) return p;
+	throw std::bad_alloc();
+}
+
+void* allocateAligned(size_t size, std::align_val_t alignment) {
+	allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+	size_t align = static_cast<size_t>(alignment);
+	// aligned_alloc takes a nonzero multiple of the alignment
+	size_t rounded = (size + align - 1) / align * align;
+	if (void* p = std::aligned_alloc(align, rounded ? rounded : align)) return p;
+	throw std::bad_alloc();
+}
+
+}
+
+void* operator new(size_t size) { return allocate(size); }
+void* operator new[](size_t size) { return allocate(size); }
+void* operator new(size_t size, std::align_val_t alignment) { return allocateAligned(size, alignment); }
+void* operator new[](size_t size, std::align_val_t alignment) { return allocateAligned(size, alignment); }
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+void operator delete[](void* p, size_t) noexcept { std::free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void* p, size_t, std::align_val_t) noexcept { std::free(p); }
+
+namespace {
+
+void expression(std::string& out, int depth, int& leaf) {
+	static const char* const leaves[] = { "a", "b", "k", "7", "a", "(2 * 3 + 1)", "b", "1" };
+	static const char* const ops[] = { " + ", " * ", " - " };
+	if (depth == 0)
+	{
+		out += leaves[leaf++ % 8];
+		return;
+	}
+	out.push_back('(');
+	expression(out, depth - 1, leaf);
+	out += ops[(depth + leaf) % 3];
+	expression(out, depth - 1, leaf);
+	out.push_back(')');
+}
+
+const Ast& program(int functions) {
+	static std::unordered_map<int, std::unique_ptr<Ast>> programs;
+	std::unique_ptr<Ast>& ast = programs[functions];
+	if (!ast)
+	{
+		ast = std::make_unique<Ast>();
+		parseSource(syntheticSource(functions, 4), *ast);
+	}
+	return *ast;
+}
+
+CodegenOptions benchOptions(int64_t level) {
+	CodegenOptions options;
+	options.optimizer.level = static_cast<OptLevel>(level);
+	options.threads = 1;
+	options.foldConstants = false;
+	return options;
+}
+
+}
+
+std::string syntheticSource(int functions, int depth) {
+	std::string out = "k = 3\n";
+	int leaf = 0;
+	for (int i = 0; i < functions; i++)
+	{
+		out += "fn f" + std::to_string(i) + " a, b:\n    x = ";
+		expression(out, depth, leaf);
+		out += "\n    y = x * 2 - a\n";
+		if (i == 0)
+		{
+			out += "    y + x / 3\n";
+			continue;
+		}
+		out += "    z = @f" + std::to_string(i - 1) + " a, 1.5\n";
+		out += "    y + x / 3 + z\n";
+	}
+	out += "r = @f" + std::to_string(functions - 1) + " 1, 2\n";
+	out += "r\n";
+	return out;
+}
+
+void parseSource(const std::string& source, Ast& ast) {
+	TokenBuffer tokens;
+	QuarkLexer(source).tokenize(tokens);
+	QuarkParser(tokens, ast).parse();
+}
+
+static void BM_Lex(benchmark::State& state) {
+	std::string source = syntheticSource(static_cast<int>(state.range(0)), 4);
+	AllocationCounter counter(state);
+	size_t count = 0;
+	for (auto _ : state)
+	{
+		TokenBuffer tokens;
+		QuarkLexer(source).tokenize(tokens);
+		count = tokens.size();
+		benchmark::DoNotOptimize(tokens.tokens.data());
+	}
+	counter.finish(count);
+	state.SetBytesProcessed(static_cast<int64_t>(source.size() * state.iterations()));
+}
+BENCHMARK(BM_Lex)->Arg(16)->Arg(256)->Arg(4096);
+
+// Sources under a megabyte are lexed serially, so only the bigger ones split
+static void BM_LexParallel(benchmark::State& state) {
+	std::string source = syntheticSource(static_cast<int>(state.range(0)), 4);
+	AllocationCounter counter(state);
+	size_t count = 0;
+	for (auto _ : state)
+	{
+		TokenBuffer tokens;
+		QuarkLexer(source).tokenizeParallel(tokens, ThreadPool::shared());
+		count = tokens.size();
+		benchmark::DoNotOptimize(tokens.tokens.data());
+	}
+	counter.finish(count);
+	state.SetBytesProcessed(static_cast<int64_t>(source.size() * state.iterations()));
+}
+BENCHMARK(BM_LexParallel)->Arg(4096)->Arg(16384)->UseRealTime();
+
+static void BM_Parse(benchmark::State& state) {
+	std::string source = syntheticSource(static_cast<int>(state.range(0)), 4);
+	TokenBuffer tokens;
+	QuarkLexer(source).tokenize(tokens);
+	AllocationCounter counter(state);
+	size_t nodes = 0;
+	for (auto _ : state)
+	{
+		Ast ast;
+		QuarkParser(tokens, ast).parse();
+		nodes = ast.size();
+		benchmark::DoNotOptimize(ast.root());
+	}
+	counter.finish(nodes);
+}
+BENCHMARK(BM_Parse)->Arg(16)->Arg(256)->Arg(4096);
+
+// Tree construction alone: a left-deep chain of additions, as the Pratt
+// parser builds for a long sum
+static void BM_BuildTree(benchmark::State& state) {
+	uint32_t terms = static_cast<uint32_t>(state.range(0));
+	AllocationCounter counter(state);
+	size_t nodes = 0;
+	for (auto _ : state)
+	{
+		Ast ast;
+		AstBuilder builder(ast);
+		SymbolId one = builder.symbols().intern("1");
+		SymbolId plus = builder.symbols().intern("+");
+		builder.open(CompilationUnit);
+		builder.leaf(Literal, Token{ TokenKind::INT, one, SourceLoc{} });
+		for (uint32_t i = 1; i < terms; i++)
+		{
+			builder.openAround(Operator, Token{ TokenKind::PLUS, plus, SourceLoc{} });
+			builder.leaf(Literal, Token{ TokenKind::INT, one, SourceLoc{} });
+			builder.close();
+		}
+		ast.setRoot(builder.close());
+		nodes = ast.size();
+		benchmark::DoNotOptimize(ast.root());
+	}
+	counter.finish(nodes);
+}
+BENCHMARK(BM_BuildTree)->Arg(1 << 10)->Arg(1 << 16)->Arg(1 << 20);
+
+// The bridge run_codegen.py uses: TreeNode.pack() bytes decoded natively
+static void BM_UnpackTree(benchmark::State& state) {
+	const Ast& ast = program(static_cast<int>(state.range(0)));
+	std::vector<uint8_t> packed = writePackedTree(ast.rootRef());
+	AllocationCounter counter(state);
+	for (auto _ : state)
+	{
+		Ast unpacked;
+		readPackedTree(packed.data(), packed.size(), unpacked);
+		benchmark::DoNotOptimize(unpacked.root());
+	}
+	counter.finish(ast.size());
+	state.SetBytesProcessed(static_cast<int64_t>(packed.size() * state.iterations()));
+}
+BENCHMARK(BM_UnpackTree)->Arg(16)->Arg(256)->Arg(4096);
+
+// Into the null device; the bench measures formatting and the writer, not a terminal
+static void BM_Dump(benchmark::State& state) {
+	const Ast& ast = program(static_cast<int>(state.range(0)));
+	DumpFormat format = static_cast<DumpFormat>(state.range(1));
+#ifdef _WIN32
+	std::FILE* null = std::fopen("NUL", "wb");
+#else
+	std::FILE* null = std::fopen("/dev/null", "wb");
+#endif
+	AllocationCounter counter(state);
+	for (auto _ : state) dumpTree(ast.rootRef(), format, fileno(null));
+	counter.finish(ast.size());
+	std::fclose(null);
+}
+BENCHMARK(BM_Dump)->ArgsProduct({ { 16, 256, 4096 }, { 0, 1, 2 } })->ArgNames({ "functions", "format" });
+
+static void BM_Fold(benchmark::State& state) {
+	const Ast& ast = program(static_cast<int>(state.range(0)));
+	AllocationCounter counter(state);
+	for (auto _ : state)
+	{
+		counter.pause();
+		Ast working = ast;
+		counter.resume();
+		benchmark::DoNotOptimize(foldConstants(working));
+	}
+	counter.finish(ast.size());
+}
+BENCHMARK(BM_Fold)->Arg(16)->Arg(256)->Arg(4096);
+
+static void BM_Infer(benchmark::State& state) {
+	const Ast& ast = program(static_cast<int>(state.range(0)));
+	AllocationCounter counter(state);
+	for (auto _ : state)
+	{
+		ModulePlan plan = planModule(ast.rootRef());
+		benchmark::DoNotOptimize(plan.functions.data());
+	}
+	counter.finish(ast.size());
+}
+BENCHMARK(BM_Infer)->Arg(16)->Arg(256)->Arg(4096);
+
+static void BM_EmitIR(benchmark::State& state) {
+	const Ast& ast = program(static_cast<int>(state.range(0)));
+	CodegenOptions options = benchOptions(state.range(1));
+	AllocationCounter counter(state);
+	for (auto _ : state)
+	{
+		QuarkCodegen cg(options);
+		benchmark::DoNotOptimize(cg.run(ast.rootRef(), CodegenMode::IR).ir.size());
+	}
+	counter.finish(ast.size());
+}
+BENCHMARK(BM_EmitIR)->ArgsProduct({ { 16, 256 }, { 0, 1, 2, 3 } })->ArgNames({ "functions", "O" })->Unit(benchmark::kMillisecond);
+
+static void BM_JIT(benchmark::State& state) {
+	const Ast& ast = program(static_cast<int>(state.range(0)));
+	CodegenOptions options = benchOptions(state.range(1));
+	AllocationCounter counter(state);
+	for (auto _ : state)
+	{
+		QuarkCodegen cg(options);
+		benchmark::DoNotOptimize(cg.run(ast.rootRef(), CodegenMode::JIT).floatValue);
+	}
+	counter.finish(ast.size());
+}
+BENCHMARK(BM_JIT)->ArgsProduct({ { 16, 256 }, { 0, 1, 2, 3 } })->ArgNames({ "functions", "O" })->Unit(benchmark::kMillisecond);
+
+// 64 units of source, lexed, parsed and compiled one after another or as
+// one batch on the pool
+static void BM_Batch(benchmark::State& state) {
+	std::vector<std::string> sources;
+	for (int i = 0; i < 64; i++) sources.push_back(syntheticSource(static_cast<int>(state.range(0)) + i % 4, 4));
+	std::vector<BatchUnit> units;
+	for (const std::string& source : sources) units.push_back(BatchUnit{ source, false });
+	CodegenOptions options = benchOptions(2);
+	for (auto _ : state)
+	{
+		if (state.range(1))
+		{
+			benchmark::DoNotOptimize(compileBatch(units, CodegenMode::JIT, options).size());
+			continue;
+		}
+		for (const BatchUnit& unit : units)
+			benchmark::DoNotOptimize(compileBatch({ unit }, CodegenMode::JIT, options).size());
+	}
+	state.SetItemsProcessed(static_cast<int64_t>(units.size() * state.iterations()));
+}
+BENCHMARK(BM_Batch)->ArgsProduct({ { 16 }, { 0, 1 } })->ArgNames({ "functions", "batch" })->Unit(benchmark::kMillisecond)->UseRealTime();
+
+BENCHMARK_MAIN();
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <benchmark/benchmark.h>
+#include "ast.h"
+
+// Bytes requested from operator new since the process started; the bench
+// replaces the global allocator to count them
+extern std::atomic<uint64_t> allocatedBytes;
+
+// A valid Quark program of roughly the given number of functions, each with
+// a few statements over expressions nested depth levels deep, and a call to
+// every function from the top level. Deterministic, so runs compare.
+std::string syntheticSource(int functions, int depth);
+
+// Lexes and parses source into ast
+void parseSource(const std::string& source, Ast& ast);
+
+// Measures bytes allocated per node over the benchmark loop, and nodes/sec
+class AllocationCounter
+{
+public:
+	explicit AllocationCounter(benchmark::State& state) : state(state), start(allocatedBytes.load()) {}
+
+	// Per-iteration setup, left out of both the time and the byte count
+	void pause()
+	{
+		state.PauseTiming();
+		pausedAt = allocatedBytes.load();
+	}
+
+	void resume()
+	{
+		excluded += allocatedBytes.load() - pausedAt;
+		state.ResumeTiming();
+	}
+
+	void finish(uint64_t nodesPerIteration)
+	{
+		uint64_t bytes = allocatedBytes.load() - start - excluded;
+		double nodes = static_cast<double>(nodesPerIteration) * static_cast<double>(state.iterations());
+		state.counters["nodes/s"] = benchmark::Counter(nodes, benchmark::Counter::kIsRate);
+		state.counters["bytes/node"] = nodes > 0 ? static_cast<double>(bytes) / nodes : 0;
+		state.SetItemsProcessed(static_cast<int64_t>(nodes));
+	}
+
+private:
+	benchmark::State& state;
+	uint64_t start;
+	uint64_t pausedAt = 0;
+	uint64_t excluded = 0;
+};
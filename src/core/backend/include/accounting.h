@@ -0,0 +1,185 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Opt-in accounting of the memory the backend's own data structures hold,
+// to tell which of them a process's RSS goes to. Each structure carries a
+// MemoryCharge of the bytes it has reserved, which it keeps up to date as it
+// grows, so the counters are exact for the arrays and estimates for LLVM's
+// modules, whose allocations LLVM does not expose. Allocations outside these
+// structures, and pages mapped from files, are not counted. The counters are
+// per process: concurrent compiles add up, as they do in the RSS.
+
+enum class MemoryKind : uint8_t
+{
+	AstNodes,		// node types, tokens and child lists of Asts
+	Tokens,			// the lexer's token arrays
+	Symbols,		// interned spellings and their index
+	Sources,		// source text read into memory and line tables
+	LlvmModules,	// IR of the units being lowered and optimized, estimated
+	Objects,		// object code of compiled units, until it is linked
+	Count,
+};
+
+constexpr size_t MemoryKindCount = static_cast<size_t>(MemoryKind::Count);
+
+// "ast_nodes", "tokens", "symbols", "sources", "llvm_modules" or "objects"
+const char* memoryKindString(MemoryKind kind);
+
+enum class MemoryTracking
+{
+	Off,
+	Counters,	// bytes per kind, with high-water marks
+	Sites,		// and the bytes each AST building call site allocated
+};
+
+// Parses "off", "counters" or "sites"; throws std::invalid_argument otherwise
+MemoryTracking memoryTrackingFromString(const std::string& mode);
+
+// Turning tracking on starts the high-water marks from what is held then.
+// Structures that grew while it was off are counted once they next grow.
+void setMemoryTracking(MemoryTracking mode);
+MemoryTracking memoryTracking();
+
+namespace detail {
+inline std::atomic<bool> memoryTrackingOn{ false };
+inline std::atomic<bool> memorySitesOn{ false };
+}
+
+// What every charge checks first, so tracking costs one branch when it is off
+inline bool memoryTrackingOn() {
+	return detail::memoryTrackingOn.load(std::memory_order_relaxed);
+}
+
+// Hot paths only set up a MemorySiteScope when this is true
+inline bool memorySitesOn() {
+	return detail::memorySitesOn.load(std::memory_order_relaxed);
+}
+
+struct MemoryUsage
+{
+	uint64_t bytes = 0;
+	uint64_t peakBytes = 0;
+};
+
+struct MemoryStats
+{
+	MemoryUsage kinds[MemoryKindCount];
+	MemoryUsage total;
+};
+
+// Bytes held now, and the high-water marks since tracking was turned on
+MemoryStats memoryStats();
+
+// Bytes held now, and the high-water marks since the last call, which is
+// what TimeReport records for a phase as it ends
+MemoryStats sampleMemoryPhase();
+
+// Adds bytes, which may be negative, to the counters of kind
+void memoryChange(MemoryKind kind, int64_t bytes);
+
+// The bytes one structure has reserved, given back when it goes. A charge
+// follows its structure when it moves; a copy starts out empty.
+class MemoryCharge
+{
+public:
+	explicit MemoryCharge(MemoryKind kind) : memoryKind(kind) {}
+	~MemoryCharge() { set(0); }
+
+	MemoryCharge(const MemoryCharge& other) : memoryKind(other.memoryKind) {}
+	MemoryCharge(MemoryCharge&& other) noexcept : memoryKind(other.memoryKind), charged(std::exchange(other.charged, 0)) {}
+
+	MemoryCharge& operator=(const MemoryCharge&) = delete;
+	MemoryCharge& operator=(MemoryCharge&&) = delete;
+
+	// The structure now holds bytes. Only a charge taken while tracking was
+	// on follows the structure once tracking is off.
+	void update(uint64_t bytes)
+	{
+		if (charged || memoryTrackingOn()) set(bytes);
+	}
+
+	void set(uint64_t bytes)
+	{
+		if (bytes == charged) return;
+		memoryChange(memoryKind, static_cast<int64_t>(bytes) - static_cast<int64_t>(charged));
+		charged = bytes;
+	}
+
+	// For structures that swap their storage: the bytes change hands, and
+	// each charge keeps its kind
+	void swap(MemoryCharge& other)
+	{
+		if (memoryKind != other.memoryKind && charged != other.charged)
+		{
+			int64_t delta = static_cast<int64_t>(other.charged) - static_cast<int64_t>(charged);
+			memoryChange(memoryKind, delta);
+			memoryChange(other.memoryKind, -delta);
+		}
+		std::swap(charged, other.charged);
+	}
+
+	MemoryKind kind() const { return memoryKind; }
+	uint64_t bytes() const { return charged; }
+
+private:
+	MemoryKind memoryKind;
+	uint64_t charged = 0;
+};
+
+// Where an allocation was asked for. As a defaulted argument, here() is the
+// caller's file, line and function.
+struct MemorySite
+{
+	const char* file;
+	uint32_t line;
+	const char* function;
+
+	static MemorySite here(const char* file = __builtin_FILE(), uint32_t line = __builtin_LINE(),
+		const char* function = __builtin_FUNCTION())
+	{
+		return MemorySite{ file, line, function };
+	}
+};
+
+// In Sites mode, the charges that grow on this thread while the innermost
+// scope is alive add their bytes to its site, and each scope counts as a
+// call of it. Arrays grow by doubling, so a site is charged for the growth
+// it happens to set off, not an even share of it.
+class MemorySiteScope
+{
+public:
+	explicit MemorySiteScope(const MemorySite& site)
+	{
+		if (memorySitesOn()) enter(site);
+	}
+
+	~MemorySiteScope()
+	{
+		if (entered) leave();
+	}
+
+	MemorySiteScope(const MemorySiteScope&) = delete;
+	MemorySiteScope& operator=(const MemorySiteScope&) = delete;
+
+private:
+	void enter(const MemorySite& site);
+	void leave();
+
+	void* outer = nullptr;
+	bool entered = false;
+};
+
+struct SiteUsage
+{
+	std::string site;		// "file:line function", the file without its directory
+	uint64_t calls = 0;
+	uint64_t bytes = 0;
+};
+
+// Every site recorded since tracking was turned on, most bytes first
+std::vector<SiteUsage> memorySites();
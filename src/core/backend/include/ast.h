@@ -1,58 +1,350 @@
 #pragma once
 
-#include <iostream>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
 #include <vector>
+#include "column.h"
+#include "source.h"
+#include "symbols.h"
+#include "token.h"
 
-enum NodeType
+// Node types in the order of helper_types.NodeType on the Python side. One
+// byte per node, also on disk in .qast files, so only append to the list.
+#define QUARK_NODE_TYPES(X) \
+	X(CompilationUnit) \
+	X(Block) \
+	X(Statement) \
+	X(Expression) \
+	X(Condition) \
+	X(Function) \
+	X(FunctionCall) \
+	X(Arguments) \
+	X(Identifier) \
+	X(Literal) \
+	X(Operator) \
+	X(List) \
+	X(Pipe)
+
+enum NodeType : uint8_t
 {
-	CompilationUnit,
-	Block,
-	Statement,
-	Expression,
-	Condition,
-	Function,
-	FunctionCall,
-	Arguments,
-	Identifier,
-	Literal,
-	Operator,
+#define QUARK_NODE_ENUM(name) name,
+	QUARK_NODE_TYPES(QUARK_NODE_ENUM)
+#undef QUARK_NODE_ENUM
+	NodeTypeCount,
+};
+
+inline constexpr const char* NodeTypeNames[] = {
+#define QUARK_NODE_NAME(name) #name,
+	QUARK_NODE_TYPES(QUARK_NODE_NAME)
+#undef QUARK_NODE_NAME
 };
 
-struct Token
+constexpr const char* nodeTypeString(NodeType type) {
+	return NodeTypeNames[type];
+}
+
+// Index of a node inside an Ast arena
+using NodeId = uint32_t;
+constexpr NodeId InvalidNode = UINT32_MAX;
+
+// Children of a node are stored contiguously in Ast::childIds
+struct ChildRange
 {
-	std::string type;
-	std::string value;
-	int lineNo;
-	int pos;
+	uint32_t first;
+	uint32_t count;
 };
 
-struct TreeNode
+class NodeRef;
+
+// Flat AST: every node lives in one set of parallel arrays (struct-of-arrays)
+// and refers to its children through a (first, count) range of node indices.
+class Ast
 {
-	NodeType type;
-	Token tok;
-	std::vector<TreeNode> children;
+public:
+	Ast() = default;
+
+	NodeId addNode(NodeType type, Token tok, const NodeId* children, uint32_t count)
+	{
+		NodeId id = static_cast<NodeId>(types.size());
+		types.push_back(type);
+		toks.push_back(std::move(tok));
+		ranges.push_back(ChildRange{ static_cast<uint32_t>(childIds.size()), count });
+		childIds.append(children, count);
+		return id;
+	}
+
+	void reserve(size_t nodes)
+	{
+		types.reserve(nodes);
+		toks.reserve(nodes);
+		ranges.reserve(nodes);
+		childIds.reserve(nodes);
+	}
+
+	void clear()
+	{
+		types.clear();
+		toks.clear();
+		ranges.clear();
+		childIds.clear();
+		rootId = InvalidNode;
+		consing = false;
+		symbolTable = SymbolTable();
+		sourceTable = SourceTable();
+		backing.reset();
+	}
+
+	// Drops the nodes from first on, which nothing before first refers to:
+	// the last items of a stream, once they have been compiled. Symbols and
+	// sources stay.
+	void truncate(NodeId first)
+	{
+		if (first >= size()) return;
+		childIds.resize(ranges[first].first);
+		types.resize(first);
+		toks.resize(first);
+		ranges.resize(first);
+		if (rootId != InvalidNode && rootId >= first) rootId = InvalidNode;
+	}
+
+	size_t size() const { return types.size(); }
+	bool empty() const { return types.empty(); }
+
+	NodeType type(NodeId id) const { return types[id]; }
+	const Token& tok(NodeId id) const { return toks[id]; }
+	uint32_t childCount(NodeId id) const { return ranges[id].count; }
+	const NodeId* childBegin(NodeId id) const { return childIds.data() + ranges[id].first; }
+	const NodeId* childEnd(NodeId id) const { return childBegin(id) + ranges[id].count; }
+	NodeId child(NodeId id, uint32_t i) const { return childIds[ranges[id].first + i]; }
+
+	NodeId root() const { return rootId; }
+	void setRoot(NodeId id) { rootId = id; }
+	NodeRef rootRef() const;
+
+	SymbolTable& symbols() { return symbolTable; }
+	const SymbolTable& symbols() const { return symbolTable; }
+	std::string_view spelling(NodeId id) const { return symbolTable.spelling(toks[id].value); }
+
+	SourceTable& sources() { return sourceTable; }
+	const SourceTable& sources() const { return sourceTable; }
+
+	// Where the subtree at id starts: the first location among its tokens,
+	// since an operator's token comes after its left operand
+	SourceLoc startLoc(NodeId id) const
+	{
+		SourceLoc first;
+		std::vector<NodeId> stack{ id };
+		while (!stack.empty())
+		{
+			NodeId node = stack.back();
+			stack.pop_back();
+			SourceLoc loc = toks[node].loc;
+			if (loc.valid() && (!first.valid() || loc < first)) first = loc;
+			stack.insert(stack.end(), childBegin(node), childEnd(node));
+		}
+		return first;
+	}
+
+	// In-place rewrites for tree passes. Nodes that drop out of the tree stay
+	// in the arena, unreachable from the root. On a mapped tree the first
+	// rewrite copies the affected column.
+	void setChild(NodeId id, uint32_t i, NodeId child) { childIds.set(ranges[id].first + i, child); }
+	void makeLeaf(NodeId id, NodeType type, Token tok)
+	{
+		types.set(id, type);
+		toks.set(id, std::move(tok));
+		ranges.set(id, ChildRange{ ranges[id].first, 0 });
+	}
+
+	// True when the arrays point into a mapped .qast file
+	bool mapped() const { return backing != nullptr; }
+
+	// Hash-consing: identical pure subtrees are stored once and shared, so the
+	// tree is a DAG (see SubtreeTable). Builders made from now on share what
+	// they build; shareSubtrees() shares a tree built without. A shared node
+	// keeps the token, and so the location, of its first occurrence.
+	void setHashConsing(bool on) { consing = on; }
+	bool hashConsing() const { return consing; }
+
+private:
+	friend class AstFile;
+
+	Column<NodeType> types{ MemoryKind::AstNodes };
+	Column<Token> toks{ MemoryKind::AstNodes };
+	Column<ChildRange> ranges{ MemoryKind::AstNodes };
+	Column<NodeId> childIds{ MemoryKind::AstNodes };
+	NodeId rootId = InvalidNode;
+	bool consing = false;
+	SymbolTable symbolTable;
+	SourceTable sourceTable;
+
+	// Keeps the mapping alive for borrowed columns
+	std::shared_ptr<const void> backing;
 };
 
-inline std::string nodeTypeString(NodeType type) {
-	std::string vals[] = {
-		"CompilationUnit",
-		"Block",
-		"Statement",
-		"Expression",
-		"Condition",
-		"Function",
-		"FunctionCall",
-		"Arguments",
-		"Identifier",
-		"Literal",
-		"Operator",
+// Cheap (pointer, index) handle used wherever the old by-value TreeNode was passed around
+class NodeRef
+{
+public:
+	class Iterator
+	{
+	public:
+		Iterator(const Ast* ast, const NodeId* cur) : ast(ast), cur(cur) {}
+
+		NodeRef operator*() const { return NodeRef(ast, *cur); }
+		Iterator& operator++() { ++cur; return *this; }
+		bool operator!=(const Iterator& other) const { return cur != other.cur; }
+		bool operator==(const Iterator& other) const { return cur == other.cur; }
+
+	private:
+		const Ast* ast;
+		const NodeId* cur;
 	};
-	return vals[type];
-}
 
-inline void printTree(const TreeNode& root, int level = 0)
+	struct Children
+	{
+		Iterator b, e;
+		Iterator begin() const { return b; }
+		Iterator end() const { return e; }
+	};
+
+	NodeRef() = default;
+	NodeRef(const Ast* ast, NodeId id) : ast(ast), nodeId(id) {}
+
+	bool valid() const { return ast && nodeId != InvalidNode; }
+	NodeId id() const { return nodeId; }
+	const Ast& tree() const { return *ast; }
+
+	NodeType type() const { return ast->type(nodeId); }
+	const Token& tok() const { return ast->tok(nodeId); }
+	TokenKind kind() const { return ast->tok(nodeId).kind; }
+	std::string_view value() const { return ast->spelling(nodeId); }
+	uint32_t childCount() const { return ast->childCount(nodeId); }
+	NodeRef child(uint32_t i) const { return NodeRef(ast, ast->child(nodeId, i)); }
+	Children children() const
+	{
+		return Children{ Iterator(ast, ast->childBegin(nodeId)), Iterator(ast, ast->childEnd(nodeId)) };
+	}
+
+private:
+	const Ast* ast = nullptr;
+	NodeId nodeId = InvalidNode;
+};
+
+inline NodeRef Ast::rootRef() const { return NodeRef(this, rootId); }
+
+// One node per distinct shareable subtree. A subtree is shareable when its
+// value depends on nothing but the variables it reads: a literal, an
+// identifier, or an operator other than assignment over shareable operands.
+// Since its operands are shared already, a subtree is known by its type,
+// token kind and spelling and the ids of its children; a 64-bit hash of
+// those finds it, and a hit is compared in full, so a collision only costs
+// a missed share.
+class SubtreeTable
+{
+public:
+	// The node standing for the subtree, or InvalidNode when there is none
+	// yet or it is not shareable
+	NodeId find(const Ast& ast, NodeType type, const Token& tok, const NodeId* children, uint32_t count) const;
+
+	// Makes id the node standing for its subtree, if it is shareable and
+	// none does yet
+	void add(const Ast& ast, NodeId id);
+
+	// Whether id stands for its subtree
+	bool shared(NodeId id) const { return id < members.size() && members[id]; }
+
+private:
+	bool shareable(NodeType type, const Token& tok, const NodeId* children, uint32_t count) const;
+	static uint64_t key(NodeType type, const Token& tok, const NodeId* children, uint32_t count);
+
+	std::unordered_map<uint64_t, NodeId> nodes;
+	std::vector<bool> members;
+};
+
+// Builds an Ast in post-order: a node is appended to the arena when it is
+// closed, at which point all of its children are known and can be stored as
+// one contiguous range. Leaves can be added directly with leaf().
+class AstBuilder
 {
-	for (int i = 0; i < level; i++) std::cout << '\t';
-	std::cout << nodeTypeString(root.type) + '[' + root.tok.value + "]\n";
-	for (TreeNode child : root.children) printTree(child, level + 1);
-}
\ No newline at end of file
+public:
+	explicit AstBuilder(Ast& ast) : ast(ast), consing(ast.hashConsing()) {}
+
+	void open(NodeType type, Token tok = Token{})
+	{
+		frames.push_back(Frame{ type, std::move(tok), pending.size() });
+	}
+
+	// Opens a node whose first child is the node attached last, which is how
+	// the Pratt parser turns an already built left operand into a binary node
+	void openAround(NodeType type, Token tok = Token{})
+	{
+		frames.push_back(Frame{ type, std::move(tok), pending.size() - 1 });
+	}
+
+	// With memory tracking by site, what the node takes is charged to site,
+	// the caller by default
+	NodeId close(MemorySite site = MemorySite::here())
+	{
+		if (memorySitesOn()) return closeAt(site);
+		return closeNode();
+	}
+
+	NodeId leaf(NodeType type, Token tok = Token{}, MemorySite site = MemorySite::here())
+	{
+		if (memorySitesOn()) return leafAt(type, std::move(tok), site);
+		return leafNode(type, std::move(tok));
+	}
+
+	size_t depth() const { return frames.size(); }
+	SymbolTable& symbols() { return ast.symbols(); }
+
+private:
+	struct Frame
+	{
+		NodeType type;
+		Token tok;
+		size_t mark;
+	};
+
+	// Defined with the accounting, out of line: a site scope inlined into
+	// every call of close() shows in parse times even when it is off
+	NodeId closeAt(const MemorySite& site);
+	NodeId leafAt(NodeType type, Token tok, const MemorySite& site);
+
+	// Defined with SubtreeTable, which they go through instead of addNode
+	NodeId closeShared();
+	NodeId leafShared(NodeType type, Token tok);
+
+	NodeId closeNode()
+	{
+		if (consing) return closeShared();
+		Frame frame = std::move(frames.back());
+		frames.pop_back();
+		uint32_t count = static_cast<uint32_t>(pending.size() - frame.mark);
+		NodeId id = ast.addNode(frame.type, std::move(frame.tok), pending.data() + frame.mark, count);
+		pending.resize(frame.mark);
+		return attach(id);
+	}
+
+	NodeId leafNode(NodeType type, Token tok)
+	{
+		if (consing) return leafShared(type, std::move(tok));
+		return attach(ast.addNode(type, std::move(tok), nullptr, 0));
+	}
+
+	NodeId attach(NodeId id)
+	{
+		if (frames.empty()) ast.setRoot(id);
+		else pending.push_back(id);
+		return id;
+	}
+
+	Ast& ast;
+	bool consing;
+	SubtreeTable shared;
+	std::vector<Frame> frames;
+	std::vector<NodeId> pending;
+};
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include "ast.h"
+
+// .qast: the native Ast written column by column, so a cached parse can be
+// mapped back and used in place with no per-node decoding. Everything is an
+// index, so the file is position independent. All fields are in host byte
+// order (checked through byteOrder) and every section starts 8-byte aligned:
+//
+//   AstFileHeader
+//   NodeType   types[nodeCount]
+//   Token      toks[nodeCount]             kind, symbol, loc
+//   ChildRange ranges[nodeCount]
+//   NodeId     childIds[childIdCount]
+//   uint32_t   symbolOffsets[symbolCount + 1]
+//   uint64_t   symbolHashes[symbolCount]
+//   uint32_t   symbolBuckets[bucketCount]  open-addressing index, see SymbolTable
+//   char       chars[charBytes]
+//   SourceBuffer sourceBuffers[bufferCount]
+//   uint32_t   lineStarts[lineCount]       see SourceTable
+//   char       names[nameBytes]
+constexpr uint32_t AstFileMagic = 0x54534151; // "QAST"
+constexpr uint16_t AstFileVersion = 5;
+constexpr uint16_t AstFileByteOrder = 0x0102;
+
+#pragma pack(push, 1)
+struct AstFileHeader
+{
+	uint32_t magic;
+	uint16_t version;
+	uint16_t byteOrder;
+	uint64_t sourceHash;
+	uint64_t fileSize;
+	uint32_t nodeCount;
+	uint32_t childIdCount;
+	uint32_t symbolCount;
+	uint32_t bucketCount;
+	uint32_t charBytes;
+	uint32_t root;
+	uint32_t bufferCount;
+	uint32_t lineCount;
+	uint32_t nameBytes;
+	uint32_t reserved;
+};
+#pragma pack(pop)
+
+static_assert(sizeof(AstFileHeader) == 64, "AstFileHeader must match the .qast layout");
+
+// Hash of the source text a .qast was parsed from
+inline uint64_t sourceHash(std::string_view source) {
+	return hashBytes(source);
+}
+
+class AstFile
+{
+public:
+	// Writes ast to path through a temporary file and a rename, so readers
+	// never map a partial file
+	static void write(const Ast& ast, uint64_t sourceHash, const std::string& path);
+
+	// Maps path read-only and points ast's columns into it. Returns false,
+	// leaving ast untouched, when the file is missing, malformed, from another
+	// format version or was parsed from different source.
+	static bool map(const std::string& path, uint64_t sourceHash, Ast& ast);
+};
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <exception>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "codegen.h"
+#include "timing.h"
+
+// Independent compilation units compiled together, as a build system does
+// with hundreds of modules per job. Every unit is lexed and parsed, or
+// decoded, and then compiled on the shared pool, next to the others; with
+// threads != 1 its functions spread over the same pool too.
+
+struct BatchUnit
+{
+	// Quark source, or a packed tree (TreeNode.pack()) when packed is set.
+	// Only read during compileBatch().
+	std::string_view data;
+	bool packed = false;
+};
+
+struct BatchResult
+{
+	CodegenResult result;
+	std::vector<std::string> diagnostics;	// the lexer's warnings
+	std::exception_ptr error;				// what compiling the unit threw, if anything
+	std::unique_ptr<TimeReport> timings;	// the unit's phases, from lex or bridge on
+};
+
+// Runs mode, ir or jit, on every unit with options, whose timings are
+// ignored. A unit's error is only recorded in its result; the others still
+// compile. Throws std::invalid_argument for the other modes.
+std::vector<BatchResult> compileBatch(const std::vector<BatchUnit>& units, CodegenMode mode, const CodegenOptions& options);
@@ -1,11 +1,216 @@
 #pragma once
 
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
 #include "ast.h"
+#include "compilecache.h"
+#include "dump.h"
+#include "optimizer.h"
+#include "timing.h"
+
+enum class CodegenMode
+{
+	Dump,	// write the tree with dumpTree, nothing else
+	IR,		// lower to LLVM IR and return the textual module
+	JIT,	// lower, compile with ORC LLJIT and run the compilation unit
+	AOT,	// compile for the target and link an executable or shared library
+};
+
+// Parses "dump", "ir", "jit" or "aot"; throws std::invalid_argument otherwise
+CodegenMode codegenModeFromString(const std::string& mode);
+
+class QuarkCodegenError : public std::runtime_error
+{
+public:
+	using std::runtime_error::runtime_error;
+};
+
+// A runtime error in the program run by runJit(), such as an index out of
+// range; the program state is gone, the compiled units are not affected
+class QuarkRuntimeError : public QuarkCodegenError
+{
+public:
+	using QuarkCodegenError::QuarkCodegenError;
+};
+
+// Value types known to the backend. Lists hold unboxed elements of one
+// numeric type, see runtime.h.
+enum class ValueKind
+{
+	None,
+	Int,
+	Float,
+	IntList,
+	FloatList,
+};
+
+struct CodegenResult
+{
+	// Value of the last top-level statement when running in JIT mode
+	ValueKind kind = ValueKind::None;
+	int64_t intValue = 0;
+	double floatValue = 0;
+	std::vector<int64_t> intValues;		// kind IntList
+	std::vector<double> floatValues;	// kind FloatList
+
+	// Textual LLVM module in IR mode
+	std::string ir;
+
+	// Path of what AOT mode built
+	std::string output;
+
+	// With CodegenOptions::siteCounters, the dispatch sites of what JIT mode
+	// ran, the most called first
+	std::vector<DispatchSite> sites;
+};
+
+// Machine code generation targets. An empty triple is the host's; an empty
+// CPU is the host's, with its features, when the triple is the host's and
+// "generic" otherwise. Features are LLVM's, e.g. "+avx2,-fma", and go on
+// top of the CPU's.
+struct TargetOptions
+{
+	std::string triple;
+	std::string cpu;
+	std::string features;
+};
+
+enum class AotOutput
+{
+	Executable,		// main() runs the top-level statements and prints the result as the driver would
+	SharedLibrary,	// exports __quark_main and __quark_result, see lowering.h
+};
+
+// Parses "exe" or "shared"; throws std::invalid_argument otherwise
+AotOutput aotOutputFromString(const std::string& output);
+
+// How AOT mode links. The objects go to a temporary directory and are linked
+// with the static runtime (runtime.h) into output; the program needs neither
+// LLVM nor Python to run.
+struct AotOptions
+{
+	std::string output = "a.out";
+	AotOutput kind = AotOutput::Executable;
+
+	// Compiler driver that links, adding the C++ and system libraries; a
+	// foreign target needs one that targets it
+	std::string linker = "c++";
+
+	// Path of libquark_runtime.a; empty is the one built with this backend
+	std::string runtimeLibrary;
+
+	// Executables for Linux targets link libc statically as well, so that
+	// starting one maps a single file and resolves no symbols
+	bool staticExecutable = true;
+
+	// Passed to the linker after everything else
+	std::vector<std::string> linkerArgs;
+};
+
+struct CodegenOptions
+{
+	// Run foldConstants() on the tree before lowering it
+	bool foldConstants = true;
+
+	// Then run shareSubtrees() on it, so identical pure subexpressions are
+	// lowered once per block. A shared node has the location of its first
+	// occurrence, so this is skipped with debugInfo or siteCounters; a
+	// stream's items are hash-consed as they are parsed instead.
+	bool shareSubtrees = false;
+
+	// -O0 keeps interactive compiles fast; batch jobs want -O3
+	OptimizerOptions optimizer;
+
+	// Worker threads for per-function codegen; 0 shares one pool sized to the
+	// machine, 1 compiles every unit on the calling thread
+	unsigned threads = 0;
+
+	// Directory of the object cache; empty disables it. Only functions whose
+	// structural hash changed since they were cached get recompiled.
+	std::string cacheDir;
+	uint64_t cacheMaxBytes = CompileCache::DefaultMaxBytes;
+
+	// Where to record phase and LLVM pass timings; null turns them off
+	TimeReport* timings = nullptr;
+
+	// What dump mode writes, and to which descriptor, which stays open
+	DumpFormat dumpFormat = DumpFormat::Text;
+	int dumpFd = 1;
+
+	// What every mode compiles for; JIT mode only runs host triples
+	TargetOptions target;
+
+	// Emit DWARF line tables, a line per statement, so debuggers and
+	// profilers map machine code back to the source; the JIT registers its
+	// code with gdb
+	bool debugInfo = false;
+
+	// Count the calls generated code makes into the runtime's list entry
+	// points per operator or builtin call site, with how many list elements
+	// each went through and, for subscripts, how many the inline fast path
+	// served. JIT mode returns the counts in CodegenResult::sites and adds
+	// them to timings; an AOT executable writes them to stderr at exit.
+	bool siteCounters = false;
+
+	AotOptions aot;
+};
+
+class ItemReader;
 
 class QuarkCodegen
 {
 public:
-	QuarkCodegen() = default;
+	explicit QuarkCodegen(CodegenOptions options = CodegenOptions());
+	~QuarkCodegen();
+
+	// Lowers the compilation unit below root into one LLVM module per
+	// function plus one whose __quark_main runs the top-level statements.
+	// Each module has its own context, so units are lowered in parallel.
+	void begin(NodeRef root);
+
+	// Runs the configured optimization pipeline over every module
+	void optimize();
+
+	// The modules in definition order, top-level statements first
+	std::string printIR() const;
+
+	// Plans the compilation unit and turns every codegen unit straight into
+	// an object: taken from the cache when its hash is known, otherwise
+	// lowered, optimized and emitted on the pool and then cached
+	void compile(NodeRef root);
+
+	// Links the objects from compile(), or emits them from the modules of
+	// begin(), with LLJIT and runs __quark_main in-process
+	CodegenResult runJit();
+
+	// Links the objects from compile() with an entry point and the runtime
+	// into options.aot.output, and returns its path
+	std::string link();
+
+	// Counters of the cache in cacheDir, over every compile in this process
+	CacheStats cacheStats() const;
+
+	// Runs the given mode end to end on a tree
+	CodegenResult run(NodeRef root, CodegenMode mode);
+
+	// Same, but first folds constants in ast and shares its subtrees when
+	// those are enabled and the mode compiles anything
+	CodegenResult run(Ast& ast, CodegenMode mode);
+
+	// Runs ir, jit or aot mode on a program read an item at a time (see
+	// stream.h), for sources too big to parse whole. Statements are compiled
+	// a segment of items at a time and their nodes dropped, so memory follows
+	// the largest segment and the definitions; see StreamPlanner for how the
+	// program is typed. So do source locations, which are 32 bits: the text
+	// of the items that define functions plus that of a segment has to be
+	// under 4 GB, or std::length_error is thrown, however big the source.
+	// Throws std::invalid_argument in dump mode.
+	CodegenResult runStream(ItemReader& items, CodegenMode mode);
 
-	void begin(const TreeNode& tree);
-};
\ No newline at end of file
+private:
+	struct Impl;
+	std::unique_ptr<Impl> impl;
+};
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+#include "accounting.h"
+
+// Array that either owns its elements or borrows them from memory it does
+// not manage, such as a mapped .qast file. Reads go through one pointer in
+// both cases; the first mutation of a borrowed column copies it, so mapped
+// data is never written to. What an owning column has reserved is charged
+// to its MemoryKind while memory tracking is on.
+template <typename T>
+class Column
+{
+public:
+	explicit Column(MemoryKind kind) : charge(kind) {}
+
+	Column(const Column& other)
+		: owned(other.owned), ptr(other.ptr), count(other.count), isBorrowed(other.isBorrowed), charge(other.charge)
+	{
+		if (!isBorrowed) sync();
+	}
+
+	Column(Column&& other) noexcept
+		: owned(std::move(other.owned)), ptr(other.ptr), count(other.count), isBorrowed(other.isBorrowed),
+		  charge(std::move(other.charge))
+	{
+		if (!isBorrowed) sync();
+		other.reset();
+	}
+
+	Column& operator=(Column other) noexcept
+	{
+		owned.swap(other.owned);
+		std::swap(ptr, other.ptr);
+		std::swap(count, other.count);
+		std::swap(isBorrowed, other.isBorrowed);
+		charge.swap(other.charge);
+		if (!isBorrowed) sync();
+		return *this;
+	}
+
+	// Points the column at count elements that outlive it
+	void borrow(const T* data, size_t size)
+	{
+		owned = std::vector<T>();
+		ptr = data;
+		count = size;
+		isBorrowed = true;
+		charge.set(0);
+	}
+
+	bool borrowed() const { return isBorrowed; }
+
+	const T* data() const { return ptr; }
+	size_t size() const { return count; }
+	bool empty() const { return count == 0; }
+	const T& operator[](size_t i) const { return ptr[i]; }
+	const T& back() const { return ptr[count - 1]; }
+	const T* begin() const { return ptr; }
+	const T* end() const { return ptr + count; }
+
+	void reserve(size_t n)
+	{
+		own().reserve(n);
+		sync();
+	}
+
+	void push_back(T value)
+	{
+		own().push_back(std::move(value));
+		sync();
+	}
+
+	void append(const T* first, size_t n)
+	{
+		own().insert(owned.end(), first, first + n);
+		sync();
+	}
+
+	void assign(std::vector<T>&& values)
+	{
+		isBorrowed = false;
+		owned = std::move(values);
+		sync();
+	}
+
+	void set(size_t i, T value)
+	{
+		own()[i] = std::move(value);
+	}
+
+	// Keeps the capacity, so a column that is refilled stays at its peak
+	void resize(size_t n)
+	{
+		own().resize(n);
+		sync();
+	}
+
+	void clear()
+	{
+		isBorrowed = false;
+		owned.clear();
+		sync();
+	}
+
+private:
+	std::vector<T>& own()
+	{
+		if (isBorrowed)
+		{
+			owned.assign(ptr, ptr + count);
+			isBorrowed = false;
+			sync();
+		}
+		return owned;
+	}
+
+	void sync()
+	{
+		ptr = owned.data();
+		count = owned.size();
+		charge.update(owned.capacity() * sizeof(T));
+	}
+
+	void reset()
+	{
+		owned.clear();
+		ptr = nullptr;
+		count = 0;
+		isBorrowed = false;
+	}
+
+	std::vector<T> owned;
+	const T* ptr = nullptr;
+	size_t count = 0;
+	bool isBorrowed = false;
+	MemoryCharge charge;
+};
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+
+// SHA-1 of everything that went into an object file
+using CacheKey = std::array<uint8_t, 20>;
+
+std::string cacheKeyString(const CacheKey& key);
+
+struct CacheStats
+{
+	uint64_t hits = 0;
+	uint64_t misses = 0;
+	uint64_t stores = 0;
+	uint64_t evictions = 0;
+	uint64_t bytes = 0;		// current size of the cache directory
+};
+
+// Content-addressed store of compiled objects, one file per key. Lookups
+// refresh a file's mtime, and once the directory grows past maxBytes the
+// least recently used files are removed. Safe to use from several threads
+// and from several processes sharing a directory.
+class CompileCache
+{
+public:
+	static constexpr uint64_t DefaultMaxBytes = 256ull << 20;
+
+	// One instance per directory, so counters add up over every compile in
+	// the process. maxBytes == 0 disables eviction.
+	static std::shared_ptr<CompileCache> open(const std::string& directory, uint64_t maxBytes = DefaultMaxBytes);
+
+	CompileCache(std::string directory, uint64_t maxBytes);
+
+	const std::string& directory() const { return dir; }
+	void setMaxBytes(uint64_t bytes) { maxBytes = bytes; }
+
+	bool load(const CacheKey& key, std::string& object);
+	void store(const CacheKey& key, const std::string& object);
+
+	CacheStats stats() const;
+
+private:
+	std::string path(const CacheKey& key) const;
+	void evict();
+
+	std::string dir;
+	std::atomic<uint64_t> maxBytes;
+	std::atomic<uint64_t> hits{ 0 };
+	std::atomic<uint64_t> misses{ 0 };
+	std::atomic<uint64_t> stores{ 0 };
+	std::atomic<uint64_t> evictions{ 0 };
+	std::atomic<uint64_t> bytes{ 0 };
+	std::mutex evictMutex;
+};
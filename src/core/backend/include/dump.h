@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include "ast.h"
+
+enum class DumpFormat
+{
+	Text,	// Type[spelling] per line, a tab per level, as printTree always wrote
+	Json,	// nested {"type", "kind", "value", "line", "pos", "children"} objects
+	Dot,	// Graphviz digraph in the shape and labels of utils/treeviz.py
+};
+
+// Parses "text", "json" or "dot"; throws std::invalid_argument otherwise
+DumpFormat dumpFormatFromString(const std::string& format);
+
+// Buffered output straight to a file descriptor, past iostreams and stdio.
+// flush() throws std::runtime_error when the descriptor takes no more; the
+// destructor flushes what is left and swallows that.
+class FdWriter
+{
+public:
+	static constexpr size_t DefaultCapacity = 1 << 20;
+
+	explicit FdWriter(int fd, size_t capacity = DefaultCapacity);
+	~FdWriter();
+
+	FdWriter(const FdWriter&) = delete;
+	FdWriter& operator=(const FdWriter&) = delete;
+
+	void write(const char* data, size_t size)
+	{
+		if (size > capacity - used)
+		{
+			flush();
+			if (size >= capacity)
+			{
+				writeAll(data, size);
+				return;
+			}
+		}
+		std::memcpy(buffer.get() + used, data, size);
+		used += size;
+	}
+
+	void write(std::string_view text) { write(text.data(), text.size()); }
+
+	void put(char c)
+	{
+		if (used == capacity) flush();
+		buffer[used++] = c;
+	}
+
+	void number(uint64_t value);
+	void number(int64_t value);
+
+	void flush();
+
+	// Bytes handed to write(), put() and number() so far
+	uint64_t size() const { return flushed + used; }
+
+private:
+	int fd;
+	size_t capacity;
+	size_t used = 0;
+	uint64_t flushed = 0;
+	std::unique_ptr<char[]> buffer;
+
+	void writeAll(const char* data, size_t size);
+};
+
+// Writes the tree below root to fd, which is left open, and returns the
+// number of nodes written. Nodes are visited without recursion, so any tree
+// that fits in memory can be dumped.
+uint64_t dumpTree(NodeRef root, DumpFormat format, int fd = 1);
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstdint>
+#include "ast.h"
+
+struct FoldStats
+{
+	uint32_t folded = 0;		// operators replaced by a literal
+	uint32_t simplified = 0;	// operators replaced by one of their operands
+};
+
+// Folds constant Int/Float arithmetic below the root of ast in place, with
+// the same i64 wrap-around and double rounding the backend emits, and applies
+// x*1, 1*x, x/1, x-0, x+0 and --x where that cannot change the value or the
+// type. A folded literal keeps the source location where its expression
+// started. Division by zero and results that are not finite are left for
+// run time. The tree below the root has to lie at node first and after, as
+// the nodes of a stream's last item do, so folding it costs what it has.
+FoldStats foldConstants(Ast& ast, NodeId first = 0);
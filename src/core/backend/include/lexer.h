@@ -0,0 +1,120 @@
+#pragma once
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "accounting.h"
+#include "token.h"
+
+class ThreadPool;
+
+// One entry of the native token array. The spelling is not copied; it is the
+// [offset, offset + length) slice of the source the tokens were lexed from.
+// Synthesized INDENT/DEDENT/EOF tokens have length 0.
+struct LexToken
+{
+	TokenKind kind;
+	uint32_t offset;
+	uint32_t length;
+	int32_t lineNo;
+};
+
+struct TokenBuffer
+{
+	std::string_view source;
+	// Where source starts in the whole input, for the items of a stream
+	uint64_t origin = 0;
+	// Location of source's first byte in the SourceTable of the Ast the
+	// tokens are parsed into; the parser adds source to the table itself
+	// when this is left invalid
+	SourceLoc start;
+	std::vector<LexToken> tokens;
+	// Illegal characters are skipped, like t_error() in lex_grammar.py
+	std::vector<std::string> diagnostics;
+	MemoryCharge charge{ MemoryKind::Tokens };
+
+	// Charges what tokens has reserved, once the lexer is done filling it
+	void account() { charge.update(tokens.capacity() * sizeof(LexToken)); }
+
+	std::string_view text(const LexToken& tok) const { return source.substr(tok.offset, tok.length); }
+	size_t size() const { return tokens.size(); }
+	const LexToken& operator[](size_t i) const { return tokens[i]; }
+};
+
+// Raised for the same cases as QuarkLexer._indentation_filter in Python
+class QuarkIndentationError : public std::runtime_error
+{
+public:
+	using std::runtime_error::runtime_error;
+};
+
+// Native counterpart of core/quark_lexer.py: the lex_grammar rules, the
+// token tracking filter and the indentation filter fused into a single pass
+// over the source. The resulting stream matches the Python one token for
+// token, except that line numbers are counted per line.
+class QuarkLexer
+{
+public:
+	explicit QuarkLexer(std::string_view source) : source(source) {}
+
+	// Lexes the whole source into out. The source must outlive out.
+	void tokenize(TokenBuffer& out, bool addEndMarker = true);
+
+	// tokenize() on the pool, for big sources. The source is cut before lines
+	// that begin with a name or a number, where the indentation filter is
+	// back at column 0 with every block closed, and the pieces are lexed at
+	// once, each from a fresh state, then joined with their offsets and line
+	// numbers shifted. Where a cut turns out to be inside parentheses, or
+	// where a block has to open, or a piece raises, the source is lexed again
+	// in one piece, so the tokens, diagnostics and errors are tokenize()'s.
+	void tokenizeParallel(TokenBuffer& out, ThreadPool& pool, bool addEndMarker = true);
+
+	// Lexes the next top-level item of the source into out, replacing its
+	// tokens but keeping its diagnostics: one line of statements, with the
+	// block of a function defined on it and the DEDENTs closing that, then
+	// EOF. Offsets count from out.origin, where the item starts, so only an
+	// item has to fit in 32 bits. The items' tokens, EOFs aside, are those
+	// tokenize() gives. Returns false once the source is used up.
+	bool tokenizeItem(TokenBuffer& out);
+
+	// Offset up to which tokenizeItem() has read the source: the end of the
+	// item lexed last
+	size_t consumed() const { return position; }
+
+private:
+	enum IndentState
+	{
+		NoIndent,
+		MayIndent,
+		MustIndent,
+	};
+
+	void reset();
+
+	// Lexes from position on, offsets counting from base; with oneItem,
+	// stops where a new top-level line begins, once out has tokens
+	void scan(TokenBuffer& out, bool oneItem);
+	void emitRaw(TokenBuffer& out, TokenKind kind, uint32_t offset, uint32_t length);
+	void emit(TokenBuffer& out, TokenKind kind, uint32_t offset, uint32_t length, int32_t lineNo);
+
+	std::string_view source;
+	size_t position = 0;
+	size_t base = 0;
+	int32_t lineNo = 1;
+	int parenCount = 0;
+
+	// _track_tokens_filter state
+	bool atLineStart = true;
+	IndentState indent = NoIndent;
+
+	// _indentation_filter state
+	std::vector<uint32_t> levels;
+	uint32_t depth = 0;
+	bool prevWasWs = false;
+
+	// Position of the last raw token, used by the trailing DEDENTs
+	uint32_t lastRawOffset = 0;
+	int32_t lastRawLine = 1;
+};
@@ -0,0 +1,163 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "codegen.h"
+
+namespace llvm {
+class LLVMContext;
+class Module;
+class TargetMachine;
+}
+
+// Backend internals shared by QuarkCodegen and the unit lowering. A
+// compilation unit is split into codegen units: unit 0 holds the top-level
+// statements (__quark_main) and defines the globals, unit i > 0 holds
+// function instance i - 1. Units only see each other through the plan, so
+// each one can be lowered into its own LLVMContext on a different thread.
+
+constexpr const char* EntryName = "__quark_main";
+constexpr const char* ResultName = "__quark_result";
+
+// FunctionCall node -> index of the instance it calls
+using CallTargets = std::unordered_map<NodeId, uint32_t>;
+
+// A function as written. Its parameters are generic: every distinct list of
+// argument kinds it is called with gets a FunctionPlan of its own.
+struct FunctionDefinition
+{
+	SymbolId name = EmptySymbol;
+	NodeRef node;
+	std::vector<SymbolId> params;
+};
+
+// One monomorphic instance of a definition, with every type concrete, so it
+// is lowered to unboxed i64/double code with no run-time checks
+struct FunctionPlan
+{
+	SymbolId name = EmptySymbol;
+	NodeRef node;
+	std::vector<SymbolId> params;
+	std::vector<ValueKind> paramKinds;
+	ValueKind returnKind = ValueKind::None;
+	std::string linkName;
+	CallTargets calls;
+};
+
+struct GlobalPlan
+{
+	SymbolId name = EmptySymbol;
+	ValueKind kind = ValueKind::None;
+};
+
+// Function signatures and global types, computed once up front and then
+// shared read-only by every worker
+struct ModulePlan
+{
+	NodeRef root;
+	std::vector<NodeRef> statements;				// top-level statements other than functions
+	std::vector<FunctionDefinition> definitions;	// in definition order
+	std::vector<FunctionPlan> functions;			// instances, in order of first use
+	std::vector<GlobalPlan> globals;				// in order of first assignment
+	std::unordered_map<SymbolId, size_t> definitionIndex;
+	std::map<std::pair<SymbolId, std::vector<ValueKind>>, size_t> instanceIndex;
+	std::unordered_map<SymbolId, size_t> globalIndex;
+	CallTargets mainCalls;
+	ValueKind resultKind = ValueKind::None;
+
+	// Whether the units carry DWARF locations, see CodegenOptions
+	bool debugInfo = false;
+
+	// Whether they count their dispatch sites, see CodegenOptions
+	bool siteCounters = false;
+
+	// A segment of a stream (StreamPlanner) only owns what it added: the
+	// globals from firstGlobal on and, as its units i > 0, the instances from
+	// firstFunction on; its statements run as entryName and leave their value
+	// in resultName. A whole program owns everything.
+	size_t firstFunction = 0;
+	size_t firstGlobal = 0;
+	std::string entryName = EntryName;
+	std::string resultName = ResultName;
+
+	size_t unitCount() const { return functions.size() - firstFunction + 1; }
+	const FunctionPlan& instance(size_t unit) const { return functions[firstFunction + unit - 1]; }
+	const CallTargets& calls(size_t unit) const { return unit == 0 ? mainCalls : instance(unit).calls; }
+	const FunctionDefinition* definition(SymbolId name) const;
+	const GlobalPlan* global(SymbolId name) const;
+
+	// The instance a FunctionCall node in unit calls
+	const FunctionPlan& callee(size_t unit, NodeRef call) const;
+	std::string_view spelling(SymbolId name) const { return root.tree().symbols().spelling(name); }
+};
+
+// Collects functions and globals and infers their types. Types flow forward
+// from literals through the arithmetic promotion rules; a function is
+// instantiated once per signature it is called with, and one that is never
+// called once with Int parameters. A recursive instance's return type is the
+// least one (Int before Float) its body agrees with.
+ModulePlan planModule(NodeRef root);
+
+// Plans a program that arrives a top-level item at a time, see stream.h, as
+// a series of segments that are compiled one after another. Definitions
+// stay in the plan from their item on, since a later call with new argument
+// kinds instantiates them again; each segment's statements, and the calls
+// they make, replace the last segment's. Unlike planModule(), which sees
+// every definition first, a call can only reach the functions defined above
+// the statement that makes it, as in Python.
+class StreamPlanner
+{
+public:
+	// Items are parsed into plan.root.tree()
+	explicit StreamPlanner(ModulePlan& plan);
+	~StreamPlanner();
+
+	void define(NodeRef function);
+
+	// Plans segment index: types its statements, which instantiates what they
+	// call, and points the plan's segment fields at what it added
+	void segment(size_t index, std::vector<NodeRef> statements);
+
+	// Adds the functions no statement has called to the segment planned last,
+	// as planModule() compiles them
+	void finish();
+
+private:
+	struct Impl;
+	std::unique_ptr<Impl> impl;
+};
+
+// Linkage name of a user global, and of a function instance with the given
+// parameter kinds
+std::string symbolName(std::string_view name);
+std::string symbolName(std::string_view name, const std::vector<ValueKind>& paramKinds);
+
+// Names of segment's entry and result in a stream, given EntryName and
+// ResultName
+std::string segmentSymbol(const char* name, size_t segment);
+
+// Canonical bytes of everything lowerUnit(plan, unit) reads: the unit's
+// subtrees by node type, token kind and spelling, with debug info or site
+// counters also by line and column, plus the signatures and global types it refers to.
+// Units with equal fingerprints lower to
+// identical modules, so this is what the compile cache keys on.
+std::string unitFingerprint(const ModulePlan& plan, size_t unit);
+
+// Lowers one codegen unit into a new module owned by context
+std::unique_ptr<llvm::Module> lowerUnit(const ModulePlan& plan, size_t unit, llvm::LLVMContext& context,
+	const llvm::TargetMachine& targetMachine);
+
+// The main() of an AOT executable: runs __quark_main and prints the result
+// with the runtime, the way run_codegen.py prints what the JIT returns
+std::unique_ptr<llvm::Module> lowerProgramEntry(const ModulePlan& plan, llvm::LLVMContext& context,
+	const llvm::TargetMachine& targetMachine);
+
+// The __quark_main of a stream: runs the entries of its segments in order
+// and, unless the plan's resultKind is None, copies the segment result named
+// by its resultName into __quark_result
+std::unique_ptr<llvm::Module> lowerStreamEntry(const ModulePlan& plan, size_t segments, llvm::LLVMContext& context,
+	const llvm::TargetMachine& targetMachine);
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+// Read-only view of a whole file, for .qast trees used in place and for
+// sources read once front to back. Unmapped with the last reference.
+class MappedFile
+{
+public:
+	// Null when the file is missing, empty or cannot be mapped
+	static std::shared_ptr<MappedFile> open(const std::string& path);
+
+	MappedFile() = default;
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	const char* data() const { return static_cast<const char*>(addr); }
+	size_t size() const { return length; }
+
+	// The file is going to be read once, in order: read ahead, and do not
+	// keep what has been read any longer than other page cache
+	void sequential();
+
+	// Drops the resident pages wholly below offset; reading them again faults
+	// them back in from the file. Does nothing where that is not supported.
+	void release(size_t offset);
+
+private:
+	void* addr = nullptr;
+	size_t length = 0;
+	size_t released = 0;
+};
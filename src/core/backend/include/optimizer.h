@@ -0,0 +1,48 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include "timing.h"
+
+namespace llvm {
+class Module;
+class TargetMachine;
+}
+
+enum class OptLevel
+{
+	O0,
+	O1,
+	O2,
+	O3,
+	Os,
+};
+
+// Accepts "O2", "-O2" or "2"; throws std::invalid_argument otherwise
+OptLevel optLevelFromString(const std::string& level);
+const char* optLevelString(OptLevel level);
+
+struct OptimizerOptions
+{
+	OptLevel level = OptLevel::O0;
+
+	// Textual new-pass-manager pipeline, e.g. "function(instcombine,gvn)".
+	// When set it replaces the default pipeline for level.
+	std::string passPipeline;
+
+	// Instrument the module for a profile written here once the program has
+	// run, see profile.h; empty does not
+	std::string profileGenerate;
+
+	// Indexed profile from an instrumented run whose counts drive inlining,
+	// block layout and branch weights; empty optimizes without one
+	std::string profileUse;
+};
+
+// Runs the PassBuilder default pipeline for options.level, or the custom
+// pipeline, over module, after the instrumentation or the profile of
+// options. targetMachine supplies TTI for the vectorizers. Throws
+// std::invalid_argument when options both generate and use a profile.
+// When passTimes is set every pass that runs is timed into it by name.
+void optimizeModule(llvm::Module& module, llvm::TargetMachine* targetMachine, const OptimizerOptions& options,
+	std::map<std::string, PassTiming>* passTimes = nullptr);
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "ast.h"
+
+// Packed preorder tree written by helper_types.TreeNode.pack(). All fields
+// are little-endian and the layout is:
+//
+//   PackedTreeHeader
+//   uint32_t symbolOffsets[symbolCount + 1]   offsets into the chars blob
+//   char     chars[charBytes]                 padded to a multiple of 4
+//   PackedNode nodes[nodeCount]               preorder
+//
+// Symbol 0 must be the empty string; nodes without a token use kind 0.
+constexpr uint32_t PackedTreeMagic = 0x45525451; // "QTRE"
+constexpr uint16_t PackedTreeVersion = 1;
+
+#pragma pack(push, 1)
+struct PackedTreeHeader
+{
+	uint32_t magic;
+	uint16_t version;
+	uint16_t flags;
+	uint32_t nodeCount;
+	uint32_t symbolCount;
+	uint32_t charBytes;
+};
+
+struct PackedNode
+{
+	uint8_t type;
+	uint8_t kind;
+	uint16_t reserved;
+	uint32_t childCount;
+	uint32_t value;
+	int32_t lineNo;
+	int32_t pos;
+};
+#pragma pack(pop)
+
+static_assert(sizeof(PackedTreeHeader) == 20, "PackedTreeHeader must match helper_types.TREE_HEADER");
+static_assert(sizeof(PackedNode) == 20, "PackedNode must match helper_types.TREE_NODE");
+
+// Decodes a packed tree into ast. Throws std::runtime_error on malformed input.
+void readPackedTree(const void* data, size_t size, Ast& ast);
+
+// Encodes the tree below root in the same format, numbering symbols in
+// preorder like TreeNode.pack(), so the output of both front ends can be
+// compared byte for byte.
+std::vector<uint8_t> writePackedTree(NodeRef root);
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <stdexcept>
+#include "ast.h"
+#include "lexer.h"
+
+// Mirrors helper_types.Precedence
+enum Precedence
+{
+	PrecZero,
+	PrecAssignment,
+	PrecPipe,
+	PrecTerm,
+	PrecFactor,
+	PrecUnary,
+	PrecCall,
+};
+
+class QuarkSyntaxError : public std::runtime_error
+{
+public:
+	using std::runtime_error::runtime_error;
+};
+
+// Native port of core/quark_parser.py and core/expr_parser.py. Walks the
+// token array with a cursor and builds the flat Ast directly; the Python
+// parser remains the reference implementation.
+class QuarkParser
+{
+public:
+	QuarkParser(const TokenBuffer& tokens, Ast& ast);
+
+	// Parses the whole token stream into a CompilationUnit and returns its id.
+	// Nodes go after those ast already has, so a stream's items can share
+	// one arena and symbol table. Syntax errors start with the file, line and
+	// column of the token they are about.
+	NodeId parse();
+
+private:
+	using PrefixFn = void (QuarkParser::*)(const LexToken&);
+	using InfixFn = void (QuarkParser::*)(const LexToken&);
+
+	struct Rule
+	{
+		Precedence precedence = PrecZero;
+		PrefixFn prefix = nullptr;
+		InfixFn infix = nullptr;
+	};
+
+	static const Rule& rule(TokenKind kind);
+
+	// Util functions
+	const LexToken& cur() const { return tokens[cursor]; }
+	const LexToken& peek(size_t index = 1) const;
+	const LexToken& consume();
+	const LexToken& expect(TokenKind kind);
+	Token token(const LexToken& tok);
+	SourceLoc loc(const LexToken& tok) const;
+	QuarkSyntaxError error(const LexToken& at, const std::string& message) const;
+
+	// Parsing functions
+	void block();
+	void line();
+	void statements(TokenKind end);
+	void statement();
+	void expression(Precedence precedence = PrecAssignment);
+	void function();
+	void functionCall();
+	void arguments();
+
+	// Pratt expression parser (ExprParser)
+	void parseExpr(Precedence precedence = PrecAssignment);
+	void paren(const LexToken& tok);
+	void call(const LexToken& tok);
+	void identifier(const LexToken& tok);
+	void number(const LexToken& tok);
+	void unary(const LexToken& tok);
+	void binary(const LexToken& tok);
+	void list(const LexToken& tok);
+	void subscript(const LexToken& tok);
+	void pipe(const LexToken& tok);
+	void stage();
+
+	const TokenBuffer& tokens;
+	Ast& ast;
+	AstBuilder builder;
+	SourceLoc start;
+	size_t cursor = 0;
+	TokenKind prevKind = TokenKind::None;
+};
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace llvm {
+class LLVMContext;
+class Module;
+class TargetMachine;
+}
+
+// Profile-guided optimization of generated code. A build with
+// OptimizerOptions::profileGenerate runs LLVM's IR instrumentation over
+// every unit before its pipeline, and lowerProfileCounters() turns the
+// counter intrinsics into plain counters with a QuarkProfileRecord
+// (runtime.h) per function. The JIT writes the records once the program has
+// run, an executable when it exits: a text profile, which mergeProfiles()
+// turns into the indexed one OptimizerOptions::profileUse takes. Both passes
+// see the units as lowered, so a profile taken at one level serves every
+// other, and a function whose code changed since is compiled without one.
+
+// Name of the record of function's counters
+std::string profileSymbol(std::string_view function);
+
+// Replaces the counter increments PGOInstrumentationGen left in module with
+// loads and stores of a counter array per function, and defines the record
+// of every function module defines, with no counters for one that has none
+void lowerProfileCounters(llvm::Module& module);
+
+// SHA1 of the indexed profile at path, in hex, for the compile cache to key
+// on. Throws QuarkCodegenError when it cannot be read or is not indexed.
+std::string profileDigest(const std::string& path);
+
+// Merges the raw, text or indexed profiles in inputs into the indexed
+// profile output. Throws QuarkCodegenError when an input cannot be read or
+// the profiles are of different kinds.
+void mergeProfiles(const std::vector<std::string>& inputs, const std::string& output);
+
+// A module whose constructor registers the records of functions with the
+// runtime, which writes them to path when an instrumented executable exits
+std::unique_ptr<llvm::Module> lowerProfileRegistration(const std::vector<std::string>& functions, const std::string& path,
+	llvm::LLVMContext& context, const llvm::TargetMachine& targetMachine);
+
+// Builds with CodegenOptions::siteCounters define a QuarkSiteTable (runtime.h)
+// per function, of the dispatch sites lowerUnit() counted in it
+std::string siteSymbol(std::string_view function);
+
+// A module whose constructor registers the site tables of functions with the
+// runtime, which writes them to stderr when the executable exits
+std::unique_ptr<llvm::Module> lowerSiteRegistration(const std::vector<std::string>& functions, llvm::LLVMContext& context,
+	const llvm::TargetMachine& targetMachine);
@@ -0,0 +1,200 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Native runtime that JIT-compiled and AOT-built programs call into.
+// Lists are contiguous and typed: the planner proves each one holds only
+// Ints or only Floats, so elements are stored unboxed as int64_t or double
+// and the kernels run over plain arrays, with AVX2 or NEON when the CPU has
+// them. Every SIMD level computes bit-identical results; Float reductions
+// add in the same fixed lane order everywhere.
+
+// Float reductions put element i in lane i % ReductionLanes and combine the
+// lanes in order at the end, at every level and in the loops the lowering
+// fuses, so the result does not depend on the CPU or on how it was reached
+constexpr int64_t ReductionLanes = 16;
+
+struct QuarkList
+{
+	int64_t length;
+	int64_t reserved;	// keeps the elements, which follow, 16-byte aligned
+};
+
+// Counters of one function of an instrumented program, see profile.h: the
+// function's name and CFG hash as LLVM's PGO passes compute them and one
+// counter per instrumented edge or block
+struct QuarkProfileRecord
+{
+	const char* name;
+	uint64_t hash;
+	uint64_t counterCount;
+	uint64_t* counters;
+};
+
+// Counters of one dispatch site of a program built with
+// CodegenOptions::siteCounters: an operator or call that generated code
+// hands to one of the list entry points below, which dispatch on the
+// operation and the CPU's kernels at run time
+struct QuarkSiteRecord
+{
+	const char* site;	// "file:line:column what operand-kinds"
+	int64_t fastPath;	// 1 when an inline guard handles the common case
+	uint64_t calls;
+	uint64_t hits;		// calls the fast path handled without the runtime
+	uint64_t elements;	// list elements the runtime went through
+};
+
+// The sites of one function
+struct QuarkSiteTable
+{
+	int64_t count;
+	QuarkSiteRecord* const* records;
+};
+
+// Element-wise operators. The Rev forms take the scalar as left operand.
+enum class ListOp : int32_t
+{
+	Add,
+	Sub,
+	Mul,
+	Div,
+	RevSub,
+	RevDiv,
+};
+
+// Comparisons, which produce an Int list of 0 and 1
+enum class ListCompare : int32_t
+{
+	Lt,
+	Le,
+	Gt,
+	Ge,
+	Eq,
+	Ne,
+};
+
+// Entry points in the C ABI, named as lowering declares them. Lists are
+// immutable once built; every operation allocates its result. Lists of
+// different lengths, an index out of range, integer division by zero and
+// min/max of an empty list are runtime errors.
+extern "C" {
+QuarkList* quark_list_from_i64(const int64_t* values, int64_t length);
+QuarkList* quark_list_from_f64(const double* values, int64_t length);
+QuarkList* quark_list_range(int64_t length);
+QuarkList* quark_list_to_f64(const QuarkList* list);
+int64_t quark_list_len(const QuarkList* list);
+int64_t quark_list_at_i64(const QuarkList* list, int64_t index);
+double quark_list_at_f64(const QuarkList* list, int64_t index);
+
+QuarkList* quark_list_arith_i64(int32_t op, const QuarkList* lhs, const QuarkList* rhs);
+QuarkList* quark_list_arith_f64(int32_t op, const QuarkList* lhs, const QuarkList* rhs);
+QuarkList* quark_list_arith_scalar_i64(int32_t op, const QuarkList* lhs, int64_t rhs);
+QuarkList* quark_list_arith_scalar_f64(int32_t op, const QuarkList* lhs, double rhs);
+
+QuarkList* quark_list_compare_i64(int32_t compare, const QuarkList* lhs, const QuarkList* rhs);
+QuarkList* quark_list_compare_f64(int32_t compare, const QuarkList* lhs, const QuarkList* rhs);
+QuarkList* quark_list_compare_scalar_i64(int32_t compare, const QuarkList* lhs, int64_t rhs);
+QuarkList* quark_list_compare_scalar_f64(int32_t compare, const QuarkList* lhs, double rhs);
+
+int64_t quark_list_sum_i64(const QuarkList* list);
+double quark_list_sum_f64(const QuarkList* list);
+int64_t quark_list_min_i64(const QuarkList* list);
+double quark_list_min_f64(const QuarkList* list);
+int64_t quark_list_max_i64(const QuarkList* list);
+double quark_list_max_f64(const QuarkList* list);
+
+// Elements of list whose mask element is not 0; both elements kinds alike
+QuarkList* quark_list_filter(const QuarkList* list, const QuarkList* mask);
+
+// For loops the lowering fuses (pipes): a list of capacity elements, none
+// of them set, which the caller fills and may shorten by storing a smaller
+// length; and the error min/max of an empty list raise
+QuarkList* quark_list_new(int64_t capacity);
+void quark_list_fail_empty(const char* what);
+
+// The error an Int division by zero raises, as the list entry points do
+void quark_fail_division_by_zero();
+
+// What the main() of an AOT executable prints the result with: a line in
+// the form Python prints the value run_codegen.py gets back from the JIT
+void quark_print_i64(int64_t value);
+void quark_print_f64(double value);
+void quark_print_list_i64(const QuarkList* list);
+void quark_print_list_f64(const QuarkList* list);
+
+// Writes the counters of records to path in LLVM's text profile format,
+// which llvm-profdata and mergeProfiles() read; records without counters are
+// left out. LLVM_PROFILE_FILE overrides path when set, as it does for
+// programs clang instruments, and %p in either is replaced with the process
+// id. Returns 0, or -1 when the file cannot be written.
+int32_t quark_profile_write(const char* path, const QuarkProfileRecord* const* records, int64_t count);
+
+// What the constructor of an instrumented AOT executable calls: the records
+// are written to path when the program exits
+void quark_profile_init(const char* path, const QuarkProfileRecord* const* records, int64_t count);
+
+// Writes the sites of tables to out as a table, the most called first
+void quark_sites_write(std::FILE* out, const QuarkSiteTable* const* tables, int64_t count);
+
+// What the constructor of an AOT executable built with site counters calls:
+// the sites are written to stderr when the program exits
+void quark_sites_init(const QuarkSiteTable* const* tables, int64_t count);
+}
+
+inline int64_t* listInts(QuarkList* list) { return reinterpret_cast<int64_t*>(list + 1); }
+inline const int64_t* listInts(const QuarkList* list) { return reinterpret_cast<const int64_t*>(list + 1); }
+inline double* listFloats(QuarkList* list) { return reinterpret_cast<double*>(list + 1); }
+inline const double* listFloats(const QuarkList* list) { return reinterpret_cast<const double*>(list + 1); }
+
+enum class SimdLevel
+{
+	Scalar,
+	AVX2,
+	NEON,
+};
+
+const char* simdLevelString(SimdLevel level);
+
+// The best level this CPU runs, and the one the kernels use, which starts
+// out as the best. setSimdLevel() is for benchmarks and tests; it returns
+// the level it settled on, never one the CPU lacks.
+SimdLevel detectSimdLevel();
+SimdLevel simdLevel();
+SimdLevel setSimdLevel(SimdLevel level);
+
+// Owns the lists allocated on this thread while it lives, and frees them
+// when it goes. Lists allocated outside any arena live until exit, which
+// is right for a standalone program.
+class ListArena
+{
+public:
+	ListArena();
+	~ListArena();
+
+	ListArena(const ListArena&) = delete;
+	ListArena& operator=(const ListArena&) = delete;
+
+	void adopt(QuarkList* list) { lists.push_back(list); }
+
+private:
+	ListArena* outer;
+	std::vector<QuarkList*> lists;
+};
+
+// Runs a program's entry point on the calling thread. A runtime error
+// unwinds straight back here, past the generated code, and is returned as
+// false with its message in error. Outside runProgram a runtime error
+// prints the message and exits.
+bool runProgram(void (*entry)(), std::string& error);
+
+// Name and address of every entry point above, for the JIT to define
+struct RuntimeSymbol
+{
+	const char* name;
+	void* address;
+};
+
+const std::vector<RuntimeSymbol>& runtimeSymbols();
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Long-running compile daemon around the backend. Everything a compile sets
+// up once stays resident between requests: the initialized LLVM targets,
+// each worker's target machines and pass pipelines, and the object caches
+// with their counters. Clients connect to a Unix socket, one request per
+// connection:
+//
+//   mode jit\n            header lines "key value", any order, then a blank
+//   opt O2\n              line; keys are initCodegen()'s keyword options
+//   \n                    plus mode, report (1 returns the time report) and
+//   x = 2\n...            name (the file errors and debug info refer to);
+//                         then the source, up to the client's end of stream
+//
+// The reply is one JSON object, after which the server closes the
+// connection: {"ok": true, "diagnostics": [...], "kind": ..., "value": ...}
+// with "ir", "dump" or "output" for those modes and "report" and "cache"
+// when asked for, or {"ok": false, "error": "SyntaxError", "message": ...}
+// where error is the Python exception initCodegen() would have raised.
+//
+// Clients act as the server's user, so only that user may connect: the
+// socket is created with mode 0600. What aot mode links with is the
+// server's choice; a request that names a linker or runtime library is
+// refused. A request that is too big or does not end in time is refused
+// too, so that no client holds a worker.
+
+struct ServerOptions
+{
+	std::string socketPath;
+
+	// Requests served at once; 0 is one per core. Each one's codegen still
+	// spreads over the shared pool.
+	unsigned workers = 0;
+
+	// Every worker compiles and runs a one-line program before the first
+	// client is accepted, so that no client pays for setting LLVM up
+	bool warmUp = true;
+
+	// Bounds on one request: its bytes, and the time from accepting the
+	// connection to the client's end of stream
+	size_t maxRequestBytes = 64 << 20;
+	unsigned requestTimeoutMs = 30000;
+
+	// What aot requests link with; empty keeps AotOptions' defaults
+	std::string linker;
+	std::string runtimeLibrary;
+};
+
+class CompileServer
+{
+public:
+	// Binds and listens on the socket, replacing a stale one left by a server
+	// that died; throws QuarkCodegenError when it cannot, or when another
+	// server answers on it
+	explicit CompileServer(ServerOptions options);
+	~CompileServer();
+
+	CompileServer(const CompileServer&) = delete;
+	CompileServer& operator=(const CompileServer&) = delete;
+
+	// Accepts and serves clients until stop(); returns once the requests in
+	// progress have been answered, and removes the socket
+	void serve();
+
+	// Makes serve() return. Async-signal-safe, for SIGINT and SIGTERM.
+	void stop();
+
+	uint64_t served() const { return requests.load(); }
+
+	// The reply to one request, as sent on a connection
+	std::string handle(const std::string& request) const;
+
+private:
+	void work();
+
+	ServerOptions options;
+	int listenFd = -1;
+	int wakeFds[2] = { -1, -1 };
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable ready;
+	std::deque<int> connections;
+	bool stopping = false;
+	std::atomic<uint64_t> requests{ 0 };
+};
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstdint>
+#include "ast.h"
+
+struct ShareStats
+{
+	uint32_t shared = 0;	// child slots pointed at an identical subtree met earlier
+	uint32_t distinct = 0;	// shareable subtrees left, each stored once
+};
+
+// Common-subexpression sharing over the tree below the root of ast: every
+// child slot holding a shareable subtree (see SubtreeTable) is pointed at the
+// first identical one, and ast is marked hash-consed, which lowering then
+// uses to compute a shared value once per basic block. The nodes dropped out
+// stay in the arena, unreachable, as with foldConstants().
+ShareStats shareSubtrees(Ast& ast);
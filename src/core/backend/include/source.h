@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "column.h"
+#include "token.h"
+
+// A SourceLoc resolved: the file, and the line and column counting from 1.
+// offset is the byte offset into the file, which the packed tree and dump
+// formats call pos.
+struct PresumedLoc
+{
+	std::string_view file;
+	uint32_t line = 0;
+	uint32_t column = 0;
+	uint64_t offset = 0;
+
+	bool valid() const { return line != 0; }
+};
+
+// One file's part of the location space, or a window onto [offset,
+// offset + size) of it that starts a line; its lines are
+// lineStarts[firstLine, next buffer's firstLine), the first numbered lineNo
+struct SourceBuffer
+{
+	uint32_t start;		// location of the first byte
+	uint32_t size;
+	uint32_t firstLine;
+	uint32_t name;		// [name, name + nameSize) of the names blob
+	uint32_t nameSize;
+	uint32_t lineNo;
+	uint64_t offset;
+};
+
+// The files an Ast was built from, laid end to end in one 32-bit location
+// space, with the location at which each of their lines starts. Location 0
+// is kept free for no location, and every buffer has one more for the
+// position after its last byte, so no location runs into the next file.
+// The arrays are Columns, so a table can borrow them from a mapped .qast
+// file, like SymbolTable.
+class SourceTable
+{
+public:
+	// Adds a buffer holding text and returns the location of its first byte.
+	// Throws std::length_error once the sources outgrow 32 bits.
+	SourceLoc add(std::string_view name, std::string_view text);
+
+	// Adds a buffer of size bytes whose lines addLines() records as its text
+	// is read. A file streamed an item at a time gets one per item: the
+	// window at byte offset of the file, whose first line is line lineNo.
+	SourceLoc reserve(std::string_view name, uint64_t size, uint64_t offset = 0, uint32_t lineNo = 1);
+
+	// Records the lines starting in text, which is the text of the buffer
+	// added last from at on; everything before at is recorded already.
+	// Returns how many it recorded.
+	size_t addLines(SourceLoc at, std::string_view text);
+
+	// Drops the buffers from index count on with their lines, so the
+	// locations they held are handed out again. Nothing may refer to them.
+	void truncate(size_t count);
+
+	// Adds a buffer known only by its size and by the offset of each of its
+	// lines after the first, in order
+	SourceLoc add(std::string_view name, uint64_t size, const std::vector<uint32_t>& lineOffsets);
+
+	// Where the next buffer will start
+	SourceLoc end() const;
+
+	PresumedLoc resolve(SourceLoc loc) const;
+
+	// "file:line:column", or empty for no location
+	std::string describe(SourceLoc loc) const;
+
+	size_t size() const { return buffers.size(); }
+
+private:
+	friend class AstFile;
+
+	Column<SourceBuffer> buffers{ MemoryKind::Sources };
+	Column<uint32_t> lineStarts{ MemoryKind::Sources };
+	Column<char> names{ MemoryKind::Sources };
+};
+
+// Rebuilds the buffer of a tree that comes with a line number and an offset
+// per token but without its text, as Python trees and packed trees do. A
+// line is taken to start at its first token: the lines resolve to what the
+// front end gave and the columns count from there.
+class SourceSketch
+{
+public:
+	explicit SourceSketch(SourceTable& table) : table(table), start(table.end()) {}
+
+	// The location of a token at pos on line lineNo; none without a line
+	SourceLoc loc(int32_t lineNo, int32_t pos);
+
+	// Adds the buffer the locations handed out point into. Nothing else may
+	// be added to the table before.
+	void finish(std::string_view name);
+
+private:
+	SourceTable& table;
+	SourceLoc start;
+	uint64_t size = 0;
+	std::vector<uint32_t> lineOffsets;	// per line, UINT32_MAX until a token is seen on it
+};
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "ast.h"
+#include "lexer.h"
+#include "mapping.h"
+
+// Streaming front end for sources too big to hold as one token array and
+// one tree. The source is lexed a top-level item at a time, see
+// QuarkLexer::tokenizeItem, and each item is parsed on its own into an arena
+// that the consumer cuts back once it has compiled the item, as
+// QuarkCodegen::runStream() does. What is resident at a time is the largest
+// item's tokens and nodes plus the function definitions and the symbols,
+// not the file.
+
+// A source file mapped for one pass front to back. Pages the reader is done
+// with are dropped, so the file is never resident as a whole. One that
+// cannot be mapped, because it is empty or a pipe, is read into memory.
+class SourceFile
+{
+public:
+	// Throws std::runtime_error when path cannot be read
+	explicit SourceFile(const std::string& path);
+
+	std::string_view text() const { return view; }
+	const std::string& path() const { return name; }
+
+	// Called with the offset before which the text is no longer needed
+	void release(uint64_t offset);
+
+private:
+	std::string name;
+	std::shared_ptr<MappedFile> mapping;
+	std::string contents;
+	MemoryCharge charge{ MemoryKind::Sources };
+	std::string_view view;
+	uint64_t released = 0;
+};
+
+class ItemReader
+{
+public:
+	explicit ItemReader(std::string_view source, std::string name = "<input>")
+		: lexer(source), source(source), name(std::move(name)) {}
+	explicit ItemReader(SourceFile& file) : lexer(file.text()), source(file.text()), name(file.path()), file(&file) {}
+
+	// Lexes the next item; false at the end of the source
+	bool next();
+
+	// Whether the item lexed last defines a function
+	bool definesFunction() const;
+
+	// Parses the item lexed last into ast, after the nodes it already has,
+	// and returns the item's CompilationUnit, which is also ast's root now.
+	// The item is a buffer of its own in ast's SourceTable, a window onto
+	// the source that resolves to the source's lines and offsets.
+	NodeId parse(Ast& ast);
+
+	// Tokens of the item lexed last, EOF included
+	size_t tokens() const { return buffer.size(); }
+
+	// The lexer's warnings so far
+	std::vector<std::string>& diagnostics() { return buffer.diagnostics; }
+
+private:
+	QuarkLexer lexer;
+	TokenBuffer buffer;
+	std::string_view source;
+	std::string_view item;
+	std::string name;
+	uint32_t lineNo = 1;	// of the next item's first line
+	SourceFile* file = nullptr;
+};
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "column.h"
+#include "token.h"
+
+inline uint64_t hashBytes(std::string_view bytes, uint64_t seed = 0xcbf29ce484222325ull) {
+	// FNV-1a, 64-bit
+	uint64_t h = seed;
+	for (unsigned char c : bytes)
+	{
+		h ^= c;
+		h *= 0x100000001b3ull;
+	}
+	return h;
+}
+
+// Deduplicates identifier and literal spellings into dense 32-bit ids. All
+// spellings share one character buffer; the lookup index is an open-addressing
+// table of ids, so no per-symbol std::string is ever allocated. Symbol 0 is
+// always the empty string. The arrays are Columns, so a table can borrow
+// them straight from a mapped .qast file.
+class SymbolTable
+{
+public:
+	SymbolTable()
+	{
+		offsets.push_back(0);
+		intern(std::string_view());
+	}
+
+	SymbolId intern(std::string_view text)
+	{
+		uint64_t h = hashBytes(text);
+		if ((size() + 1) * 4 > buckets.size() * 3) grow();
+
+		size_t mask = buckets.size() - 1;
+		for (size_t i = h & mask;; i = (i + 1) & mask)
+		{
+			uint32_t slot = buckets[i];
+			if (slot == 0)
+			{
+				SymbolId id = static_cast<SymbolId>(size());
+				chars.append(text.data(), text.size());
+				offsets.push_back(static_cast<uint32_t>(chars.size()));
+				hashes.push_back(h);
+				buckets.set(i, id + 1);
+				return id;
+			}
+			if (hashes[slot - 1] == h && spelling(slot - 1) == text) return slot - 1;
+		}
+	}
+
+	std::string_view spelling(SymbolId id) const
+	{
+		return std::string_view(chars.data() + offsets[id], offsets[id + 1] - offsets[id]);
+	}
+
+	uint64_t hash(SymbolId id) const { return hashes[id]; }
+	size_t size() const { return hashes.size(); }
+
+private:
+	friend class AstFile;
+
+	void grow()
+	{
+		std::vector<uint32_t> next(buckets.empty() ? 64 : buckets.size() * 2, 0);
+		size_t mask = next.size() - 1;
+		for (SymbolId id = 0; id < size(); id++)
+		{
+			size_t i = hashes[id] & mask;
+			while (next[i] != 0) i = (i + 1) & mask;
+			next[i] = id + 1;
+		}
+		buckets.assign(std::move(next));
+	}
+
+	Column<char> chars{ MemoryKind::Symbols };
+	Column<uint32_t> offsets{ MemoryKind::Symbols };
+	Column<uint64_t> hashes{ MemoryKind::Symbols };
+	Column<uint32_t> buckets{ MemoryKind::Symbols };
+};
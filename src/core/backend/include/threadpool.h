@@ -0,0 +1,74 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed-size pool with one deque per worker. A worker pops its own newest
+// task first and steals the oldest task from the other queues when it runs
+// dry, so independent codegen units spread over all cores without a shared
+// queue becoming the bottleneck.
+class ThreadPool
+{
+public:
+	// threads == 0 uses std::thread::hardware_concurrency()
+	explicit ThreadPool(unsigned threads = 0);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	// Process-wide pool sized to the machine
+	static ThreadPool& shared();
+
+	unsigned size() const { return static_cast<unsigned>(workers.size()); }
+
+	void submit(std::function<void()> task);
+
+	// Runs one queued task on the calling thread, if there is any
+	bool runOne();
+
+private:
+	struct Queue
+	{
+		std::mutex mutex;
+		std::deque<std::function<void()>> tasks;
+	};
+
+	bool pop(unsigned index, std::function<void()>& task);
+	bool steal(unsigned index, std::function<void()>& task);
+	void workerLoop(unsigned index);
+
+	std::vector<std::unique_ptr<Queue>> queues;
+	std::vector<std::thread> workers;
+	std::mutex sleepMutex;
+	std::condition_variable wake;
+	std::atomic<size_t> queued{ 0 };
+	std::atomic<unsigned> nextQueue{ 0 };
+	bool stopping = false;
+};
+
+// Tracks a batch of tasks on a pool. wait() helps run queued tasks instead
+// of blocking, and rethrows the first exception raised by a task.
+class TaskGroup
+{
+public:
+	explicit TaskGroup(ThreadPool& pool) : pool(pool) {}
+	~TaskGroup();
+
+	void run(std::function<void()> task);
+	void wait();
+
+private:
+	ThreadPool& pool;
+	std::mutex mutex;
+	std::condition_variable done;
+	size_t pending = 0;
+	std::exception_ptr error;
+};
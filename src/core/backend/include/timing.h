@@ -0,0 +1,151 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "accounting.h"
+
+// Wall time and counters of one compile phase. Names with a dot are steps
+// inside the phase before the dot, summed over every codegen unit, so with
+// several threads they can add up to more than that phase.
+struct PhaseTiming
+{
+	std::string name;
+	double seconds = 0;
+	uint64_t items = 0;				// bytes for read, tokens for lex, units for plan and compile, nodes otherwise
+	uint64_t peakRssBytes = 0;		// process high-water mark when the phase ended, 0 for steps
+	uint64_t rssGrowthBytes = 0;	// how far the phase raised it
+	// What the tracked structures held when the phase ended and at most
+	// while it ran, see accounting.h; only for phases that ended with memory
+	// tracking on. With several reports at once a phase's peaks count from
+	// when any of them last ended a phase.
+	bool memoryTracked = false;
+	MemoryStats memory;
+};
+
+// One LLVM pass, summed over every run of it in every unit. Time spent in
+// nested passes is not counted towards the pass or pass manager running them.
+struct PassTiming
+{
+	std::string name;
+	double seconds = 0;
+	uint64_t runs = 0;
+};
+
+// One dispatch site of a program built with CodegenOptions::siteCounters,
+// with the counters its run left (QuarkSiteRecord in runtime.h)
+struct DispatchSite
+{
+	std::string site;		// "file:line:column what operand-kinds"
+	bool fastPath = false;	// whether an inline guard handles the common case
+	uint64_t calls = 0;
+	uint64_t hits = 0;		// calls the fast path handled
+	uint64_t elements = 0;	// list elements the runtime went through
+};
+
+// Collects phase and pass timings across a whole compile. Codegen workers
+// record into it concurrently.
+class TimeReport
+{
+public:
+	TimeReport();
+
+	// A phase that just ended; samples the process peak RSS, and the tracked
+	// memory when that is on
+	void phase(const std::string& name, double seconds, uint64_t items);
+
+	// A per-unit step total; memory is only sampled per phase
+	void step(const std::string& name, double seconds, uint64_t items);
+
+	void passes(const std::map<std::string, PassTiming>& timings);
+
+	// The sites of a program that ran
+	void sites(const std::vector<DispatchSite>& ran);
+
+	std::vector<PhaseTiming> phases() const;
+	std::vector<PassTiming> passes() const;
+
+	// The most called first
+	std::vector<DispatchSite> sites() const;
+
+	// {"phases": [...], "passes": [...], "total_seconds": ...}, passes slowest
+	// first; total_seconds sums the phases without a dot. With memory
+	// tracking on, "memory" has the bytes per kind and their high-water marks
+	// since it was turned on, and in Sites mode the sites, most bytes first.
+	// "dispatch_sites" lists the sites of programs run with site counters.
+	std::string json() const;
+
+	// The same as aligned tables
+	std::string text() const;
+
+private:
+	mutable std::mutex mutex;
+	std::vector<PhaseTiming> phaseList;
+	std::map<std::string, PassTiming> passTimes;
+	std::vector<DispatchSite> siteList;
+	uint64_t lastPeak = 0;
+
+	std::vector<PassTiming> sortedPasses() const;
+	std::vector<DispatchSite> sortedSites() const;
+	double totalSeconds() const;
+};
+
+// Appends value as a JSON string literal
+void appendJsonString(std::string& out, const std::string& value);
+
+// High-water mark of the process resident set in bytes, 0 where unknown
+uint64_t peakRssBytes();
+
+// Records the enclosing scope as a phase of report; does nothing when report
+// is null, so instrumentation costs one branch when it is off
+class PhaseTimer
+{
+public:
+	PhaseTimer(TimeReport* report, const char* name, uint64_t items = 0)
+		: report(report), name(name), items(items)
+	{
+		if (report) start = std::chrono::steady_clock::now();
+	}
+
+	~PhaseTimer()
+	{
+		if (report) report->phase(name, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(), items);
+	}
+
+	PhaseTimer(const PhaseTimer&) = delete;
+	PhaseTimer& operator=(const PhaseTimer&) = delete;
+
+	// For counts only known once the phase is done
+	void setItems(uint64_t count) { items = count; }
+
+private:
+	TimeReport* report;
+	const char* name;
+	uint64_t items;
+	std::chrono::steady_clock::time_point start;
+};
+
+// Accumulates the duration of scopes into total, for per-unit steps
+class StepTimer
+{
+public:
+	explicit StepTimer(double* total) : total(total)
+	{
+		if (total) start = std::chrono::steady_clock::now();
+	}
+
+	~StepTimer()
+	{
+		if (total) *total += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	StepTimer(const StepTimer&) = delete;
+	StepTimer& operator=(const StepTimer&) = delete;
+
+private:
+	double* total;
+	std::chrono::steady_clock::time_point start;
+};
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+#include <unordered_map>
+
+// Mirrors lex_grammar.tokens followed by the values of lex_grammar.reserved,
+// in the same order. Keep both lists in sync when the lexer grammar changes.
+#define QUARK_TOKEN_KINDS(X) \
+	X(ID, "ID") \
+	X(PLUS, "PLUS") \
+	X(MINUS, "MINUS") \
+	X(MULTIPLY, "MULTIPLY") \
+	X(DIVIDE, "DIVIDE") \
+	X(MODULO, "MODULO") \
+	X(AMPER, "AMPER") \
+	X(NOT, "NOT") \
+	X(EQUALS, "EQUALS") \
+	X(LT, "LT") \
+	X(GT, "GT") \
+	X(LTE, "LTE") \
+	X(GTE, "GTE") \
+	X(DEQ, "DEQ") \
+	X(NE, "NE") \
+	X(LPAR, "LPAR") \
+	X(RPAR, "RPAR") \
+	X(LBRACE, "LBRACE") \
+	X(RBRACE, "RBRACE") \
+	X(BLOCKSTART, "BLOCKSTART") \
+	X(BLOCKEND, "BLOCKEND") \
+	X(INT, "INT") \
+	X(FLOAT, "FLOAT") \
+	X(STR, "STR") \
+	X(AT, "AT") \
+	X(DOT, "DOT") \
+	X(COMMA, "COMMA") \
+	X(QUOTES, "QUOTES") \
+	X(DQUOTES, "DQUOTES") \
+	X(PIPE, "PIPE") \
+	X(COLON, "COLON") \
+	X(COMMENT, "COMMENT") \
+	X(WS, "WS") \
+	X(NEWLINE, "NEWLINE") \
+	X(INDENT, "INDENT") \
+	X(DEDENT, "DEDENT") \
+	X(EndMarker, "EOF") \
+	X(USE, "USE") \
+	X(MODULE, "MODULE") \
+	X(IN, "IN") \
+	X(AND, "AND") \
+	X(OR, "OR") \
+	X(IF, "IF") \
+	X(ELIF, "ELIF") \
+	X(ELSE, "ELSE") \
+	X(FOR, "FOR") \
+	X(WHILE, "WHILE") \
+	X(FN, "FN") \
+	X(CLASS, "CLASS")
+
+// None is used by nodes that carry no token (CompilationUnit, Block, ...)
+enum class TokenKind : uint8_t
+{
+	None,
+#define QUARK_TOKEN_ENUM(name, str) name,
+	QUARK_TOKEN_KINDS(QUARK_TOKEN_ENUM)
+#undef QUARK_TOKEN_ENUM
+	Count,
+};
+
+// Interned spelling of an identifier or literal, see SymbolTable
+using SymbolId = uint32_t;
+constexpr SymbolId EmptySymbol = 0;
+
+// Where a token starts: an offset into the buffers of its Ast's SourceTable
+// laid end to end, so one word places it in any of the files a tree was
+// built from. Lines and columns are only worked out when something prints
+// them, see SourceTable::resolve(). 0 is no location.
+struct SourceLoc
+{
+	uint32_t offset = 0;
+
+	bool valid() const { return offset != 0; }
+	SourceLoc operator+(uint32_t bytes) const { return SourceLoc{ offset + bytes }; }
+	bool operator==(SourceLoc other) const { return offset == other.offset; }
+	bool operator!=(SourceLoc other) const { return offset != other.offset; }
+	bool operator<(SourceLoc other) const { return offset < other.offset; }
+};
+
+struct Token
+{
+	TokenKind kind = TokenKind::None;
+	SymbolId value = EmptySymbol;
+	SourceLoc loc;
+};
+
+inline const char* tokenKindString(TokenKind kind) {
+	static const char* const names[] = {
+		"",
+#define QUARK_TOKEN_NAME(name, str) str,
+		QUARK_TOKEN_KINDS(QUARK_TOKEN_NAME)
+#undef QUARK_TOKEN_NAME
+	};
+	return names[static_cast<size_t>(kind)];
+}
+
+// Maps a token type name as produced by the Python lexer ("PLUS", "ID", ...)
+// to its kind. Unknown names map to TokenKind::None.
+inline TokenKind tokenKindFromString(std::string_view name) {
+	static const std::unordered_map<std::string_view, TokenKind> kinds = [] {
+		std::unordered_map<std::string_view, TokenKind> map;
+		for (size_t i = 1; i < static_cast<size_t>(TokenKind::Count); i++)
+		{
+			map.emplace(tokenKindString(static_cast<TokenKind>(i)), static_cast<TokenKind>(i));
+		}
+		return map;
+	}();
+
+	auto it = kinds.find(name);
+	return it == kinds.end() ? TokenKind::None : it->second;
+}
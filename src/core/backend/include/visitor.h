@@ -0,0 +1,137 @@
+#pragma once
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "ast.h"
+
+// Depth-first traversal of an Ast on an explicit stack, so tree depth is
+// bounded by memory rather than by the call stack. Derived classes hide
+// the hooks they care about (CRTP); the rest fall through to enterNode and
+// leaveNode. Dispatch on NodeType is a switch the compiler resolves into
+// direct calls, with no virtual functions involved.
+//
+//   enterLiteral(node) ... enterOperator(node)
+//		pre-order; return false to skip the node's children
+//   leaveLiteral(node) ... leaveOperator(node)
+//		post-order, once every visited child has been left
+//   descend(node, i)
+//		whether child i of node is visited at all
+//
+// Hooks may start a nested walk(), for example into another function's body.
+// parent() and childIndex() then refer to the innermost walk.
+template <typename Derived>
+class AstVisitor
+{
+public:
+	explicit AstVisitor(const Ast& ast) : ast(ast) {}
+
+	void walk(NodeId root)
+	{
+		// A nested walk stacks its frames on top of the enclosing one's
+		NestedWalk nested(*this);
+
+		push(root);
+		while (frames.size() > base)
+		{
+			Frame& top = frames.back();
+			while (top.next < top.count && !derived().descend(NodeRef(&ast, top.id), top.next)) top.next++;
+			if (top.next < top.count)
+			{
+				push(ast.child(top.id, top.next++));
+				continue;
+			}
+
+			leave(top.id);
+			frames.pop_back();
+		}
+	}
+
+protected:
+	const Ast& ast;
+
+	// The node the current hook's node is a child of, invalid at the root
+	NodeRef parent() const
+	{
+		if (frames.size() < base + 2) return NodeRef();
+		return NodeRef(&ast, frames[frames.size() - 2].id);
+	}
+
+	// Position of the current hook's node among its parent's children
+	uint32_t childIndex() const { return frames[frames.size() - 2].next - 1; }
+
+	// Levels from the root of the innermost walk to the current hook's node
+	size_t depth() const { return frames.size() - base - 1; }
+
+	bool enterNode(NodeRef) { return true; }
+	void leaveNode(NodeRef) {}
+	bool descend(NodeRef, uint32_t) { return true; }
+
+#define QUARK_VISITOR_HOOKS(type) \
+	bool enter##type(NodeRef node) { return derived().enterNode(node); } \
+	void leave##type(NodeRef node) { derived().leaveNode(node); }
+	QUARK_NODE_TYPES(QUARK_VISITOR_HOOKS)
+#undef QUARK_VISITOR_HOOKS
+
+private:
+	struct Frame
+	{
+		NodeId id;
+		uint32_t next;	// child to visit next
+		uint32_t count;	// children to visit, 0 when enter skipped them
+	};
+
+	// Starts a walk above the frames of the enclosing one, and drops whatever
+	// it left behind when it ends, also by an exception
+	class NestedWalk
+	{
+	public:
+		explicit NestedWalk(AstVisitor& visitor) : visitor(visitor), outer(std::exchange(visitor.base, visitor.frames.size())) {}
+		~NestedWalk()
+		{
+			visitor.frames.resize(visitor.base);
+			visitor.base = outer;
+		}
+
+	private:
+		AstVisitor& visitor;
+		size_t outer;
+	};
+
+	std::vector<Frame> frames;
+	size_t base = 0;	// first frame of the innermost walk
+
+	Derived& derived() { return static_cast<Derived&>(*this); }
+
+	void push(NodeId id)
+	{
+		frames.push_back(Frame{ id, 0, ast.childCount(id) });
+		if (!enter(id)) frames.back().count = 0;
+	}
+
+	bool enter(NodeId id)
+	{
+		NodeRef node(&ast, id);
+		switch (ast.type(id))
+		{
+#define QUARK_VISITOR_ENTER(type) \
+		case type: return derived().enter##type(node);
+		QUARK_NODE_TYPES(QUARK_VISITOR_ENTER)
+#undef QUARK_VISITOR_ENTER
+		default: return derived().enterNode(node);
+		}
+	}
+
+	void leave(NodeId id)
+	{
+		NodeRef node(&ast, id);
+		switch (ast.type(id))
+		{
+#define QUARK_VISITOR_LEAVE(type) \
+		case type: derived().leave##type(node); break;
+		QUARK_NODE_TYPES(QUARK_VISITOR_LEAVE)
+#undef QUARK_VISITOR_LEAVE
+		default: derived().leaveNode(node); break;
+		}
+	}
+};
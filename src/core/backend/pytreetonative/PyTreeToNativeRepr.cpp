@@ -2,32 +2,546 @@
 
 PYBIND11_MODULE(pytreetonative, m)
 {
-    m.def("initCodegen", &PyTreeToNativeRepr::consumePyTree, "Takes in a pybind11::object tree and converts it to native C++ representation");
+    pybind11::register_exception_translator([](std::exception_ptr p) {
+        try
+        {
+            if (p) std::rethrow_exception(p);
+        }
+        catch (const QuarkIndentationError& e)
+        {
+            PyErr_SetString(PyExc_IndentationError, e.what());
+        }
+        catch (const QuarkSyntaxError& e)
+        {
+            PyErr_SetString(PyExc_SyntaxError, e.what());
+        }
+        catch (const QuarkCodegenError& e)
+        {
+            PyErr_SetString(PyExc_RuntimeError, e.what());
+        }
+    });
+
+    pybind11::class_<Ast>(m, "Tree")
+        .def("__len__", &Ast::size)
+        .def("pack", [](const Ast& ast) {
+            std::vector<uint8_t> bytes = writePackedTree(ast.rootRef());
+            return pybind11::bytes(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+        }, "Serializes the tree in the TreeNode.pack() format")
+        .def("save", &AstFile::write, "Writes the tree as a .qast file that loadTree() can map back",
+            pybind11::arg("path"), pybind11::arg("source_hash"))
+        .def("dump", [](const Ast& ast, const std::string& format, int fd) {
+            DumpFormat dumpFormat = dumpFormatFromString(format);
+            pybind11::gil_scoped_release release;
+            return dumpTree(ast.rootRef(), dumpFormat, fd);
+        }, "Writes the tree as text, json or dot to a file descriptor and returns the number of nodes written",
+            pybind11::arg("format") = "text", pybind11::arg("fd") = 1)
+        .def_property_readonly("mapped", &Ast::mapped);
+
+    // Passed as report= to parse() and initCodegen(), which append their
+    // phases; the driver adds the phases it times in Python with add()
+    pybind11::class_<TimeReport>(m, "TimeReport")
+        .def(pybind11::init<>())
+        .def("add", &TimeReport::phase, "Records a phase timed by the caller",
+            pybind11::arg("name"), pybind11::arg("seconds"), pybind11::arg("items") = 0)
+        .def_property_readonly("phases", &PyTreeToNativeRepr::phases)
+        .def_property_readonly("passes", &PyTreeToNativeRepr::passes)
+        .def_property_readonly("sites", &PyTreeToNativeRepr::sites)
+        .def("json", &TimeReport::json)
+        .def("__str__", &TimeReport::text);
+
+    pybind11::class_<PyToken>(m, "Token")
+        .def_readonly("type", &PyToken::type)
+        .def_readonly("value", &PyToken::value)
+        .def_readonly("lineno", &PyToken::lineno)
+        .def_readonly("pos", &PyToken::pos)
+        .def("__repr__", [](const PyToken& tok) {
+            return "Token(type: " + tok.type + ", value: " + std::string(pybind11::repr(tok.value))
+                + ", line: " + std::to_string(tok.lineno) + ", pos: " + std::to_string(tok.pos) + ")";
+        });
+
+    m.def("tokenize", &PyTreeToNativeRepr::tokenize, "Lexes Quark source with the native lexer and returns the token list");
+    // share hash-conses the tree as it is built, storing identical pure
+    // subexpressions once (see SubtreeTable)
+    m.def("parse", &PyTreeToNativeRepr::parse, "Lexes and parses Quark source natively and returns the tree",
+        pybind11::arg("source"), pybind11::arg("name") = "<input>", pybind11::arg("report") = nullptr,
+        pybind11::arg("share") = false);
+    m.def("unpack", &PyTreeToNativeRepr::unpack, "Decodes a packed tree buffer (TreeNode.pack()) into a native tree");
+    m.def("sourceHash", [](const std::string& source) { return sourceHash(source); },
+        "Hash of the source text, as stored in .qast files");
+    m.def("loadTree", &PyTreeToNativeRepr::loadTree,
+        "Maps a .qast file written by Tree.save(); None if it is missing, stale or from another version",
+        pybind11::arg("path"), pybind11::arg("source_hash"));
+    // mode is "dump" (print the tree), "ir" (returns the LLVM module as text),
+    // "jit" (compiles and runs it, returns the value of the last statement)
+    // or "aot" (compiles and links it, returns the path of the binary).
+    // Keyword options: opt (O0/O1/O2/O3/Os), passes (a custom new-pass-manager
+    // pipeline), threads (codegen workers, 0 = all cores), cache_dir and
+    // cache_size (object cache directory and its size bound in bytes), fold
+    // (constant folding before codegen, on by default), share (sharing of
+    // identical pure subexpressions after it, see shareSubtrees), debug
+    // (DWARF line tables, and gdb registration of JIT code), profile_generate
+    // (instrument the code and write a profile to this path once it has run) and
+    // profile_use (an indexed profile, see mergeProfiles, to optimize with),
+    // site_counters (count the runtime calls of each operator and builtin
+    // call site, which jit mode adds to the report and an executable writes
+    // to stderr at exit), report (a TimeReport
+    // that receives the bridge and codegen phases and the LLVM pass timings),
+    // dump_format and dump_fd (what dump mode writes where: text, json or dot,
+    // to stdout unless another file descriptor is given), target, cpu and
+    // features (what to generate code for, the host by default), output,
+    // shared, static, linker, linker_args and runtime_library (what aot mode
+    // builds and how it links it: a.out, an executable rather than a shared
+    // library, libc linked statically, with c++ and this build's runtime).
+    m.def("initCodegen", &PyTreeToNativeRepr::consumeNativeTree, "Runs codegen on a tree returned by parse()",
+        pybind11::arg("tree"), pybind11::arg("mode") = "dump");
+    m.def("initCodegen", &PyTreeToNativeRepr::consumePackedTree, "Takes in a packed tree buffer (TreeNode.pack()) and runs codegen on it",
+        pybind11::arg("tree"), pybind11::arg("mode") = "dump");
+    m.def("initCodegen", &PyTreeToNativeRepr::consumePyTree, "Takes in a pybind11::object tree and converts it to native C++ representation",
+        pybind11::arg("tree"), pybind11::arg("mode") = "dump");
+    // Lexes, parses and compiles every source (str) or packed tree (bytes,
+    // TreeNode.pack()) on the native pool without the GIL, and returns one
+    // dict per unit, in order: value (what initCodegen() would return),
+    // error (the exception it would have raised, or None), diagnostics (the
+    // lexer's warnings) and report (a TimeReport of the unit's phases).
+    // mode is "ir" or "jit"; options are initCodegen()'s but for report.
+    m.def("compile_many", &PyTreeToNativeRepr::compileMany, "Compiles many sources or packed trees in parallel",
+        pybind11::arg("sources"), pybind11::arg("mode") = "jit");
+    // Compiles the source file at path front to back a top-level item at a
+    // time, so that what is resident is the largest item rather than the
+    // file; see QuarkCodegen::runStream(). Calls reach only the functions
+    // defined above them. mode is "ir", "jit" or "aot"; options are
+    // initCodegen()'s.
+    m.def("compileFile", &PyTreeToNativeRepr::compileFile, "Streams a source file through the native front end and codegen",
+        pybind11::arg("path"), pybind11::arg("mode") = "jit");
+    // Merges the profiles of instrumented runs into the indexed one that
+    // profile_use takes
+    m.def("mergeProfiles", [](const std::vector<std::string>& inputs, const std::string& output) {
+            pybind11::gil_scoped_release release;
+            mergeProfiles(inputs, output);
+        }, "Merges raw, text or indexed profiles into an indexed one", pybind11::arg("inputs"), pybind11::arg("output"));
+    m.def("cacheStats", &PyTreeToNativeRepr::cacheStats, "Hit, miss, store and eviction counters of an object cache directory",
+        pybind11::arg("cache_dir"));
+    // mode is "off", "counters" or "sites". While it is on, the phases of a
+    // TimeReport carry what the tracked structures held, and its json() and
+    // text the totals since it was turned on.
+    m.def("trackMemory", [](const std::string& mode) { setMemoryTracking(memoryTrackingFromString(mode)); },
+        "Turns accounting of the memory held by trees, tokens, symbols, sources and LLVM modules on or off",
+        pybind11::arg("mode") = "counters");
+    m.def("memoryStats", &PyTreeToNativeRepr::memoryStats, "Bytes held per kind and their high-water marks since trackMemory()");
+};
+
+pybind11::list PyTreeToNativeRepr::tokenize(const std::string& source)
+{
+    TokenBuffer buffer;
+    {
+        pybind11::gil_scoped_release release;
+        QuarkLexer(source).tokenizeParallel(buffer, ThreadPool::shared());
+    }
+
+    for (const std::string& msg : buffer.diagnostics) pybind11::print(msg);
+
+    pybind11::list tokens(buffer.size());
+    for (size_t i = 0; i < buffer.size(); i++)
+    {
+        const LexToken& tok = buffer[i];
+        std::string text(buffer.text(tok));
+        pybind11::object value = pybind11::none();
+        switch (tok.kind)
+        {
+        case TokenKind::INT:
+            value = pybind11::reinterpret_steal<pybind11::object>(PyLong_FromString(text.c_str(), nullptr, 10));
+            break;
+        case TokenKind::FLOAT:
+            value = pybind11::float_(std::stod(text));
+            break;
+        case TokenKind::INDENT:
+        case TokenKind::DEDENT:
+        case TokenKind::EndMarker:
+            break;
+        default:
+            value = pybind11::str(text);
+            break;
+        }
+
+        tokens[i] = pybind11::cast(PyToken{ tokenKindString(tok.kind), std::move(value), tok.lineNo, static_cast<int>(tok.offset) });
+    }
+    return tokens;
+};
+
+std::unique_ptr<Ast> PyTreeToNativeRepr::parse(const std::string& source, const std::string& name, TimeReport* report, bool share)
+{
+    auto ast = std::make_unique<Ast>();
+    ast->setHashConsing(share);
+    TokenBuffer buffer;
+    buffer.start = ast->sources().add(name, source);
+    {
+        pybind11::gil_scoped_release release;
+        {
+            PhaseTimer timer(report, "lex");
+            QuarkLexer(source).tokenizeParallel(buffer, ThreadPool::shared());
+            timer.setItems(buffer.size());
+        }
+        PhaseTimer timer(report, "parse");
+        QuarkParser(buffer, *ast).parse();
+        timer.setItems(ast->size());
+    }
+
+    for (const std::string& msg : buffer.diagnostics) pybind11::print(msg);
+    return ast;
+};
+
+std::unique_ptr<Ast> PyTreeToNativeRepr::unpack(const pybind11::buffer& buffer)
+{
+    pybind11::buffer_info info = buffer.request();
+    size_t size = static_cast<size_t>(info.size) * static_cast<size_t>(info.itemsize);
+
+    auto ast = std::make_unique<Ast>();
+    {
+        pybind11::gil_scoped_release release;
+        readPackedTree(info.ptr, size, *ast);
+    }
+    return ast;
+};
+
+pybind11::object PyTreeToNativeRepr::loadTree(const std::string& path, uint64_t sourceHash)
+{
+    auto ast = std::make_unique<Ast>();
+    if (!AstFile::map(path, sourceHash, *ast)) return pybind11::none();
+    return pybind11::cast(std::move(ast));
+};
+
+NodeId PyTreeToNativeRepr::genNativeTreeRepr(pybind11::handle tree, AstBuilder& builder, SourceSketch& source)
+{
+    auto open = [&builder, &source](pybind11::handle node) {
+        // Spellings and line starts, when memory is tracked by site
+        MemorySiteScope site(MemorySite::here());
+        NodeType type = static_cast<NodeType>(std::stoi(pybind11::str(node.attr("type").attr("value"))));
+        Token tok{};
+        pybind11::object pyTok = node.attr("tok");
+        if (!pyTok.is_none())
+        {
+            tok = Token{
+                tokenKindFromString(std::string(pybind11::str(pyTok.attr("type")))),
+                builder.symbols().intern(std::string(pybind11::str(pyTok.attr("value")))),
+                source.loc(std::stoi(pybind11::str(pyTok.attr("lineno"))), std::stoi(pybind11::str(pyTok.attr("pos")))) };
+        }
+        builder.open(type, std::move(tok));
+    };
+
+    // One iterator over the children of every open node, so a deep Python
+    // tree does not recurse as deep in C++
+    std::vector<pybind11::iterator> stack;
+    open(tree);
+    stack.push_back(pybind11::iter(tree.attr("children")));
+    NodeId id = InvalidNode;
+    while (!stack.empty())
+    {
+        pybind11::iterator& children = stack.back();
+        if (children == pybind11::iterator::sentinel())
+        {
+            stack.pop_back();
+            id = builder.close();
+            continue;
+        }
+
+        pybind11::object child = pybind11::reinterpret_borrow<pybind11::object>(*children);
+        ++children;
+        open(child);
+        stack.push_back(pybind11::iter(child.attr("children")));
+    }
+    return id;
+};
+
+pybind11::object PyTreeToNativeRepr::consumePyTree(const pybind11::object& tree, const std::string& mode, const pybind11::kwargs& options)
+{
+    CodegenOptions codegen = codegenOptions(options);
+    Ast ast;
+    {
+        PhaseTimer timer(codegen.timings, "bridge");
+        AstBuilder builder(ast);
+        SourceSketch source(ast.sources());
+        genNativeTreeRepr(tree, builder, source);
+        source.finish("<input>");
+        timer.setItems(ast.size());
+    }
+
+    return runCodegen(ast, mode, codegen);
+};
+
+pybind11::object PyTreeToNativeRepr::consumePackedTree(const pybind11::buffer& buffer, const std::string& mode, const pybind11::kwargs& options)
+{
+    pybind11::buffer_info info = buffer.request();
+    size_t size = static_cast<size_t>(info.size) * static_cast<size_t>(info.itemsize);
+
+    // The buffer stays alive through the caller's reference, so the decode
+    // can run without the GIL
+    CodegenOptions codegen = codegenOptions(options);
+    Ast ast;
+    {
+        pybind11::gil_scoped_release release;
+        PhaseTimer timer(codegen.timings, "bridge");
+        readPackedTree(info.ptr, size, ast);
+        timer.setItems(ast.size());
+    }
+
+    return runCodegen(ast, mode, codegen);
+};
+
+pybind11::object PyTreeToNativeRepr::consumeNativeTree(const Ast& ast, const std::string& mode, const pybind11::kwargs& options)
+{
+    // Folding rewrites the tree; the caller's tree stays as parsed. Copying a
+    // mapped tree only copies the columns the folder touches.
+    Ast copy = ast;
+    return runCodegen(copy, mode, codegenOptions(options));
+};
+
+pybind11::object PyTreeToNativeRepr::compileFile(const std::string& path, const std::string& mode, const pybind11::kwargs& kwargs)
+{
+    CodegenMode codegenMode = codegenModeFromString(mode);
+    CodegenOptions options = codegenOptions(kwargs);
+
+    CodegenResult result;
+    std::vector<std::string> diagnostics;
+    {
+        pybind11::gil_scoped_release release;
+        SourceFile file(path);
+        ItemReader items(file);
+        result = QuarkCodegen(options).runStream(items, codegenMode);
+        diagnostics = std::move(items.diagnostics());
+    }
+
+    for (const std::string& msg : diagnostics) pybind11::print(msg);
+    return resultObject(result, codegenMode);
+};
+
+pybind11::dict PyTreeToNativeRepr::cacheStats(const std::string& directory)
+{
+    CacheStats stats = CompileCache::open(directory)->stats();
+    pybind11::dict result;
+    result["hits"] = stats.hits;
+    result["misses"] = stats.misses;
+    result["stores"] = stats.stores;
+    result["evictions"] = stats.evictions;
+    result["bytes"] = stats.bytes;
+    return result;
+};
+
+pybind11::list PyTreeToNativeRepr::phases(const TimeReport& report)
+{
+    pybind11::list result;
+    for (const PhaseTiming& phase : report.phases())
+    {
+        pybind11::dict entry;
+        entry["name"] = phase.name;
+        entry["seconds"] = phase.seconds;
+        entry["items"] = phase.items;
+        entry["peak_rss_bytes"] = phase.peakRssBytes;
+        entry["rss_growth_bytes"] = phase.rssGrowthBytes;
+        if (phase.memoryTracked) entry["memory"] = memoryDict(phase.memory);
+        result.append(entry);
+    }
+    return result;
+};
+
+pybind11::list PyTreeToNativeRepr::passes(const TimeReport& report)
+{
+    pybind11::list result;
+    for (const PassTiming& pass : report.passes())
+    {
+        pybind11::dict entry;
+        entry["name"] = pass.name;
+        entry["seconds"] = pass.seconds;
+        entry["runs"] = pass.runs;
+        result.append(entry);
+    }
+    return result;
+};
+
+pybind11::list PyTreeToNativeRepr::sites(const TimeReport& report)
+{
+    pybind11::list result;
+    for (const DispatchSite& site : report.sites())
+    {
+        pybind11::dict entry;
+        entry["site"] = site.site;
+        entry["fast_path"] = site.fastPath;
+        entry["calls"] = site.calls;
+        entry["hits"] = site.hits;
+        entry["elements"] = site.elements;
+        result.append(entry);
+    }
+    return result;
+};
+
+pybind11::dict PyTreeToNativeRepr::memoryStats()
+{
+    pybind11::dict result = memoryDict(::memoryStats());
+    if (memoryTracking() != MemoryTracking::Sites) return result;
+    pybind11::list sites;
+    for (const SiteUsage& site : memorySites())
+    {
+        pybind11::dict entry;
+        entry["site"] = site.site;
+        entry["calls"] = site.calls;
+        entry["bytes"] = site.bytes;
+        sites.append(entry);
+    }
+    result["sites"] = sites;
+    return result;
+};
+
+pybind11::dict PyTreeToNativeRepr::memoryDict(const MemoryStats& stats)
+{
+    auto usage = [](const MemoryUsage& usage) {
+        pybind11::dict entry;
+        entry["bytes"] = usage.bytes;
+        entry["peak_bytes"] = usage.peakBytes;
+        return entry;
+    };
+    pybind11::dict result;
+    for (size_t i = 0; i < MemoryKindCount; i++) result[memoryKindString(static_cast<MemoryKind>(i))] = usage(stats.kinds[i]);
+    result["total"] = usage(stats.total);
+    return result;
+};
+
+CodegenOptions PyTreeToNativeRepr::codegenOptions(const pybind11::kwargs& kwargs)
+{
+    CodegenOptions options;
+    for (auto [key, value] : kwargs)
+    {
+        std::string name = pybind11::str(key);
+        if (name == "opt") options.optimizer.level = optLevelFromString(value.cast<std::string>());
+        else if (name == "passes") options.optimizer.passPipeline = value.cast<std::string>();
+        else if (name == "threads") options.threads = value.cast<unsigned>();
+        else if (name == "fold") options.foldConstants = value.cast<bool>();
+        else if (name == "share") options.shareSubtrees = value.cast<bool>();
+        else if (name == "debug") options.debugInfo = value.cast<bool>();
+        else if (name == "site_counters") options.siteCounters = value.cast<bool>();
+        else if (name == "profile_generate") options.optimizer.profileGenerate = value.cast<std::string>();
+        else if (name == "profile_use") options.optimizer.profileUse = value.cast<std::string>();
+        else if (name == "cache_dir") options.cacheDir = value.cast<std::string>();
+        else if (name == "cache_size") options.cacheMaxBytes = value.cast<uint64_t>();
+        else if (name == "report") options.timings = value.is_none() ? nullptr : value.cast<TimeReport*>();
+        else if (name == "dump_format") options.dumpFormat = dumpFormatFromString(value.cast<std::string>());
+        else if (name == "dump_fd") options.dumpFd = value.cast<int>();
+        else if (name == "target") options.target.triple = value.cast<std::string>();
+        else if (name == "cpu") options.target.cpu = value.cast<std::string>();
+        else if (name == "features") options.target.features = value.cast<std::string>();
+        else if (name == "output") options.aot.output = value.cast<std::string>();
+        else if (name == "shared") options.aot.kind = value.cast<bool>() ? AotOutput::SharedLibrary : AotOutput::Executable;
+        else if (name == "static") options.aot.staticExecutable = value.cast<bool>();
+        else if (name == "linker") options.aot.linker = value.cast<std::string>();
+        else if (name == "linker_args") options.aot.linkerArgs = value.cast<std::vector<std::string>>();
+        else if (name == "runtime_library") options.aot.runtimeLibrary = value.cast<std::string>();
+        else throw pybind11::type_error("initCodegen() got an unexpected keyword argument '" + name + "'");
+    }
+    return options;
 };
 
-TreeNode PyTreeToNativeRepr::genNativeTreeRepr(pybind11::object tree)
+pybind11::object PyTreeToNativeRepr::runCodegen(Ast& ast, const std::string& mode, const CodegenOptions& options)
 {
-    TreeNode node;
-    node.type = static_cast<NodeType>(std::stoi(pybind11::str(tree.attr("type").attr("value"))));
-    if (!tree.attr("tok").is_none())
+    CodegenMode codegenMode = codegenModeFromString(mode);
+
+    CodegenResult result;
     {
-        node.tok = Token{
-            pybind11::str(tree.attr("tok").attr("type")),
-            pybind11::str(tree.attr("tok").attr("value")),
-            std::stoi(pybind11::str(tree.attr("tok").attr("lineno"))),
-            std::stoi(pybind11::str(tree.attr("tok").attr("pos"))) };
+        pybind11::gil_scoped_release release;
+        QuarkCodegen cg(options);
+        result = cg.run(ast, codegenMode);
     }
 
-    for (pybind11::handle child : tree.attr("children"))
+    return resultObject(result, codegenMode);
+};
+
+pybind11::object PyTreeToNativeRepr::resultObject(const CodegenResult& result, CodegenMode mode)
+{
+    if (mode == CodegenMode::IR) return pybind11::str(result.ir);
+    if (mode == CodegenMode::AOT) return pybind11::str(result.output);
+    switch (result.kind)
     {
-        node.children.push_back(genNativeTreeRepr(pybind11::reinterpret_borrow<pybind11::object>(child)));
+    case ValueKind::Int: return pybind11::int_(result.intValue);
+    case ValueKind::Float: return pybind11::float_(result.floatValue);
+    case ValueKind::IntList: return pybind11::cast(result.intValues);
+    case ValueKind::FloatList: return pybind11::cast(result.floatValues);
+    default: return pybind11::none();
     }
+};
 
-    return node;
+pybind11::object PyTreeToNativeRepr::exceptionObject(std::exception_ptr error)
+{
+    auto raise = [](PyObject* type, const char* message) {
+        return pybind11::reinterpret_borrow<pybind11::object>(type)(message);
+    };
+    try
+    {
+        std::rethrow_exception(error);
+    }
+    catch (const QuarkIndentationError& e)
+    {
+        return raise(PyExc_IndentationError, e.what());
+    }
+    catch (const QuarkSyntaxError& e)
+    {
+        return raise(PyExc_SyntaxError, e.what());
+    }
+    catch (const std::invalid_argument& e)
+    {
+        return raise(PyExc_ValueError, e.what());
+    }
+    catch (const std::exception& e)
+    {
+        return raise(PyExc_RuntimeError, e.what());
+    }
 };
 
-void PyTreeToNativeRepr::consumePyTree(const pybind11::object& tree)
+pybind11::list PyTreeToNativeRepr::compileMany(const pybind11::list& sources, const std::string& mode, const pybind11::kwargs& kwargs)
 {
-    QuarkCodegen cg;
-    cg.begin(PyTreeToNativeRepr::genNativeTreeRepr(tree));
-};
\ No newline at end of file
+    CodegenMode codegenMode = codegenModeFromString(mode);
+    CodegenOptions options = codegenOptions(kwargs);
+    if (options.timings) throw pybind11::type_error("compile_many() times every unit itself and takes no report");
+
+    // Sources are copied and buffers pinned while the GIL is held, since the
+    // caller may change the list once it is released
+    std::vector<std::string> texts(sources.size());
+    std::vector<pybind11::buffer_info> buffers;
+    buffers.reserve(sources.size());
+    std::vector<BatchUnit> units;
+    for (size_t i = 0; i < sources.size(); i++)
+    {
+        pybind11::handle source = sources[i];
+        if (pybind11::isinstance<pybind11::str>(source))
+        {
+            texts[i] = source.cast<std::string>();
+            units.push_back(BatchUnit{ texts[i], false });
+        }
+        else if (pybind11::isinstance<pybind11::buffer>(source))
+        {
+            buffers.push_back(pybind11::reinterpret_borrow<pybind11::buffer>(source).request());
+            const pybind11::buffer_info& info = buffers.back();
+            size_t size = static_cast<size_t>(info.size) * static_cast<size_t>(info.itemsize);
+            units.push_back(BatchUnit{ std::string_view(static_cast<const char*>(info.ptr), size), true });
+        }
+        else
+        {
+            throw pybind11::type_error("compile_many() takes str sources and packed tree buffers, not "
+                + std::string(pybind11::str(source.get_type().attr("__name__"))));
+        }
+    }
+
+    std::vector<BatchResult> results;
+    {
+        pybind11::gil_scoped_release release;
+        results = compileBatch(units, codegenMode, options);
+    }
+
+    pybind11::list out;
+    for (BatchResult& unit : results)
+    {
+        pybind11::dict entry;
+        entry["value"] = unit.error ? pybind11::none() : resultObject(unit.result, codegenMode);
+        entry["error"] = unit.error ? exceptionObject(unit.error) : pybind11::none();
+        entry["diagnostics"] = pybind11::cast(unit.diagnostics);
+        entry["report"] = pybind11::cast(unit.timings.release(), pybind11::return_value_policy::take_ownership);
+        out.append(entry);
+    }
+    return out;
+};
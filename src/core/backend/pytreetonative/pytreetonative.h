@@ -2,12 +2,59 @@
 
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
+#include "../include/accounting.h"
 #include "../include/ast.h"
+#include "../include/astfile.h"
+#include "../include/batch.h"
 #include "../include/codegen.h"
+#include "../include/dump.h"
+#include "../include/lexer.h"
+#include "../include/packedtree.h"
+#include "../include/parser.h"
+#include "../include/profile.h"
+#include "../include/stream.h"
+#include "../include/threadpool.h"
+#include "../include/timing.h"
+
+// Token handed to the Python parser by tokenize(); has the same attributes
+// as the tokens produced by QuarkLexer in Python
+struct PyToken
+{
+	std::string type;
+	pybind11::object value;
+	int lineno;
+	int pos;
+};
 
 class PyTreeToNativeRepr
 {
 public:
-	static TreeNode genNativeTreeRepr(pybind11::object tree);
-	static void consumePyTree(const pybind11::object& tree);
+	static pybind11::list tokenize(const std::string& source);
+	static std::unique_ptr<Ast> parse(const std::string& source, const std::string& name, TimeReport* report, bool share);
+	static std::unique_ptr<Ast> unpack(const pybind11::buffer& buffer);
+	static pybind11::object loadTree(const std::string& path, uint64_t sourceHash);
+	static NodeId genNativeTreeRepr(pybind11::handle tree, AstBuilder& builder, SourceSketch& source);
+	static pybind11::object consumePyTree(const pybind11::object& tree, const std::string& mode, const pybind11::kwargs& options);
+	static pybind11::object consumePackedTree(const pybind11::buffer& buffer, const std::string& mode, const pybind11::kwargs& options);
+	static pybind11::object consumeNativeTree(const Ast& ast, const std::string& mode, const pybind11::kwargs& options);
+	static pybind11::list compileMany(const pybind11::list& sources, const std::string& mode, const pybind11::kwargs& options);
+	static pybind11::object compileFile(const std::string& path, const std::string& mode, const pybind11::kwargs& options);
+	static pybind11::dict cacheStats(const std::string& directory);
+	static pybind11::list phases(const TimeReport& report);
+	static pybind11::list passes(const TimeReport& report);
+	static pybind11::list sites(const TimeReport& report);
+	static pybind11::dict memoryStats();
+
+	// {"ast_nodes": {"bytes": ..., "peak_bytes": ...}, ..., "total": {...}}
+	static pybind11::dict memoryDict(const MemoryStats& stats);
+
+	// Keyword options shared by the initCodegen overloads
+	static CodegenOptions codegenOptions(const pybind11::kwargs& options);
+	static pybind11::object runCodegen(Ast& ast, const std::string& mode, const CodegenOptions& options);
+
+	// What initCodegen() returns for result in mode
+	static pybind11::object resultObject(const CodegenResult& result, CodegenMode mode);
+
+	// The Python exception the translator in PYBIND11_MODULE raises for error
+	static pybind11::object exceptionObject(std::exception_ptr error);
 };
\ No newline at end of file
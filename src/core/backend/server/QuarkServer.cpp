@@ -0,0 +1,83 @@
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include "accounting.h"
+#include "codegen.h"
+#include "server.h"
+
+// quark_server: the compile daemon of server.h, e.g.
+//   quark_server --socket /tmp/quark.sock --jobs 8
+// and then run_codegen.py --server /tmp/quark.sock for every file. SIGINT
+// and SIGTERM stop it once the requests in progress are answered. With
+// --track-memory counters or sites, the reports requests ask for carry the
+// memory the compiles in progress hold, see accounting.h. --linker and
+// --runtime-library are what aot requests link with, which requests cannot
+// choose; --max-request-bytes and --timeout-ms bound each request.
+
+namespace {
+
+CompileServer* running = nullptr;
+
+void onSignal(int) {
+	if (running) running->stop();
+}
+
+int usage() {
+	std::fprintf(stderr, "usage: quark_server --socket PATH [--jobs N] [--no-warm-up] [--track-memory counters|sites]\n"
+		"                    [--linker PATH] [--runtime-library PATH] [--max-request-bytes N] [--timeout-ms N]\n");
+	return 2;
+}
+
+}
+
+int main(int argc, char** argv) {
+	ServerOptions options;
+	for (int i = 1; i < argc; i++)
+	{
+		if (!std::strcmp(argv[i], "--socket") && i + 1 < argc) options.socketPath = argv[++i];
+		else if (!std::strcmp(argv[i], "--jobs") && i + 1 < argc) options.workers = static_cast<unsigned>(std::atoi(argv[++i]));
+		else if (!std::strcmp(argv[i], "--no-warm-up")) options.warmUp = false;
+		else if (!std::strcmp(argv[i], "--linker") && i + 1 < argc) options.linker = argv[++i];
+		else if (!std::strcmp(argv[i], "--runtime-library") && i + 1 < argc) options.runtimeLibrary = argv[++i];
+		else if (!std::strcmp(argv[i], "--max-request-bytes") && i + 1 < argc)
+			options.maxRequestBytes = static_cast<size_t>(std::strtoull(argv[++i], nullptr, 10));
+		else if (!std::strcmp(argv[i], "--timeout-ms") && i + 1 < argc)
+			options.requestTimeoutMs = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+		else if (!std::strcmp(argv[i], "--track-memory") && i + 1 < argc)
+		{
+			try
+			{
+				setMemoryTracking(memoryTrackingFromString(argv[++i]));
+			}
+			catch (const std::invalid_argument&)
+			{
+				return usage();
+			}
+		}
+		else return usage();
+	}
+	if (options.socketPath.empty()) return usage();
+
+	// A client that hangs up early must not take the server with it
+	std::signal(SIGPIPE, SIG_IGN);
+	try
+	{
+		CompileServer server(options);
+		running = &server;
+		std::signal(SIGINT, onSignal);
+		std::signal(SIGTERM, onSignal);
+		std::fprintf(stderr, "quark_server: listening on %s\n", options.socketPath.c_str());
+		server.serve();
+		running = nullptr;
+		std::fprintf(stderr, "quark_server: served %llu requests\n", static_cast<unsigned long long>(server.served()));
+	}
+	catch (const QuarkCodegenError& e)
+	{
+		std::fprintf(stderr, "quark_server: %s\n", e.what());
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,364 @@
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <vector>
+#include "codegen.h"
+#include "lexer.h"
+#include "parser.h"
+#include "stream.h"
+#include "threadpool.h"
+
+namespace {
+
+int failures = 0;
+
+void check(bool ok, const std::string& test, const std::string& what) {
+	if (ok) return;
+	std::fprintf(stderr, "FAIL %s: %s\n", test.c_str(), what.c_str());
+	failures++;
+}
+
+CodegenResult run(const std::string& source, const CodegenOptions& options) {
+	TokenBuffer tokens;
+	Ast ast;
+	QuarkLexer(source).tokenize(tokens);
+	tokens.start = ast.sources().add("test.qrk", source);
+	QuarkParser(tokens, ast).parse();
+	return QuarkCodegen(options).run(ast, CodegenMode::JIT);
+}
+
+CodegenResult run(const std::string& source, OptLevel level) {
+	CodegenOptions options;
+	options.optimizer.level = level;
+	return run(source, options);
+}
+
+CodegenResult runStream(const std::string& source, OptLevel level) {
+	CodegenOptions options;
+	options.optimizer.level = level;
+	ItemReader items(source, "test.qrk");
+	return QuarkCodegen(options).runStream(items, CodegenMode::JIT);
+}
+
+// At O0 and O2, since folding and LLVM's optimizations see different
+// amounts of the program
+void expectInt(const std::string& test, const std::string& source, int64_t expected) {
+	for (OptLevel level : { OptLevel::O0, OptLevel::O2 })
+	{
+		try
+		{
+			CodegenResult result = run(source, level);
+			check(result.kind == ValueKind::Int && result.intValue == expected, test,
+				"expected " + std::to_string(expected) + ", got " + std::to_string(result.intValue));
+		}
+		catch (const std::exception& e)
+		{
+			check(false, test, std::string("unexpected error: ") + e.what());
+		}
+	}
+}
+
+void expectFloat(const std::string& test, const std::string& source, double expected) {
+	for (OptLevel level : { OptLevel::O0, OptLevel::O2 })
+	{
+		try
+		{
+			CodegenResult result = run(source, level);
+			check(result.kind == ValueKind::Float && result.floatValue == expected, test,
+				"expected " + std::to_string(expected) + ", got " + std::to_string(result.floatValue));
+		}
+		catch (const std::exception& e)
+		{
+			check(false, test, std::string("unexpected error: ") + e.what());
+		}
+	}
+}
+
+void expectRuntimeError(const std::string& test, const std::string& source, const std::string& message) {
+	for (OptLevel level : { OptLevel::O0, OptLevel::O2 })
+	{
+		try
+		{
+			run(source, level);
+			check(false, test, "expected the runtime error '" + message + "'");
+		}
+		catch (const QuarkRuntimeError& e)
+		{
+			check(std::string(e.what()).find(message) != std::string::npos, test, std::string("unexpected error: ") + e.what());
+		}
+		catch (const std::exception& e)
+		{
+			check(false, test, std::string("unexpected error: ") + e.what());
+		}
+	}
+}
+
+const char* const Divide = "fn div a, b: a / b\n";
+const char* const Stages = "fn sq x: x * x\nfn big x: x / 5\nfn add a, b: a + b\nfn half x: x * 0.5\nnone = 0 - 5\n";
+
+// An entry whose header claims more bytes than the file holds is a miss,
+// and gets replaced, rather than an allocation of that size
+void corruptCacheEntry() {
+	const std::string test = "corrupt cache entry";
+	namespace fs = std::filesystem;
+	fs::path dir = fs::temp_directory_path() / "quark_backend_tests_cache";
+	fs::remove_all(dir);
+	CodegenOptions options;
+	options.cacheDir = dir.string();
+	const std::string source = std::string(Divide) + "@div 84, 2\n";
+	try
+	{
+		run(source, options);
+		size_t entries = 0;
+		for (const fs::directory_entry& entry : fs::directory_iterator(dir))
+		{
+			std::fstream file(entry.path(), std::ios::binary | std::ios::in | std::ios::out);
+			uint64_t size = uint64_t(1) << 60;
+			file.seekp(8);
+			file.write(reinterpret_cast<const char*>(&size), sizeof(size));
+			entries++;
+		}
+		check(entries > 0, test, "nothing was cached");
+
+		CodegenResult result = run(source, options);
+		check(result.kind == ValueKind::Int && result.intValue == 42, test, "expected 42, got " + std::to_string(result.intValue));
+		for (const fs::directory_entry& entry : fs::directory_iterator(dir))
+		{
+			std::ifstream file(entry.path(), std::ios::binary);
+			uint64_t size = 0;
+			file.seekg(8);
+			file.read(reinterpret_cast<char*>(&size), sizeof(size));
+			check(size + 16 == fs::file_size(entry.path()), test, "the corrupt entry was not replaced");
+		}
+	}
+	catch (const std::exception& e)
+	{
+		check(false, test, std::string("unexpected error: ") + e.what());
+	}
+	fs::remove_all(dir);
+}
+
+// A stream's items are windows that resolve to the file's lines and offsets
+// past 4 GB, and the windows of dropped items are reused
+void sourceWindows() {
+	const std::string test = "source windows";
+	SourceTable table;
+	SourceLoc kept = table.reserve("big.qrk", 6, 0, 1);
+	table.addLines(kept, "x = 1\n");
+	size_t keptCount = table.size();
+	SourceLoc end = table.end();
+
+	uint64_t offset = uint64_t(5) << 30;
+	SourceLoc item = table.reserve("big.qrk", 8, offset, 1000);
+	check(table.addLines(item, "y = 2\nz\n") == 2, test, "expected two more lines");
+	PresumedLoc where = table.resolve(item + 6);
+	check(where.file == "big.qrk" && where.line == 1001 && where.column == 1 && where.offset == offset + 6, test,
+		"resolved to " + table.describe(item + 6) + " at " + std::to_string(where.offset));
+
+	table.truncate(keptCount);
+	check(table.end().offset == end.offset, test, "the dropped window's locations were not reused");
+	check(table.describe(kept + 4) == "big.qrk:1:5", test, "the kept window resolved to " + table.describe(kept + 4));
+}
+
+// The Int a program gives, or the error it raises
+std::string outcome(const std::function<CodegenResult()>& run) {
+	try
+	{
+		CodegenResult result = run();
+		if (result.kind != ValueKind::Int) return "a result that is no Int";
+		return std::to_string(result.intValue);
+	}
+	catch (const std::exception& e)
+	{
+		return std::string("error: ") + e.what();
+	}
+}
+
+// Functions defined a few segments apart, each calling the one before, and
+// globals that sum over what they return, between first and last
+std::string streamSource(const std::string& first, const std::string& last) {
+	std::string source = first + "fn f0 x: x + 1\nt0 = 0\n";
+	for (int i = 1; i <= 25000; i++)
+	{
+		std::string n = std::to_string(i), f = std::to_string(i / 12000);
+		if (i % 12000 == 0) source += "fn f" + f + " x: @f" + std::to_string(i / 12000 - 1) + " x * 2\n";
+		source += "t" + n + " = t" + std::to_string(i - 1) + " + @f" + f + " " + std::to_string(i % 7) + "\n";
+	}
+	return source + last;
+}
+
+// runStream() compiles what a whole-file run does, over segments of more
+// than StreamSegmentNodes, and reports the errors of a late item the same.
+// At O0 only, since O2 takes minutes over a main this long.
+void streamMatchesWholeFile() {
+	struct Program
+	{
+		const char* test;
+		std::string source;
+		std::string expected;	// part of the outcome
+	};
+	const Program programs[] = {
+		{ "stream result", streamSource("", "t25000 + @f2 3\n"), "145018" },
+		{ "stream runtime error", streamSource(Divide, "@div t25000, t0\nt25000\n"), "Integer division by zero" },
+		{ "stream located error", streamSource("fn count x: @len x\n", "@count 1\nt25000\n"), "test.qrk:1:14: 'len' takes a list" },
+	};
+	for (const Program& program : programs)
+	{
+		std::string whole = outcome([&] { return run(program.source, OptLevel::O0); });
+		std::string streamed = outcome([&] { return runStream(program.source, OptLevel::O0); });
+		check(streamed == whole, program.test, "streaming gave " + streamed + ", the whole file " + whole);
+		check(streamed.find(program.expected) != std::string::npos, program.test, "expected " + program.expected + ", got " + streamed);
+	}
+}
+
+// A token with its offset into the whole source
+struct SourceToken
+{
+	TokenKind kind;
+	uint64_t offset;
+	uint32_t length;
+	int32_t lineNo;
+
+	bool operator==(const SourceToken& other) const
+	{
+		return kind == other.kind && offset == other.offset && length == other.length && lineNo == other.lineNo;
+	}
+};
+
+std::vector<SourceToken> sourceTokens(const TokenBuffer& tokens, size_t count) {
+	std::vector<SourceToken> result;
+	for (size_t i = 0; i < count; i++)
+	{
+		const LexToken& tok = tokens[i];
+		result.push_back(SourceToken{ tok.kind, tokens.origin + tok.offset, tok.length, tok.lineNo });
+	}
+	return result;
+}
+
+void expectSameTokens(const std::string& test, const std::vector<SourceToken>& expected, const std::vector<SourceToken>& actual) {
+	size_t i = 0;
+	while (i < expected.size() && i < actual.size() && expected[i] == actual[i]) i++;
+	if (i == expected.size() && i == actual.size()) return;
+	auto describe = [](const std::vector<SourceToken>& tokens, size_t i) {
+		if (i >= tokens.size()) return std::string("the end");
+		return std::string(tokenKindString(tokens[i].kind)) + " at " + std::to_string(tokens[i].offset) + " on line "
+			+ std::to_string(tokens[i].lineNo);
+	};
+	check(false, test, "token " + std::to_string(i) + " is " + describe(actual, i) + ", expected " + describe(expected, i));
+}
+
+// Nested blocks that items end inside of, blank and comment lines between
+// items, parentheses across lines, illegal characters and stray spaces, with
+// CRLF on every other copy
+std::string lexerSource(size_t bytes) {
+	std::string source;
+	for (size_t i = 0; source.size() < bytes; i++)
+	{
+		std::string n = std::to_string(i);
+		std::string chunk = "fn f" + n + " x:\n"
+			"    fn g y:\n"
+			"        y * 2 // twice\n"
+			"\n"
+			"    @g (x +\n"
+			"        1)\n"
+			"v" + n + " = @f" + n + " " + n + "\n"
+			"// between items\n"
+			"   \n"
+			"fn h" + n + " a, b:\n"
+			"    fn k c:\n"
+			"        fn m d:\n"
+			"            d - 1.5 $\n"
+			"w" + n + " = @h" + n + " 1, 2 // closes three blocks\n"
+			"@range 10 | map sq\n";
+		if (i % 2)
+		{
+			for (size_t at = 0; (at = chunk.find('\n', at)) != std::string::npos; at += 2) chunk.insert(at, "\r");
+		}
+		source += chunk;
+	}
+	return source + "fn last x:\n    fn inner y:\n        y";
+}
+
+// tokenizeParallel() and tokenizeItem() give the tokens and diagnostics
+// tokenize() does
+void lexerEquivalence() {
+	const std::string source = lexerSource(3 << 20);
+	TokenBuffer serial;
+	QuarkLexer(source).tokenize(serial, false);
+	std::vector<SourceToken> expected = sourceTokens(serial, serial.size());
+
+	ThreadPool pool(4);
+	TokenBuffer parallel;
+	QuarkLexer(source).tokenizeParallel(parallel, pool, false);
+	expectSameTokens("parallel lexing", expected, sourceTokens(parallel, parallel.size()));
+	check(parallel.diagnostics == serial.diagnostics, "parallel lexing", "the diagnostics differ");
+
+	QuarkLexer items(source);
+	TokenBuffer item;
+	std::vector<SourceToken> itemTokens;
+	size_t itemCount = 0;
+	while (items.tokenizeItem(item))
+	{
+		check(item.tokens.back().kind == TokenKind::EndMarker, "item lexing", "an item does not end in EOF");
+		std::vector<SourceToken> tokens = sourceTokens(item, item.size() - 1);
+		itemTokens.insert(itemTokens.end(), tokens.begin(), tokens.end());
+		itemCount++;
+	}
+	expectSameTokens("item lexing", expected, itemTokens);
+	check(item.diagnostics == serial.diagnostics, "item lexing", "the diagnostics differ");
+	check(itemCount > 1000, "item lexing", "only " + std::to_string(itemCount) + " items");
+}
+
+}
+
+int main() {
+	expectInt("division", std::string(Divide) + "@div 7, 2\n", 3);
+	expectInt("division rounds to zero", std::string(Divide) + "@div 0 - 7, 2\n", -3);
+	expectRuntimeError("division by a run-time zero", std::string(Divide) + "@div 7, 0\n", "Integer division by zero");
+	expectRuntimeError("division by a constant zero", "1 / 0\n", "Integer division by zero");
+	expectInt("INT64_MIN / -1 wraps", std::string(Divide) + "m = 0 - 9223372036854775807 - 1\n@div m, 0 - 1\n", INT64_MIN);
+	expectInt("constant INT64_MIN / -1 wraps", "(0 - 9223372036854775807 - 1) / (0 - 1)\n", INT64_MIN);
+
+	// Ten million frames are far more than the stack holds, so these only
+	// get to the division at the bottom when the tail calls are jumps
+	expectRuntimeError("self tail recursion", "fn down n, k: @down n - 1, k / n\n@down 10000000, 1\n",
+		"Integer division by zero");
+	expectRuntimeError("mutual tail recursion", "fn ping n: @pong n - 1, 10 / n\nfn pong n, q: @ping n\n@ping 10000000\n",
+		"Integer division by zero");
+
+	// 2^61 elements take 2^64 bytes, which wrapped to a small allocation
+	expectRuntimeError("oversized range", "@len @range 2305843009213693952\n", "Out of memory");
+	expectRuntimeError("range too big to allocate", "@len @range 1152921504606846975\n", "Out of memory");
+
+	// Fused stages, against the same stages one list at a time
+	std::string stages(Stages);
+	expectInt("fused pipe", stages + "@range 10 | filter big | map sq | sum\n", 255);
+	expectInt("unfused pipe", stages + "a = @range 10\nb = a | filter big\nc = b | map sq\nc | sum\n", 255);
+	expectInt("fused map and filter", stages + "@range 10 | map sq | filter big | sum\n", 280);
+	expectInt("fused reduce", stages + "@range 5 | map sq | reduce add 10\n", 40);
+	expectInt("fused len", stages + "@range 10 | filter big | len\n", 5);
+	expectInt("fused max", stages + "@range 10 | map sq | max\n", 81);
+	expectInt("fused min", stages + "@range 10 | filter big | min\n", 5);
+	expectFloat("fused float pipe", stages + "@range 4 | map half | sum\n", 3.0);
+	expectFloat("fused float max", stages + "@range 10 | filter big | map half | max\n", 4.5);
+	expectInt("empty range", stages + "@range 0 | map sq | sum\n", 0);
+	expectInt("negative range", stages + "@range none | map sq | sum\n", 0);
+	expectInt("negative range length", stages + "@range none | len\n", 0);
+	expectInt("empty filter", stages + "@range 4 | filter big | sum\n", 0);
+	expectRuntimeError("min of an empty range", stages + "@range 0 | min\n", "Cannot take the min of an empty list");
+	expectRuntimeError("fused min of a negative range", stages + "@range none | map sq | min\n",
+		"Cannot take the min of an empty list");
+	expectRuntimeError("fused min of nothing filtered", stages + "@range 4 | filter big | min\n",
+		"Cannot take the min of an empty list");
+
+	corruptCacheEntry();
+	sourceWindows();
+	lexerEquivalence();
+	streamMatchesWholeFile();
+
+	if (failures) std::fprintf(stderr, "%d failed\n", failures);
+	return failures ? 1 : 0;
+}
@@ -15,6 +15,9 @@ class ExprParser:
             Rule("FLOAT", Precedence.Zero, prefix=self.number),
             Rule("ID", Precedence.Zero, prefix=self.identifier),
             Rule("LPAR", Precedence.Zero, prefix=self.paren),
+            Rule("AT", Precedence.Zero, prefix=self.call),
+            Rule("LBRACE", Precedence.Call, prefix=self.list, infix=self.subscript),
+            Rule("PIPE", Precedence.Pipe, infix=self.pipe),
         ]
 
     def rule(self, tok_type):
@@ -25,6 +28,9 @@ class ExprParser:
         self.parser.expect("RPAR")
         return expr
 
+    def call(self):
+        return self.parser.function_call()
+
     def identifier(self):
         return TreeNode(NodeType.Identifier, self.parser.prev)
 
@@ -42,6 +48,45 @@ class ExprParser:
         node.children.extend([left, self.parse(precedence=rule.precedence + 1)])
         return node
 
+    def list(self):
+        # [a, b, c], with an optional trailing comma
+        node = TreeNode(NodeType.List, self.parser.prev)
+        while self.parser.cur.type != "RBRACE":
+            node.children.append(self.parse())
+            if self.parser.cur.type != "COMMA":
+                break
+            self.parser.consume()
+        self.parser.expect("RBRACE")
+        return node
+
+    def subscript(self, left):
+        # list[index] is an Operator on the [ token
+        node = TreeNode(NodeType.Operator, self.parser.prev)
+        node.children.extend([left, self.parse()])
+        self.parser.expect("RBRACE")
+        return node
+
+    def pipe(self, left):
+        # a | f x | g is one Pipe node on the first | over a and a
+        # FunctionCall per stage, which gets the piped value ahead of its
+        # own arguments
+        node = TreeNode(NodeType.Pipe, self.parser.prev)
+        node.children.extend([left, self.stage()])
+        while self.parser.cur.type == "PIPE":
+            self.parser.consume()
+            node.children.append(self.stage())
+        return node
+
+    def stage(self):
+        # Arguments are separated by spaces, as a comma ends the whole pipe,
+        # and each one ends at the next |
+        args = TreeNode(NodeType.Arguments)
+        node = TreeNode(NodeType.FunctionCall)
+        node.children.extend([TreeNode(NodeType.Identifier, self.parser.expect("ID")), args])
+        while self.parser.cur.type not in ["PIPE", "RPAR", "RBRACE", "NEWLINE", "COMMA", "COLON", "EOF"]:
+            args.children.append(self.parse(precedence=Precedence.Pipe + 1))
+        return node
+
     def parse(self, precedence=Precedence.Assignment):
         prefix = self.rule(self.parser.consume().type).prefix
 
@@ -51,7 +96,7 @@ class ExprParser:
         expr = prefix()
 
         while (
-            self.parser.cur.type not in ["RPAR", "NEWLINE", "COMMA", "COLON"]
+            self.parser.cur.type not in ["RPAR", "RBRACE", "NEWLINE", "COMMA", "COLON"]
             and self.rule(self.parser.cur.type).precedence >= precedence
         ):
             infix = self.rule(self.parser.consume().type).infix
@@ -1,8 +1,20 @@
+import struct
 from enum import Enum
 from typing import Any
 from ply.lex import Token
 from dataclasses import dataclass, field
 from ctypes import POINTER, Structure, c_int16, c_int32, c_char_p
+from .lex_grammar import tokens, reserved
+
+# Token kind ids used by the packed tree format; must match TokenKind in
+# backend/include/token.h (0 means the node carries no token)
+TOKEN_KINDS = {name: i for i, name in enumerate((None, *tokens, *reserved.values()))}
+
+# Layout of backend/include/packedtree.h
+TREE_MAGIC = 0x45525451
+TREE_VERSION = 1
+TREE_HEADER = struct.Struct("<IHHIII")
+TREE_NODE = struct.Struct("<BBxxIIii")
 
 
 class NodeType(Enum):
@@ -17,6 +29,8 @@ class NodeType(Enum):
     Identifier = 8
     Literal = 9
     Operator = 10
+    List = 11
+    Pipe = 12
 
     def __str__(self):
         return self._name_
@@ -26,9 +40,11 @@ class NodeType(Enum):
 class Precedence:
     Zero = 0
     Assignment = 1
-    Term = 2
-    Factor = 3
-    Unary = 4
+    Pipe = 2
+    Term = 3
+    Factor = 4
+    Unary = 5
+    Call = 6
 
 
 @dataclass
@@ -45,6 +61,44 @@ class TreeNode:
         for child in self.children:
             child.print(level + 1)
 
+    def pack(self):
+        """Serializes the tree into the packed preorder format read by the
+        native backend, so it can be handed over as a single buffer."""
+        symbols = {"": 0}
+        nodes = []
+        stack = [self]
+        while stack:
+            node = stack.pop()
+            tok = node.tok
+            if tok is not None:
+                value = "" if tok.value is None else str(tok.value)
+                sym = symbols.setdefault(value, len(symbols))
+                nodes.append((node.type.value, TOKEN_KINDS.get(tok.type, 0),
+                              len(node.children), sym, tok.lineno, tok.pos))
+            else:
+                nodes.append((node.type.value, 0, len(node.children), 0, 0, 0))
+            stack.extend(reversed(node.children))
+
+        chars = bytearray()
+        offsets = [0]
+        for value in symbols:
+            chars += value.encode("utf-8")
+            offsets.append(len(chars))
+        char_bytes = len(chars)
+        chars += bytes(-len(chars) % 4)
+
+        buf = bytearray(TREE_HEADER.size + 4 * len(offsets) + len(chars) + TREE_NODE.size * len(nodes))
+        TREE_HEADER.pack_into(buf, 0, TREE_MAGIC, TREE_VERSION, 0, len(nodes), len(symbols), char_bytes)
+        off = TREE_HEADER.size
+        struct.pack_into(f"<{len(offsets)}I", buf, off, *offsets)
+        off += 4 * len(offsets)
+        buf[off:off + len(chars)] = chars
+        off += len(chars)
+        for fields in nodes:
+            TREE_NODE.pack_into(buf, off, *fields)
+            off += TREE_NODE.size
+        return buf
+
 
 @dataclass(frozen=True)
 class Rule:
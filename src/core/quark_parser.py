@@ -1,10 +1,15 @@
 from core.expr_parser import ExprParser
-from .helper_types import NodeType, TreeNode
+from .helper_types import NodeType, Precedence, TreeNode
+
+
+# Trace levels: off, one line per statement-level rule, and every rule
+TRACE_OFF, TRACE_STATEMENTS, TRACE_ALL = 0, 1, 2
 
 
 class QuarkParser:
-    def __init__(self, token_stream):
+    def __init__(self, token_stream, trace=TRACE_OFF):
         self.tree = None
+        self.trace = trace
         self.tokens = list(token_stream)
         self.expr_parser = ExprParser(self)
         self.prev, self.cur = None, self.tokens[0]
@@ -21,6 +26,9 @@ class QuarkParser:
     def is_term(self, token):
         return token.type in ["ID", "INT", "FLOAT", "STR"]
 
+    def trace_rule(self, rule):
+        print(f"{rule}: {self.cur}")
+
     def expect(self, type):
         if self.cur.type == type:
             return self.consume()
@@ -29,40 +37,58 @@ class QuarkParser:
 
     # Parsing functions
     def block(self):
-        print(f"Block: {self.cur}")
+        if self.trace >= TRACE_STATEMENTS:
+            self.trace_rule("Block")
         node = TreeNode(NodeType.Block)
 
         if self.cur.type == "NEWLINE" and self.peek().type == "INDENT":
-            pass
+            self.consume()
+            self.consume()
+            self.statements(node, "DEDENT")
+            self.expect("DEDENT")
         else:
-            while self.cur.type != "NEWLINE":
-                node.children.append(self.statement())
-            self.expect("NEWLINE")
+            self.line(node)
 
         return node
 
+    def line(self, node):
+        # A statement that ends in its own block (a function body) has
+        # already consumed the line break
+        while self.cur.type not in ["NEWLINE", "EOF"]:
+            node.children.append(self.statement())
+            if self.prev.type in ["NEWLINE", "DEDENT"]:
+                return
+
+        if self.cur.type == "NEWLINE":
+            self.consume()
+
+    def statements(self, node, end):
+        while self.cur.type not in [end, "EOF"]:
+            self.line(node)
+
     def statement(self):
-        print(f"Statement: {self.cur}")
+        if self.trace >= TRACE_STATEMENTS:
+            self.trace_rule("Statement")
         node = None
 
         if self.cur.type == "IF":
             node = self.ifelse()
         elif "FN" in [self.cur.type, self.peek(2).type]:
             node = self.function()
-        elif self.cur.type == "AT":
-            self.consume()
-            node = self.function_call()
         else:
+            # Calls included, which a pipe may follow
             node = self.expression()
 
         return node
 
-    def expression(self):
-        print(f"Expression: {self.cur}")
-        return self.expr_parser.parse()
+    def expression(self, precedence=Precedence.Assignment):
+        if self.trace >= TRACE_ALL:
+            self.trace_rule("Expression")
+        return self.expr_parser.parse(precedence)
 
     def function(self):
-        print(f"Function: {self.cur}")
+        if self.trace >= TRACE_STATEMENTS:
+            self.trace_rule("Function")
         node = None
 
         if self.cur.type == "FN":
@@ -83,7 +109,8 @@ class QuarkParser:
         return node
 
     def function_call(self):
-        print(f"Function Call: {self.cur}")
+        if self.trace >= TRACE_STATEMENTS:
+            self.trace_rule("Function Call")
         node = TreeNode(NodeType.FunctionCall)
         node.children.extend(
             [TreeNode(NodeType.Identifier, self.expect("ID")), self.arguments()]
@@ -91,16 +118,21 @@ class QuarkParser:
         return node
 
     def arguments(self):
-        print(f"Arguments: {self.cur}")
+        if self.trace >= TRACE_ALL:
+            self.trace_rule("Arguments")
         node = TreeNode(NodeType.Arguments)
 
-        while self.cur.type not in ["COLON", "NEWLINE"]:
-            node.children.append(self.expression())
+        # A call inside parentheses or a list ends at the closing RPAR or
+        # RBRACE, and one in a pipe at the next |, so @f x | g pipes what f
+        # returns
+        while self.cur.type not in ["COLON", "NEWLINE", "RPAR", "RBRACE", "PIPE"]:
+            node.children.append(self.expression(Precedence.Pipe + 1))
 
             if self.cur.type == "COMMA":
                 self.consume()
 
-        print(node)
+        if self.trace >= TRACE_ALL:
+            print(node)
         return node
 
     def ifelse(self):
@@ -114,4 +146,6 @@ class QuarkParser:
 
     def parse(self):
         self.tree = TreeNode(NodeType.CompilationUnit)
-        self.tree.children.append(self.block())
+        block = TreeNode(NodeType.Block)
+        self.statements(block, "EOF")
+        self.tree.children.append(block)
@@ -1,18 +1,301 @@
+import argparse
+import json
+import os
+import socket
 import sys
-import ply.lex as lex
-from core.lex_grammar import *
-from core.helper_types import *
-from core.quark_lexer import QuarkLexer
-from core.quark_parser import QuarkParser
-import pytreetonative as cg
+import time
 
-lexer = QuarkLexer(lex.lex())
 
-if __name__ == "__main__":
-    with open(sys.argv[1], "r") as inputf:
-        lexer.input(inputf.read())
-        parser = QuarkParser(lexer.token_stream)
+def ply_tokens(source):
+    import ply.lex as lex
+    from core import lex_grammar
+    from core.quark_lexer import QuarkLexer
+
+    lexer = QuarkLexer(lex.lex(module=lex_grammar))
+    lexer.input(source)
+    return lexer.token_stream
+
+
+class Phase:
+    """Times a with-block into report as a phase; does nothing without one."""
+
+    def __init__(self, report, name):
+        self.report, self.name, self.items = report, name, 0
+
+    def __enter__(self):
+        self.start = time.perf_counter()
+        return self
+
+    def __exit__(self, *exc):
+        if self.report is not None and exc[0] is None:
+            self.report.add(self.name, time.perf_counter() - self.start, self.items)
+
+
+def front_end(source, args, report):
+    if args.frontend == "native":
+        return cg.parse(source, args.file, report)
+
+    from core.quark_parser import QuarkParser
+
+    with Phase(report, "lex") as phase:
+        # PLY lexes lazily, so its tokens are drawn here rather than in the parser
+        tokens = list(cg.tokenize(source) if args.lexer == "native" else ply_tokens(source))
+        phase.items = len(tokens)
+    with Phase(report, "parse") as phase:
+        parser = QuarkParser(tokens, trace=args.trace_parser)
         parser.parse()
+        phase.items = len(tokens)
+    if not parser.tree:
+        return None
+    with Phase(report, "bridge") as phase:
+        tree = cg.unpack(parser.tree.pack())
+        phase.items = len(tree)
+    return tree
+
+
+def cache_directory(args):
+    # Kept beside the source like __pycache__
+    return args.ast_cache or os.path.join(os.path.dirname(os.path.abspath(args.file)), "__quarkcache__")
+
+
+def tree_cache_path(args):
+    # The front ends differ in the source locations they record, so each
+    # gets its own file
+    frontend = "native" if args.frontend == "native" else "python-" + args.lexer
+    return os.path.join(cache_directory(args), f"{os.path.basename(args.file)}.{frontend}.qast")
+
+
+def merged_profile(args):
+    """Merges the profiles --profile-use names into the indexed one codegen
+    takes, and returns its path. The merge is the same file for the same
+    profiles, so the object cache still hits."""
+    import pytreetonative as cg
+    path = os.path.join(cache_directory(args), f"{os.path.basename(args.file)}.profdata")
+    os.makedirs(os.path.dirname(path), exist_ok=True)
+    cg.mergeProfiles(args.profile_use, path)
+    return path
+
+
+def load_tree(source, args, report=None):
+    """Maps the cached parse of source when there is a valid one, otherwise
+    runs the front end and caches its tree."""
+    if args.no_ast_cache:
+        return front_end(source, args, report)
+
+    path = tree_cache_path(args)
+    with Phase(report, "load") as phase:
+        source_hash = cg.sourceHash(source)
+        tree = cg.loadTree(path, source_hash)
+        phase.items = len(tree) if tree is not None else 0
+    if tree is not None:
+        return tree
+
+    tree = front_end(source, args, report)
+    if tree:
+        with Phase(report, "save") as phase:
+            os.makedirs(os.path.dirname(path), exist_ok=True)
+            tree.save(path, source_hash)
+            phase.items = len(tree)
+    return tree
+
+
+def remote(source, args):
+    """Has the quark_server on args.server compile source, and prints what it
+    sends back as a local run would print it."""
+    header = dict(mode=args.mode, opt="O" + args.opt, threads=args.threads, fold=int(not args.no_fold),
+                  share=int(args.share_subtrees), debug=int(args.debug),
+                  site_counters=int(args.site_counters), dump_format=args.dump_format,
+                  report=int(args.time_report is not None), name=args.file)
+    for key in ("passes", "target", "cpu", "features"):
+        if getattr(args, key):
+            header[key] = getattr(args, key)
+    if args.cache:
+        header.update(cache_dir=os.path.abspath(args.cache), cache_size=args.cache_size)
+    if args.profile_generate:
+        header.update(profile_generate=os.path.abspath(args.profile_generate))
+    if args.profile_use:
+        header.update(profile_use=merged_profile(args))
+    if args.mode == "aot":
+        # The server does not run in our directory
+        header.update(output=os.path.abspath(args.output or "a.out"), shared=int(args.shared),
+                      static=int(not args.dynamic))
+
+    request = "".join(f"{key} {value}\n" for key, value in header.items()) + "\n" + source
+    with socket.socket(socket.AF_UNIX, socket.SOCK_STREAM) as conn:
+        conn.connect(args.server)
+        conn.sendall(request.encode())
+        conn.shutdown(socket.SHUT_WR)
+        chunks = []
+        while chunk := conn.recv(1 << 16):
+            chunks.append(chunk)
+    reply = json.loads(b"".join(chunks))
+
+    for message in reply["diagnostics"]:
+        print(message)
+    if not reply["ok"]:
+        errors = dict(SyntaxError=SyntaxError, IndentationError=IndentationError, ValueError=ValueError)
+        raise errors.get(reply["error"], RuntimeError)(reply["message"])
+    if "dump" in reply:
+        if args.output:
+            with open(args.output, "w") as out:
+                out.write(reply["dump"])
+        else:
+            sys.stdout.write(reply["dump"])
+    elif "ir" in reply:
+        print(reply["ir"])
+    elif reply.get("value") is not None:
+        print(reply["value"])
+    if args.cache and args.cache_stats:
+        print(reply["cache"], file=sys.stderr)
+    if args.time_report:
+        print(json.dumps(reply["report"]) if args.time_report == "json" else reply["report_text"], file=sys.stderr)
+
+
+if __name__ == "__main__":
+    argp = argparse.ArgumentParser(description="Runs the Quark front end and the native backend on a file")
+    argp.add_argument("file")
+    argp.add_argument("--frontend", choices=["native", "python"], default="native",
+                      help="native lexes and parses in the backend; python runs QuarkParser")
+    argp.add_argument("--lexer", choices=["native", "ply"], default="native",
+                      help="lexer used by the python front end; ply uses core.quark_lexer")
+    argp.add_argument("--mode", choices=["dump", "ir", "jit", "aot"], default="dump",
+                      help="dump prints the tree, ir prints LLVM IR, jit compiles and runs the program, "
+                           "aot compiles it into an executable that prints what jit would")
+    argp.add_argument("--dump-format", choices=["text", "json", "dot"], default="text",
+                      help="tree format of --mode dump; dot is for Graphviz")
+    argp.add_argument("-o", dest="output", default="",
+                      help="file --mode dump writes the tree to instead of stdout, and the one --mode aot builds "
+                           "(default a.out)")
+    argp.add_argument("-O", dest="opt", choices=["0", "1", "2", "3", "s"], default="0",
+                      help="optimization level: -O0 for fast interactive compiles, -O3 for batch jobs")
+    argp.add_argument("--passes", default="",
+                      help="custom LLVM pass pipeline, e.g. 'function(instcombine,gvn)'; overrides -O")
+    argp.add_argument("--target", default="",
+                      help="target triple of the generated code, e.g. aarch64-linux-gnu (default: the host)")
+    argp.add_argument("--cpu", default="",
+                      help="CPU to generate code for, e.g. skylake or generic (default: the host's)")
+    argp.add_argument("--features", default="",
+                      help="LLVM target features on top of the CPU's, e.g. +avx2,-fma")
+    argp.add_argument("--shared", action="store_true",
+                      help="--mode aot builds a shared library exporting __quark_main and __quark_result")
+    argp.add_argument("--dynamic", action="store_true",
+                      help="--mode aot links libc dynamically; static executables start faster")
+    argp.add_argument("--linker", default="c++",
+                      help="compiler driver --mode aot links with; a foreign --target needs one for it")
+    argp.add_argument("--no-fold", action="store_true",
+                      help="skip constant folding and algebraic simplification before codegen")
+    argp.add_argument("--share-subtrees", action="store_true",
+                      help="store identical pure subexpressions once and compute each once per block; locations "
+                           "are those of the first occurrence, so -g and --site-counters turn this off")
+    argp.add_argument("-g", dest="debug", action="store_true",
+                      help="emit DWARF line tables so debuggers and profilers map code back to the source")
+    argp.add_argument("--site-counters", action="store_true",
+                      help="count the runtime calls of each operator and builtin call site, the list elements they "
+                           "went through and the subscripts served inline; jit mode adds them to the time report, "
+                           "an aot executable prints them to stderr when it exits")
+    argp.add_argument("--profile-generate", metavar="PATH", default="",
+                      help="instrument the code and write a profile of the run to PATH, which an aot executable "
+                           "does when it exits, relative to where it runs")
+    argp.add_argument("--profile-use", metavar="PROFILE", nargs="+", default=[],
+                      help="optimize with the profiles of instrumented runs, merged into __quarkcache__ beside the "
+                           "file: inlining, block layout and branch weights follow the counts")
+    argp.add_argument("-j", dest="threads", type=int, default=0,
+                      help="codegen worker threads; functions compile in parallel (0 = all cores)")
+    argp.add_argument("--cache", default="",
+                      help="object cache directory; unchanged functions are not recompiled")
+    argp.add_argument("--cache-size", type=int, default=256 << 20,
+                      help="size bound of the cache directory in bytes")
+    argp.add_argument("--cache-stats", action="store_true",
+                      help="print the cache hit/miss counters after compiling")
+    argp.add_argument("--ast-cache", default="",
+                      help="directory of cached .qast parse trees (default: __quarkcache__ beside the file)")
+    argp.add_argument("--no-ast-cache", action="store_true",
+                      help="always run the front end and do not write a .qast file")
+    argp.add_argument("--stream", action="store_true",
+                      help="compile the file a top-level item at a time instead of as one tree, for sources too "
+                           "big to hold in memory; calls reach only functions defined above them")
+    argp.add_argument("--time-report", nargs="?", const="text", choices=["text", "json"],
+                      help="print wall time, counts and peak RSS per phase and LLVM pass timings to stderr")
+    argp.add_argument("--track-memory", nargs="?", const="counters", choices=["counters", "sites"],
+                      help="add the memory held by trees, tokens, symbols, sources and LLVM modules to the time "
+                           "report; sites also attributes it to the front end's call sites")
+    argp.add_argument("--trace-parser", type=int, choices=[0, 1, 2], default=0,
+                      help="python front end: 1 traces statement-level rules, 2 every rule")
+    argp.add_argument("--server", default="",
+                      help="Unix socket of a running quark_server to compile on; it parses with the native "
+                           "front end and keeps LLVM and the caches warm between runs")
+    args = argp.parse_args()
+    if args.profile_generate and args.profile_use:
+        argp.error("--profile-generate and --profile-use are separate builds")
+    if args.track_memory and args.server:
+        argp.error("--track-memory is an option of quark_server when compiling on a server")
+    if args.linker != "c++" and args.server:
+        argp.error("--linker is an option of quark_server when compiling on a server")
+    if (args.track_memory or args.site_counters and args.mode == "jit") and not args.time_report:
+        args.time_report = "text"
+
+    if args.server:
+        with open(args.file, "r") as inputf:
+            remote(inputf.read(), args)
+        sys.exit(0)
+
+    if args.stream and (args.mode == "dump" or args.frontend != "native"):
+        argp.error("--stream compiles with the native front end in ir, jit or aot mode")
+
+    import pytreetonative as cg
+
+    if args.track_memory:
+        cg.trackMemory(args.track_memory)
+    report = cg.TimeReport() if args.time_report else None
+    if args.stream:
+        # The backend maps the file and reads it once; there is no tree to cache
+        tree = None
+    else:
+        with Phase(report, "read") as phase:
+            with open(args.file, "r") as inputf:
+                source = inputf.read()
+            phase.items = len(source)
+        tree = load_tree(source, args, report)
+
+    if tree or args.stream:
+        options = dict(opt="O" + args.opt, passes=args.passes, threads=args.threads, fold=not args.no_fold,
+                       share=args.share_subtrees, debug=args.debug,
+                       site_counters=args.site_counters, target=args.target, cpu=args.cpu, features=args.features)
+        if args.cache:
+            options.update(cache_dir=args.cache, cache_size=args.cache_size)
+        if args.profile_generate:
+            options.update(profile_generate=args.profile_generate)
+        if args.profile_use:
+            options.update(profile_use=merged_profile(args))
+        if report is not None:
+            options.update(report=report)
+
+        if args.mode == "aot":
+            options.update(output=args.output or "a.out", shared=args.shared, static=not args.dynamic,
+                           linker=args.linker)
+
+        dump_file = None
+        if args.mode == "dump":
+            # The backend writes the tree to the descriptor itself, so what
+            # Python has buffered goes out first
+            sys.stdout.flush()
+            dump_file = open(args.output, "wb") if args.output else None
+            options.update(dump_format=args.dump_format,
+                           dump_fd=dump_file.fileno() if dump_file else sys.stdout.fileno())
+
+        try:
+            if args.stream:
+                result = cg.compileFile(args.file, mode=args.mode, **options)
+            else:
+                result = cg.initCodegen(tree, mode=args.mode, **options)
+        finally:
+            if dump_file:
+                dump_file.close()
+        # The path aot mode returns is the -o the user gave
+        if result is not None and args.mode != "aot":
+            print(result)
+        if args.cache and args.cache_stats:
+            print(cg.cacheStats(args.cache), file=sys.stderr)
 
-        if parser.tree:
-            cg.initCodegen(parser.tree)
+    if report is not None:
+        print(report.json() if args.time_report == "json" else report, file=sys.stderr)
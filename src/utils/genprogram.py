@@ -0,0 +1,118 @@
+"""Writes synthetic Quark programs for benchmarking the front end and backend.
+
+    python -m utils.genprogram --lines 100000 -o big.qrk
+    python -m utils.genprogram --functions 500 --statements 8 --depth 4 --nesting 2
+
+Programs are deterministic for a given seed. Every function body assigns
+fresh locals, so no variable changes type, and divisions are only by non-zero
+literals. Calls stay within groups of --group functions, which keeps the
+run-time call depth bounded however large the program gets, so the output
+compiles and runs in JIT mode. The exception is --nesting above 1: that
+nests function definitions, which the parsers accept but codegen rejects.
+"""
+
+import argparse
+import random
+import sys
+
+INDENT = "    "
+
+
+class ProgramGenerator:
+    def __init__(self, statements=6, depth=3, nesting=1, group=16, seed=0):
+        self.statements = max(1, statements)
+        self.depth = max(0, depth)
+        self.nesting = max(1, nesting)
+        self.group = max(1, group)
+        self.rng = random.Random(seed)
+
+    def expression(self, names, depth):
+        """Random arithmetic over names and literals, depth operators deep."""
+        if depth == 0:
+            pick = self.rng.random()
+            if pick < 0.6:
+                return self.rng.choice(names)
+            if pick < 0.9:
+                return str(self.rng.randint(0, 99))
+            return f"{self.rng.randint(0, 99)}.5"
+
+        op = self.rng.choice(["+", "-", "*", "*", "/"])
+        left = self.expression(names, depth - 1)
+        if op == "/":
+            return f"({left} / {self.rng.randint(1, 9)})"
+        return f"({left} {op} {self.expression(names, depth - 1)})"
+
+    def function(self, out, index, level=1):
+        """Writes function index and returns the number of lines written."""
+        pad = INDENT * (level - 1)
+        body = INDENT * level
+        name = f"f{index}" if level == 1 else f"f{index}_{level}"
+        out.write(f"{pad}fn {name} a, b:\n")
+        lines = 1
+
+        if level < self.nesting:
+            lines += self.function(out, index, level + 1)
+
+        names = ["a", "b"]
+        for i in range(self.statements - 1):
+            local = f"v{i}"
+            if i == 0 and index % self.group and level == 1:
+                # One call per function into the previous one of its group
+                value = f"@f{index - 1} {self.expression(names, 1)}, {self.expression(names, 1)}"
+            else:
+                value = self.expression(names, self.depth)
+            out.write(f"{body}{local} = {value}\n")
+            names.append(local)
+            lines += 1
+
+        out.write(f"{body}{self.expression(names, self.depth)}\n")
+        return lines + 1
+
+    def program(self, out, functions):
+        """Writes the function definitions with a call to the last function
+        of each group after it, and returns the number of lines written."""
+        out.write("k = 3\n")
+        lines = 1
+        for index in range(functions):
+            lines += self.function(out, index)
+            if index % self.group == self.group - 1 or index == functions - 1:
+                out.write(f"r{index} = @f{index} k, {self.expression(['k'], 1)}\n")
+                lines += 1
+        out.write(f"r{functions - 1}\n")
+        return lines + 1
+
+    def lines_per_function(self):
+        return self.statements + 1 + (self.statements + 1) * (self.nesting - 1)
+
+
+def main(argv=None):
+    argp = argparse.ArgumentParser(description="Writes a synthetic Quark program")
+    argp.add_argument("-o", "--output", default="-", help="output file, - for stdout")
+    argp.add_argument("--lines", type=int, default=0,
+                      help="approximate program size; overrides --functions")
+    argp.add_argument("--functions", type=int, default=100)
+    argp.add_argument("--statements", type=int, default=6, help="statements per function body")
+    argp.add_argument("--depth", type=int, default=3, help="operators per expression, nested")
+    argp.add_argument("--nesting", type=int, default=1,
+                      help="function definitions nested inside each other; above 1 only parses")
+    argp.add_argument("--group", type=int, default=16, help="functions per call chain")
+    argp.add_argument("--seed", type=int, default=0)
+    args = argp.parse_args(argv)
+
+    gen = ProgramGenerator(args.statements, args.depth, args.nesting, args.group, args.seed)
+    functions = args.functions
+    if args.lines:
+        per_function = gen.lines_per_function() + 1.0 / gen.group
+        functions = max(1, int(args.lines / per_function))
+
+    out = sys.stdout if args.output == "-" else open(args.output, "w", buffering=1 << 20)
+    try:
+        lines = gen.program(out, functions)
+    finally:
+        if out is not sys.stdout:
+            out.close()
+    print(f"{lines} lines, {functions} functions", file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,192 @@
+"""End-to-end scaling benchmark: runs drivers/run_codegen.py on generated
+programs of growing size and reports wall time, peak RSS and per-phase times.
+
+    python -m utils.scaling_bench --sizes 1000,10000,100000 --frontend python
+    python -m utils.scaling_bench --mode ir -O 2 --plot scaling.png
+
+For each size it writes a program with utils.genprogram and runs the driver as
+a separate process with --time-report=json, so every run starts cold and its
+peak RSS is its own. The exponent column is the slope of log time over log
+lines from the previous size: about 1 is linear, and anything well above it
+flags superlinear behavior in some phase, which the phase columns then
+locate. A run that takes longer than --timeout is stopped, and so is the
+benchmark, with the sizes that finished.
+"""
+
+import argparse
+import json
+import math
+import os
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+from utils.genprogram import ProgramGenerator
+
+SRC_DIR = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+DRIVER = os.path.join(SRC_DIR, "drivers", "run_codegen.py")
+
+
+def parse_sizes(text):
+    sizes = []
+    for part in text.split(","):
+        part = part.strip().lower()
+        scale = 1
+        if part.endswith("k"):
+            scale, part = 1000, part[:-1]
+        elif part.endswith("m"):
+            scale, part = 1000000, part[:-1]
+        sizes.append(int(float(part) * scale))
+    return sizes
+
+
+def generate(path, lines, args):
+    gen = ProgramGenerator(args.statements, args.depth, 1, args.group, args.seed)
+    functions = max(1, int(lines / (gen.lines_per_function() + 1.0 / gen.group)))
+    with open(path, "w", buffering=1 << 20) as out:
+        return gen.program(out, functions)
+
+
+def run_driver(path, args):
+    """Runs the driver once; returns wall seconds, peak RSS bytes and the
+    phases of its time report, or None if it ran longer than --timeout."""
+    command = [sys.executable, DRIVER, path, "--frontend", args.frontend, "--lexer", args.lexer,
+               "--mode", args.mode, "-O", args.opt, "-j", str(args.threads), "--no-ast-cache",
+               "--time-report=json"]
+    # The driver imports core.* relative to src
+    env = dict(os.environ)
+    env["PYTHONPATH"] = os.pathsep.join(filter(None, [SRC_DIR, env.get("PYTHONPATH")]))
+    start = time.perf_counter()
+    # stderr goes to a file, which takes a report of any size while the
+    # driver runs, where a full pipe would stall it until wait4 returned
+    with open(os.devnull, "w") as devnull, tempfile.TemporaryFile("w+") as errors:
+        proc = subprocess.Popen(command, cwd=SRC_DIR, env=env, stdout=devnull, stderr=errors)
+        watchdog = threading.Timer(args.timeout, proc.kill)
+        watchdog.start()
+        _, status, usage = os.wait4(proc.pid, 0)
+        elapsed = time.perf_counter() - start
+        watchdog.cancel()
+        proc.returncode = os.waitstatus_to_exitcode(status)
+        errors.seek(0)
+        stderr = errors.read()
+
+    if elapsed >= args.timeout and proc.returncode < 0:
+        return None
+    if proc.returncode != 0:
+        raise RuntimeError(f"run_codegen.py failed on {path}:\n{stderr}")
+
+    report = json.loads(stderr.strip().splitlines()[-1])
+    # ru_maxrss is in kilobytes on Linux and bytes on macOS
+    peak = usage.ru_maxrss if sys.platform == "darwin" else usage.ru_maxrss * 1024
+    return elapsed, peak, report["phases"]
+
+
+def phase_seconds(phases):
+    totals = {}
+    for phase in phases:
+        if "." not in phase["name"]:
+            totals[phase["name"]] = totals.get(phase["name"], 0.0) + phase["seconds"]
+    return totals
+
+
+def print_table(results):
+    names = []
+    for result in results:
+        for name in result["phases"]:
+            if name not in names:
+                names.append(name)
+
+    header = f"{'lines':>10} {'seconds':>10} {'peak MiB':>10} {'exponent':>9}" + "".join(f" {n:>9}" for n in names)
+    print(header)
+    previous = None
+    for result in results:
+        exponent = ""
+        if previous and result["seconds"] > 0 and previous["seconds"] > 0:
+            slope = math.log(result["seconds"] / previous["seconds"]) / math.log(result["lines"] / previous["lines"])
+            exponent = f"{slope:.2f}"
+        row = f"{result['lines']:>10} {result['seconds']:>10.3f} {result['peak_rss_bytes'] / (1 << 20):>10.1f} {exponent:>9}"
+        row += "".join(f" {result['phases'].get(n, 0.0):>9.3f}" for n in names)
+        print(row)
+        previous = result
+
+
+def plot(results, path):
+    try:
+        import matplotlib
+
+        matplotlib.use("Agg")
+        import matplotlib.pyplot as plt
+    except ImportError:
+        print("matplotlib is not installed, skipping the plot", file=sys.stderr)
+        return
+
+    lines = [r["lines"] for r in results]
+    fig, (time_ax, mem_ax) = plt.subplots(1, 2, figsize=(12, 5))
+
+    time_ax.loglog(lines, [r["seconds"] for r in results], "o-", label="total")
+    for name in results[-1]["phases"]:
+        time_ax.loglog(lines, [max(r["phases"].get(name, 0.0), 1e-6) for r in results], ".--", label=name)
+    # Linear reference through the first point
+    time_ax.loglog(lines, [results[0]["seconds"] * n / lines[0] for n in lines], ":", color="gray", label="linear")
+    time_ax.set_xlabel("lines")
+    time_ax.set_ylabel("seconds")
+    time_ax.legend(fontsize="small")
+
+    mem_ax.loglog(lines, [r["peak_rss_bytes"] / (1 << 20) for r in results], "o-")
+    mem_ax.set_xlabel("lines")
+    mem_ax.set_ylabel("peak RSS (MiB)")
+
+    fig.tight_layout()
+    fig.savefig(path)
+    print(f"wrote {path}", file=sys.stderr)
+
+
+def main(argv=None):
+    argp = argparse.ArgumentParser(description="Times run_codegen.py on generated programs of growing size")
+    argp.add_argument("--sizes", default="1k,10k,100k,1m,10m", help="program sizes in lines, e.g. 1k,10k,1m")
+    argp.add_argument("--frontend", choices=["native", "python"], default="native")
+    argp.add_argument("--lexer", choices=["native", "ply"], default="native")
+    argp.add_argument("--mode", choices=["dump", "ir", "jit"], default="jit")
+    argp.add_argument("-O", dest="opt", choices=["0", "1", "2", "3", "s"], default="0")
+    argp.add_argument("-j", dest="threads", type=int, default=0)
+    argp.add_argument("--statements", type=int, default=6)
+    argp.add_argument("--depth", type=int, default=3)
+    argp.add_argument("--group", type=int, default=16)
+    argp.add_argument("--seed", type=int, default=0)
+    argp.add_argument("--timeout", type=float, default=600,
+                      help="stop a run after this many seconds and do not try larger sizes")
+    argp.add_argument("--json", help="also write the results to this file")
+    argp.add_argument("--plot", help="plot time and memory against size into this image (needs matplotlib)")
+    argp.add_argument("--keep", help="directory to keep the generated programs in")
+    args = argp.parse_args(argv)
+
+    results = []
+    with tempfile.TemporaryDirectory() as scratch:
+        directory = args.keep or scratch
+        os.makedirs(directory, exist_ok=True)
+        for size in parse_sizes(args.sizes):
+            path = os.path.join(directory, f"scaling_{size}.qrk")
+            lines = generate(path, size, args)
+            run = run_driver(path, args)
+            if not args.keep:
+                os.remove(path)
+            if run is None:
+                print(f"stopping, {lines} lines took longer than {args.timeout:g}s", file=sys.stderr)
+                break
+
+            seconds, peak, phases = run
+            results.append(dict(lines=lines, seconds=seconds, peak_rss_bytes=peak, phases=phase_seconds(phases)))
+            print(f"{lines} lines: {seconds:.3f}s, {peak / (1 << 20):.1f} MiB", file=sys.stderr)
+
+    print_table(results)
+    if args.json:
+        with open(args.json, "w") as out:
+            json.dump(results, out, indent=2)
+    if args.plot and results:
+        plot(results, args.plot)
+
+
+if __name__ == "__main__":
+    main()